@@ -0,0 +1,476 @@
+// Headless engine benchmark: builds a synthetic scene and runs the simulation systems, culling and rendering on
+// sokol's dummy backend for a fixed number of frames, then prints per-stage CPU times, draw counts and heap
+// allocations as JSON.
+//
+// usage: matfx_bench [--entities=N] [--frames=N] [--warmup=N] [--meshes=N] [--spin=FRACTION] [--packed=0|1]
+//                    [--lods=0|1] [--software=0|1] [--image=PATH] [--capture=PATH] [--output=PATH] [--trace=PATH]
+//
+// With --lods=1 the entities are spheres drawn through LOD chains instead of cubes. --software=1 renders on the CPU
+// with SoftwareRenderer instead of sokol, --image then writes the last frame as a binary PPM and --capture records
+// every measured frame through FrameCapture, as a Y4M stream when PATH ends in .y4m and as PNGs otherwise.
+#include <sokol_time.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <entt/entity/organizer.hpp>
+#include <entt/entity/registry.hpp>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "culling.h"
+#include "frame_capture.h"
+#include "frame_log.h"
+#include "job_system.h"
+#include "lod_selector.h"
+#include "mesh_simplifier.h"
+#include "primitives.h"
+#include "profiler.h"
+#include "render_list.h"
+#include "renderer.h"
+#include "simulation.h"
+#include "software_renderer.h"
+#include "spatial_index.h"
+#include "spin_system.h"
+#include "transform_system.h"
+#include "vertex_packing.h"
+
+static std::atomic<uint64_t> g_allocations{0};
+static std::atomic<uint64_t> g_allocated_bytes{0};
+
+// Counts every heap allocation made by the engine, worker threads included
+void *operator new(size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+// GCC can't tell that these pair with the replaced operator new above
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t /* size */) noexcept { std::free(ptr); }
+
+struct BenchConfig {
+  size_t entities = 10000;
+  size_t frames = 300;
+  size_t warmup = 30;
+  size_t meshes = 4;
+  float spin_fraction = 0.25f;
+  bool packed = false;
+  bool lods = false;
+  bool software = false;
+  std::string image;
+  std::string capture;
+  std::string output;
+  std::string trace;
+};
+
+struct Stage {
+  std::string name;
+  std::vector<double> ms;
+};
+
+static bool parse_args(int argc, char **argv, BenchConfig &config) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = std::strchr(arg, '=');
+    if (!value) {
+      return false;
+    }
+    const std::string key(arg, value - arg);
+    value++;
+
+    if (key == "--entities") {
+      config.entities = std::strtoull(value, nullptr, 10);
+    } else if (key == "--frames") {
+      config.frames = std::strtoull(value, nullptr, 10);
+    } else if (key == "--warmup") {
+      config.warmup = std::strtoull(value, nullptr, 10);
+    } else if (key == "--meshes") {
+      config.meshes = std::max<size_t>(std::strtoull(value, nullptr, 10), 1);
+    } else if (key == "--spin") {
+      config.spin_fraction = std::strtof(value, nullptr);
+    } else if (key == "--packed") {
+      config.packed = std::atoi(value) != 0;
+    } else if (key == "--lods") {
+      config.lods = std::atoi(value) != 0;
+    } else if (key == "--software") {
+      config.software = std::atoi(value) != 0;
+    } else if (key == "--image") {
+      config.image = value;
+    } else if (key == "--capture") {
+      config.capture = value;
+    } else if (key == "--output") {
+      config.output = value;
+    } else if (key == "--trace") {
+      config.trace = value;
+    } else {
+      return false;
+    }
+  }
+  return config.frames > 0;
+}
+
+// Fills a cube of space around the origin with a grid of entities and looks into it from the middle of one face, so
+// culling has roughly half of the scene to reject
+static void create_scene(entt::registry &registry, const BenchConfig &config) {
+  std::vector<Mesh> meshes;
+  std::vector<std::shared_ptr<MeshLodChain>> chains;
+  std::vector<Bounds> bounds;
+  for (size_t i = 0; i < config.meshes; ++i) {
+    const float size = 0.25f + 0.25f * static_cast<float>(i);
+    if (config.lods) {
+      const Mesh sphere = createSphereMesh(0.5f * size, 64, 32);
+      bounds.push_back(computeBounds(sphere));
+      chains.push_back(std::make_shared<MeshLodChain>(buildLodChain(sphere)));
+      if (config.packed) {
+        for (Mesh &level : chains.back()->levels) {
+          packMesh(level);
+        }
+      }
+      continue;
+    }
+    meshes.push_back(createCubeMesh(size));
+    bounds.push_back(computeBounds(meshes.back()));
+    if (config.packed) {
+      packMesh(meshes.back());
+    }
+  }
+
+  const size_t side =
+      std::max<size_t>(static_cast<size_t>(std::ceil(std::cbrt(static_cast<double>(config.entities)))), 1);
+  const float half = static_cast<float>(side) - 1.0f;
+
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  for (size_t i = 0; i < config.entities; ++i) {
+    const size_t x = i % side;
+    const size_t y = (i / side) % side;
+    const size_t z = i / (side * side);
+    const size_t mesh = i % config.meshes;
+
+    const entt::entity entity = registry.create();
+    TransformRef transform = registry.emplace<Transform>(entity);
+    transform.position = {2.0f * x - half, 2.0f * y - half, 2.0f * z - half};
+    transform.rotation = glm::angleAxis(unit(rng) * glm::two_pi<float>(), glm::vec3(0, 1, 0));
+    if (config.lods) {
+      registry.emplace<MeshLod>(entity, chains[mesh]);
+    } else {
+      registry.emplace<Mesh>(entity, meshes[mesh]);
+    }
+    registry.emplace<Bounds>(entity, bounds[mesh]);
+
+    if (unit(rng) < config.spin_fraction) {
+      registry.emplace<Spin>(entity, glm::vec3(0.0f, 1.0f + unit(rng), 0.0f));
+      registry.emplace<PreviousWorldTransform>(entity);
+    }
+  }
+
+  Camera &camera = registry.emplace<Camera>(registry.create());
+  camera.position = {0.0f, 0.0f, half};
+  camera.target = {0.0f, 0.0f, 0.0f};
+  camera.fov = 60.0f;
+  camera.far_plane = 8.0f * half + 8.0f;
+}
+
+static CaptureFormat capture_format(const std::string &path) {
+  const bool y4m = path.size() >= 4 && path.compare(path.size() - 4, 4, ".y4m") == 0;
+  return y4m ? CaptureFormat::Y4m : CaptureFormat::PngSequence;
+}
+
+// Binary PPM of the software renderer's last frame, alpha dropped
+static bool write_ppm(const std::string &path, const SoftwareRenderer &renderer) {
+  FILE *file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+  std::fprintf(file, "P6\n%d %d\n255\n", renderer.getWidth(), renderer.getHeight());
+  std::vector<unsigned char> row(static_cast<size_t>(renderer.getWidth()) * 3);
+  for (int y = 0; y < renderer.getHeight(); ++y) {
+    const uint32_t *pixels = renderer.getPixels() + y * renderer.getStride();
+    for (int x = 0; x < renderer.getWidth(); ++x) {
+      row[x * 3 + 0] = static_cast<unsigned char>(pixels[x]);
+      row[x * 3 + 1] = static_cast<unsigned char>(pixels[x] >> 8);
+      row[x * 3 + 2] = static_cast<unsigned char>(pixels[x] >> 16);
+    }
+    std::fwrite(row.data(), 1, row.size(), file);
+  }
+  return std::fclose(file) == 0;
+}
+
+static double mean(const std::vector<double> &values) {
+  double sum = 0.0;
+  for (double value : values) {
+    sum += value;
+  }
+  return values.empty() ? 0.0 : sum / static_cast<double>(values.size());
+}
+
+static double percentile(std::vector<double> values, double fraction) {
+  if (values.empty()) {
+    return 0.0;
+  }
+  std::sort(values.begin(), values.end());
+  const size_t index =
+      std::min(values.size() - 1, static_cast<size_t>(fraction * static_cast<double>(values.size())));
+  return values[index];
+}
+
+int main(int argc, char **argv) {
+  BenchConfig config;
+  if (!parse_args(argc, argv, config)) {
+    std::fprintf(stderr,
+                 "usage: %s [--entities=N] [--frames=N] [--warmup=N] [--meshes=N] [--spin=FRACTION] "
+                 "[--packed=0|1] [--lods=0|1] [--software=0|1] [--image=PATH] [--capture=PATH] "
+                 "[--output=PATH] [--trace=PATH]\n",
+                 argv[0]);
+    return 1;
+  }
+
+  // stdout carries the report
+  spdlog::set_default_logger(spdlog::stderr_color_mt("bench"));
+  spdlog::set_level(spdlog::level::warn);
+  stm_setup();
+  FrameLog::start();
+  MATFX_PROFILE_THREAD("main");
+
+#ifndef NDEBUG
+  std::fprintf(stderr, "warning: benchmark built without NDEBUG, configure with -DCMAKE_BUILD_TYPE=Release\n");
+#endif
+
+  Renderer renderer;
+  if (!renderer.init()) {
+    return 1;
+  }
+
+  entt::registry registry;
+  create_scene(registry, config);
+  TransformSystem transform_system(registry);
+  SpinSystem spin_system{transform_system};
+  FrustumCuller culler;
+  LodSelector lods;
+  RenderList render_list;
+  JobSystem jobs;
+  SpatialIndex spatial(registry, &jobs);
+  std::vector<entt::entity> spatial_visible;
+  SoftwareRenderer software_renderer(jobs);
+  FrameCapture capture;
+  const bool capturing = config.software && !config.capture.empty();
+  if (capturing && !capture.start(config.capture, capture_format(config.capture))) {
+    return 1;
+  }
+
+  entt::organizer organizer;
+  organizer.emplace<&SpinSystem::update>(spin_system, "spin");
+  organizer.emplace<&TransformSystem::update, Transform, const Parent, WorldTransform>(transform_system, "transforms");
+  const std::vector<entt::organizer::vertex> systems = organizer.graph();
+
+  // Systems run one after the other in graph order so each gets its own timing; the graph orders dependencies from
+  // earlier to later vertices
+  std::vector<Stage> stages;
+  stages.push_back({"store_previous", {}});
+  for (const entt::organizer::vertex &vertex : systems) {
+    vertex.prepare(registry);
+    stages.push_back({vertex.name() ? vertex.name() : "unnamed", {}});
+  }
+  stages.push_back({"capture", {}});
+  stages.push_back({"interpolate", {}});
+  if (config.lods) {
+    stages.push_back({"lod", {}});
+  }
+  stages.push_back({"cull", {}});
+  stages.push_back({"spatial", {}});
+  stages.push_back({"render", {}});
+  stages.push_back({"frame", {}});
+  for (Stage &stage : stages) {
+    stage.ms.reserve(config.frames);  // keeps the recording itself out of the allocation counts
+  }
+
+  constexpr int width = 1280;
+  constexpr int height = 720;
+  constexpr double step_seconds = 1.0 / 60.0;
+  const float aspect_ratio = static_cast<float>(width) / static_cast<float>(height);
+
+  uint64_t allocations = 0;
+  uint64_t allocated_bytes = 0;
+  uint64_t software_triangles = 0;
+  double software_ms = 0.0;
+  for (size_t frame = 0; frame < config.warmup + config.frames; ++frame) {
+    const bool measured = frame >= config.warmup;
+    if (frame == config.warmup && !config.trace.empty()) {
+      Profiler::requestCapture(config.frames, config.trace);
+    }
+    MATFX_PROFILE_FRAME();
+    FrameLog::setFrame(frame);
+    const uint64_t allocations_before = g_allocations.load(std::memory_order_relaxed);
+    const uint64_t bytes_before = g_allocated_bytes.load(std::memory_order_relaxed);
+    const uint64_t frame_start = stm_now();
+
+    size_t stage = 0;
+    uint64_t lap = stm_now();
+    auto record = [&] {
+      const double ms = stm_ms(stm_laptime(&lap));
+      if (measured) {
+        stages[stage].ms.push_back(ms);
+      }
+      stage++;
+    };
+
+    registry.ctx().insert_or_assign(SimTime{step_seconds, frame});
+    transform_system.storePrevious();
+    record();
+    for (const entt::organizer::vertex &vertex : systems) {
+      vertex.callback()(vertex.data(), registry);
+      record();
+    }
+
+    render_list.capture(registry);
+    record();
+    render_list.interpolate(0.5f);
+    record();
+    if (config.lods) {
+      lods.select(render_list, static_cast<float>(height));
+      record();
+    }
+    const Frustum frustum = Frustum::fromMatrix(render_list.getCamera().getViewProjectionMatrix(aspect_ratio));
+    culler.cull(render_list, frustum);
+    record();
+    // Index upkeep after the systems moved things, plus the same frustum test through the tree
+    spatial.update();
+    spatial_visible.clear();
+    spatial.queryFrustum(frustum, spatial_visible);
+    record();
+    if (config.software) {
+      software_renderer.beginFrame(width, height);
+      software_renderer.render(render_list, culler.getVisible());
+      if (capturing && measured) {
+        capture.submitImage(software_renderer.getPixels(), software_renderer.getWidth(),
+                            software_renderer.getHeight(), software_renderer.getStride());
+      }
+    } else {
+      renderer.beginFrame(width, height);
+      renderer.render(render_list, culler.getVisible());
+      renderer.endFrame();
+    }
+    record();
+
+    if (measured) {
+      stages.back().ms.push_back(stm_ms(stm_since(frame_start)));
+      allocations += g_allocations.load(std::memory_order_relaxed) - allocations_before;
+      allocated_bytes += g_allocated_bytes.load(std::memory_order_relaxed) - bytes_before;
+      const SoftwareRenderStats &software = software_renderer.getStats();
+      software_triangles += software.triangles;
+      software_ms += software.geometry_ms + software.raster_ms;
+    }
+  }
+
+  MATFX_PROFILE_FRAME();
+  Profiler::flush();
+  FrameLog::stop();
+  capture.stop();
+
+  if (config.software && !config.image.empty() && !write_ppm(config.image, software_renderer)) {
+    std::fprintf(stderr, "failed to write %s\n", config.image.c_str());
+  }
+
+  FILE *out = stdout;
+  if (!config.output.empty()) {
+    out = std::fopen(config.output.c_str(), "w");
+    if (!out) {
+      std::fprintf(stderr, "failed to open %s\n", config.output.c_str());
+      return 1;
+    }
+  }
+
+  const FrameStats &frame_stats = renderer.getFrameStats();
+  const RenderQueueStats &queue = renderer.getQueueStats();
+  const CullingStats &culling = culler.getStats();
+  const MeshCacheStats &cache = renderer.getMeshCache().getStats();
+  const LodStats &lod = lods.getStats();
+  const FrameAllocatorStats &stream = renderer.getStreamStats();
+  const PipelineCacheStats &pipeline_cache = renderer.getPipelineCache().getStats();
+  const SoftwareRenderStats &software = software_renderer.getStats();
+  const FrameCaptureStats capture_stats = capture.getStats();
+  const SpatialIndexStats &spatial_stats = spatial.getStats();
+  const double frames = static_cast<double>(config.frames);
+
+  std::fprintf(out, "{\n");
+  std::fprintf(out, "  \"config\": {\"entities\": %zu, \"frames\": %zu, \"warmup\": %zu, \"meshes\": %zu, "
+               "\"spin\": %g, \"packed\": %s, \"lods\": %s, \"software\": %s},\n",
+               config.entities, config.frames, config.warmup, config.meshes, config.spin_fraction,
+               config.packed ? "true" : "false", config.lods ? "true" : "false", config.software ? "true" : "false");
+  std::fprintf(out, "  \"stages_ms\": {\n");
+  for (size_t i = 0; i < stages.size(); ++i) {
+    const std::vector<double> &ms = stages[i].ms;
+    std::fprintf(out, "    \"%s\": {\"mean\": %.4f, \"min\": %.4f, \"p95\": %.4f, \"max\": %.4f}%s\n",
+                 stages[i].name.c_str(), mean(ms), percentile(ms, 0.0), percentile(ms, 0.95), percentile(ms, 1.0),
+                 i + 1 < stages.size() ? "," : "");
+  }
+  std::fprintf(out, "  },\n");
+  std::fprintf(out, "  \"render\": {\"draws\": %u, \"pipelines_applied\": %u, \"bindings_applied\": %u, "
+               "\"visible\": %zu, \"tested\": %zu, \"resident_meshes\": %zu, \"resident_bytes\": %zu},\n",
+               queue.draws, queue.pipelines_applied, queue.bindings_applied, culling.visible, culling.tested,
+               cache.resident_meshes, cache.resident_bytes);
+  std::fprintf(out, "  \"sokol\": {\"draw_calls\": %u, \"pipeline_switches\": %u, \"binding_switches\": %u, "
+               "\"uniform_updates\": %u, \"buffer_upload_bytes\": %llu, \"uniform_upload_bytes\": %llu},\n",
+               frame_stats.draw_calls, frame_stats.pipeline_switches, frame_stats.binding_switches,
+               frame_stats.uniform_updates, static_cast<unsigned long long>(frame_stats.buffer_upload_bytes),
+               static_cast<unsigned long long>(frame_stats.uniform_upload_bytes));
+  std::fprintf(out, "  \"stream\": {\"frame_bytes\": %zu, \"high_water\": %zu, \"capacity\": %zu, \"grows\": %u, "
+               "\"appends\": %u, \"failed\": %u},\n",
+               stream.frame_bytes, stream.high_water, stream.capacity, stream.grows, stream.frame_appends,
+               stream.frame_failed);
+  std::fprintf(out, "  \"pipeline_cache\": {\"shaders\": %u, \"pipelines\": %u, \"shader_hits\": %u, "
+               "\"pipeline_hits\": %u, \"shader_ms\": %.3f},\n",
+               pipeline_cache.shaders, pipeline_cache.pipelines, pipeline_cache.shader_hits,
+               pipeline_cache.pipeline_hits, pipeline_cache.shader_ms);
+  std::fprintf(out, "  \"lod\": {\"items\": %zu, \"switches\": %zu, \"full_triangles\": %llu, "
+               "\"selected_triangles\": %llu},\n",
+               lod.items, lod.switches, static_cast<unsigned long long>(lod.full_triangles),
+               static_cast<unsigned long long>(lod.selected_triangles));
+  std::fprintf(out, "  \"spatial\": {\"entities\": %u, \"nodes\": %u, \"visible\": %zu, \"refitted\": %u, "
+               "\"reinserted\": %u, \"rebuilds\": %u, \"update_ms\": %.4f, \"rebuild_ms\": %.4f},\n",
+               spatial_stats.entities, spatial_stats.nodes, spatial_visible.size(), spatial_stats.refitted,
+               spatial_stats.reinserted, spatial_stats.rebuilds, spatial_stats.update_ms, spatial_stats.rebuild_ms);
+  if (config.software) {
+    std::fprintf(out, "  \"software\": {\"draws\": %u, \"triangles\": %llu, \"culled\": %llu, \"clipped\": %llu, "
+                 "\"rasterized\": %llu, \"tile_triangles\": %llu, \"geometry_ms\": %.4f, \"raster_ms\": %.4f, "
+                 "\"mtris_per_second\": %.2f, \"image_hash\": \"%016llx\"},\n",
+                 software.draws, static_cast<unsigned long long>(software.triangles),
+                 static_cast<unsigned long long>(software.triangles_culled),
+                 static_cast<unsigned long long>(software.triangles_clipped),
+                 static_cast<unsigned long long>(software.triangles_rasterized),
+                 static_cast<unsigned long long>(software.tile_triangles), software.geometry_ms, software.raster_ms,
+                 software_ms > 0.0 ? static_cast<double>(software_triangles) / software_ms / 1000.0 : 0.0,
+                 static_cast<unsigned long long>(software_renderer.hashImage()));
+  }
+  if (capturing) {
+    std::fprintf(out, "  \"capture\": {\"frames_written\": %llu, \"frames_dropped\": %llu, \"bytes_written\": %llu, "
+                 "\"last_write_ms\": %.4f},\n",
+                 static_cast<unsigned long long>(capture_stats.frames_written),
+                 static_cast<unsigned long long>(capture_stats.frames_dropped),
+                 static_cast<unsigned long long>(capture_stats.bytes_written), capture_stats.last_write_ms);
+  }
+  std::fprintf(out, "  \"allocations\": {\"per_frame\": %.2f, \"bytes_per_frame\": %.1f}\n",
+               static_cast<double>(allocations) / frames, static_cast<double>(allocated_bytes) / frames);
+  std::fprintf(out, "}\n");
+
+  if (out != stdout) {
+    std::fclose(out);
+  }
+  return 0;
+}
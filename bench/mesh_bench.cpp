@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "culling.h"
+#include "mesh_file.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "primitives.h"
+#include "vertex_packing.h"
+
+template <typename Fn>
+static double time_ms(Fn &&fn) {
+  const auto start = std::chrono::steady_clock::now();
+  fn();
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// What an exporter hands over at worst: triangles in arbitrary order, every corner its own vertex
+static Mesh make_triangle_soup(const Mesh &source, std::mt19937 &rng) {
+  std::vector<uint32_t> triangles(source.indices.size() / 3);
+  for (uint32_t t = 0; t < triangles.size(); ++t) {
+    triangles[t] = t;
+  }
+  std::shuffle(triangles.begin(), triangles.end(), rng);
+
+  Mesh soup;
+  soup.vertices.reserve(source.indices.size());
+  soup.indices.reserve(source.indices.size());
+  for (uint32_t t : triangles) {
+    for (int corner = 0; corner < 3; ++corner) {
+      soup.indices.push_back(static_cast<uint32_t>(soup.vertices.size()));
+      soup.vertices.push_back(source.vertices[source.indices[t * 3 + corner]]);
+    }
+  }
+  return soup;
+}
+
+static void print_row(const char *pass, const Mesh &mesh, double ms) {
+  const VertexCacheStats stats = analyzeVertexCache(mesh);
+  std::printf("  %-16s %9zu %9zu   %6.3f  %6.3f  %9.3f ms\n", pass, mesh.getVertexCount(), mesh.getIndexCount() / 3,
+              stats.acmr, stats.atvr, ms);
+}
+
+static void run(const char *name, Mesh mesh) {
+  std::printf("%s\n", name);
+  std::printf("  %-16s %9s %9s   %6s  %6s  %12s\n", "pass", "vertices", "triangles", "ACMR", "ATVR", "time");
+  print_row("input", mesh, 0.0);
+
+  double ms = time_ms([&] { weldVertices(mesh); });
+  print_row("weld", mesh, ms);
+  ms = time_ms([&] { optimizeVertexCache(mesh); });
+  print_row("vertex cache", mesh, ms);
+  ms = time_ms([&] { optimizeOverdraw(mesh); });
+  print_row("overdraw", mesh, ms);
+  ms = time_ms([&] { optimizeVertexFetch(mesh); });
+  print_row("vertex fetch", mesh, ms);
+}
+
+// Triangles, error and build time of each level of the mesh's LOD chain
+static void report_lods(const char *name, const Mesh &mesh) {
+  MeshLodChain chain;
+  const double ms = time_ms([&] { chain = buildLodChain(mesh); });
+  const float radius = glm::length(computeBounds(mesh).extents);
+
+  std::printf("%s, LOD chain (%.3f ms)\n", name, ms);
+  std::printf("  %-6s %9s %9s   %10s %10s\n", "level", "vertices", "triangles", "error", "of radius");
+  for (size_t i = 0; i < chain.levels.size(); ++i) {
+    std::printf("  %-6zu %9zu %9zu   %10.5f %9.3f%%\n", i, chain.levels[i].getVertexCount(),
+                chain.levels[i].getIndexCount() / 3, chain.errors[i], 100.0f * chain.errors[i] / radius);
+  }
+}
+
+// Size and worst case decode error of the packed vertex format
+static void report_packing(const char *name, Mesh mesh) {
+  const double ms = time_ms([&] { packMesh(mesh); });
+
+  float position_error = 0.0f;
+  float normal_error_degrees = 0.0f;
+  float texcoord_error = 0.0f;
+  for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+    const Vertex &original = mesh.vertices[i];
+    const Vertex decoded = unpackVertex(mesh, mesh.packed_vertices[i]);
+    position_error = std::max(position_error, glm::length(decoded.position - original.position));
+    const float cosine = std::clamp(glm::dot(decoded.normal, glm::normalize(original.normal)), -1.0f, 1.0f);
+    normal_error_degrees = std::max(normal_error_degrees, glm::degrees(std::acos(cosine)));
+    texcoord_error = std::max(texcoord_error, glm::length(decoded.texcoord - original.texcoord));
+  }
+
+  const size_t index_size = mesh.usesShortIndices() ? sizeof(uint16_t) : sizeof(uint32_t);
+  const size_t float_bytes = mesh.vertices.size() * sizeof(Vertex) + mesh.indices.size() * sizeof(uint32_t);
+  const size_t packed_bytes = mesh.packed_vertices.size() * sizeof(PackedVertex) + mesh.indices.size() * index_size;
+  std::printf("%s, packed\n", name);
+  std::printf("  vertex %zu -> %zu bytes, indices %zu -> %zu bytes, mesh %.2f -> %.2f MiB, %.3f ms\n",
+              sizeof(Vertex), sizeof(PackedVertex), sizeof(uint32_t), index_size, float_bytes / 1048576.0,
+              packed_bytes / 1048576.0, ms);
+  std::printf("  max error: position %.3g (extent %.3g), normal %.4f deg, texcoord %.3g\n", position_error,
+              mesh.quantization_scale, normal_error_degrees, texcoord_error);
+}
+
+// Loading through a mapping against reading the same file into vectors. Both read every byte once so the page cache
+// is warm for the second and the comparison is copy against no copy, not disk against memory.
+static void report_loading(const char *name, Mesh mesh) {
+  optimizeMesh(mesh);
+  packMesh(mesh);
+  const std::string path = (std::filesystem::temp_directory_path() / "matfx_mesh_bench.mfxmesh").string();
+  if (!writeMeshFile(path, mesh, Bounds{})) {
+    return;
+  }
+  const double size_mib = static_cast<double>(std::filesystem::file_size(path)) / 1048576.0;
+
+  std::vector<PackedVertex> vertices;
+  std::vector<uint32_t> indices;
+  const double read_ms = time_ms([&] {
+    MeshFileHeader header;
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file || std::fread(&header, sizeof(header), 1, file) != 1) {
+      return;
+    }
+    vertices.resize(header.vertex_count);
+    indices.resize(header.index_count);
+    std::fseek(file, static_cast<long>(header.vertex_offset), SEEK_SET);
+    const size_t read = std::fread(vertices.data(), 1, header.vertex_bytes, file);
+    std::fseek(file, static_cast<long>(header.index_offset), SEEK_SET);
+    std::fread(indices.data(), 1, header.index_bytes, file);
+    std::fclose(file);
+    (void)read;
+  });
+
+  Mesh loaded;
+  Bounds bounds;
+  uint64_t checksum = 0;
+  const double map_ms = time_ms([&] {
+    if (!loadMeshFile(path, loaded, bounds)) {
+      return;
+    }
+    // Verification already read every byte, this only keeps the compiler from dropping the load
+    const auto *bytes = static_cast<const unsigned char *>(loaded.blob->vertices);
+    for (size_t i = 0; i < loaded.blob->vertex_bytes; i += 4096) {
+      checksum += bytes[i];
+    }
+  });
+
+  const bool identical = loaded.blob && loaded.blob->vertex_bytes == vertices.size() * sizeof(PackedVertex) &&
+                         std::memcmp(loaded.blob->vertices, vertices.data(), loaded.blob->vertex_bytes) == 0;
+  std::printf("%s, mesh file (%.2f MiB)\n", name, size_mib);
+  std::printf("  read into vectors %8.3f ms  %8.1f MiB/s\n", read_ms, size_mib / (read_ms / 1000.0));
+  std::printf("  map and verify   %8.3f ms  %8.1f MiB/s  identical: %s (%llu)\n", map_ms,
+              size_mib / (map_ms / 1000.0), identical ? "yes" : "NO", static_cast<unsigned long long>(checksum));
+  loaded.clear();
+  std::filesystem::remove(path);
+}
+
+int main(int argc, char **argv) {
+  const uint32_t segments = argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 512;
+  const uint32_t rings = std::max(segments / 2, 2u);
+
+#ifndef NDEBUG
+  std::printf("warning: benchmark built without NDEBUG, configure with -DCMAKE_BUILD_TYPE=Release\n");
+#endif
+  std::printf("FIFO cache of %u vertices\n", default_vertex_cache_size);
+
+  std::mt19937 rng(1234);
+  const Mesh sphere = createSphereMesh(1.0f, segments, rings);
+  run("sphere, generator order", sphere);
+  run("sphere, shuffled triangle soup", make_triangle_soup(sphere, rng));
+  report_lods("sphere", sphere);
+  report_lods("small sphere", createSphereMesh(1.0f, 64, 32));
+  report_packing("sphere", sphere);
+  report_packing("small sphere", createSphereMesh(1.0f, 64, 32));
+  report_loading("sphere", sphere);
+  return 0;
+}
@@ -0,0 +1,255 @@
+// usage: matfx_spatial_bench [entities] [movers per frame] [frames] [workers, 0 for one per hardware thread]
+#include <sokol_time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <entt/entity/registry.hpp>
+#include <gtc/matrix_transform.hpp>
+#include <gtc/quaternion.hpp>
+#include <random>
+#include <vector>
+
+#include "components.h"
+#include "culling.h"
+#include "job_system.h"
+#include "spatial_index.h"
+
+struct WorldBox {
+  glm::vec3 min;
+  glm::vec3 max;
+};
+
+// Same transform of the local box as SpatialIndex, so exact tests agree bit for bit
+static bool world_box(const entt::registry &registry, entt::entity entity, WorldBox &box) {
+  const Bounds *bounds = registry.try_get<Bounds>(entity);
+  const WorldTransform *world = registry.try_get<WorldTransform>(entity);
+  if (!bounds || !world) {
+    return false;
+  }
+  const glm::mat4 &m = world->matrix;
+  const glm::vec3 center = glm::vec3(m * glm::vec4(bounds->center, 1.0f));
+  const glm::vec3 extents = glm::abs(glm::vec3(m[0])) * bounds->extents.x +
+                            glm::abs(glm::vec3(m[1])) * bounds->extents.y +
+                            glm::abs(glm::vec3(m[2])) * bounds->extents.z;
+  box = {center - extents, center + extents};
+  return true;
+}
+
+static glm::mat4 random_matrix(std::mt19937 &rng, float half) {
+  std::uniform_real_distribution<float> position(-half, half);
+  std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+  std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+  const glm::quat rotation = glm::angleAxis(angle(rng), glm::normalize(glm::vec3(0.3f, 1.0f, 0.2f)));
+  return glm::translate(glm::mat4(1.0f), {position(rng), position(rng), position(rng)}) * glm::mat4_cast(rotation) *
+         glm::scale(glm::mat4(1.0f), glm::vec3(scale(rng)));
+}
+
+static bool same_entities(std::vector<entt::entity> a, std::vector<entt::entity> b) {
+  std::sort(a.begin(), a.end());
+  std::sort(b.begin(), b.end());
+  return a == b;
+}
+
+int main(int argc, char **argv) {
+  const size_t entity_count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  const size_t mover_count = std::min<size_t>(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4096, entity_count);
+  const size_t frames = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 120;
+  const size_t workers = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 0;
+
+#ifndef NDEBUG
+  std::printf("warning: benchmark built without NDEBUG, configure with -DCMAKE_BUILD_TYPE=Release\n");
+#endif
+  stm_setup();
+
+  // Roughly constant density, so query selectivity doesn't depend on the entity count
+  const float half = 2.0f * std::cbrt(static_cast<float>(entity_count));
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> extent(0.1f, 1.0f);
+
+  entt::registry registry;
+  std::vector<entt::entity> entities(entity_count);
+  registry.create(entities.begin(), entities.end());
+  for (entt::entity entity : entities) {
+    registry.emplace<Bounds>(entity, Bounds{glm::vec3(0.0f), {extent(rng), extent(rng), extent(rng)}});
+    registry.emplace<WorldTransform>(entity, WorldTransform{random_matrix(rng, half)});
+  }
+
+  JobSystem jobs(workers);
+  std::printf("%zu entities, %zu moving per frame, %zu frames, %zu workers\n", entity_count, mover_count, frames,
+              jobs.getWorkerCount());
+
+  {
+    SpatialIndex serial(registry);
+    serial.update();
+    std::printf("  build, serial     %9.3f ms\n", serial.getStats().rebuild_ms);
+  }
+  SpatialIndex index(registry, &jobs);
+  index.update();
+  const SpatialIndexStats &stats = index.getStats();
+  std::printf("  build, parallel   %9.3f ms  %u nodes\n", stats.rebuild_ms, stats.nodes);
+  index.rebuild();
+  std::printf("  rebuild, parallel %9.3f ms\n", stats.rebuild_ms);
+
+  // Movers drift a little every frame, a few of them jump across the world; a handful of entities respawn
+  std::uniform_int_distribution<size_t> pick(0, entity_count - 1);
+  std::uniform_real_distribution<float> step(-0.05f, 0.05f);
+  std::vector<size_t> movers(mover_count);
+  for (size_t &mover : movers) {
+    mover = pick(rng);
+  }
+  double update_ms = 0.0;
+  double max_update_ms = 0.0;
+  uint64_t refitted = 0;
+  uint64_t reinserted = 0;
+  const uint32_t rebuilds_before = stats.rebuilds;
+  for (size_t frame = 0; frame < frames; ++frame) {
+    for (size_t i = 0; i < movers.size(); ++i) {
+      registry.patch<WorldTransform>(entities[movers[i]], [&](WorldTransform &world) {
+        if (i % 64 == 0) {
+          world.matrix = random_matrix(rng, half);
+        } else {
+          world.matrix[3] += glm::vec4(step(rng), step(rng), step(rng), 0.0f);
+        }
+      });
+    }
+    for (size_t i = 0; i < 16; ++i) {
+      const size_t k = pick(rng);
+      registry.destroy(entities[k]);
+      entities[k] = registry.create();
+      registry.emplace<Bounds>(entities[k], Bounds{glm::vec3(0.0f), glm::vec3(extent(rng))});
+      registry.emplace<WorldTransform>(entities[k], WorldTransform{random_matrix(rng, half)});
+    }
+
+    index.update();
+    update_ms += stats.update_ms;
+    max_update_ms = std::max(max_update_ms, stats.update_ms);
+    refitted += stats.refitted;
+    reinserted += stats.reinserted;
+  }
+  const double frame_count = frames ? static_cast<double>(frames) : 1.0;
+  std::printf("  update            %9.3f ms mean  %9.3f ms max  %.1f refitted  %.1f reinserted  %u rebuilds  "
+              "%u nodes\n",
+              update_ms / frame_count, max_update_ms, static_cast<double>(refitted) / frame_count,
+              static_cast<double>(reinserted) / frame_count,
+              stats.rebuilds - rebuilds_before, stats.nodes);
+
+  // Queries against a brute force pass over the registry
+  std::vector<entt::entity> all;
+  std::vector<WorldBox> boxes;
+  for (entt::entity entity : registry.view<Bounds, WorldTransform>()) {
+    WorldBox box;
+    world_box(registry, entity, box);
+    all.push_back(entity);
+    boxes.push_back(box);
+  }
+
+  bool ok = stats.entities == all.size();
+  std::vector<entt::entity> found;
+  std::vector<entt::entity> expected;
+  auto check = [&](const char *name, size_t queries, auto &&query, auto &&matches) {
+    size_t hits = 0;
+    double ms = 0.0;
+    bool match = true;
+    for (size_t q = 0; q < queries; ++q) {
+      found.clear();
+      const uint64_t start = stm_now();
+      query(q, found);
+      ms += stm_ms(stm_since(start));
+      hits += found.size();
+
+      expected.clear();
+      for (size_t i = 0; i < all.size(); ++i) {
+        if (matches(q, boxes[i])) {
+          expected.push_back(all[i]);
+        }
+      }
+      match = match && same_entities(found, expected);
+    }
+    std::printf("  %-17s %9.4f ms  %9.1f hits  matches brute force: %s\n", name, ms / static_cast<double>(queries),
+                static_cast<double>(hits) / static_cast<double>(queries), match ? "yes" : "NO");
+    ok = ok && match;
+  };
+
+  constexpr size_t query_count = 32;
+  std::uniform_real_distribution<float> position(-half, half);
+  std::vector<glm::vec3> points(query_count);
+  for (glm::vec3 &point : points) {
+    point = {position(rng), position(rng), position(rng)};
+  }
+
+  std::vector<Frustum> frustums;
+  for (const glm::vec3 &point : points) {
+    const glm::mat4 view = glm::lookAt(point, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    frustums.push_back(Frustum::fromMatrix(glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, half) * view));
+  }
+  check(
+      "frustum", query_count, [&](size_t q, std::vector<entt::entity> &out) { index.queryFrustum(frustums[q], out); },
+      [&](size_t q, const WorldBox &box) {
+        const glm::vec3 center = (box.min + box.max) * 0.5f;
+        const glm::vec3 extents = (box.max - box.min) * 0.5f;
+        for (const glm::vec4 &p : frustums[q].planes) {
+          const float radius = std::abs(p.x) * extents.x + std::abs(p.y) * extents.y + std::abs(p.z) * extents.z;
+          if (p.x * center.x + p.y * center.y + p.z * center.z + p.w + radius < 0.0f) {
+            return false;
+          }
+        }
+        return true;
+      });
+
+  const glm::vec3 box_half(half * 0.1f);
+  check(
+      "box", query_count,
+      [&](size_t q, std::vector<entt::entity> &out) {
+        index.queryBox(points[q] - box_half, points[q] + box_half, out);
+      },
+      [&](size_t q, const WorldBox &box) {
+        return glm::all(glm::lessThanEqual(box.min, points[q] + box_half)) &&
+               glm::all(glm::lessThanEqual(points[q] - box_half, box.max));
+      });
+
+  const float radius = half * 0.1f;
+  check(
+      "sphere", query_count,
+      [&](size_t q, std::vector<entt::entity> &out) { index.querySphere(points[q], radius, out); },
+      [&](size_t q, const WorldBox &box) {
+        const glm::vec3 d = glm::max(glm::max(box.min - points[q], points[q] - box.max), glm::vec3(0.0f));
+        return glm::dot(d, d) <= radius * radius;
+      });
+
+  // Rays from outside the world towards random points, compared by hit distance since boxes may tie
+  size_t ray_hits = 0;
+  double ray_ms = 0.0;
+  bool ray_match = true;
+  for (size_t q = 0; q < query_count; ++q) {
+    const glm::vec3 origin = glm::vec3(-2.0f * half, position(rng), position(rng));
+    const glm::vec3 direction = glm::normalize(points[q] - origin);
+    RayHit hit;
+    const uint64_t start = stm_now();
+    const bool found_hit = index.raycast(origin, direction, 8.0f * half, hit);
+    ray_ms += stm_ms(stm_since(start));
+
+    float best = 8.0f * half;
+    bool expected_hit = false;
+    for (const WorldBox &box : boxes) {
+      const glm::vec3 t1 = (box.min - origin) / direction;
+      const glm::vec3 t2 = (box.max - origin) / direction;
+      const glm::vec3 near = glm::min(t1, t2);
+      const glm::vec3 far = glm::max(t1, t2);
+      const float t_near = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+      const float t_far = std::min(std::min(far.x, far.y), std::min(far.z, best));
+      if (t_near <= t_far) {
+        best = t_near;
+        expected_hit = true;
+      }
+    }
+    ray_hits += found_hit ? 1 : 0;
+    ray_match = ray_match && found_hit == expected_hit && (!found_hit || std::abs(hit.distance - best) <= 1e-3f);
+  }
+  std::printf("  %-17s %9.4f ms  %9zu hits  matches brute force: %s\n", "raycast",
+              ray_ms / static_cast<double>(query_count), ray_hits, ray_match ? "yes" : "NO");
+  ok = ok && ray_match;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "components.h"
+#include "transform_batch.h"
+
+template <typename Fn>
+static double time_best_ns(int iterations, Fn &&fn) {
+  double best = 1e30;
+  for (int i = 0; i < iterations; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    fn();
+    const auto end = std::chrono::steady_clock::now();
+    const double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    best = ns < best ? ns : best;
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  const size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+  const int iterations = argc > 2 ? std::atoi(argv[2]) : 50;
+
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> dist(-10.0f, 10.0f);
+  std::uniform_real_distribution<float> scale_dist(0.5f, 2.0f);
+
+  std::vector<Transform> transforms(count);
+  for (Transform &t : transforms) {
+    t.position = {dist(rng), dist(rng), dist(rng)};
+    t.rotation = glm::normalize(glm::quat(dist(rng), dist(rng), dist(rng), dist(rng)));
+    t.scale = {scale_dist(rng), scale_dist(rng), scale_dist(rng)};
+  }
+
+  // The same transforms in the registry's structure-of-arrays layout
+  TransformStorage storage;
+  storage.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    storage.emplace(static_cast<entt::entity>(i), transforms[i]);
+  }
+  const TransformLanes lanes = storage.getLanes();
+
+  std::vector<glm::mat4> reference(count);
+  std::vector<glm::mat4> scalar(count);
+  std::vector<glm::mat4> batched(count);
+  std::vector<glm::mat4> soa(count);
+
+  const double get_matrix_ns = time_best_ns(iterations, [&] {
+    for (size_t i = 0; i < count; ++i) {
+      reference[i] = transforms[i].getMatrix();
+    }
+  });
+  const double scalar_ns =
+      time_best_ns(iterations, [&] { composeTransformsScalar(transforms.data(), scalar.data(), count); });
+  const double batched_ns =
+      time_best_ns(iterations, [&] { composeTransforms(transforms.data(), batched.data(), count); });
+
+  const double soa_ns = time_best_ns(iterations, [&] { composeTransforms(lanes, 0, soa.data(), count); });
+
+  const bool identical = std::memcmp(scalar.data(), batched.data(), count * sizeof(glm::mat4)) == 0;
+  const bool soa_identical = std::memcmp(scalar.data(), soa.data(), count * sizeof(glm::mat4)) == 0;
+
+  float max_error = 0.0f;
+  for (size_t i = 0; i < count; ++i) {
+    for (int c = 0; c < 4; ++c) {
+      for (int r = 0; r < 4; ++r) {
+        const float error = std::abs(reference[i][c][r] - batched[i][c][r]);
+        max_error = error > max_error ? error : max_error;
+      }
+    }
+  }
+
+#ifdef __AVX2__
+  const char *batched_path = "avx2";
+#else
+  const char *batched_path = "scalar";
+#endif
+
+#ifndef NDEBUG
+  std::printf("warning: benchmark built without NDEBUG, configure with -DCMAKE_BUILD_TYPE=Release\n");
+#endif
+  std::printf("transforms: %zu, iterations: %d (best of)\n", count, iterations);
+  std::printf("  getMatrix()              %8.3f ms  %6.2f ns/transform\n", get_matrix_ns * 1e-6, get_matrix_ns / count);
+  std::printf("  composeTransformsScalar  %8.3f ms  %6.2f ns/transform  %5.2fx\n", scalar_ns * 1e-6,
+              scalar_ns / count, get_matrix_ns / scalar_ns);
+  std::printf("  composeTransforms (%s) %8.3f ms  %6.2f ns/transform  %5.2fx\n", batched_path, batched_ns * 1e-6,
+              batched_ns / count, get_matrix_ns / batched_ns);
+  std::printf("  composeTransforms SoA (%s) %6.3f ms  %6.2f ns/transform  %5.2fx\n", batched_path, soa_ns * 1e-6,
+              soa_ns / count, get_matrix_ns / soa_ns);
+  std::printf("  batched vs scalar bit-identical: %s, SoA vs scalar: %s, max abs error vs getMatrix(): %g\n",
+              identical ? "yes" : "NO", soa_identical ? "yes" : "NO", max_error);
+
+  return identical && soa_identical ? 0 : 1;
+}
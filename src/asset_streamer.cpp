@@ -0,0 +1,415 @@
+#include "asset_streamer.h"
+
+#include <sokol_log.h>
+#include <sokol_time.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "frame_log.h"
+#include "job_system.h"
+#include "mesh_cache.h"
+#include "mesh_file.h"
+#include "profiler.h"
+
+static constexpr size_t max_pooled_buffers = 8;
+
+std::vector<uint8_t> AssetStreamer::BufferPool::acquire() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_.empty()) {
+    return {};
+  }
+  std::vector<uint8_t> buffer = std::move(free_.back());
+  free_.pop_back();
+  return buffer;
+}
+
+void AssetStreamer::BufferPool::release(std::vector<uint8_t> &&buffer) {
+  buffer.clear();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_.size() < max_pooled_buffers && buffer.capacity() > 0) {
+    free_.push_back(std::move(buffer));
+  }
+}
+
+AssetStreamer::AssetStreamer(JobSystem &jobs, uint32_t lanes_per_priority, uint32_t chunk_size, uint32_t max_decodes)
+    : jobs_(jobs),
+      lanes_per_priority_(std::max(lanes_per_priority, 1u)),
+      chunk_size_(std::max(chunk_size, 4096u)),
+      initialized_(false),
+      next_id_(1),
+      buffer_pool_(std::make_shared<BufferPool>()),
+      decode_slots_(std::max(max_decodes, 1u), nullptr),
+      decodes_pending_(0) {
+  for (uint32_t slot = 0; slot < decode_slots_.size(); ++slot) {
+    free_decode_slots_.push_back(slot);
+  }
+}
+
+AssetStreamer::~AssetStreamer() { shutdown(); }
+
+bool AssetStreamer::init() {
+  sfetch_desc_t desc{};
+  desc.max_requests = lanes_per_priority_ * asset_priority_count;
+  desc.num_channels = asset_priority_count;
+  desc.num_lanes = lanes_per_priority_;
+  desc.logger.func = slog_func;
+  sfetch_setup(&desc);
+  if (!sfetch_valid()) {
+    SPDLOG_ERROR("Failed to set up sokol_fetch");
+    return false;
+  }
+
+  for (size_t p = 0; p < asset_priority_count; ++p) {
+    for (uint32_t lane = 0; lane < lanes_per_priority_; ++lane) {
+      chunk_buffers_.emplace_back(new uint8_t[chunk_size_]);
+      free_chunks_[p].push_back(chunk_buffers_.back().get());
+    }
+  }
+  initialized_ = true;
+
+  SPDLOG_INFO("Asset streamer: {} I/O lanes per priority, {} KiB chunks, {} decode jobs", lanes_per_priority_,
+              chunk_size_ / 1024, decode_slots_.size());
+  return true;
+}
+
+void AssetStreamer::shutdown() {
+  if (!initialized_) {
+    return;
+  }
+
+  // Decode jobs point into requests_, they have to be done before it goes
+  while (decodes_pending_.load(std::memory_order_acquire) > 0) {
+    std::this_thread::yield();
+  }
+  sfetch_shutdown();
+
+  requests_.clear();
+  for (size_t p = 0; p < asset_priority_count; ++p) {
+    queued_[p].clear();
+    loaded_[p].clear();
+    decoded_[p].clear();
+    free_chunks_[p].clear();
+  }
+  finished_decodes_.clear();
+  free_decode_slots_.clear();
+  for (uint32_t slot = 0; slot < decode_slots_.size(); ++slot) {
+    decode_slots_[slot] = nullptr;
+    free_decode_slots_.push_back(slot);
+  }
+  chunk_buffers_.clear();
+  initialized_ = false;
+}
+
+AssetHandle AssetStreamer::requestMesh(const std::string &path, AssetPriority priority) {
+  if (!initialized_) {
+    return {};
+  }
+  if (path.size() + 1 >= static_cast<size_t>(sfetch_max_path())) {
+    SPDLOG_ERROR("Asset path too long: {}", path);
+    return {};
+  }
+
+  const uint32_t id = next_id_++;
+  auto request = std::make_unique<Request>();
+  request->id = id;
+  request->path = path;
+  request->priority = priority;
+  request->state = AssetState::Queued;
+  request->cancelled = false;
+  request->decode_running = false;
+  request->decode_ok = false;
+  request->fetch = {};
+  request->chunk = nullptr;
+  requests_.emplace(id, std::move(request));
+  queued_[static_cast<size_t>(priority)].push_back(id);
+  return {id};
+}
+
+AssetStreamer::Request *AssetStreamer::find(AssetHandle handle) const {
+  auto it = requests_.find(handle.id);
+  if (it == requests_.end() || it->second->cancelled) {
+    return nullptr;
+  }
+  return it->second.get();
+}
+
+void AssetStreamer::erase(uint32_t id) {
+  auto it = requests_.find(id);
+  if (it == requests_.end()) {
+    return;
+  }
+  if (it->second->data.capacity() > 0) {
+    buffer_pool_->release(std::move(it->second->data));
+  }
+  requests_.erase(it);
+}
+
+void AssetStreamer::setPriority(AssetHandle handle, AssetPriority priority) {
+  Request *request = find(handle);
+  if (!request || request->priority == priority) {
+    return;
+  }
+
+  // The entry under the old priority goes stale, popId() skips it
+  request->priority = priority;
+  const size_t p = static_cast<size_t>(priority);
+  if (request->state == AssetState::Queued) {
+    queued_[p].push_back(request->id);
+  } else if (request->state == AssetState::Decoding && !request->decode_running) {
+    loaded_[p].push_back(request->id);
+  } else if (request->state == AssetState::Uploading) {
+    decoded_[p].push_back(request->id);
+  }
+}
+
+void AssetStreamer::cancel(AssetHandle handle) {
+  Request *request = find(handle);
+  if (!request) {
+    return;
+  }
+
+  if (request->state != AssetState::Resident && request->state != AssetState::Failed) {
+    stats_.total_cancelled++;
+  }
+  // Requests still held by an I/O thread or a decode job are dropped once they come back
+  if (request->state == AssetState::Loading) {
+    request->cancelled = true;
+    sfetch_cancel(request->fetch);
+    return;
+  }
+  if (request->decode_running) {
+    request->cancelled = true;
+    return;
+  }
+  erase(request->id);
+}
+
+AssetState AssetStreamer::getState(AssetHandle handle) const {
+  const Request *request = find(handle);
+  return request ? request->state : AssetState::Invalid;
+}
+
+bool AssetStreamer::getMesh(AssetHandle handle, Mesh &mesh, Bounds &bounds) const {
+  const Request *request = find(handle);
+  if (!request || request->state != AssetState::Resident) {
+    return false;
+  }
+  mesh = request->mesh;
+  bounds = request->bounds;
+  return true;
+}
+
+bool AssetStreamer::popId(std::deque<uint32_t> &queue, size_t priority, AssetState state, uint32_t &id) {
+  while (!queue.empty()) {
+    id = queue.front();
+    queue.pop_front();
+    auto it = requests_.find(id);
+    if (it != requests_.end() && !it->second->cancelled && it->second->state == state &&
+        static_cast<size_t>(it->second->priority) == priority && !it->second->decode_running) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void AssetStreamer::update() {
+  if (!initialized_) {
+    return;
+  }
+  MATFX_PROFILE_ZONE("asset streaming");
+
+  collectDecodes();
+  dispatchFetches();
+  // Dispatches what was just sent and runs fetchCallback() for every chunk the I/O threads finished
+  sfetch_dowork();
+  dispatchDecodes();
+
+  stats_.queued = 0;
+  stats_.loading = 0;
+  stats_.decoding = 0;
+  stats_.uploading = 0;
+  for (const auto &[id, request] : requests_) {
+    if (request->cancelled) {
+      continue;
+    }
+    stats_.queued += request->state == AssetState::Queued ? 1 : 0;
+    stats_.loading += request->state == AssetState::Loading ? 1 : 0;
+    stats_.decoding += request->state == AssetState::Decoding ? 1 : 0;
+    stats_.uploading += request->state == AssetState::Uploading ? 1 : 0;
+  }
+}
+
+void AssetStreamer::dispatchFetches() {
+  uint32_t urgent_waiting = 0;
+  for (const auto &[id, request] : requests_) {
+    if (!request->cancelled && request->state == AssetState::Queued && request->priority != AssetPriority::Prefetch) {
+      urgent_waiting++;
+    }
+  }
+
+  for (size_t p = 0; p < asset_priority_count; ++p) {
+    // Prefetches would compete with more urgent reads for the disk
+    if (p == static_cast<size_t>(AssetPriority::Prefetch) && urgent_waiting > 0) {
+      break;
+    }
+
+    uint32_t id;
+    // A free chunk buffer means a free lane, sokol_fetch never has to queue a request internally
+    while (!free_chunks_[p].empty() && popId(queued_[p], p, AssetState::Queued, id)) {
+      Request &request = *requests_[id];
+      request.chunk = free_chunks_[p].back();
+
+      const FetchContext context{this, id};
+      sfetch_request_t desc{};
+      desc.channel = static_cast<uint32_t>(p);
+      desc.path = request.path.c_str();
+      desc.callback = fetchCallback;
+      desc.chunk_size = chunk_size_;
+      desc.buffer = {request.chunk, chunk_size_};
+      desc.user_data = SFETCH_RANGE(context);
+      request.fetch = sfetch_send(&desc);
+      if (!sfetch_handle_valid(request.fetch)) {
+        // Can't happen while requests stay within the lanes sokol_fetch was set up with
+        MATFX_LOG_ERROR("sokol_fetch refused a request for {}", request.path);
+        request.state = AssetState::Failed;
+        stats_.total_failed++;
+        continue;
+      }
+      // Only taken from the pool once sokol_fetch accepted the request, a failed one would never give it back
+      request.data = buffer_pool_->acquire();
+      request.state = AssetState::Loading;
+      free_chunks_[p].pop_back();
+      urgent_waiting -= p != static_cast<size_t>(AssetPriority::Prefetch) ? 1 : 0;
+    }
+  }
+}
+
+void AssetStreamer::fetchCallback(const sfetch_response_t *response) {
+  const FetchContext &context = *static_cast<const FetchContext *>(response->user_data);
+  AssetStreamer &streamer = *context.streamer;
+  // Requests are only erased once sokol_fetch is done with them
+  Request &request = *streamer.requests_.at(context.id);
+
+  if (response->fetched && !request.cancelled) {
+    const auto *bytes = static_cast<const uint8_t *>(response->data.ptr);
+    request.data.insert(request.data.end(), bytes, bytes + response->data.size);
+    streamer.stats_.total_loaded_bytes += response->data.size;
+  }
+  if (!response->finished) {
+    return;
+  }
+
+  streamer.free_chunks_[response->channel].push_back(request.chunk);
+  if (request.cancelled || response->cancelled) {
+    streamer.erase(context.id);
+    return;
+  }
+  if (response->failed) {
+    MATFX_LOG_WARN("Streaming {} failed, sokol_fetch error {}", request.path, static_cast<int>(response->error_code));
+    streamer.buffer_pool_->release(std::move(request.data));
+    request.state = AssetState::Failed;
+    streamer.stats_.total_failed++;
+    return;
+  }
+
+  request.state = AssetState::Decoding;
+  streamer.loaded_[static_cast<size_t>(request.priority)].push_back(context.id);
+}
+
+void AssetStreamer::dispatchDecodes() {
+  for (size_t p = 0; p < asset_priority_count; ++p) {
+    uint32_t id;
+    while (!free_decode_slots_.empty() && popId(loaded_[p], p, AssetState::Decoding, id)) {
+      const uint32_t slot = free_decode_slots_.back();
+      free_decode_slots_.pop_back();
+      Request *request = requests_[id].get();
+      request->decode_running = true;
+      decode_slots_[slot] = request;
+
+      decodes_pending_.fetch_add(1, std::memory_order_relaxed);
+      jobs_.dispatchBackground(&AssetStreamer::decodeJob, this, slot, decodes_pending_);
+    }
+  }
+}
+
+void AssetStreamer::decodeJob(void *context, size_t slot) {
+  AssetStreamer &streamer = *static_cast<AssetStreamer *>(context);
+  // Only this job touches the request until the slot is handed back
+  Request &request = *streamer.decode_slots_[slot];
+  {
+    MATFX_PROFILE_ZONE("decode mesh");
+
+    // The file buffer goes back to the pool once the last copy of the mesh lets go of its blob
+    std::shared_ptr<BufferPool> pool = streamer.buffer_pool_;
+    std::shared_ptr<std::vector<uint8_t>> file(new std::vector<uint8_t>(std::move(request.data)),
+                                               [pool](std::vector<uint8_t> *buffer) {
+                                                 pool->release(std::move(*buffer));
+                                                 delete buffer;
+                                               });
+    const unsigned char *data = file->data();
+    const size_t size = file->size();
+    request.decode_ok = parseMeshFile(request.path, std::move(file), data, size, request.mesh, request.bounds);
+    if (!request.decode_ok) {
+      request.mesh.clear();
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(streamer.finished_decodes_mutex_);
+  streamer.finished_decodes_.push_back(static_cast<uint32_t>(slot));
+}
+
+void AssetStreamer::collectDecodes() {
+  finished_scratch_.clear();
+  {
+    std::lock_guard<std::mutex> lock(finished_decodes_mutex_);
+    finished_scratch_.swap(finished_decodes_);
+  }
+
+  for (uint32_t slot : finished_scratch_) {
+    Request &request = *decode_slots_[slot];
+    decode_slots_[slot] = nullptr;
+    free_decode_slots_.push_back(slot);
+    request.decode_running = false;
+
+    if (request.cancelled) {
+      erase(request.id);
+    } else if (request.decode_ok) {
+      request.state = AssetState::Uploading;
+      decoded_[static_cast<size_t>(request.priority)].push_back(request.id);
+    } else {
+      request.state = AssetState::Failed;
+      stats_.total_failed++;
+    }
+  }
+}
+
+void AssetStreamer::finish(MeshCache &cache, double budget_ms) {
+  MATFX_PROFILE_ZONE("asset finish");
+  const uint64_t start = stm_now();
+  stats_.frame_finished = 0;
+
+  for (size_t p = 0; p < asset_priority_count; ++p) {
+    uint32_t id;
+    while ((stats_.frame_finished == 0 || stm_ms(stm_since(start)) < budget_ms) &&
+           popId(decoded_[p], p, AssetState::Uploading, id)) {
+      Request &request = *requests_[id];
+      const uint32_t deferred = cache.getStats().frame_deferred;
+      if (cache.acquire(request.mesh)) {
+        request.state = AssetState::Resident;
+        stats_.frame_finished++;
+        stats_.total_resident++;
+      } else if (cache.getStats().frame_deferred != deferred) {
+        // Out of upload budget for this frame, the cache has the final say on how many bytes go up
+        decoded_[p].push_front(id);
+        stats_.frame_finish_ms = stm_ms(stm_since(start));
+        return;
+      } else {
+        request.state = AssetState::Failed;
+        stats_.total_failed++;
+      }
+    }
+  }
+  stats_.frame_finish_ms = stm_ms(stm_since(start));
+}
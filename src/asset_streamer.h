@@ -0,0 +1,170 @@
+#pragma once
+#include <sokol_fetch.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "components.h"
+
+class JobSystem;
+class MeshCache;
+
+// Lower values are served first. Each priority has its own sokol_fetch channel, so a visible request never queues
+// behind a prefetch on the same I/O thread, and prefetches are only sent while nothing more urgent is waiting.
+enum class AssetPriority : uint8_t { Visible, Nearby, Prefetch };
+constexpr size_t asset_priority_count = 3;
+
+enum class AssetState : uint8_t {
+  Invalid,    // unknown or cancelled handle
+  Queued,     // waiting for a free I/O lane
+  Loading,    // being read by a sokol_fetch I/O thread
+  Decoding,   // read, waiting for or running its decode job
+  Uploading,  // decoded, waiting for its GPU buffers
+  Resident,   // done, getMesh() returns it
+  Failed,
+};
+
+struct AssetHandle {
+  uint32_t id = 0;
+};
+
+struct AssetStreamerStats {
+  uint32_t queued = 0;  // requests alive per stage, updated by update()
+  uint32_t loading = 0;
+  uint32_t decoding = 0;
+  uint32_t uploading = 0;
+
+  // reset by finish()
+  uint32_t frame_finished = 0;
+  double frame_finish_ms = 0.0;
+
+  uint64_t total_loaded_bytes = 0;
+  uint64_t total_resident = 0;
+  uint64_t total_failed = 0;
+  uint64_t total_cancelled = 0;
+};
+
+// Streams mesh files in without the frame loop ever touching the disk. A request moves through
+//
+//   sokol_fetch I/O thread   file read in chunk_size pieces into pooled chunk buffers
+//   update()                 chunks appended to a pooled file buffer
+//   background job           header validated and content hash checked on a JobSystem worker
+//   finish()                 vertex and index buffers created through the MeshCache, within a time budget
+//
+// sokol_fetch hands over one chunk per request and update(), chunk_size bounds how fast a single file streams in.
+//
+// sokol_fetch keeps its state per thread: init(), update(), finish() and the request functions all have to be called
+// from the same thread. Buffers are pooled, a streamed mesh's blob returns its file buffer to the pool when the last
+// copy of the mesh goes away.
+class AssetStreamer {
+ public:
+  explicit AssetStreamer(JobSystem &jobs, uint32_t lanes_per_priority = 4, uint32_t chunk_size = 1024 * 1024,
+                         uint32_t max_decodes = 4);
+  ~AssetStreamer();
+
+  AssetStreamer(const AssetStreamer &) = delete;
+  AssetStreamer &operator=(const AssetStreamer &) = delete;
+  AssetStreamer(AssetStreamer &&) = delete;
+  AssetStreamer &operator=(AssetStreamer &&) = delete;
+
+  bool init();
+  void shutdown();
+
+  // Every call starts its own request, the MeshCache still shares the GPU buffers of identical files
+  AssetHandle requestMesh(const std::string &path, AssetPriority priority);
+  // Takes effect at the request's next stage; a request already being read keeps its I/O lane
+  void setPriority(AssetHandle handle, AssetPriority priority);
+  // Stops the request wherever it is and forgets the handle. Also how a caller lets go of a finished request.
+  void cancel(AssetHandle handle);
+
+  AssetState getState(AssetHandle handle) const;
+  // Copies out the mesh of a Resident request, its buffers are already uploaded
+  bool getMesh(AssetHandle handle, Mesh &mesh, Bounds &bounds) const;
+
+  // Once per frame: hands finished reads to decode jobs and sends queued requests to free I/O lanes. Never waits.
+  void update();
+  // Creates GPU buffers for decoded meshes, most urgent first, until budget_ms is spent or the cache defers an
+  // upload. At least one mesh is finished per call so a tiny budget still makes progress. Call after
+  // MeshCache::beginFrame().
+  void finish(MeshCache &cache, double budget_ms);
+
+  const AssetStreamerStats &getStats() const { return stats_; }
+
+ private:
+  // Recycled file buffers, shared with the blobs of streamed meshes which may outlive the streamer
+  class BufferPool {
+   public:
+    std::vector<uint8_t> acquire();
+    void release(std::vector<uint8_t> &&buffer);
+
+   private:
+    std::mutex mutex_;
+    std::vector<std::vector<uint8_t>> free_;
+  };
+
+  struct Request {
+    uint32_t id;
+    std::string path;
+    AssetPriority priority;
+    AssetState state;
+    bool cancelled;  // set while an I/O thread or decode job still holds the request
+    bool decode_running;
+    bool decode_ok;
+    sfetch_handle_t fetch;
+    uint8_t *chunk;
+    std::vector<uint8_t> data;
+    Mesh mesh;
+    Bounds bounds;
+  };
+
+  // Copied into sokol_fetch's user data block, must stay trivially copyable
+  struct FetchContext {
+    AssetStreamer *streamer;
+    uint32_t id;
+  };
+
+  JobSystem &jobs_;
+  uint32_t lanes_per_priority_;
+  uint32_t chunk_size_;
+  bool initialized_;
+
+  std::unordered_map<uint32_t, std::unique_ptr<Request>> requests_;
+  uint32_t next_id_;
+  // Ids per stage and priority. Entries go stale when a request is cancelled or reprioritised and are skipped when
+  // they come up, checking a request's state and priority is cheaper than searching the queues.
+  std::deque<uint32_t> queued_[asset_priority_count];
+  std::deque<uint32_t> loaded_[asset_priority_count];
+  std::deque<uint32_t> decoded_[asset_priority_count];
+
+  // lanes_per_priority_ chunk buffers per channel, a request holds one from sfetch_send() until it finishes
+  std::vector<std::unique_ptr<uint8_t[]>> chunk_buffers_;
+  std::vector<uint8_t *> free_chunks_[asset_priority_count];
+  std::shared_ptr<BufferPool> buffer_pool_;
+
+  // A decode slot holds the request its job works on; slots are handed back through finished_decodes_
+  std::vector<Request *> decode_slots_;
+  std::vector<uint32_t> free_decode_slots_;
+  std::mutex finished_decodes_mutex_;
+  std::vector<uint32_t> finished_decodes_;
+  std::vector<uint32_t> finished_scratch_;
+  std::atomic<size_t> decodes_pending_;
+
+  AssetStreamerStats stats_;
+
+  Request *find(AssetHandle handle) const;
+  void erase(uint32_t id);
+  bool popId(std::deque<uint32_t> &queue, size_t priority, AssetState state, uint32_t &id);
+  void dispatchFetches();
+  void dispatchDecodes();
+  void collectDecodes();
+
+  static void fetchCallback(const sfetch_response_t *response);
+  static void decodeJob(void *context, size_t slot);
+};
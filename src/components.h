@@ -1,21 +1,33 @@
 #pragma once
 #include <cstdint>
+#include <entt/entity/entity.hpp>
 #include <glm.hpp>
 #include <gtc/matrix_transform.hpp>
 #include <gtc/quaternion.hpp>
+#include <memory>
 #include <vector>
 
-struct Transform {
-  glm::vec3 position{0.0f};
-  glm::quat rotation{1.0f, 0.0f, 0.0f, 0.0f};
-  glm::vec3 scale{1.0f};
+// Transform is declared along with its storage
+#include "transform_storage.h"
 
-  glm::mat4 getMatrix() const {
-    glm::mat4 t = glm::translate(glm::mat4(1.0f), position);
-    glm::mat4 r = glm::mat4_cast(rotation);
-    glm::mat4 s = glm::scale(glm::mat4(1.0f), scale);
-    return t * r * s;
-  }
+struct Parent {
+  entt::entity entity{entt::null};
+};
+
+// Written by TransformSystem, read-only for everything else. Updates go through patch(), so on_update fires.
+struct WorldTransform {
+  glm::mat4 matrix{1.0f};
+};
+
+// World matrix at the end of the previous simulation step. Only entities carrying one are interpolated when drawn,
+// everything else is rendered at its current WorldTransform; children of a moving parent need one too.
+struct PreviousWorldTransform {
+  glm::mat4 matrix{1.0f};
+};
+
+// Constant angular velocity in radians per second, integrated every simulation step
+struct Spin {
+  glm::vec3 angular_velocity{0.0f};
 };
 
 struct Camera {
@@ -32,6 +44,22 @@ struct Camera {
   glm::mat4 getProjectionMatrix(float aspect_ratio) const {
     return glm::perspective(glm::radians(fov), aspect_ratio, near_plane, far_plane);
   }
+
+  glm::mat4 getViewProjectionMatrix(float aspect_ratio) const {
+    return getProjectionMatrix(aspect_ratio) * getViewMatrix();
+  }
+};
+
+// Local-space axis-aligned bounding box
+struct Bounds {
+  glm::vec3 center{0.0f};
+  glm::vec3 extents{0.5f};
+};
+
+struct Material {
+  uint32_t pipeline_id = 0;  // 0 selects the renderer's default opaque or transparent pipeline
+  glm::vec4 color{1.0f};
+  bool transparent = false;
 };
 
 struct Vertex {
@@ -40,9 +68,44 @@ struct Vertex {
   glm::vec2 texcoord;
 };
 
+// Compact GPU vertex written by packMesh(), 16 bytes. Positions are unorm16 in a cube around the mesh (w is always
+// 65535 so it decodes to 1), normals octahedral snorm16 and texcoords half floats.
+struct PackedVertex {
+  uint16_t position[4];
+  int16_t normal[2];
+  uint16_t texcoord[2];
+};
+static_assert(sizeof(PackedVertex) == 16);
+
+// Geometry already laid out the way the GPU takes it, vertices in Vertex or PackedVertex form and indices 16 or 32
+// bits wide. Usually a view into a memory-mapped mesh file (see mesh_file.h) that owner keeps alive.
+struct MeshBlob {
+  std::shared_ptr<const void> owner;
+  const void *vertices = nullptr;
+  size_t vertex_bytes = 0;
+  const void *indices = nullptr;
+  size_t index_bytes = 0;
+  uint32_t vertex_count = 0;
+  uint32_t index_count = 0;
+  bool packed = false;
+  bool short_indices = false;
+  uint64_t content_hash = 0;
+};
+
 struct Mesh {
   std::vector<Vertex> vertices;
   std::vector<uint32_t> indices;
+
+  // Uploaded instead of vertices when present. Decoded positions map back to mesh space through
+  // quantization_offset + position * quantization_scale; the scale is the same on every axis so it can be folded
+  // into the model matrix without skewing normals.
+  std::vector<PackedVertex> packed_vertices;
+  glm::vec3 quantization_offset{0.0f};
+  float quantization_scale = 1.0f;
+
+  // Uploaded as is when set, the vectors above are then usually empty. Copies of the mesh share it.
+  std::shared_ptr<const MeshBlob> blob;
+
   uint32_t vertex_buffer_id = 0;
   uint32_t index_buffer_id = 0;
   bool uploaded = false;
@@ -50,11 +113,35 @@ struct Mesh {
   void clear() {
     vertices.clear();
     indices.clear();
+    packed_vertices.clear();
+    blob.reset();
     vertex_buffer_id = 0;
     index_buffer_id = 0;
     uploaded = false;
   }
 
-  size_t getVertexCount() const { return vertices.size(); }
-  size_t getIndexCount() const { return indices.size(); }
+  bool isPacked() const { return blob ? blob->packed : !packed_vertices.empty(); }
+  size_t getVertexCount() const {
+    if (blob) {
+      return blob->vertex_count;
+    }
+    return isPacked() ? packed_vertices.size() : vertices.size();
+  }
+  size_t getIndexCount() const { return blob ? blob->index_count : indices.size(); }
+  // Indices go to the GPU as 16 bits whenever every vertex can be addressed that way
+  bool usesShortIndices() const { return blob ? blob->short_indices : getVertexCount() <= 0xffff; }
+};
+
+// Levels of detail of one mesh, most detailed first. errors[i] estimates how far, in mesh units, level i's surface lies
+// from the full mesh's; screen-space selection projects it to pixels. Built by buildLodChain().
+struct MeshLodChain {
+  std::vector<Mesh> levels;
+  std::vector<float> errors;
+};
+
+// Drawn in place of a Mesh component: each frame LodSelector picks one level of the shared chain. level is that
+// choice, remembered between frames for hysteresis.
+struct MeshLod {
+  std::shared_ptr<MeshLodChain> chain;
+  uint32_t level = 0;
 };
\ No newline at end of file
@@ -0,0 +1,238 @@
+#include "culling.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+
+#include "profiler.h"
+
+Frustum Frustum::fromMatrix(const glm::mat4 &view_proj) {
+  const glm::mat4 m = glm::transpose(view_proj);
+
+  Frustum frustum;
+  frustum.planes[0] = m[3] + m[0];
+  frustum.planes[1] = m[3] - m[0];
+  frustum.planes[2] = m[3] + m[1];
+  frustum.planes[3] = m[3] - m[1];
+  frustum.planes[4] = m[3] + m[2];
+  frustum.planes[5] = m[3] - m[2];
+
+  for (glm::vec4 &plane : frustum.planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  return frustum;
+}
+
+Bounds computeBounds(const Mesh &mesh) {
+  if (mesh.vertices.empty()) {
+    return Bounds{glm::vec3(0.0f), glm::vec3(0.0f)};
+  }
+
+  glm::vec3 min = mesh.vertices[0].position;
+  glm::vec3 max = min;
+  for (const Vertex &vertex : mesh.vertices) {
+    min = glm::min(min, vertex.position);
+    max = glm::max(max, vertex.position);
+  }
+  return Bounds{(min + max) * 0.5f, (max - min) * 0.5f};
+}
+
+// The scalar tails below evaluate the exact expressions of the vector loops so results never depend on batch position
+static inline float plane_distance(const glm::vec4 &p, float x, float y, float z) {
+  return p.x * x + p.y * y + p.z * z + p.w;
+}
+
+static inline bool sphere_visible(const Frustum &frustum, float x, float y, float z, float radius) {
+  for (const glm::vec4 &p : frustum.planes) {
+    if (!(plane_distance(p, x, y, z) + radius >= 0.0f)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static inline bool box_visible(const Frustum &frustum, float cx, float cy, float cz, float ex, float ey, float ez) {
+  for (const glm::vec4 &p : frustum.planes) {
+    const float radius = std::abs(p.x) * ex + std::abs(p.y) * ey + std::abs(p.z) * ez;
+    if (!(plane_distance(p, cx, cy, cz) + radius >= 0.0f)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef __AVX2__
+
+struct PlaneLanes {
+  __m256 x, y, z, w;
+  __m256 abs_x, abs_y, abs_z;
+};
+
+static inline std::array<PlaneLanes, 6> broadcast_planes(const Frustum &frustum) {
+  std::array<PlaneLanes, 6> lanes;
+  for (size_t i = 0; i < frustum.planes.size(); ++i) {
+    const glm::vec4 &p = frustum.planes[i];
+    lanes[i].x = _mm256_set1_ps(p.x);
+    lanes[i].y = _mm256_set1_ps(p.y);
+    lanes[i].z = _mm256_set1_ps(p.z);
+    lanes[i].w = _mm256_set1_ps(p.w);
+    lanes[i].abs_x = _mm256_set1_ps(std::abs(p.x));
+    lanes[i].abs_y = _mm256_set1_ps(std::abs(p.y));
+    lanes[i].abs_z = _mm256_set1_ps(std::abs(p.z));
+  }
+  return lanes;
+}
+
+static inline __m256 plane_distance8(const PlaneLanes &p, __m256 x, __m256 y, __m256 z) {
+  const __m256 xy = _mm256_add_ps(_mm256_mul_ps(p.x, x), _mm256_mul_ps(p.y, y));
+  return _mm256_add_ps(_mm256_add_ps(xy, _mm256_mul_ps(p.z, z)), p.w);
+}
+
+static inline size_t append_visible(int mask, size_t base, uint32_t *visible, size_t written) {
+  while (mask) {
+    visible[written++] = static_cast<uint32_t>(base + __builtin_ctz(mask));
+    mask &= mask - 1;
+  }
+  return written;
+}
+
+size_t cullSpheres(const Frustum &frustum, const float *x, const float *y, const float *z, const float *radius,
+                   size_t count, uint32_t *visible) {
+  const std::array<PlaneLanes, 6> planes = broadcast_planes(frustum);
+  const __m256 zero = _mm256_setzero_ps();
+
+  size_t written = 0;
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i);
+    const __m256 r = _mm256_loadu_ps(radius + i);
+
+    int mask = 0xff;
+    for (const PlaneLanes &p : planes) {
+      const __m256 inside = _mm256_cmp_ps(_mm256_add_ps(plane_distance8(p, px, py, pz), r), zero, _CMP_GE_OQ);
+      mask &= _mm256_movemask_ps(inside);
+      if (!mask) {
+        break;
+      }
+    }
+    written = append_visible(mask, i, visible, written);
+  }
+
+  for (; i < count; ++i) {
+    if (sphere_visible(frustum, x[i], y[i], z[i], radius[i])) {
+      visible[written++] = static_cast<uint32_t>(i);
+    }
+  }
+  return written;
+}
+
+size_t cullBoxes(const Frustum &frustum, const float *cx, const float *cy, const float *cz, const float *ex,
+                 const float *ey, const float *ez, size_t count, uint32_t *visible) {
+  const std::array<PlaneLanes, 6> planes = broadcast_planes(frustum);
+  const __m256 zero = _mm256_setzero_ps();
+
+  size_t written = 0;
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 x = _mm256_loadu_ps(cx + i), y = _mm256_loadu_ps(cy + i), z = _mm256_loadu_ps(cz + i);
+    const __m256 hx = _mm256_loadu_ps(ex + i), hy = _mm256_loadu_ps(ey + i), hz = _mm256_loadu_ps(ez + i);
+
+    int mask = 0xff;
+    for (const PlaneLanes &p : planes) {
+      const __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p.abs_x, hx), _mm256_mul_ps(p.abs_y, hy)),
+                                     _mm256_mul_ps(p.abs_z, hz));
+      const __m256 inside = _mm256_cmp_ps(_mm256_add_ps(plane_distance8(p, x, y, z), r), zero, _CMP_GE_OQ);
+      mask &= _mm256_movemask_ps(inside);
+      if (!mask) {
+        break;
+      }
+    }
+    written = append_visible(mask, i, visible, written);
+  }
+
+  for (; i < count; ++i) {
+    if (box_visible(frustum, cx[i], cy[i], cz[i], ex[i], ey[i], ez[i])) {
+      visible[written++] = static_cast<uint32_t>(i);
+    }
+  }
+  return written;
+}
+
+#else
+
+size_t cullSpheres(const Frustum &frustum, const float *x, const float *y, const float *z, const float *radius,
+                   size_t count, uint32_t *visible) {
+  size_t written = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (sphere_visible(frustum, x[i], y[i], z[i], radius[i])) {
+      visible[written++] = static_cast<uint32_t>(i);
+    }
+  }
+  return written;
+}
+
+size_t cullBoxes(const Frustum &frustum, const float *cx, const float *cy, const float *cz, const float *ex,
+                 const float *ey, const float *ez, size_t count, uint32_t *visible) {
+  size_t written = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (box_visible(frustum, cx[i], cy[i], cz[i], ex[i], ey[i], ez[i])) {
+      visible[written++] = static_cast<uint32_t>(i);
+    }
+  }
+  return written;
+}
+
+#endif
+
+void FrustumCuller::cull(const RenderList &list, const Frustum &frustum) {
+  MATFX_PROFILE_ZONE("FrustumCuller::cull");
+  candidates_.clear();
+  center_x_.clear();
+  center_y_.clear();
+  center_z_.clear();
+  extent_x_.clear();
+  extent_y_.clear();
+  extent_z_.clear();
+  visible_.clear();
+  stats_ = {};
+
+  const std::vector<RenderItem> &items = list.getItems();
+  const std::vector<glm::mat4> &world = list.getWorld();
+
+  // World-space AABB of the transformed local box: the center moves with the matrix and each world extent is the
+  // local extents projected onto that axis through the absolute rotation-scale part
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (!items[i].bounded) {
+      visible_.push_back(static_cast<uint32_t>(i));
+      continue;
+    }
+
+    const glm::mat4 &m = world[i];
+    const Bounds &bounds = items[i].bounds;
+    const glm::vec3 center = glm::vec3(m * glm::vec4(bounds.center, 1.0f));
+    const glm::vec3 &e = bounds.extents;
+
+    candidates_.push_back(static_cast<uint32_t>(i));
+    center_x_.push_back(center.x);
+    center_y_.push_back(center.y);
+    center_z_.push_back(center.z);
+    extent_x_.push_back(std::abs(m[0][0]) * e.x + std::abs(m[1][0]) * e.y + std::abs(m[2][0]) * e.z);
+    extent_y_.push_back(std::abs(m[0][1]) * e.x + std::abs(m[1][1]) * e.y + std::abs(m[2][1]) * e.z);
+    extent_z_.push_back(std::abs(m[0][2]) * e.x + std::abs(m[1][2]) * e.y + std::abs(m[2][2]) * e.z);
+  }
+  stats_.unbounded = visible_.size();
+
+  visible_indices_.resize(candidates_.size());
+  const size_t visible_count =
+      cullBoxes(frustum, center_x_.data(), center_y_.data(), center_z_.data(), extent_x_.data(), extent_y_.data(),
+                extent_z_.data(), candidates_.size(), visible_indices_.data());
+
+  for (size_t i = 0; i < visible_count; ++i) {
+    visible_.push_back(candidates_[visible_indices_[i]]);
+  }
+
+  stats_.tested = candidates_.size();
+  stats_.visible = visible_.size();
+}
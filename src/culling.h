@@ -0,0 +1,48 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "components.h"
+#include "render_list.h"
+
+struct Frustum {
+  // left, right, bottom, top, near, far; xyz is the inward facing normal, w the distance
+  std::array<glm::vec4, 6> planes;
+
+  static Frustum fromMatrix(const glm::mat4 &view_proj);
+};
+
+Bounds computeBounds(const Mesh &mesh);
+
+// SoA visibility kernels. Indices of the inputs that intersect the frustum are written to visible, which must hold
+// count entries; the number written is returned.
+size_t cullSpheres(const Frustum &frustum, const float *x, const float *y, const float *z, const float *radius,
+                   size_t count, uint32_t *visible);
+size_t cullBoxes(const Frustum &frustum, const float *cx, const float *cy, const float *cz, const float *ex,
+                 const float *ey, const float *ez, size_t count, uint32_t *visible);
+
+struct CullingStats {
+  size_t tested = 0;
+  size_t visible = 0;
+  size_t unbounded = 0;
+};
+
+// Collects the indices of the render list items that intersect the frustum, tested at their interpolated world
+// matrix. Items without Bounds are never culled.
+class FrustumCuller {
+ public:
+  void cull(const RenderList &list, const Frustum &frustum);
+
+  const std::vector<uint32_t> &getVisible() const { return visible_; }
+  const CullingStats &getStats() const { return stats_; }
+
+ private:
+  std::vector<uint32_t> candidates_;
+  std::vector<float> center_x_, center_y_, center_z_;
+  std::vector<float> extent_x_, extent_y_, extent_z_;
+  std::vector<uint32_t> visible_indices_;
+  std::vector<uint32_t> visible_;
+  CullingStats stats_;
+};
@@ -0,0 +1,121 @@
+#include "frame_allocator.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+#include "frame_log.h"
+#include "profiler.h"
+
+static size_t align_up(size_t value) {
+  return (value + FrameAllocator::alignment - 1) & ~(FrameAllocator::alignment - 1);
+}
+
+FrameAllocator::FrameAllocator(const char *label)
+    : label_(label),
+      buffer_{},
+      used_(0),
+      flushed_(0),
+      requested_(0),
+      allocations_(0),
+      appends_(0),
+      failed_(0) {}
+
+FrameAllocator::~FrameAllocator() { shutdown(); }
+
+bool FrameAllocator::init(size_t capacity) {
+  createBuffer(align_up(std::max(capacity, alignment)));
+  if (sg_query_buffer_state(buffer_) != SG_RESOURCESTATE_VALID) {
+    SPDLOG_ERROR("Failed to create the {} buffer", label_);
+    return false;
+  }
+  return true;
+}
+
+void FrameAllocator::shutdown() {
+  if (buffer_.id != SG_INVALID_ID) {
+    if (sg_isvalid()) {
+      sg_destroy_buffer(buffer_);
+    }
+    buffer_ = {};
+  }
+  stats_.capacity = 0;
+}
+
+void FrameAllocator::createBuffer(size_t capacity) {
+  if (buffer_.id != SG_INVALID_ID) {
+    sg_destroy_buffer(buffer_);
+    stats_.grows++;
+  }
+
+  sg_buffer_desc buf_desc{};
+  buf_desc.size = capacity;
+  buf_desc.usage.vertex_buffer = true;
+  buf_desc.usage.stream_update = true;
+  buf_desc.label = label_;
+  buffer_ = sg_make_buffer(&buf_desc);
+  stats_.capacity = capacity;
+  staging_.resize(std::max(staging_.size(), capacity));
+}
+
+void FrameAllocator::beginFrame() {
+  stats_.frame_bytes = used_;
+  stats_.frame_allocations = allocations_;
+  stats_.frame_appends = appends_;
+  stats_.frame_failed = failed_;
+  used_ = 0;
+  flushed_ = 0;
+  requested_ = 0;
+  allocations_ = 0;
+  appends_ = 0;
+  failed_ = 0;
+}
+
+void *FrameAllocator::allocate(size_t size, uint32_t &offset) {
+  size = align_up(size);
+  requested_ += size;
+  stats_.high_water = std::max(stats_.high_water, requested_);
+
+  // Once part of the frame is in the GPU buffer it can't be replaced, the rest of the frame has to fit
+  if (flushed_ > 0 && used_ + size > stats_.capacity) {
+    failed_++;
+    MATFX_LOG_WARN("The {} buffer is full, {} bytes refused; it grows next frame", label_, size);
+    return nullptr;
+  }
+  if (used_ + size > staging_.size()) {
+    staging_.resize(std::max(used_ + size, staging_.size() * 2));
+  }
+
+  offset = static_cast<uint32_t>(used_);
+  used_ += size;
+  allocations_++;
+  return staging_.data() + offset;
+}
+
+void FrameAllocator::flush() {
+  if (used_ == flushed_) {
+    return;
+  }
+  MATFX_PROFILE_ZONE("FrameAllocator::flush");
+
+  // The first append of a frame may still swap the buffer for a bigger one; growing to the high-water mark rather
+  // than this frame's size keeps a frame that overflowed after a flush from overflowing again
+  const size_t needed = std::max(used_, stats_.high_water);
+  if (flushed_ == 0 && needed > stats_.capacity) {
+    size_t capacity = std::max<size_t>(stats_.capacity, alignment);
+    while (capacity < needed) {
+      capacity *= 2;
+    }
+    createBuffer(capacity);
+    MATFX_LOG_DEBUG("The {} buffer grew to {} bytes", label_, capacity);
+  }
+
+  const sg_range range{staging_.data() + flushed_, used_ - flushed_};
+  const int offset = sg_append_buffer(buffer_, &range);
+  if (static_cast<size_t>(offset) != flushed_) {
+    MATFX_LOG_ERROR("The {} buffer appended at {} instead of {}, draws will read the wrong data", label_, offset,
+                    flushed_);
+  }
+  flushed_ = used_;
+  appends_++;
+}
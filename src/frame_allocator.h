@@ -0,0 +1,71 @@
+#pragma once
+#include <sokol_gfx.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct FrameAllocatorStats {
+  size_t capacity = 0;    // bytes of the GPU buffer
+  size_t high_water = 0;  // most bytes any frame has asked for
+  uint32_t grows = 0;     // times the GPU buffer was recreated larger
+
+  // last completed frame, collected by beginFrame()
+  size_t frame_bytes = 0;
+  uint32_t frame_allocations = 0;
+  uint32_t frame_appends = 0;
+  uint32_t frame_failed = 0;  // allocations refused because the buffer was already in use and full
+};
+
+// Linear per-frame allocator over one stream buffer for data that changes every frame, such as instance transforms.
+// allocate() hands out a byte offset into the buffer and CPU memory to write the data to; flush() uploads everything
+// allocated since the last flush with a single sg_append_buffer(), and draws bind the buffer at their offsets.
+// Sokol keeps one GL buffer per frame in flight for stream buffers, so a frame never writes to memory the GPU may
+// still be reading.
+//
+// The buffer grows to fit a frame as long as nothing has been appended to it that frame yet. Allocations past the
+// capacity after a flush are refused, and the next frame's first flush grows the buffer to the high-water mark.
+class FrameAllocator {
+ public:
+  // Offsets and sizes are rounded to this, which keeps them valid for vertex attributes and sokol's appends
+  static constexpr size_t alignment = 16;
+
+  explicit FrameAllocator(const char *label);
+  ~FrameAllocator();
+
+  FrameAllocator(const FrameAllocator &) = delete;
+  FrameAllocator &operator=(const FrameAllocator &) = delete;
+  FrameAllocator(FrameAllocator &&) = delete;
+  FrameAllocator &operator=(FrameAllocator &&) = delete;
+
+  // Needs sokol set up. The buffer is bound as a vertex buffer.
+  bool init(size_t capacity);
+  void shutdown();
+
+  void beginFrame();
+  // Returns nullptr when the allocation doesn't fit. The memory stays valid until the next allocate() or flush().
+  void *allocate(size_t size, uint32_t &offset);
+  template <typename T>
+  T *allocate(size_t count, uint32_t &offset) {
+    return static_cast<T *>(allocate(count * sizeof(T), offset));
+  }
+  // Uploads the allocations made since the last flush, before the draws using them are submitted
+  void flush();
+
+  sg_buffer getBuffer() const { return buffer_; }
+  const FrameAllocatorStats &getStats() const { return stats_; }
+
+ private:
+  const char *label_;
+  sg_buffer buffer_;
+  std::vector<uint8_t> staging_;
+  size_t used_;       // bytes allocated this frame
+  size_t flushed_;    // bytes appended to the GPU buffer this frame
+  size_t requested_;  // bytes asked for this frame, refused allocations included
+  uint32_t allocations_;
+  uint32_t appends_;
+  uint32_t failed_;
+  FrameAllocatorStats stats_;
+
+  void createBuffer(size_t capacity);
+};
@@ -0,0 +1,543 @@
+#include "frame_capture.h"
+
+#ifndef SOKOL_DUMMY_BACKEND
+#include <glad/glad.h>
+#endif
+
+#include <sokol_gfx.h>
+#include <sokol_time.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "frame_log.h"
+#include "profiler.h"
+
+// How long stop() waits for a readback still on the GPU
+static constexpr uint64_t stop_wait_ns = 1000000000ull;
+static constexpr size_t file_buffer_size = 1 << 20;
+
+// CRC-32 as PNG uses it, eight table lookups per eight bytes
+namespace {
+struct Crc32Tables {
+  uint32_t table[8][256];
+
+  Crc32Tables() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (int t = 1; t < 8; ++t) {
+        table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xff];
+      }
+    }
+  }
+};
+}  // namespace
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size) {
+  static const Crc32Tables tables;
+  const auto &t = tables.table;
+  crc = ~crc;
+  for (; size >= 8; size -= 8, data += 8) {
+    uint32_t low;
+    uint32_t high;
+    std::memcpy(&low, data, 4);
+    std::memcpy(&high, data + 4, 4);
+    low ^= crc;
+    crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+          t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+  }
+  for (; size > 0; --size) {
+    crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t size) {
+  // 5552 bytes is the most that can be summed before the 32 bit sums could overflow
+  uint32_t a = adler & 0xffff;
+  uint32_t b = adler >> 16;
+  while (size > 0) {
+    const size_t block = std::min<size_t>(size, 5552);
+    for (size_t i = 0; i < block; ++i) {
+      a += data[i];
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+    data += block;
+    size -= block;
+  }
+  return (b << 16) | a;
+}
+
+static void put_u32_be(std::vector<uint8_t> &out, uint32_t value) {
+  const uint8_t bytes[4] = {static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16),
+                            static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)};
+  out.insert(out.end(), bytes, bytes + 4);
+}
+
+// Appends a PNG chunk whose data is out[data_start, end) preceded by the length and type reserved at data_start - 8
+static void finish_chunk(std::vector<uint8_t> &out, size_t data_start) {
+  const uint32_t length = static_cast<uint32_t>(out.size() - data_start);
+  for (int i = 0; i < 4; ++i) {
+    out[data_start - 8 + i] = static_cast<uint8_t>(length >> (24 - 8 * i));
+  }
+  put_u32_be(out, crc32_update(0, out.data() + data_start - 4, length + 4));
+}
+
+static size_t begin_chunk(std::vector<uint8_t> &out, const char *type) {
+  put_u32_be(out, 0);
+  out.insert(out.end(), type, type + 4);
+  return out.size();
+}
+
+FrameCapture::FrameCapture()
+    : format_(CaptureFormat::PngSequence),
+      fps_(60),
+      active_(false),
+      gl_buffers_(false),
+      next_frame_(0),
+      frames_read_(0),
+      frames_dropped_(0),
+      stopping_(false),
+      stream_(nullptr),
+      stream_width_(0),
+      stream_height_(0),
+      frames_written_(0),
+      bytes_written_(0),
+      last_write_us_(0),
+      writer_dropped_(0) {}
+
+FrameCapture::~FrameCapture() { stop(); }
+
+bool FrameCapture::start(const std::string &path, CaptureFormat format, int fps) {
+  if (active_) {
+    stop();
+  }
+
+  if (format == CaptureFormat::Y4m) {
+    stream_ = std::fopen(path.c_str(), "wb");
+    if (!stream_) {
+      SPDLOG_ERROR("Can't open {} for frame capture", path);
+      return false;
+    }
+    std::setvbuf(stream_, nullptr, _IOFBF, file_buffer_size);
+    stream_width_ = 0;
+    stream_height_ = 0;
+  }
+
+#ifndef SOKOL_DUMMY_BACKEND
+  if (sg_isvalid() && sg_query_backend() == SG_BACKEND_GLCORE) {
+    for (Slot &slot : slots_) {
+      glGenBuffers(1, &slot.buffer);
+      slot.buffer_size = 0;
+    }
+    gl_buffers_ = true;
+  }
+#endif
+
+  format_ = format;
+  path_ = path;
+  fps_ = std::max(fps, 1);
+  next_frame_ = 0;
+  frames_read_ = 0;
+  frames_dropped_ = 0;
+  frames_written_ = 0;
+  bytes_written_ = 0;
+  last_write_us_ = 0;
+  writer_dropped_ = 0;
+  stopping_ = false;
+  writer_ = std::thread(&FrameCapture::writerLoop, this);
+  active_ = true;
+  SPDLOG_INFO("Capturing frames to {} as {}", path, format == CaptureFormat::Y4m ? "Y4M" : "PNG");
+  return true;
+}
+
+void FrameCapture::stop() {
+  if (!active_) {
+    return;
+  }
+
+  queueFinishedReadbacks(true);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  writer_.join();
+  reclaimSlots();
+
+#ifndef SOKOL_DUMMY_BACKEND
+  if (gl_buffers_) {
+    for (Slot &slot : slots_) {
+      if (slot.fence) {
+        glDeleteSync(static_cast<GLsync>(slot.fence));
+        slot.fence = nullptr;
+      }
+      glDeleteBuffers(1, &slot.buffer);
+      slot.buffer = 0;
+      slot.buffer_size = 0;
+      slot.state = SlotState::Free;
+    }
+    gl_buffers_ = false;
+    sg_reset_state_cache();
+  }
+#endif
+
+  if (stream_) {
+    std::fclose(stream_);
+    stream_ = nullptr;
+  }
+  active_ = false;
+
+  const FrameCaptureStats stats = getStats();
+  SPDLOG_INFO("Frame capture to {} stopped: {} frames written, {} dropped, {:.1f} MiB", path_, stats.frames_written,
+              stats.frames_dropped, static_cast<double>(stats.bytes_written) / 1048576.0);
+}
+
+FrameCaptureStats FrameCapture::getStats() const {
+  FrameCaptureStats stats;
+  stats.frames_read = frames_read_;
+  stats.frames_written = frames_written_.load(std::memory_order_relaxed);
+  stats.frames_dropped = frames_dropped_ + writer_dropped_.load(std::memory_order_relaxed);
+  stats.bytes_written = bytes_written_.load(std::memory_order_relaxed);
+  stats.last_write_ms = static_cast<double>(last_write_us_.load(std::memory_order_relaxed)) / 1000.0;
+  return stats;
+}
+
+void FrameCapture::readFramebuffer(int width, int height) {
+  if (!active_ || !gl_buffers_ || width <= 0 || height <= 0) {
+    return;
+  }
+  MATFX_PROFILE_ZONE("FrameCapture::readFramebuffer");
+  reclaimSlots();
+  queueFinishedReadbacks(false);
+
+  Slot *slot = acquireSlot();
+  if (!slot) {
+    frames_dropped_++;
+    MATFX_LOG_DEBUG("Frame capture dropped a frame, all {} slots busy", slot_count);
+    return;
+  }
+
+#ifndef SOKOL_DUMMY_BACKEND
+  const size_t stride = static_cast<size_t>(width) * 4;
+  const size_t size = stride * height;
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+  if (slot->buffer_size != size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(size), nullptr, GL_STREAM_READ);
+    slot->buffer_size = size;
+  }
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  sg_reset_state_cache();
+
+  slot->width = width;
+  slot->height = height;
+  slot->stride = stride;
+  slot->bottom_up = true;
+  slot->frame = next_frame_++;
+  slot->state.store(SlotState::Reading, std::memory_order_relaxed);
+  frames_read_++;
+#endif
+}
+
+void FrameCapture::submitImage(const uint32_t *pixels, int width, int height, size_t stride) {
+  if (!active_ || width <= 0 || height <= 0) {
+    return;
+  }
+  MATFX_PROFILE_ZONE("FrameCapture::submitImage");
+  reclaimSlots();
+
+  Slot *slot = acquireSlot();
+  if (!slot) {
+    frames_dropped_++;
+    return;
+  }
+
+  const size_t row_bytes = static_cast<size_t>(width) * 4;
+  slot->image.resize(row_bytes * height);
+  for (int y = 0; y < height; ++y) {
+    std::memcpy(slot->image.data() + y * row_bytes, pixels + y * stride, row_bytes);
+  }
+  slot->pixels = slot->image.data();
+  slot->width = width;
+  slot->height = height;
+  slot->stride = row_bytes;
+  slot->bottom_up = false;
+  slot->frame = next_frame_++;
+  frames_read_++;
+  queue(*slot);
+}
+
+FrameCapture::Slot *FrameCapture::acquireSlot() {
+  for (Slot &slot : slots_) {
+    if (slot.state.load(std::memory_order_acquire) == SlotState::Free) {
+      return &slot;
+    }
+  }
+  return nullptr;
+}
+
+void FrameCapture::reclaimSlots() {
+  for (Slot &slot : slots_) {
+    if (slot.state.load(std::memory_order_acquire) != SlotState::Written) {
+      continue;
+    }
+#ifndef SOKOL_DUMMY_BACKEND
+    if (slot.mapped) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+#endif
+    slot.mapped = nullptr;
+    slot.pixels = nullptr;
+    slot.state.store(SlotState::Free, std::memory_order_relaxed);
+  }
+}
+
+// Readbacks are handed over in the order they were issued, a fence that hasn't signalled yet holds back the ones
+// after it so the writer never sees frames out of order
+void FrameCapture::queueFinishedReadbacks(bool wait) {
+#ifndef SOKOL_DUMMY_BACKEND
+  if (!gl_buffers_) {
+    return;
+  }
+  while (true) {
+    Slot *oldest = nullptr;
+    for (Slot &slot : slots_) {
+      if (slot.state.load(std::memory_order_relaxed) == SlotState::Reading &&
+          (!oldest || slot.frame < oldest->frame)) {
+        oldest = &slot;
+      }
+    }
+    if (!oldest) {
+      return;
+    }
+
+    const GLsync fence = static_cast<GLsync>(oldest->fence);
+    const GLenum status = glClientWaitSync(fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? stop_wait_ns : 0);
+    if (status == GL_TIMEOUT_EXPIRED && !wait) {
+      return;
+    }
+    glDeleteSync(fence);
+    oldest->fence = nullptr;
+
+    void *mapped = nullptr;
+    if (status != GL_WAIT_FAILED && status != GL_TIMEOUT_EXPIRED) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, oldest->buffer);
+      mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(oldest->buffer_size),
+                                GL_MAP_READ_BIT);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    if (!mapped) {
+      SPDLOG_WARN("Frame capture lost frame {}, its readback could not be mapped", oldest->frame);
+      frames_dropped_++;
+      oldest->state.store(SlotState::Free, std::memory_order_relaxed);
+      continue;
+    }
+    oldest->mapped = static_cast<const uint8_t *>(mapped);
+    oldest->pixels = oldest->mapped;
+    queue(*oldest);
+  }
+#else
+  (void)wait;
+#endif
+}
+
+void FrameCapture::queue(Slot &slot) {
+  slot.state.store(SlotState::Writing, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(&slot);
+  }
+  wake_.notify_one();
+}
+
+void FrameCapture::writerLoop() {
+  MATFX_PROFILE_THREAD("capture writer");
+  while (true) {
+    Slot *slot;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this] { return !queue_.empty() || stopping_; });
+      if (queue_.empty()) {
+        return;
+      }
+      slot = queue_.front();
+      queue_.pop_front();
+    }
+
+    const uint64_t start = stm_now();
+    const bool written = format_ == CaptureFormat::Y4m ? writeY4mFrame(*slot) : writePng(*slot);
+    if (written) {
+      frames_written_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      writer_dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    last_write_us_.store(static_cast<uint64_t>(stm_us(stm_since(start))), std::memory_order_relaxed);
+    slot->state.store(SlotState::Written, std::memory_order_release);
+  }
+}
+
+// RGB, no filtering and stored deflate blocks: the checksums are the only work per byte, which keeps a 1080p frame
+// within a frame's time at the cost of files as large as the raw pixels
+bool FrameCapture::writePng(const Slot &slot) {
+  MATFX_PROFILE_ZONE("FrameCapture::writePng");
+  std::vector<uint8_t> &out = encoded_;
+  out.clear();
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  out.insert(out.end(), signature, signature + 8);
+
+  size_t chunk = begin_chunk(out, "IHDR");
+  put_u32_be(out, static_cast<uint32_t>(slot.width));
+  put_u32_be(out, static_cast<uint32_t>(slot.height));
+  const uint8_t header[5] = {8, 2, 0, 0, 0};  // 8 bits, RGB, deflate, no filtering, not interlaced
+  out.insert(out.end(), header, header + 5);
+  finish_chunk(out, chunk);
+
+  // The zlib stream is a two byte header, the rows (a filter byte each) in stored blocks of up to 65535 bytes and the
+  // Adler-32 of the rows
+  const size_t row_bytes = 1 + static_cast<size_t>(slot.width) * 3;
+  const size_t raw_size = row_bytes * slot.height;
+  const size_t block_count = std::max<size_t>((raw_size + 65534) / 65535, 1);
+  chunk = begin_chunk(out, "IDAT");
+  const size_t zlib_start = out.size();
+  out.resize(zlib_start + 2 + raw_size + block_count * 5 + 4);
+  uint8_t *cursor = out.data() + zlib_start;
+  *cursor++ = 0x78;
+  *cursor++ = 0x01;
+
+  size_t block_left = 0;
+  size_t raw_left = raw_size;
+  uint32_t adler = 1;
+  auto put = [&](const uint8_t *bytes, size_t size) {
+    adler = adler32_update(adler, bytes, size);
+    while (size > 0) {
+      if (block_left == 0) {
+        block_left = std::min<size_t>(raw_left, 65535);
+        raw_left -= block_left;
+        const uint16_t length = static_cast<uint16_t>(block_left);
+        *cursor++ = raw_left == 0 ? 1 : 0;
+        *cursor++ = static_cast<uint8_t>(length);
+        *cursor++ = static_cast<uint8_t>(length >> 8);
+        *cursor++ = static_cast<uint8_t>(~length);
+        *cursor++ = static_cast<uint8_t>(~length >> 8);
+      }
+      const size_t n = std::min(size, block_left);
+      std::memcpy(cursor, bytes, n);
+      cursor += n;
+      bytes += n;
+      size -= n;
+      block_left -= n;
+    }
+  };
+
+  std::vector<uint8_t> row(row_bytes);
+  row[0] = 0;
+  for (int y = 0; y < slot.height; ++y) {
+    const int source_y = slot.bottom_up ? slot.height - 1 - y : y;
+    const uint8_t *source = slot.pixels + source_y * slot.stride;
+    for (int x = 0; x < slot.width; ++x) {
+      std::memcpy(&row[1 + x * 3], source + x * 4, 3);
+    }
+    put(row.data(), row.size());
+  }
+  for (int i = 0; i < 4; ++i) {
+    *cursor++ = static_cast<uint8_t>(adler >> (24 - 8 * i));
+  }
+  out.resize(cursor - out.data());
+  finish_chunk(out, chunk);
+
+  chunk = begin_chunk(out, "IEND");
+  finish_chunk(out, chunk);
+
+  char suffix[32];
+  std::snprintf(suffix, sizeof(suffix), "_%06llu.png", static_cast<unsigned long long>(slot.frame));
+  const std::string file_path = path_ + suffix;
+  std::FILE *file = std::fopen(file_path.c_str(), "wb");
+  if (!file) {
+    SPDLOG_ERROR("Can't open {} for frame capture", file_path);
+    return false;
+  }
+  const bool ok = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+  std::fclose(file);
+  if (ok) {
+    bytes_written_.fetch_add(out.size(), std::memory_order_relaxed);
+  }
+  return ok;
+}
+
+// BT.601 full range, chroma averaged over 2x2 pixels
+bool FrameCapture::writeY4mFrame(const Slot &slot) {
+  MATFX_PROFILE_ZONE("FrameCapture::writeY4mFrame");
+  if (stream_width_ == 0) {
+    stream_width_ = slot.width;
+    stream_height_ = slot.height;
+    std::fprintf(stream_, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", slot.width, slot.height,
+                 fps_);
+  } else if (slot.width != stream_width_ || slot.height != stream_height_) {
+    MATFX_LOG_DEBUG("Frame capture dropped a {}x{} frame, the Y4M stream is {}x{}", slot.width, slot.height,
+                    stream_width_, stream_height_);
+    return false;
+  }
+
+  const int width = slot.width;
+  const int height = slot.height;
+  const int chroma_width = (width + 1) / 2;
+  const int chroma_height = (height + 1) / 2;
+  const size_t luma_size = static_cast<size_t>(width) * height;
+  const size_t chroma_size = static_cast<size_t>(chroma_width) * chroma_height;
+  std::vector<uint8_t> &out = encoded_;
+  out.resize(luma_size + 2 * chroma_size);
+  uint8_t *luma = out.data();
+  uint8_t *cb = luma + luma_size;
+  uint8_t *cr = cb + chroma_size;
+
+  auto row = [&](int y) {
+    return slot.pixels + (slot.bottom_up ? height - 1 - y : y) * slot.stride;
+  };
+  for (int y = 0; y < height; ++y) {
+    const uint8_t *source = row(y);
+    uint8_t *destination = luma + static_cast<size_t>(y) * width;
+    for (int x = 0; x < width; ++x) {
+      const int r = source[x * 4], g = source[x * 4 + 1], b = source[x * 4 + 2];
+      destination[x] = static_cast<uint8_t>((77 * r + 150 * g + 29 * b + 128) >> 8);
+    }
+  }
+  for (int cy = 0; cy < chroma_height; ++cy) {
+    const uint8_t *top = row(cy * 2);
+    const uint8_t *bottom = row(std::min(cy * 2 + 1, height - 1));
+    for (int cx = 0; cx < chroma_width; ++cx) {
+      const int x0 = cx * 8;
+      const int x1 = std::min(cx * 2 + 1, width - 1) * 4;
+      const int r = top[x0] + top[x1] + bottom[x0] + bottom[x1];
+      const int g = top[x0 + 1] + top[x1 + 1] + bottom[x0 + 1] + bottom[x1 + 1];
+      const int b = top[x0 + 2] + top[x1 + 2] + bottom[x0 + 2] + bottom[x1 + 2];
+      // The sums are four pixels, hence the extra shift by 2
+      const int u = ((-43 * r - 85 * g + 128 * b + 512) >> 10) + 128;
+      const int v = ((128 * r - 107 * g - 21 * b + 512) >> 10) + 128;
+      cb[cy * chroma_width + cx] = static_cast<uint8_t>(std::clamp(u, 0, 255));
+      cr[cy * chroma_width + cx] = static_cast<uint8_t>(std::clamp(v, 0, 255));
+    }
+  }
+
+  static const char frame_header[] = "FRAME\n";
+  const bool ok = std::fwrite(frame_header, 1, sizeof(frame_header) - 1, stream_) == sizeof(frame_header) - 1 &&
+                  std::fwrite(out.data(), 1, out.size(), stream_) == out.size();
+  if (ok) {
+    bytes_written_.fetch_add(out.size() + sizeof(frame_header) - 1, std::memory_order_relaxed);
+  }
+  return ok;
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class CaptureFormat : uint8_t {
+  PngSequence,  // one PNG per frame, the frame number appended to the path: capture -> capture_000000.png
+  Y4m,          // a single YUV4MPEG2 stream, 4:2:0 full range, as ffmpeg and most players read it
+};
+
+struct FrameCaptureStats {
+  uint64_t frames_read = 0;     // readbacks started or images submitted
+  uint64_t frames_written = 0;  // encoded and written by the writer thread
+  uint64_t frames_dropped = 0;  // no free slot, or a Y4M frame whose size differs from the stream's
+  uint64_t bytes_written = 0;
+  double last_write_ms = 0.0;   // writer thread time of the last frame
+};
+
+// Captures rendered frames to disk without the render thread ever waiting on the GPU or the file system.
+//
+//   readFramebuffer()   glReadPixels into a free pixel pack buffer and a fence behind it, returns right away
+//   later frames        a signalled fence's buffer is mapped and queued for the writer, oldest first
+//   writer thread       encodes straight out of the mapped buffer and writes the file
+//   later frames        a written buffer is unmapped and free again
+//
+// A frame takes a slot from readback until it is written; when all slot_count slots are busy the frame is dropped
+// rather than waited for. submitImage() feeds CPU images (SoftwareRenderer's) through the same writer, they are copied
+// into the slot.
+//
+// All calls except the writer's own work happen on the thread owning the GL context. The GL side does nothing on the
+// dummy backend.
+class FrameCapture {
+ public:
+  static constexpr size_t slot_count = 4;
+
+  FrameCapture();
+  ~FrameCapture();
+
+  FrameCapture(const FrameCapture &) = delete;
+  FrameCapture &operator=(const FrameCapture &) = delete;
+  FrameCapture(FrameCapture &&) = delete;
+  FrameCapture &operator=(FrameCapture &&) = delete;
+
+  // Opens the output and starts the writer. fps only goes into the Y4M header.
+  bool start(const std::string &path, CaptureFormat format, int fps = 60);
+  // Waits for every frame in flight, writes it and stops the writer. Needs the GL context still current.
+  void stop();
+  bool isActive() const { return active_; }
+
+  // Call after Renderer::endFrame() and before the swap, reads back the default framebuffer
+  void readFramebuffer(int width, int height);
+  // RGBA8 rows stride pixels apart, top row first
+  void submitImage(const uint32_t *pixels, int width, int height, size_t stride);
+
+  FrameCaptureStats getStats() const;
+
+ private:
+  enum class SlotState : uint8_t { Free, Reading, Writing, Written };
+
+  struct Slot {
+    std::atomic<SlotState> state{SlotState::Free};
+    uint32_t buffer = 0;   // GL pixel pack buffer
+    size_t buffer_size = 0;
+    void *fence = nullptr;  // GLsync of the readback
+    const uint8_t *mapped = nullptr;
+    std::vector<uint8_t> image;  // copy of a submitted CPU image
+    const uint8_t *pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    size_t stride = 0;  // bytes
+    bool bottom_up = false;
+    uint64_t frame = 0;
+  };
+
+  std::array<Slot, slot_count> slots_;
+  CaptureFormat format_;
+  std::string path_;
+  int fps_;
+  bool active_;
+  bool gl_buffers_;
+  uint64_t next_frame_;
+  uint64_t frames_read_;
+  uint64_t frames_dropped_;
+
+  // Writer thread state
+  std::thread writer_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<Slot *> queue_;
+  bool stopping_;
+  std::FILE *stream_;
+  int stream_width_;
+  int stream_height_;
+  std::vector<uint8_t> encoded_;
+  std::atomic<uint64_t> frames_written_;
+  std::atomic<uint64_t> bytes_written_;
+  std::atomic<uint64_t> last_write_us_;
+  std::atomic<uint64_t> writer_dropped_;
+
+  Slot *acquireSlot();
+  void reclaimSlots();
+  void queueFinishedReadbacks(bool wait);
+  void queue(Slot &slot);
+  void writerLoop();
+  bool writePng(const Slot &slot);
+  bool writeY4mFrame(const Slot &slot);
+};
@@ -0,0 +1,356 @@
+#include "frame_log.h"
+
+#include <spdlog/fmt/bundled/args.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+std::atomic<bool> FrameLog::running_{false};
+std::atomic<uint64_t> FrameLog::frame_{0};
+std::atomic<uint32_t> FrameLog::rate_limit_{10};
+
+namespace {
+
+constexpr uint64_t rate_window_ns = 1000000000;
+
+uint64_t now_ns() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// Single producer (the owning thread), single consumer (the drain thread)
+struct LogRing {
+  std::unique_ptr<LogRecord[]> records{new LogRecord[FrameLog::ring_capacity]};
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> tail{0};
+  std::atomic<bool> writing{false};  // the owner is between beginRecord() and the end of its write
+};
+
+struct LogState {
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::vector<std::unique_ptr<LogRing>> rings;
+  std::atomic<uint64_t> dropped{0};
+
+  std::thread drain;
+  bool stopping = false;
+  FrameLogSink sink = FrameLogSink::Spdlog;
+  std::FILE *file = nullptr;
+  std::unordered_set<const LogSite *> sites_written;
+};
+
+// Never destroyed: threads may still log while static destructors run
+LogState &state() {
+  static LogState *instance = new LogState();
+  return *instance;
+}
+
+thread_local LogRing *t_ring = nullptr;
+
+LogRing &thread_ring() {
+  if (!t_ring) {
+    LogState &s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.rings.push_back(std::make_unique<LogRing>());
+    t_ring = s.rings.back().get();
+  }
+  return *t_ring;
+}
+
+template <typename T>
+T read_arg(const unsigned char *&cursor) {
+  T value;
+  std::memcpy(&value, cursor, sizeof(T));
+  cursor += sizeof(T);
+  return value;
+}
+
+std::string format_record(const LogRecord &record) {
+  fmt::dynamic_format_arg_store<fmt::format_context> store;
+  const unsigned char *cursor = record.args;
+  for (uint8_t i = 0; i < record.arg_count; ++i) {
+    switch (static_cast<LogArgType>(*cursor++)) {
+      case LogArgType::Int:
+        store.push_back(read_arg<int64_t>(cursor));
+        break;
+      case LogArgType::UInt:
+        store.push_back(read_arg<uint64_t>(cursor));
+        break;
+      case LogArgType::Double:
+        store.push_back(read_arg<double>(cursor));
+        break;
+      case LogArgType::Bool:
+        store.push_back(read_arg<uint8_t>(cursor) != 0);
+        break;
+      case LogArgType::String: {
+        const uint16_t length = read_arg<uint16_t>(cursor);
+        store.push_back(std::string(reinterpret_cast<const char *>(cursor), length));
+        cursor += length;
+        break;
+      }
+      case LogArgType::Pointer:
+        store.push_back(reinterpret_cast<const void *>(static_cast<uintptr_t>(read_arg<uint64_t>(cursor))));
+        break;
+    }
+  }
+
+  try {
+    return fmt::vformat(record.site->format, store);
+  } catch (const fmt::format_error &) {
+    // Arguments that didn't fit the record leave the format short
+    return record.site->format;
+  }
+}
+
+void write_binary(LogState &s, const LogRecord &record) {
+  const LogSite &site = *record.site;
+  if (s.sites_written.insert(&site).second) {
+    const uint64_t id = reinterpret_cast<uintptr_t>(&site);
+    const uint8_t level = static_cast<uint8_t>(site.level);
+    const uint32_t line = static_cast<uint32_t>(site.line);
+    const uint16_t file_length = static_cast<uint16_t>(std::strlen(site.file));
+    const uint16_t format_length = static_cast<uint16_t>(std::strlen(site.format));
+    std::fputc('S', s.file);
+    std::fwrite(&id, sizeof(id), 1, s.file);
+    std::fwrite(&level, sizeof(level), 1, s.file);
+    std::fwrite(&line, sizeof(line), 1, s.file);
+    std::fwrite(&file_length, sizeof(file_length), 1, s.file);
+    std::fwrite(site.file, 1, file_length, s.file);
+    std::fwrite(&format_length, sizeof(format_length), 1, s.file);
+    std::fwrite(site.format, 1, format_length, s.file);
+  }
+
+  const uint64_t id = reinterpret_cast<uintptr_t>(&site);
+  std::fputc('E', s.file);
+  std::fwrite(&id, sizeof(id), 1, s.file);
+  std::fwrite(&record.frame, sizeof(record.frame), 1, s.file);
+  std::fwrite(&record.time, sizeof(record.time), 1, s.file);
+  std::fwrite(&record.suppressed, sizeof(record.suppressed), 1, s.file);
+  std::fwrite(&record.arg_count, sizeof(record.arg_count), 1, s.file);
+  std::fwrite(record.args, 1, record.arg_bytes, s.file);
+}
+
+void write_spdlog(const LogRecord &record) {
+  const LogSite &site = *record.site;
+  spdlog::logger *logger = spdlog::default_logger_raw();
+  if (!logger->should_log(site.level)) {
+    return;
+  }
+
+  const spdlog::source_loc location{site.file, site.line, site.function};
+  if (record.suppressed > 0) {
+    logger->log(location, site.level, "[frame {}] {} ({} similar messages suppressed)", record.frame,
+                format_record(record), record.suppressed);
+  } else {
+    logger->log(location, site.level, "[frame {}] {}", record.frame, format_record(record));
+  }
+}
+
+size_t drain_ring(LogState &s, LogRing &ring) {
+  const uint64_t head = ring.head.load(std::memory_order_acquire);
+  uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+  const size_t count = static_cast<size_t>(head - tail);
+  for (; tail != head; ++tail) {
+    const LogRecord &record = ring.records[tail % FrameLog::ring_capacity];
+    if (s.sink == FrameLogSink::Binary) {
+      write_binary(s, record);
+    } else {
+      write_spdlog(record);
+    }
+    ring.tail.store(tail + 1, std::memory_order_release);
+  }
+  return count;
+}
+
+void drain_loop(LogState &s) {
+  std::vector<LogRing *> rings;
+  bool stopping = false;
+  while (!stopping) {
+    {
+      // Producers never signal, the drain polls so logging stays free of syscalls
+      std::unique_lock<std::mutex> lock(s.mutex);
+      s.wake.wait_for(lock, std::chrono::milliseconds(5), [&s] { return s.stopping; });
+      stopping = s.stopping;
+      rings.clear();
+      for (const std::unique_ptr<LogRing> &ring : s.rings) {
+        rings.push_back(ring.get());
+      }
+    }
+
+    size_t drained = 0;
+    for (LogRing *ring : rings) {
+      drained += drain_ring(s, *ring);
+    }
+    if (drained > 0) {
+      if (s.file) {
+        std::fflush(s.file);
+      } else {
+        spdlog::default_logger_raw()->flush();
+      }
+    }
+  }
+}
+
+}  // namespace
+
+bool LogRateLimiter::allow(uint32_t limit, uint32_t &suppressed) {
+  if (limit > 0) {
+    const uint64_t now = now_ns();
+    uint64_t start = window_start_.load(std::memory_order_relaxed);
+    if (now - start >= rate_window_ns &&
+        window_start_.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+      count_.store(0, std::memory_order_relaxed);
+    }
+    if (count_.fetch_add(1, std::memory_order_relaxed) >= limit) {
+      suppressed_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+
+  suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+  return true;
+}
+
+bool FrameLog::start(FrameLogSink sink, const std::string &path) {
+  LogState &s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if (running_.load()) {
+    return false;
+  }
+
+  if (sink == FrameLogSink::Binary) {
+    s.file = std::fopen(path.c_str(), "wb");
+    if (!s.file) {
+      SPDLOG_ERROR("Failed to open frame log {}", path);
+      return false;
+    }
+    std::fputs("MFXLOG1\n", s.file);
+    s.sites_written.clear();
+  }
+
+  s.sink = sink;
+  s.stopping = false;
+  s.drain = std::thread(drain_loop, std::ref(s));
+  running_.store(true);
+  return true;
+}
+
+void FrameLog::stop() {
+  LogState &s = state();
+  std::vector<const LogRing *> rings;
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (!running_.load()) {
+      return;
+    }
+    // New messages take the synchronous path from here on. Rings registered later belong to threads that will see
+    // that, the ones already there may hold a writer that saw the log running and still commits.
+    running_.store(false);
+    for (const std::unique_ptr<LogRing> &ring : s.rings) {
+      rings.push_back(ring.get());
+    }
+  }
+
+  // The drain's last pass has to come after those commits
+  for (const LogRing *ring : rings) {
+    while (ring->writing.load()) {
+      std::this_thread::yield();
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.stopping = true;
+  }
+  s.wake.notify_all();
+  s.drain.join();
+
+  if (s.file) {
+    std::fclose(s.file);
+    s.file = nullptr;
+  }
+
+  const uint64_t dropped = s.dropped.load();
+  if (dropped > 0) {
+    SPDLOG_WARN("Frame log dropped {} messages on full rings", dropped);
+  }
+}
+
+uint64_t FrameLog::getDroppedCount() { return state().dropped.load(std::memory_order_relaxed); }
+
+bool FrameLog::beginRecord() {
+  // Sequentially consistent on both sides: either stop() sees the flag and waits, or this sees the log stopped
+  LogRing &ring = thread_ring();
+  ring.writing.store(true);
+  if (running_.load()) {
+    return true;
+  }
+  ring.writing.store(false, std::memory_order_relaxed);
+  return false;
+}
+
+LogRecord *FrameLog::acquireRecord() {
+  LogRing &ring = *t_ring;
+  const uint64_t head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) >= ring_capacity) {
+    state().dropped.fetch_add(1, std::memory_order_relaxed);
+    ring.writing.store(false, std::memory_order_release);
+    return nullptr;
+  }
+
+  LogRecord *record = &ring.records[head % ring_capacity];
+  record->time = now_ns();
+  return record;
+}
+
+void FrameLog::commitRecord() {
+  LogRing &ring = *t_ring;
+  ring.head.store(ring.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  ring.writing.store(false, std::memory_order_release);
+}
+
+void FrameLog::writeSync(const LogSite &site, uint32_t suppressed, const std::string &message) {
+  const spdlog::source_loc location{site.file, site.line, site.function};
+  if (suppressed > 0) {
+    spdlog::default_logger_raw()->log(location, site.level, "{} ({} similar messages suppressed)", message,
+                                      suppressed);
+  } else {
+    spdlog::default_logger_raw()->log(location, site.level, "{}", message);
+  }
+}
+
+void FrameLog::ArgWriter::putRaw(LogArgType type, const void *data, size_t bytes) {
+  if (record_.arg_bytes + 1 + bytes > LogRecord::arg_capacity) {
+    return;
+  }
+  unsigned char *cursor = record_.args + record_.arg_bytes;
+  *cursor = static_cast<uint8_t>(type);
+  std::memcpy(cursor + 1, data, bytes);
+  record_.arg_bytes = static_cast<uint16_t>(record_.arg_bytes + 1 + bytes);
+  record_.arg_count++;
+}
+
+void FrameLog::ArgWriter::putString(std::string_view value) {
+  const size_t space = LogRecord::arg_capacity - record_.arg_bytes;
+  if (space < 1 + sizeof(uint16_t)) {
+    return;
+  }
+  const uint16_t length =
+      static_cast<uint16_t>(std::min({value.size(), FrameLog::max_string, space - 1 - sizeof(uint16_t)}));
+
+  unsigned char *cursor = record_.args + record_.arg_bytes;
+  *cursor = static_cast<uint8_t>(LogArgType::String);
+  std::memcpy(cursor + 1, &length, sizeof(length));
+  std::memcpy(cursor + 1 + sizeof(length), value.data(), length);
+  record_.arg_bytes = static_cast<uint16_t>(record_.arg_bytes + 1 + sizeof(length) + length);
+  record_.arg_count++;
+}
@@ -0,0 +1,208 @@
+#pragma once
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Logging for the frame loop. A MATFX_LOG_* call copies its call site pointer, the frame number and its raw
+// arguments into a fixed-size slot of the calling thread's ring; formatting and output happen on a drain thread.
+// When the ring is full the record is dropped and counted, the caller never waits.
+//
+// Each call site is rate limited: past rate_limit messages per second the rest of that second is dropped and the
+// next message that gets through reports how many were suppressed.
+//
+// Output goes to the default spdlog logger, or to a binary file holding one record per message and one site record
+// the first time a call site shows up, all little endian:
+//   file:   "MFXLOG1\n" { record }
+//   site:   'S' u64 id, u8 level, u32 line, u16 length, file, u16 length, format
+//   event:  'E' u64 site id, u64 frame, u64 time_ns, u32 suppressed, u8 arg_count, args
+//   arg:    u8 type (LogArgType), then i64 / u64 / f64 / u64 pointer, or u16 length and bytes for strings
+//
+// Before start() and after stop() the macros format synchronously through spdlog, still rate limited.
+enum class LogArgType : uint8_t { Int, UInt, Double, Bool, String, Pointer };
+
+class LogRateLimiter {
+ public:
+  // Returns false when the message is to be dropped; otherwise suppressed is set to the number dropped before it.
+  // A limit of 0 lets everything through.
+  bool allow(uint32_t limit, uint32_t &suppressed);
+
+ private:
+  std::atomic<uint64_t> window_start_{0};
+  std::atomic<uint32_t> count_{0};
+  std::atomic<uint32_t> suppressed_{0};
+};
+
+struct LogSite {
+  spdlog::level::level_enum level;
+  const char *format;
+  const char *file;
+  int line;
+  const char *function;
+  LogRateLimiter limiter;
+};
+
+struct LogRecord {
+  static constexpr size_t size = 192;
+  static constexpr size_t arg_capacity = size - 32;  // everything but the header fields below
+
+  const LogSite *site;
+  uint64_t frame;
+  uint64_t time;
+  uint32_t suppressed;
+  uint16_t arg_bytes;
+  uint8_t arg_count;
+  uint8_t padding;
+  unsigned char args[arg_capacity];
+};
+static_assert(sizeof(LogRecord) == LogRecord::size);
+
+enum class FrameLogSink { Spdlog, Binary };
+
+class FrameLog {
+ public:
+  static constexpr size_t ring_capacity = 4096;  // records per thread
+  static constexpr size_t max_string = 96;       // longer string arguments are truncated
+
+  static bool start(FrameLogSink sink = FrameLogSink::Spdlog, const std::string &path = {});
+  static void stop();
+  static bool isRunning() { return running_.load(std::memory_order_relaxed); }
+
+  // Tags every following record with this frame number
+  static void setFrame(uint64_t frame) { frame_.store(frame, std::memory_order_relaxed); }
+  static void setRateLimit(uint32_t messages_per_second) { rate_limit_.store(messages_per_second); }
+
+  static uint64_t getDroppedCount();
+
+  template <typename... Args>
+  static void write(LogSite &site, const Args &...args);
+
+ private:
+  static std::atomic<bool> running_;
+  static std::atomic<uint64_t> frame_;
+  static std::atomic<uint32_t> rate_limit_;
+
+  // Enums are logged as their underlying value on both paths
+  template <typename T>
+  static decltype(auto) formatArg(const T &value) {
+    if constexpr (std::is_enum_v<T>) {
+      return static_cast<std::underlying_type_t<T>>(value);
+    } else {
+      return (value);
+    }
+  }
+
+  // Marks the calling thread as writing to its ring if the log is running, stop() waits for such writers
+  static bool beginRecord();
+  // Null when the ring is full, the record is then counted as dropped and the write is over
+  static LogRecord *acquireRecord();
+  static void commitRecord();
+  static void writeSync(const LogSite &site, uint32_t suppressed, const std::string &message);
+
+  class ArgWriter {
+   public:
+    explicit ArgWriter(LogRecord &record) : record_(record) {}
+
+    template <typename T>
+    void put(const T &value);
+
+   private:
+    LogRecord &record_;
+
+    void putRaw(LogArgType type, const void *data, size_t bytes);
+    void putString(std::string_view value);
+  };
+};
+
+template <typename T>
+void FrameLog::ArgWriter::put(const T &value) {
+  using Type = std::decay_t<T>;
+  if constexpr (std::is_same_v<Type, bool>) {
+    const uint8_t raw = value ? 1 : 0;
+    putRaw(LogArgType::Bool, &raw, sizeof(raw));
+  } else if constexpr (std::is_enum_v<Type>) {
+    put(static_cast<std::underlying_type_t<Type>>(value));
+  } else if constexpr (std::is_integral_v<Type> && std::is_signed_v<Type>) {
+    const int64_t raw = value;
+    putRaw(LogArgType::Int, &raw, sizeof(raw));
+  } else if constexpr (std::is_integral_v<Type>) {
+    const uint64_t raw = value;
+    putRaw(LogArgType::UInt, &raw, sizeof(raw));
+  } else if constexpr (std::is_floating_point_v<Type>) {
+    const double raw = value;
+    putRaw(LogArgType::Double, &raw, sizeof(raw));
+  } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+    putString(std::string_view(value));
+  } else if constexpr (std::is_pointer_v<Type>) {
+    const uint64_t raw = reinterpret_cast<uintptr_t>(value);
+    putRaw(LogArgType::Pointer, &raw, sizeof(raw));
+  } else {
+    static_assert(sizeof(Type) == 0, "MATFX_LOG arguments must be numbers, strings, enums or pointers");
+  }
+}
+
+template <typename... Args>
+void FrameLog::write(LogSite &site, const Args &...args) {
+  uint32_t suppressed = 0;
+  if (!site.limiter.allow(rate_limit_.load(std::memory_order_relaxed), suppressed)) {
+    return;
+  }
+
+  if (!isRunning() || !beginRecord()) {
+    writeSync(site, suppressed, fmt::format(fmt::runtime(site.format), formatArg(args)...));
+    return;
+  }
+
+  LogRecord *record = acquireRecord();
+  if (!record) {
+    return;
+  }
+  record->site = &site;
+  record->frame = frame_.load(std::memory_order_relaxed);
+  record->suppressed = suppressed;
+  record->arg_bytes = 0;
+  record->arg_count = 0;
+  ArgWriter writer(*record);
+  (writer.put(args), ...);
+  commitRecord();
+}
+
+#define MATFX_LOG_SITE(lvl, format, ...)                                                              \
+  do {                                                                                                \
+    static LogSite matfx_log_site{lvl, format, __FILE__, __LINE__, __func__, {}};                     \
+    FrameLog::write(matfx_log_site __VA_OPT__(, ) __VA_ARGS__);                                       \
+  } while (0)
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
+#define MATFX_LOG_TRACE(...) MATFX_LOG_SITE(spdlog::level::trace, __VA_ARGS__)
+#else
+#define MATFX_LOG_TRACE(...) ((void)0)
+#endif
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define MATFX_LOG_DEBUG(...) MATFX_LOG_SITE(spdlog::level::debug, __VA_ARGS__)
+#else
+#define MATFX_LOG_DEBUG(...) ((void)0)
+#endif
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_INFO
+#define MATFX_LOG_INFO(...) MATFX_LOG_SITE(spdlog::level::info, __VA_ARGS__)
+#else
+#define MATFX_LOG_INFO(...) ((void)0)
+#endif
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_WARN
+#define MATFX_LOG_WARN(...) MATFX_LOG_SITE(spdlog::level::warn, __VA_ARGS__)
+#else
+#define MATFX_LOG_WARN(...) ((void)0)
+#endif
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_ERROR
+#define MATFX_LOG_ERROR(...) MATFX_LOG_SITE(spdlog::level::err, __VA_ARGS__)
+#else
+#define MATFX_LOG_ERROR(...) ((void)0)
+#endif
@@ -0,0 +1,54 @@
+#include "frame_pacer.h"
+
+#include <sokol_time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "profiler.h"
+
+void FramePacer::wait() {
+  MATFX_PROFILE_ZONE("FramePacer::wait");
+  const uint64_t now = stm_now();
+  if (period_ > 0.0 && frame_start_ != 0) {
+    const uint64_t period = static_cast<uint64_t>(period_ * 1e9);
+    uint64_t wake = frame_start_ + period;
+    if (low_latency_ && presented_ != 0) {
+      // The swap returns at a vblank, the next one follows a period later. Starting later than the plain limiter
+      // would is the point, so its wake up time doesn't bound this one.
+      const uint64_t lead = static_cast<uint64_t>((work_estimate_ms_ + margin_ms) * 1e6);
+      const uint64_t next_vblank = presented_ + period;
+      wake = next_vblank > lead ? next_vblank - lead : 0;
+    }
+    if (wake > now) {
+      waitUntil(wake);
+    }
+  }
+  frame_start_ = stm_now();
+}
+
+void FramePacer::markInputSampled() { input_sampled_ = stm_now(); }
+
+void FramePacer::markSubmitted() { submitted_ = stm_now(); }
+
+void FramePacer::markPresented() {
+  presented_ = stm_now();
+  input_to_present_ms_ = stm_ms(stm_diff(presented_, input_sampled_));
+
+  // Rise at once and decay slowly, a single slow frame should push the start earlier for a while
+  const uint64_t submitted = submitted_ > frame_start_ ? submitted_ : presented_;
+  const double work_ms = stm_ms(stm_diff(submitted, frame_start_)) + gpu_ms_;
+  work_estimate_ms_ = std::max(work_ms, work_estimate_ms_ * 0.95 + work_ms * 0.05);
+}
+
+void FramePacer::waitUntil(uint64_t deadline) {
+  const uint64_t now = stm_now();
+  const double sleep_ms = stm_ms(stm_diff(deadline, now)) - spin_ms;
+  if (sleep_ms > 0.0) {
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(sleep_ms));
+  }
+  while (stm_now() < deadline) {
+    std::this_thread::yield();
+  }
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+
+// Frame limiter for the render loop. wait() at the top of a frame sleeps until the frame should start, the caller
+// then samples input, builds and submits the frame, and reports the edges with markInputSampled(), markSubmitted()
+// and markPresented().
+//
+// Plain limiting starts frames one period apart. In low latency mode the start is pushed as late as possible instead:
+// the predicted next vblank (one period after the last present) minus the frame's work and a safety margin, so input
+// is sampled just before the work that depends on it and the frame still makes that vblank. The work is the CPU time
+// from frame start to the end of submission plus the GPU time reported by setGpuFrameMs(), never the time spent
+// blocked on the swap: that includes the wait for vblank and would pull every start back to right after it. Sleeping
+// stops spin_ms short of the wake up time and the rest is spun, OS sleeps overshoot by too much to hit the deadline
+// otherwise.
+class FramePacer {
+ public:
+  static constexpr double spin_ms = 1.0;
+  static constexpr double margin_ms = 1.0;
+
+  // A period of 0 disables the limiter; latency is still measured
+  void setFramePeriod(double seconds) { period_ = seconds; }
+  void setLowLatency(bool enabled) { low_latency_ = enabled; }
+  bool isLowLatency() const { return low_latency_; }
+
+  void wait();
+  void markInputSampled();
+  // Once the CPU has submitted the frame, before the swap
+  void markSubmitted();
+  void markPresented();
+  // GPU time of a recent frame, e.g. GpuFrameTiming::total_ms; it may lag a few frames behind
+  void setGpuFrameMs(double ms) { gpu_ms_ = ms; }
+
+  // Input sample to present of the last frame. Only as accurate as the present mark, which needs the swap to have
+  // completed (see Renderer::waitIdle()) to mean anything.
+  double getInputToPresentMs() const { return input_to_present_ms_; }
+  double getWorkEstimateMs() const { return work_estimate_ms_; }
+
+ private:
+  double period_ = 0.0;
+  bool low_latency_ = false;
+
+  uint64_t frame_start_ = 0;
+  uint64_t input_sampled_ = 0;
+  uint64_t submitted_ = 0;
+  uint64_t presented_ = 0;
+  double gpu_ms_ = 0.0;
+  double input_to_present_ms_ = 0.0;
+  double work_estimate_ms_ = 0.0;
+
+  static void waitUntil(uint64_t deadline);
+};
@@ -0,0 +1,111 @@
+#include "gpu_timer.h"
+
+#ifndef SOKOL_DUMMY_BACKEND
+#include <glad/glad.h>
+#endif
+
+#include "frame_log.h"
+
+GpuTimer::GpuTimer() : frame_(0), dropped_frames_(0), in_pass_(false), initialized_(false) {}
+
+GpuTimer::~GpuTimer() { shutdown(); }
+
+void GpuTimer::init() {
+#ifndef SOKOL_DUMMY_BACKEND
+  for (FrameQueries &frame : frames_) {
+    glGenQueries(static_cast<GLsizei>(frame.queries.size()), frame.queries.data());
+  }
+  initialized_ = true;
+#endif
+}
+
+void GpuTimer::shutdown() {
+#ifndef SOKOL_DUMMY_BACKEND
+  if (initialized_) {
+    for (FrameQueries &frame : frames_) {
+      glDeleteQueries(static_cast<GLsizei>(frame.queries.size()), frame.queries.data());
+      frame = {};
+    }
+    initialized_ = false;
+  }
+#endif
+}
+
+bool GpuTimer::collect(FrameQueries &frame) {
+#ifndef SOKOL_DUMMY_BACKEND
+  // Queries complete in order, so the last one being available means all of them are
+  GLint available = 0;
+  glGetQueryObjectiv(frame.queries[frame.pass_count - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available) {
+    return false;
+  }
+
+  GpuFrameTiming timing;
+  timing.frame = frame.frame;
+  timing.pass_count = frame.pass_count;
+  for (uint32_t i = 0; i < frame.pass_count; ++i) {
+    GLuint64 elapsed_ns = 0;
+    glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &elapsed_ns);
+    timing.passes[i] = {frame.names[i], static_cast<double>(elapsed_ns) * 1e-6};
+    timing.total_ms += timing.passes[i].ms;
+  }
+  timing.valid = true;
+  latest_ = timing;
+#else
+  (void)frame;
+#endif
+  return true;
+}
+
+void GpuTimer::beginFrame() {
+  if (!initialized_) {
+    return;
+  }
+
+  frame_++;
+
+  // Any older frame that finished in the meantime is picked up first, oldest to newest
+  for (size_t age = latency - 1; age > 0; --age) {
+    FrameQueries &older = frames_[(frame_ - age) % latency];
+    if (older.pending && older.frame == frame_ - age && collect(older)) {
+      older.pending = false;
+    }
+  }
+
+  // The slot this frame reuses was issued latency frames ago; its results are given up on if still not available
+  FrameQueries &current = frames_[frame_ % latency];
+  if (current.pending && !collect(current)) {
+    dropped_frames_++;
+    MATFX_LOG_DEBUG("GPU timings of frame {} were not ready after {} frames", current.frame, latency);
+  }
+  current.pending = false;
+  current.pass_count = 0;
+  current.frame = frame_;
+}
+
+void GpuTimer::beginPass(const char *name) {
+  FrameQueries &current = frames_[frame_ % latency];
+  if (!initialized_ || in_pass_ || current.pass_count == current.queries.size()) {
+    return;
+  }
+
+#ifndef SOKOL_DUMMY_BACKEND
+  glBeginQuery(GL_TIME_ELAPSED, current.queries[current.pass_count]);
+#endif
+  current.names[current.pass_count] = name;
+  in_pass_ = true;
+}
+
+void GpuTimer::endPass() {
+  if (!in_pass_) {
+    return;
+  }
+
+#ifndef SOKOL_DUMMY_BACKEND
+  glEndQuery(GL_TIME_ELAPSED);
+#endif
+  FrameQueries &current = frames_[frame_ % latency];
+  current.pass_count++;
+  current.pending = true;
+  in_pass_ = false;
+}
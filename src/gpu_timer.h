@@ -0,0 +1,65 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+struct GpuPassTiming {
+  const char *name = nullptr;
+  double ms = 0.0;
+};
+
+struct GpuFrameTiming {
+  static constexpr size_t max_passes = 8;
+
+  uint64_t frame = 0;  // GpuTimer frame the timings were recorded in
+  uint32_t pass_count = 0;
+  std::array<GpuPassTiming, max_passes> passes{};
+  double total_ms = 0.0;
+  bool valid = false;
+};
+
+// GL_TIME_ELAPSED queries around render passes. Each frame gets its own set of queries and results are only picked
+// up once the GPU reports them available, up to latency frames later; a frame whose results are still missing by
+// then is dropped rather than waited for. Does nothing on the dummy backend.
+class GpuTimer {
+ public:
+  static constexpr size_t latency = 4;
+
+  GpuTimer();
+  ~GpuTimer();
+
+  GpuTimer(const GpuTimer &) = delete;
+  GpuTimer &operator=(const GpuTimer &) = delete;
+  GpuTimer(GpuTimer &&) = delete;
+  GpuTimer &operator=(GpuTimer &&) = delete;
+
+  void init();
+  void shutdown();
+
+  void beginFrame();
+  // Pass names must outlive the frame's results; string literals are expected
+  void beginPass(const char *name);
+  void endPass();
+
+  // Most recent frame with complete results
+  const GpuFrameTiming &getLatest() const { return latest_; }
+  uint64_t getDroppedFrames() const { return dropped_frames_; }
+
+ private:
+  struct FrameQueries {
+    std::array<uint32_t, GpuFrameTiming::max_passes> queries{};
+    std::array<const char *, GpuFrameTiming::max_passes> names{};
+    uint32_t pass_count = 0;
+    uint64_t frame = 0;
+    bool pending = false;
+  };
+
+  std::array<FrameQueries, latency> frames_;
+  GpuFrameTiming latest_;
+  uint64_t frame_;
+  uint64_t dropped_frames_;
+  bool in_pass_;
+  bool initialized_;
+
+  bool collect(FrameQueries &frame);
+};
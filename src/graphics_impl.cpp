@@ -1,5 +1,9 @@
 #define SOKOL_IMPL
+#ifndef SOKOL_DUMMY_BACKEND
 #define SOKOL_EXTERNAL_GL_LOADER
 #include <glad/glad.h>
+#endif
 #include <sokol_gfx.h>
-#include <sokol_log.h>
\ No newline at end of file
+#include <sokol_log.h>
+#include <sokol_time.h>
+#include <sokol_fetch.h>
\ No newline at end of file
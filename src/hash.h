@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Fast non-cryptographic hashing for content keys (mesh cache, mesh files, vertex welding)
+inline uint64_t hashMix(uint64_t h, uint64_t value) {
+  h ^= value + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+  h *= 0xff51afd7ed558ccdull;
+  return h ^ (h >> 33);
+}
+
+inline uint64_t hashBytes(const void *data, size_t size, uint64_t h) {
+  const auto *bytes = static_cast<const unsigned char *>(data);
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(word));
+    h = hashMix(h, word);
+  }
+
+  uint64_t tail = 0;
+  std::memcpy(&tail, bytes + i, size - i);
+  return hashMix(h, tail ^ size);
+}
+
+// Bit pattern of a float for exact-match keys. Adding 0 turns -0 into +0, so values that compare equal hash equal.
+inline uint32_t floatKeyBits(float value) {
+  const float normalized = value + 0.0f;
+  uint32_t bits;
+  std::memcpy(&bits, &normalized, sizeof(bits));
+  return bits;
+}
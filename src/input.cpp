@@ -0,0 +1,18 @@
+#include "input.h"
+
+void InputEventRing::push(const InputEvent &event) {
+  events_[written_ % capacity] = event;
+  written_++;
+}
+
+bool InputEventRing::read(uint64_t &cursor, InputEvent &event) const {
+  if (written_ > capacity && cursor < written_ - capacity) {
+    cursor = written_ - capacity;
+  }
+  if (cursor >= written_) {
+    return false;
+  }
+  event = events_[cursor % capacity];
+  cursor++;
+  return true;
+}
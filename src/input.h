@@ -0,0 +1,33 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+enum class InputEventType : uint8_t { Key, MouseButton, MouseMove };
+
+struct InputEvent {
+  InputEventType type;
+  int code;    // GLFW key or mouse button, unused for motion
+  int action;  // GLFW_PRESS / GLFW_RELEASE / GLFW_REPEAT, unused for motion
+  int mods;
+  double x, y;  // cursor position for button and motion events
+  uint64_t time;  // stm_now() when GLFW delivered the event
+};
+
+// Fixed-capacity history of input events. Every consumer keeps its own cursor, starting at 0 or getWriteCount(),
+// and reads what arrived since; a consumer that falls more than capacity events behind skips the overwritten ones.
+class InputEventRing {
+ public:
+  static constexpr size_t capacity = 256;
+
+  void push(const InputEvent &event);
+
+  // Copies the next event after cursor into event and advances cursor; false once the consumer is up to date
+  bool read(uint64_t &cursor, InputEvent &event) const;
+
+  uint64_t getWriteCount() const { return written_; }
+
+ private:
+  std::array<InputEvent, capacity> events_{};
+  uint64_t written_ = 0;
+};
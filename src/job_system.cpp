@@ -0,0 +1,231 @@
+#include "job_system.h"
+
+#include <spdlog/spdlog.h>
+
+#include "profiler.h"
+
+static thread_local const JobSystem *t_owner = nullptr;
+static thread_local size_t t_queue_index = 0;
+
+void JobSystem::WorkQueue::push(const Job &job) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (size_ == ring_.size()) {
+    std::vector<Job> grown(std::max<size_t>(ring_.size() * 2, 64));
+    for (size_t i = 0; i < size_; ++i) {
+      grown[i] = ring_[(head_ + i) % ring_.size()];
+    }
+    ring_.swap(grown);
+    head_ = 0;
+  }
+  ring_[(head_ + size_) % ring_.size()] = job;
+  size_++;
+}
+
+bool JobSystem::WorkQueue::pop(Job &job) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (size_ == 0) {
+    return false;
+  }
+  size_--;
+  job = ring_[(head_ + size_) % ring_.size()];
+  return true;
+}
+
+bool JobSystem::WorkQueue::steal(Job &job) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (size_ == 0) {
+    return false;
+  }
+  job = ring_[head_];
+  head_ = (head_ + 1) % ring_.size();
+  size_--;
+  return true;
+}
+
+bool JobSystem::WorkQueue::take(Job &job, const std::atomic<size_t> *pending) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = size_; i-- > 0;) {
+    if (ring_[(head_ + i) % ring_.size()].pending != pending) {
+      continue;
+    }
+    job = ring_[(head_ + i) % ring_.size()];
+    for (size_t j = i + 1; j < size_; ++j) {
+      ring_[(head_ + j - 1) % ring_.size()] = ring_[(head_ + j) % ring_.size()];
+    }
+    size_--;
+    return true;
+  }
+  return false;
+}
+
+JobSystem::JobSystem(size_t worker_count) : graph_capacity_(0), queued_(0), sleeping_(0), running_(true) {
+  if (worker_count == 0) {
+    const unsigned hardware_threads = std::thread::hardware_concurrency();
+    worker_count = hardware_threads > 1 ? hardware_threads - 1 : 0;
+  }
+
+  // Queue 0 is shared by all non-worker threads
+  for (size_t i = 0; i <= worker_count; ++i) {
+    queues_.push_back(std::make_unique<WorkQueue>());
+  }
+  for (size_t i = 1; i <= worker_count; ++i) {
+    workers_.emplace_back(&JobSystem::workerLoop, this, i);
+  }
+
+  SPDLOG_INFO("Job system started with {} worker threads", worker_count);
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    running_ = false;
+  }
+  wake_.notify_all();
+
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+}
+
+size_t JobSystem::currentQueue() const { return t_owner == this ? t_queue_index : 0; }
+
+void JobSystem::submit(const Job &job) {
+  queues_[currentQueue()]->push(job);
+  queued_.fetch_add(1);
+  wakeWorker();
+}
+
+void JobSystem::dispatchBackground(JobFunction function, void *context, size_t index, std::atomic<size_t> &pending) {
+  if (workers_.empty()) {
+    function(context, index);
+    pending.fetch_sub(1, std::memory_order_acq_rel);
+    return;
+  }
+
+  background_.push({function, context, index, &pending});
+  queued_.fetch_add(1);
+  wakeWorker();
+}
+
+void JobSystem::wakeWorker() {
+  // Taking the lock orders this wakeup after a worker that is about to sleep has started waiting
+  if (sleeping_.load() > 0) {
+    { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+    wake_.notify_one();
+  }
+}
+
+bool JobSystem::runOne(size_t queue_index) {
+  Job job;
+  bool found = queues_[queue_index]->pop(job);
+  for (size_t i = 1; !found && i < queues_.size(); ++i) {
+    found = queues_[(queue_index + i) % queues_.size()]->steal(job);
+  }
+  if (!found) {
+    return false;
+  }
+
+  queued_.fetch_sub(1);
+  job.function(job.context, job.index);
+  job.pending->fetch_sub(1, std::memory_order_acq_rel);
+  return true;
+}
+
+bool JobSystem::runBackground() {
+  Job job;
+  if (!background_.steal(job)) {
+    return false;
+  }
+
+  queued_.fetch_sub(1);
+  job.function(job.context, job.index);
+  job.pending->fetch_sub(1, std::memory_order_acq_rel);
+  return true;
+}
+
+bool JobSystem::runOwn(std::atomic<size_t> &pending) {
+  // Jobs counted against pending sit in queue 0 unless a worker running one of them submitted more to its own queue
+  Job job;
+  bool found = false;
+  for (size_t i = 0; !found && i < queues_.size(); ++i) {
+    found = queues_[i]->take(job, &pending);
+  }
+  if (!found) {
+    return false;
+  }
+
+  queued_.fetch_sub(1);
+  job.function(job.context, job.index);
+  job.pending->fetch_sub(1, std::memory_order_acq_rel);
+  return true;
+}
+
+void JobSystem::wait(std::atomic<size_t> &pending) {
+  const bool worker = t_owner == this;
+  while (pending.load(std::memory_order_acquire) > 0) {
+    if (!(worker ? runOne(t_queue_index) : runOwn(pending))) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void JobSystem::workerLoop(size_t queue_index) {
+  t_owner = this;
+  t_queue_index = queue_index;
+  MATFX_PROFILE_THREAD("worker");
+
+  while (running_.load()) {
+    if (runOne(queue_index) || runBackground()) {
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    sleeping_.fetch_add(1);
+    wake_.wait(lock, [this] { return !running_.load() || queued_.load() > 0; });
+    sleeping_.fetch_sub(1);
+  }
+}
+
+void JobSystem::runGraphVertex(void *context, size_t index) {
+  const GraphRun &run = *static_cast<GraphRun *>(context);
+  const entt::organizer::vertex &vertex = (*run.graph)[index];
+  {
+    MATFX_PROFILE_ZONE(vertex.name() ? vertex.name() : "system");
+    vertex.callback()(vertex.data(), *run.registry);
+  }
+
+  // The finishing parent releases each child, this job's pending count is only dropped after these submits
+  for (size_t child : vertex.out_edges()) {
+    if (run.remaining[child].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      run.system->submit({&JobSystem::runGraphVertex, context, child, run.pending});
+    }
+  }
+}
+
+void JobSystem::run(const std::vector<entt::organizer::vertex> &graph, entt::registry &registry) {
+  if (graph.empty()) {
+    return;
+  }
+
+  // Storage creation is not thread safe, make sure every pool a task touches exists up front
+  for (const entt::organizer::vertex &vertex : graph) {
+    vertex.prepare(registry);
+  }
+
+  if (graph.size() > graph_capacity_) {
+    graph_remaining_ = std::make_unique<std::atomic<uint32_t>[]>(graph.size());
+    graph_capacity_ = graph.size();
+  }
+  for (size_t i = 0; i < graph.size(); ++i) {
+    graph_remaining_[i].store(static_cast<uint32_t>(graph[i].in_edges().size()), std::memory_order_relaxed);
+  }
+
+  std::atomic<size_t> pending{graph.size()};
+  GraphRun run{this, &graph, &registry, graph_remaining_.get(), &pending};
+  for (size_t i = 0; i < graph.size(); ++i) {
+    if (graph[i].in_edges().empty()) {
+      submit({&JobSystem::runGraphVertex, &run, i, &pending});
+    }
+  }
+  wait(pending);
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <entt/entity/organizer.hpp>
+#include <entt/entity/registry.hpp>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// Work-stealing thread pool. Every worker owns a queue it pushes to and pops from at the back, idle workers steal
+// from the front of other queues. Threads that are not workers share one extra queue. Waiting threads help run
+// jobs instead of blocking, so parallel loops may be nested inside jobs: a waiting worker runs any job, a waiting
+// non-worker only the jobs of the loop or graph it waits on, so the render thread never picks up a simulation system
+// and the other way round. Background jobs live in a separate queue that only otherwise idle workers drain.
+class JobSystem {
+ public:
+  using JobFunction = void (*)(void *context, size_t index);
+
+  // worker_count 0 uses one worker per hardware thread besides the calling one
+  explicit JobSystem(size_t worker_count = 0);
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+  JobSystem(JobSystem &&) = delete;
+  JobSystem &operator=(JobSystem &&) = delete;
+
+  size_t getWorkerCount() const { return workers_.size(); }
+
+  // Calls fn(begin, end) for consecutive ranges of at most grain items covering [0, count) and returns once all of
+  // them finished
+  template <typename Fn>
+  void parallelFor(size_t count, size_t grain, Fn &&fn);
+
+  // Calls fn(entity, components...) for every entity of the view. Systems running this must not add or remove the
+  // view's components while it runs.
+  template <typename View, typename Fn>
+  void parallelForEach(const View &view, Fn &&fn, size_t grain = 1024);
+
+  // Runs an entt::organizer task graph, every task starts as soon as all the tasks it depends on have finished. Only
+  // one graph may run on a job system at a time.
+  void run(const std::vector<entt::organizer::vertex> &graph, entt::registry &registry);
+
+  // Queues function(context, index) behind all other work and returns right away; pending is decremented once it has
+  // run. Only idle workers pick these jobs up, never a thread waiting on its own jobs, so a long background job can't
+  // stall a parallelFor. context and pending must outlive the job. Without workers the job runs inline.
+  void dispatchBackground(JobFunction function, void *context, size_t index, std::atomic<size_t> &pending);
+
+ private:
+  struct Job {
+    JobFunction function;
+    void *context;
+    size_t index;
+    std::atomic<size_t> *pending;
+  };
+
+  class WorkQueue {
+   public:
+    void push(const Job &job);
+    bool pop(Job &job);
+    bool steal(Job &job);
+    // Removes the newest job counted against pending
+    bool take(Job &job, const std::atomic<size_t> *pending);
+
+   private:
+    std::mutex mutex_;
+    std::vector<Job> ring_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+  };
+
+  struct GraphRun {
+    JobSystem *system;
+    const std::vector<entt::organizer::vertex> *graph;
+    entt::registry *registry;
+    std::atomic<uint32_t> *remaining;
+    std::atomic<size_t> *pending;
+  };
+
+  std::vector<std::unique_ptr<WorkQueue>> queues_;
+  WorkQueue background_;
+  std::vector<std::thread> workers_;
+  std::unique_ptr<std::atomic<uint32_t>[]> graph_remaining_;
+  size_t graph_capacity_;
+
+  std::atomic<size_t> queued_;
+  std::atomic<size_t> sleeping_;
+  std::atomic<bool> running_;
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+
+  void submit(const Job &job);
+  void wakeWorker();
+  bool runOne(size_t queue_index);
+  bool runBackground();
+  bool runOwn(std::atomic<size_t> &pending);
+  void wait(std::atomic<size_t> &pending);
+  void workerLoop(size_t queue_index);
+  size_t currentQueue() const;
+
+  static void runGraphVertex(void *context, size_t index);
+};
+
+template <typename Fn>
+void JobSystem::parallelFor(size_t count, size_t grain, Fn &&fn) {
+  grain = std::max<size_t>(grain, 1);
+  const size_t chunks = (count + grain - 1) / grain;
+  if (chunks <= 1 || workers_.empty()) {
+    if (count > 0) {
+      fn(size_t{0}, count);
+    }
+    return;
+  }
+
+  struct Context {
+    std::remove_reference_t<Fn> *fn;
+    size_t count;
+    size_t grain;
+  } context{&fn, count, grain};
+
+  const JobFunction function = [](void *ptr, size_t chunk) {
+    const Context &ctx = *static_cast<Context *>(ptr);
+    const size_t begin = chunk * ctx.grain;
+    (*ctx.fn)(begin, std::min(begin + ctx.grain, ctx.count));
+  };
+
+  std::atomic<size_t> pending{chunks};
+  for (size_t chunk = 0; chunk < chunks; ++chunk) {
+    submit({function, &context, chunk, &pending});
+  }
+  wait(pending);
+}
+
+template <typename View, typename Fn>
+void JobSystem::parallelForEach(const View &view, Fn &&fn, size_t grain) {
+  const auto *leading = view.handle();
+  if (!leading) {
+    return;
+  }
+
+  parallelFor(leading->size(), grain, [&](size_t begin, size_t end) {
+    const auto *entities = leading->data();
+    for (size_t i = begin; i < end; ++i) {
+      const auto entity = entities[i];
+      if (view.contains(entity)) {
+        std::apply([&](auto &&...components) { fn(entity, components...); }, view.get(entity));
+      }
+    }
+  });
+}
@@ -0,0 +1,51 @@
+#include "lod_selector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "profiler.h"
+
+void LodSelector::select(RenderList &list, float viewport_height) {
+  MATFX_PROFILE_ZONE("LodSelector::select");
+  stats_ = {};
+
+  const Camera &camera = list.getCamera();
+  // Pixels per world unit at distance 1
+  const float pixels_per_unit = viewport_height / (2.0f * std::tan(glm::radians(camera.fov) * 0.5f));
+  const float coarsen_threshold = threshold_pixels_ * (1.0f - hysteresis_);
+
+  std::vector<RenderItem> &items = list.getItems();
+  const std::vector<glm::mat4> &world = list.getWorld();
+  for (size_t i = 0; i < items.size(); ++i) {
+    RenderItem &item = items[i];
+    if (!item.lod || !item.lod->chain || item.lod->chain->levels.empty()) {
+      continue;
+    }
+    MeshLodChain &chain = *item.lod->chain;
+    const uint32_t last = static_cast<uint32_t>(chain.levels.size() - 1);
+
+    const glm::mat4 &matrix = world[i];
+    const float scale = std::max({glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])),
+                                  glm::length(glm::vec3(matrix[2]))});
+    const glm::vec3 center = glm::vec3(matrix * glm::vec4(item.bounds.center, 1.0f));
+    const float distance = std::max(glm::length(center - camera.position), camera.near_plane);
+    const float error_to_pixels = scale * pixels_per_unit / distance;
+
+    const uint32_t previous = std::min(item.lod->level, last);
+    uint32_t level = previous;
+    while (level > 0 && chain.errors[level] * error_to_pixels > threshold_pixels_) {
+      level--;
+    }
+    while (level < last && chain.errors[level + 1] * error_to_pixels <= coarsen_threshold) {
+      level++;
+    }
+
+    item.lod->level = level;
+    item.mesh = &chain.levels[level];
+    stats_.items++;
+    stats_.switches += level != previous ? 1 : 0;
+    stats_.full_triangles += chain.levels[0].getIndexCount() / 3;
+    stats_.selected_triangles += chain.levels[level].getIndexCount() / 3;
+  }
+}
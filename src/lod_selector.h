@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "render_list.h"
+
+struct LodStats {
+  size_t items = 0;                 // render list items with a MeshLod
+  size_t switches = 0;              // items whose level changed this frame
+  uint64_t full_triangles = 0;      // triangles those items would have at level 0
+  uint64_t selected_triangles = 0;  // triangles of the levels picked
+};
+
+// Picks each MeshLod item's level from how large its simplification error would appear on screen: the chain's error
+// for a level, scaled by the item's world scale and projected at its distance with the camera's vertical fov onto
+// the viewport height. The coarsest level within threshold_pixels wins.
+//
+// Levels only get coarser once the next one is below (1 - hysteresis) times the threshold, and finer once the current
+// one exceeds it, so an item sitting near a switching distance doesn't flicker between two levels.
+//
+// Runs on the render thread after RenderList::interpolate() and before culling; it points each item's mesh at the
+// chosen level and stores the level back into the MeshLod component.
+class LodSelector {
+ public:
+  void setThreshold(float pixels) { threshold_pixels_ = pixels; }
+  void setHysteresis(float fraction) { hysteresis_ = fraction; }
+  float getThreshold() const { return threshold_pixels_; }
+  float getHysteresis() const { return hysteresis_; }
+
+  void select(RenderList &list, float viewport_height);
+
+  const LodStats &getStats() const { return stats_; }
+
+ private:
+  float threshold_pixels_ = 1.0f;
+  float hysteresis_ = 0.25f;
+  LodStats stats_;
+};
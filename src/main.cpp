@@ -1,40 +1,254 @@
+#include <sokol_time.h>
 #include <spdlog/spdlog.h>
 
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <entt/entity/organizer.hpp>
+#include <entt/entity/registry.hpp>
+#include <memory>
+#include <string>
+
+#include "asset_streamer.h"
+#include "culling.h"
+#include "frame_capture.h"
+#include "frame_log.h"
+#include "frame_pacer.h"
+#include "job_system.h"
+#include "lod_selector.h"
+#include "mesh_simplifier.h"
+#include "primitives.h"
+#include "profiler.h"
+#include "render_list.h"
 #include "renderer.h"
+#include "simulation.h"
+#include "spin_system.h"
+#include "transform_system.h"
 #include "spdlog/common.h"
 #include "window.h"
 
-static bool run_engine() {
+struct AppConfig {
+  bool low_latency = false;
+  int swap_interval = 1;
+  double max_fps = 0.0;  // 0 leaves pacing to the swap interval
+  std::string mesh;      // mesh file streamed in to replace the cube
+  std::string capture;   // records every frame, a Y4M stream when it ends in .y4m and numbered PNGs otherwise
+  std::string shader_cache = "matfx_shader_cache";  // linked GL programs kept between starts, empty disables
+};
+
+// Time the render thread may spend per frame creating GPU buffers for streamed assets
+static constexpr double asset_finish_budget_ms = 2.0;
+
+static bool parse_args(int argc, char **argv, AppConfig &config) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = std::strchr(arg, '=');
+    if (!value) {
+      return false;
+    }
+    const std::string key(arg, value - arg);
+    value++;
+
+    if (key == "--low-latency") {
+      config.low_latency = std::atoi(value) != 0;
+    } else if (key == "--swap-interval") {
+      config.swap_interval = std::atoi(value);
+    } else if (key == "--max-fps") {
+      config.max_fps = std::strtod(value, nullptr);
+    } else if (key == "--mesh") {
+      config.mesh = value;
+    } else if (key == "--capture") {
+      config.capture = value;
+    } else if (key == "--shader-cache") {
+      config.shader_cache = value;
+    } else {
+      return false;
+    }
+  }
+  return config.swap_interval >= 0 && config.max_fps >= 0.0;
+}
+
+static void create_scene(entt::registry &registry) {
+  const Mesh mesh = createCubeMesh(0.5f);
+  const Bounds mesh_bounds = computeBounds(mesh);
+  // Every other entity is a sphere that drops detail with distance
+  const Mesh sphere = createSphereMesh(0.3f, 64, 32);
+  const Bounds sphere_bounds = computeBounds(sphere);
+  const auto sphere_lods = std::make_shared<MeshLodChain>(buildLodChain(sphere));
+
+  constexpr int grid_size = 32;
+  for (int z = 0; z < grid_size; ++z) {
+    for (int x = 0; x < grid_size; ++x) {
+      const entt::entity entity = registry.create();
+      TransformRef transform = registry.emplace<Transform>(entity);
+      transform.position = {static_cast<float>(x - grid_size / 2), 0.0f, static_cast<float>(-z)};
+      transform.rotation = glm::angleAxis(glm::radians(static_cast<float>((x * 7 + z * 13) % 90)), glm::vec3(0, 1, 0));
+      if ((x + z) % 2 == 1) {
+        registry.emplace<MeshLod>(entity, sphere_lods);
+        registry.emplace<Bounds>(entity, sphere_bounds);
+        continue;
+      }
+      registry.emplace<Mesh>(entity, mesh);
+      registry.emplace<Bounds>(entity, mesh_bounds);
+
+      if ((x + z) % 4 == 0) {
+        registry.emplace<Spin>(entity, glm::vec3(0.0f, glm::radians(static_cast<float>(45 + x * 3)), 0.0f));
+        registry.emplace<PreviousWorldTransform>(entity);
+      }
+    }
+  }
+
+  Camera &camera = registry.emplace<Camera>(registry.create());
+  camera.position = {0.0f, 6.0f, 8.0f};
+  camera.target = {0.0f, 0.0f, -8.0f};
+
+  SPDLOG_INFO("Scene created with {} meshes, sphere LOD chain of {} levels", grid_size * grid_size,
+              sphere_lods->levels.size());
+}
+
+// Swaps the placeholder cube of every cube entity for a streamed mesh. Only while the simulation isn't running.
+static void replace_meshes(entt::registry &registry, const Mesh &mesh, const Bounds &bounds) {
+  for (auto [entity, entity_mesh, entity_bounds] : registry.view<Mesh, Bounds>().each()) {
+    entity_mesh = mesh;
+    entity_bounds = bounds;
+  }
+}
+
+static bool run_engine(const AppConfig &config) {
   SPDLOG_INFO("Starting MatFX engine");
 
   Window window(800, 600, "MatFX");
   if (!window.init()) {
     return false;
   }
+  window.setSwapInterval(config.swap_interval);
+
+  // Low latency mode needs a period to schedule against, with vsync that is the monitor's
+  FramePacer pacer;
+  pacer.setLowLatency(config.low_latency);
+  if (config.max_fps > 0.0) {
+    pacer.setFramePeriod(1.0 / config.max_fps);
+  } else if (config.low_latency && config.swap_interval > 0 && window.getRefreshRate() > 0) {
+    pacer.setFramePeriod(static_cast<double>(config.swap_interval) / window.getRefreshRate());
+  }
+  SPDLOG_INFO("Swap interval {}, low latency {}, max fps {}", config.swap_interval, config.low_latency,
+              config.max_fps);
 
   Renderer renderer;
+  renderer.setProgramBinaryCache(config.shader_cache, Window::getProcAddress);
   if (!renderer.init()) {
     return false;
   }
 
+  FrameCapture capture;
+  if (!config.capture.empty()) {
+    const bool y4m = config.capture.size() >= 4 && config.capture.compare(config.capture.size() - 4, 4, ".y4m") == 0;
+    const int fps = config.max_fps > 0.0 ? static_cast<int>(config.max_fps + 0.5)
+                    : window.getRefreshRate() > 0 ? window.getRefreshRate() : 60;
+    capture.start(config.capture, y4m ? CaptureFormat::Y4m : CaptureFormat::PngSequence, fps);
+  }
+
+  entt::registry registry;
+  create_scene(registry);
+  TransformSystem transform_system(registry);
+  SpinSystem spin_system{transform_system};
+  FrustumCuller culler;
+  LodSelector lods;
+  RenderList render_list;
+
+  JobSystem jobs;
+  entt::organizer organizer;
+  organizer.emplace<&SpinSystem::update>(spin_system, "spin");
+  organizer.emplace<&TransformSystem::update, Transform, const Parent, WorldTransform>(transform_system, "transforms");
+  Simulation simulation(registry, jobs, transform_system, organizer.graph());
+
+  // The scene starts out with cubes and switches over once the mesh file has streamed in
+  AssetStreamer streamer(jobs);
+  AssetHandle mesh_asset;
+  if (!config.mesh.empty() && streamer.init()) {
+    mesh_asset = streamer.requestMesh(config.mesh, AssetPriority::Visible);
+  }
+
   SPDLOG_INFO("Entering main loop");
+  simulation.kick();
+  uint64_t frame = 0;
   while (!window.shouldClose()) {
+    MATFX_PROFILE_FRAME();
+    FrameLog::setFrame(frame++);
+    pacer.wait();
+
+    // Input is sampled as late as possible, right before this frame's view is built from it
+    window.pollEvents();
+    pacer.markInputSampled();
+    if (window.isKeyJustPressed(GLFW_KEY_F9) && Profiler::requestCapture(120, "matfx_trace.json")) {
+      SPDLOG_INFO("Capturing a profile of the next 120 frames");
+    }
+
     int width, height;
     window.getFramebufferSize(width, height);
 
+    streamer.update();
+
+    // Sync point: the simulation hands over the frame it finished and starts on the next one while this one is drawn
+    simulation.wait();
+    if (mesh_asset.id != 0) {
+      Mesh mesh;
+      Bounds mesh_bounds;
+      if (streamer.getMesh(mesh_asset, mesh, mesh_bounds)) {
+        replace_meshes(registry, mesh, mesh_bounds);
+        SPDLOG_INFO("Streamed in {} ({} vertices)", config.mesh, mesh.getVertexCount());
+        streamer.cancel(mesh_asset);
+        mesh_asset = {};
+      } else if (streamer.getState(mesh_asset) == AssetState::Failed) {
+        SPDLOG_WARN("Keeping the cube mesh, {} could not be streamed in", config.mesh);
+        streamer.cancel(mesh_asset);
+        mesh_asset = {};
+      }
+    }
+    render_list.capture(registry);
+    const float alpha = simulation.getAlpha();
+    simulation.kick();
+
+    render_list.interpolate(alpha);
+    lods.select(render_list, static_cast<float>(height));
+    const float aspect_ratio = height > 0 ? static_cast<float>(width) / static_cast<float>(height) : 1.0f;
+    culler.cull(render_list, Frustum::fromMatrix(render_list.getCamera().getViewProjectionMatrix(aspect_ratio)));
+
     renderer.beginFrame(width, height);
-    renderer.render();
+    streamer.finish(renderer.getMeshCache(), asset_finish_budget_ms);
+    renderer.render(render_list, culler.getVisible());
     renderer.endFrame();
+    capture.readFramebuffer(width, height);
+    pacer.markSubmitted();
+    if (renderer.getFrameStats().gpu.valid) {
+      pacer.setGpuFrameMs(renderer.getFrameStats().gpu.total_ms);
+    }
 
     window.swapBuffers();
-    window.pollEvents();
+    if (pacer.isLowLatency()) {
+      renderer.waitIdle();
+    }
+    pacer.markPresented();
+    renderer.setInputLatency(pacer.getInputToPresentMs());
   }
 
+  simulation.wait();
+  capture.stop();
+  Profiler::flush();
   SPDLOG_INFO("Main loop ended, shutting down");
   return true;
 }
 
-int main() {
+int main(int argc, char **argv) {
+  AppConfig config;
+  if (!parse_args(argc, argv, config)) {
+    std::fprintf(stderr,
+                 "usage: %s [--low-latency=0|1] [--swap-interval=N] [--max-fps=N] [--mesh=PATH] [--capture=PATH] "
+                 "[--shader-cache=DIR]\n",
+                 argv[0]);
+    return 1;
+  }
+
 #if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
   spdlog::set_level(spdlog::level::trace);
 #else
@@ -42,6 +256,8 @@ int main() {
 #endif
 
   spdlog::set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%^%l%$] [%s:%#] %v");
+  stm_setup();
+  MATFX_PROFILE_THREAD("main");
 
   SPDLOG_INFO("MatFX application starting");
   SPDLOG_DEBUG("debug mode enabled");
@@ -52,19 +268,25 @@ int main() {
   SPDLOG_WARN("AVX2 support not available");
 #endif
 
+  FrameLog::start();
+
+  int exit_code = 0;
   try {
-    if (!run_engine()) {
+    if (!run_engine(config)) {
       SPDLOG_ERROR("Engine failed to run");
-      return -1;
+      exit_code = -1;
     }
   } catch (const std::exception &e) {
     SPDLOG_ERROR("Exception caught: {}", e.what());
-    return -1;
+    exit_code = -1;
   } catch (...) {
     SPDLOG_ERROR("Unknown exception caught");
-    return -1;
+    exit_code = -1;
   }
 
-  SPDLOG_INFO("MatFX application exiting successfully");
-  return 0;
+  FrameLog::stop();
+  if (exit_code == 0) {
+    SPDLOG_INFO("MatFX application exiting successfully");
+  }
+  return exit_code;
 }
\ No newline at end of file
@@ -0,0 +1,217 @@
+#include "mesh_cache.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+#include "frame_log.h"
+#include "hash.h"
+#include "mesh_file.h"
+
+static constexpr size_t default_resident_budget = 512ull * 1024 * 1024;
+static constexpr size_t default_upload_budget = 8ull * 1024 * 1024;
+
+MeshCache::MeshCache()
+    : resident_budget_(default_resident_budget),
+      upload_budget_(default_upload_budget),
+      frame_(0),
+      over_budget_(false) {}
+
+MeshCache::~MeshCache() { clear(); }
+
+void MeshCache::setBudget(size_t resident_budget_bytes, size_t upload_budget_bytes) {
+  resident_budget_ = resident_budget_bytes;
+  upload_budget_ = upload_budget_bytes;
+}
+
+void MeshCache::beginFrame() {
+  if (over_budget_) {
+    stats_.over_budget_frames++;
+    over_budget_ = false;
+  }
+
+  frame_++;
+  stats_.frame_upload_bytes = 0;
+  stats_.frame_uploads = 0;
+  stats_.frame_deferred = 0;
+  stats_.frame_evictions = 0;
+  stats_.frame_dedup_hits = 0;
+}
+
+uint64_t MeshCache::computeKey(const Mesh &mesh) {
+  if (mesh.blob) {
+    // Mesh files carry a hash of their blobs, verified when the file was parsed, so nothing needs to be read here
+    const MeshBlob &blob = *mesh.blob;
+    uint64_t h = hashMix(blob.content_hash, (blob.packed ? 2 : 0) + (blob.short_indices ? 1 : 0));
+    h = hashMix(h, (static_cast<uint64_t>(blob.vertex_count) << 32) | blob.index_count);
+    h = hashMix(h, blob.vertex_bytes);
+    return hashMix(h, blob.index_bytes);
+  }
+
+  // The format goes into the key so a packed and a float copy of the same mesh never share buffers
+  uint64_t h = hashMix(mesh.getVertexCount() * 2 + (mesh.isPacked() ? 1 : 0), mesh.indices.size());
+  if (mesh.isPacked()) {
+    h = hashBytes(mesh.packed_vertices.data(), mesh.packed_vertices.size() * sizeof(PackedVertex), h);
+  } else {
+    // Not the raw records: under GLM_FORCE_ALIGNED they hold uninitialised padding
+    h = hashVertices(mesh.vertices.data(), mesh.vertices.size(), h);
+  }
+  return hashBytes(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t), h);
+}
+
+bool MeshCache::matches(const Entry &entry, const Mesh &mesh) {
+  return entry.vertex_count == mesh.getVertexCount() && entry.index_count == mesh.getIndexCount() &&
+         entry.packed == mesh.isPacked() && entry.short_indices == mesh.usesShortIndices();
+}
+
+bool MeshCache::acquire(Mesh &mesh) {
+  if (mesh.uploaded) {
+    auto it = keys_by_vertex_buffer_.find(mesh.vertex_buffer_id);
+    if (it != keys_by_vertex_buffer_.end()) {
+      entries_[it->second].last_used_frame = frame_;
+      return true;
+    }
+
+    // The buffers were evicted, the mesh has to go through the upload path again
+    mesh.vertex_buffer_id = 0;
+    mesh.index_buffer_id = 0;
+    mesh.uploaded = false;
+  }
+
+  if (mesh.getVertexCount() == 0 || mesh.getIndexCount() == 0) {
+    return false;
+  }
+
+  // A different mesh under the same key is a hash collision, the next key in the probe sequence is tried instead
+  uint64_t key = computeKey(mesh);
+  auto it = entries_.find(key);
+  while (it != entries_.end() && !matches(it->second, mesh)) {
+    key = hashMix(key, 1);
+    it = entries_.find(key);
+  }
+  if (it != entries_.end()) {
+    it->second.last_used_frame = frame_;
+    mesh.vertex_buffer_id = it->second.vertex_buffer.id;
+    mesh.index_buffer_id = it->second.index_buffer.id;
+    mesh.uploaded = true;
+    stats_.frame_dedup_hits++;
+    return true;
+  }
+
+  // Blob data goes to sokol straight from where it lives, for a mapped file that is the page cache
+  sg_range vertex_data{};
+  sg_range index_data{};
+  if (mesh.blob) {
+    vertex_data = {mesh.blob->vertices, mesh.blob->vertex_bytes};
+    index_data = {mesh.blob->indices, mesh.blob->index_bytes};
+  } else {
+    if (mesh.isPacked()) {
+      vertex_data = {mesh.packed_vertices.data(), mesh.packed_vertices.size() * sizeof(PackedVertex)};
+    } else {
+      vertex_data = {mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex)};
+    }
+    if (mesh.usesShortIndices()) {
+      // Narrowed below, once the upload is certain to happen
+      index_data = {nullptr, mesh.indices.size() * sizeof(uint16_t)};
+    } else {
+      index_data = {mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t)};
+    }
+  }
+  const size_t bytes = vertex_data.size + index_data.size;
+
+  // At least one upload per frame is always allowed so meshes larger than the budget still make progress
+  if (stats_.frame_uploads > 0 && stats_.frame_upload_bytes + bytes > upload_budget_) {
+    stats_.frame_deferred++;
+    return false;
+  }
+
+  if (stats_.resident_bytes + bytes > resident_budget_) {
+    evictFor(bytes);
+    if (stats_.resident_bytes + bytes > resident_budget_) {
+      over_budget_ = true;
+    }
+  }
+
+  if (!index_data.ptr) {
+    short_indices_.assign(mesh.indices.begin(), mesh.indices.end());
+    index_data.ptr = short_indices_.data();
+  }
+
+  sg_buffer_desc vbuf_desc{};
+  vbuf_desc.data = vertex_data;
+  vbuf_desc.label = "mesh-vertices";
+  sg_buffer vbuf = sg_make_buffer(&vbuf_desc);
+
+  sg_buffer_desc ibuf_desc{};
+  ibuf_desc.usage.index_buffer = true;
+  ibuf_desc.data = index_data;
+  ibuf_desc.label = "mesh-indices";
+  sg_buffer ibuf = sg_make_buffer(&ibuf_desc);
+
+  if (sg_query_buffer_state(vbuf) != SG_RESOURCESTATE_VALID || sg_query_buffer_state(ibuf) != SG_RESOURCESTATE_VALID) {
+    MATFX_LOG_ERROR("Failed to create mesh buffers ({} bytes)", bytes);
+    sg_destroy_buffer(vbuf);
+    sg_destroy_buffer(ibuf);
+    return false;
+  }
+
+  entries_.emplace(key, Entry{vbuf, ibuf, bytes, frame_, static_cast<uint32_t>(mesh.getVertexCount()),
+                              static_cast<uint32_t>(mesh.getIndexCount()), mesh.isPacked(), mesh.usesShortIndices()});
+  keys_by_vertex_buffer_.emplace(vbuf.id, key);
+
+  mesh.vertex_buffer_id = vbuf.id;
+  mesh.index_buffer_id = ibuf.id;
+  mesh.uploaded = true;
+
+  stats_.resident_bytes += bytes;
+  stats_.resident_meshes++;
+  stats_.frame_upload_bytes += bytes;
+  stats_.frame_uploads++;
+  stats_.total_upload_bytes += bytes;
+  stats_.total_uploads++;
+  return true;
+}
+
+void MeshCache::evictFor(size_t bytes) {
+  // Only meshes not drawn this frame may go, their buffers could still be referenced by pending draws otherwise
+  eviction_candidates_.clear();
+  for (const auto &[key, entry] : entries_) {
+    if (entry.last_used_frame < frame_) {
+      eviction_candidates_.emplace_back(entry.last_used_frame, key);
+    }
+  }
+  std::sort(eviction_candidates_.begin(), eviction_candidates_.end());
+
+  for (const auto &[last_used_frame, key] : eviction_candidates_) {
+    if (stats_.resident_bytes + bytes <= resident_budget_) {
+      break;
+    }
+
+    auto it = entries_.find(key);
+    release(it->second);
+    entries_.erase(it);
+    stats_.frame_evictions++;
+    stats_.total_evictions++;
+  }
+}
+
+void MeshCache::release(Entry &entry) {
+  keys_by_vertex_buffer_.erase(entry.vertex_buffer.id);
+  sg_destroy_buffer(entry.vertex_buffer);
+  sg_destroy_buffer(entry.index_buffer);
+  stats_.resident_bytes -= entry.bytes;
+  stats_.resident_meshes--;
+}
+
+void MeshCache::clear() {
+  if (sg_isvalid()) {
+    for (auto &[key, entry] : entries_) {
+      release(entry);
+    }
+  }
+
+  entries_.clear();
+  keys_by_vertex_buffer_.clear();
+  stats_.resident_bytes = 0;
+  stats_.resident_meshes = 0;
+}
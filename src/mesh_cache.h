@@ -0,0 +1,83 @@
+#pragma once
+#include <sokol_gfx.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "components.h"
+
+struct MeshCacheStats {
+  size_t resident_bytes = 0;
+  size_t resident_meshes = 0;
+
+  // reset by beginFrame()
+  size_t frame_upload_bytes = 0;
+  uint32_t frame_uploads = 0;
+  uint32_t frame_deferred = 0;
+  uint32_t frame_evictions = 0;
+  uint32_t frame_dedup_hits = 0;
+
+  uint64_t total_upload_bytes = 0;
+  uint64_t total_uploads = 0;
+  uint64_t total_evictions = 0;
+  uint64_t over_budget_frames = 0;
+};
+
+// Owns the GPU buffers behind every Mesh. Buffers are created lazily on first use, identical meshes share one set
+// of buffers, least recently used meshes are evicted once the VRAM budget is exceeded and uploads are throttled to
+// a per-frame byte budget so streaming in new geometry is spread over several frames. Packed vertices are uploaded in
+// place of float ones when a mesh has them, and indices are narrowed to 16 bits when Mesh::usesShortIndices() says so.
+class MeshCache {
+ public:
+  MeshCache();
+  ~MeshCache();
+
+  MeshCache(const MeshCache &) = delete;
+  MeshCache &operator=(const MeshCache &) = delete;
+  MeshCache(MeshCache &&) = delete;
+  MeshCache &operator=(MeshCache &&) = delete;
+
+  void setBudget(size_t resident_budget_bytes, size_t upload_budget_bytes);
+  size_t getResidentBudget() const { return resident_budget_; }
+  size_t getUploadBudget() const { return upload_budget_; }
+
+  void beginFrame();
+
+  // Makes the mesh resident and fills in its buffer ids. Returns false if the upload was deferred to a later frame.
+  bool acquire(Mesh &mesh);
+
+  void clear();
+
+  const MeshCacheStats &getStats() const { return stats_; }
+
+ private:
+  struct Entry {
+    sg_buffer vertex_buffer;
+    sg_buffer index_buffer;
+    size_t bytes;
+    uint64_t last_used_frame;
+    // What was uploaded, checked on a key hit so a hash collision can't hand out another mesh's buffers
+    uint32_t vertex_count;
+    uint32_t index_count;
+    bool packed;
+    bool short_indices;
+  };
+
+  std::unordered_map<uint64_t, Entry> entries_;
+  std::unordered_map<uint32_t, uint64_t> keys_by_vertex_buffer_;
+  std::vector<std::pair<uint64_t, uint64_t>> eviction_candidates_;
+  std::vector<uint16_t> short_indices_;
+
+  size_t resident_budget_;
+  size_t upload_budget_;
+  uint64_t frame_;
+  bool over_budget_;
+  MeshCacheStats stats_;
+
+  static uint64_t computeKey(const Mesh &mesh);
+  static bool matches(const Entry &entry, const Mesh &mesh);
+  void evictFor(size_t bytes);
+  void release(Entry &entry);
+};
@@ -0,0 +1,391 @@
+#include "mesh_file.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "hash.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#define MATFX_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static constexpr char mesh_file_magic[8] = {'M', 'F', 'X', 'M', 'E', 'S', 'H', '\0'};
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+
+static uint64_t hash_blobs(uint32_t flags, uint32_t vertex_count, const void *vertices, uint64_t vertex_bytes,
+                           const void *indices, uint64_t index_bytes) {
+  const uint64_t seed = hashMix(flags, vertex_count);
+  const uint64_t vertex_hash = (flags & MeshFilePacked)
+                                   ? hashBytes(vertices, vertex_bytes, seed)
+                                   : hashVertices(static_cast<const Vertex *>(vertices), vertex_count, seed);
+  return hashBytes(indices, index_bytes, vertex_hash);
+}
+
+// Whether [offset, offset + bytes) lies within size bytes; written so the sum can't wrap
+static bool fits_within(uint64_t offset, uint64_t bytes, uint64_t size) {
+  return offset <= size && bytes <= size - offset;
+}
+
+template <typename Index>
+static bool indices_in_range(const void *data, uint32_t index_count, uint32_t vertex_count) {
+  const auto *indices = static_cast<const Index *>(data);
+  Index max_index = 0;
+  for (uint32_t i = 0; i < index_count; ++i) {
+    max_index = std::max(max_index, indices[i]);
+  }
+  return index_count == 0 || max_index < vertex_count;
+}
+
+uint64_t hashVertices(const Vertex *vertices, size_t count, uint64_t h) {
+  for (size_t i = 0; i < count; ++i) {
+    const Vertex &v = vertices[i];
+    const float fields[8] = {v.position.x, v.position.y, v.position.z, v.normal.x,
+                             v.normal.y,   v.normal.z,   v.texcoord.x, v.texcoord.y};
+    h = hashBytes(fields, sizeof(fields), h);
+  }
+  return h;
+}
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string &path) {
+  std::shared_ptr<MappedFile> file(new MappedFile());
+
+#if defined(_WIN32)
+  HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+  LARGE_INTEGER size{};
+  if (!GetFileSizeEx(handle, &size)) {
+    CloseHandle(handle);
+    return nullptr;
+  }
+  if (size.QuadPart == 0) {
+    CloseHandle(handle);
+    return file;
+  }
+  HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(handle);
+  if (!mapping) {
+    return nullptr;
+  }
+  const void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!view) {
+    CloseHandle(mapping);
+    return nullptr;
+  }
+  file->data_ = static_cast<const unsigned char *>(view);
+  file->size_ = static_cast<size_t>(size.QuadPart);
+  file->mapping_ = mapping;
+#elif defined(MATFX_MMAP)
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return nullptr;
+  }
+  if (st.st_size == 0) {
+    ::close(fd);
+    return file;
+  }
+  void *view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (view == MAP_FAILED) {
+    return nullptr;
+  }
+  file->data_ = static_cast<const unsigned char *>(view);
+  file->size_ = static_cast<size_t>(st.st_size);
+  file->mapping_ = view;
+#else
+  std::FILE *stream = std::fopen(path.c_str(), "rb");
+  if (!stream) {
+    return nullptr;
+  }
+  std::fseek(stream, 0, SEEK_END);
+  const long size = std::ftell(stream);
+  std::fseek(stream, 0, SEEK_SET);
+  if (size < 0) {
+    std::fclose(stream);
+    return nullptr;
+  }
+  file->buffer_.reset(new unsigned char[size > 0 ? size : 1]);
+  const size_t read = std::fread(file->buffer_.get(), 1, static_cast<size_t>(size), stream);
+  std::fclose(stream);
+  if (read != static_cast<size_t>(size)) {
+    return nullptr;
+  }
+  file->data_ = file->buffer_.get();
+  file->size_ = static_cast<size_t>(size);
+#endif
+
+  return file;
+}
+
+MappedFile::~MappedFile() {
+#if defined(_WIN32)
+  if (mapping_) {
+    UnmapViewOfFile(data_);
+    CloseHandle(static_cast<HANDLE>(mapping_));
+  }
+#elif defined(MATFX_MMAP)
+  if (mapping_) {
+    munmap(mapping_, size_);
+  }
+#endif
+}
+
+bool writeMeshFile(const std::string &path, const Mesh &mesh, const Bounds &bounds, const MeshFileLod &lod) {
+  if (mesh.blob) {
+    SPDLOG_ERROR("Mesh file {}: meshes loaded from a file can't be written back", path);
+    return false;
+  }
+
+  const bool packed = mesh.isPacked();
+  const bool short_indices = mesh.usesShortIndices();
+  const void *vertex_data = mesh.packed_vertices.data();
+
+  // Float vertices are copied field by field into zeroed records, so their padding can't make two writes of the same
+  // mesh differ
+  std::vector<unsigned char> float_vertices;
+  if (!packed) {
+    float_vertices.assign(mesh.vertices.size() * sizeof(Vertex), 0);
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+      const Vertex &v = mesh.vertices[i];
+      unsigned char *record = float_vertices.data() + i * sizeof(Vertex);
+      std::memcpy(record + offsetof(Vertex, position), &v.position.x, 3 * sizeof(float));
+      std::memcpy(record + offsetof(Vertex, normal), &v.normal.x, 3 * sizeof(float));
+      std::memcpy(record + offsetof(Vertex, texcoord), &v.texcoord.x, 2 * sizeof(float));
+    }
+    vertex_data = float_vertices.data();
+  }
+
+  std::vector<uint16_t> narrowed;
+  const void *index_data = mesh.indices.data();
+  if (short_indices) {
+    narrowed.assign(mesh.indices.begin(), mesh.indices.end());
+    index_data = narrowed.data();
+  }
+
+  MeshFileHeader header{};
+  std::memcpy(header.magic, mesh_file_magic, sizeof(header.magic));
+  header.version = mesh_file_version;
+  header.flags = (packed ? uint32_t{MeshFilePacked} : 0u) | (short_indices ? uint32_t{MeshFileShortIndices} : 0u);
+  header.vertex_count = static_cast<uint32_t>(mesh.getVertexCount());
+  header.index_count = static_cast<uint32_t>(mesh.indices.size());
+  header.vertex_stride = packed ? sizeof(PackedVertex) : sizeof(Vertex);
+  header.index_size = short_indices ? sizeof(uint16_t) : sizeof(uint32_t);
+  header.vertex_offset = align_up(sizeof(MeshFileHeader), mesh_file_alignment);
+  header.vertex_bytes = static_cast<uint64_t>(header.vertex_count) * header.vertex_stride;
+  header.index_offset = align_up(header.vertex_offset + header.vertex_bytes, mesh_file_alignment);
+  header.index_bytes = static_cast<uint64_t>(header.index_count) * header.index_size;
+  header.content_hash = hash_blobs(header.flags, header.vertex_count, vertex_data, header.vertex_bytes, index_data,
+                                   header.index_bytes);
+  for (int i = 0; i < 3; ++i) {
+    header.bounds_center[i] = bounds.center[i];
+    header.bounds_extents[i] = bounds.extents[i];
+    header.quantization_offset[i] = mesh.quantization_offset[i];
+  }
+  header.quantization_scale = mesh.quantization_scale;
+  header.lod_level = lod.level;
+  header.lod_count = lod.count;
+  header.lod_error = lod.error;
+
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    SPDLOG_ERROR("Mesh file {}: can't open for writing", path);
+    return false;
+  }
+
+  static const unsigned char padding[mesh_file_alignment] = {};
+  const uint64_t header_gap = header.vertex_offset - sizeof(header);
+  const uint64_t vertex_gap = header.index_offset - header.vertex_offset - header.vertex_bytes;
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = ok && std::fwrite(padding, 1, header_gap, file) == header_gap;
+  ok = ok && std::fwrite(vertex_data, 1, header.vertex_bytes, file) == header.vertex_bytes;
+  ok = ok && std::fwrite(padding, 1, vertex_gap, file) == vertex_gap;
+  ok = ok && std::fwrite(index_data, 1, header.index_bytes, file) == header.index_bytes;
+  ok = std::fclose(file) == 0 && ok;
+  if (!ok) {
+    SPDLOG_ERROR("Mesh file {}: write failed", path);
+  }
+  return ok;
+}
+
+bool loadMeshFile(const std::string &path, Mesh &mesh, Bounds &bounds) {
+  std::shared_ptr<MappedFile> file = MappedFile::open(path);
+  if (!file) {
+    SPDLOG_ERROR("Mesh file {}: can't open", path);
+    return false;
+  }
+  const unsigned char *data = file->data();
+  const size_t size = file->size();
+  return parseMeshFile(path, std::move(file), data, size, mesh, bounds);
+}
+
+std::string meshLodPath(const std::string &path, uint32_t level) {
+  if (level == 0) {
+    return path;
+  }
+  const std::string suffix = ".lod" + std::to_string(level);
+  const size_t dot = path.find_last_of('.');
+  const size_t separator = path.find_last_of("/\\");
+  if (dot == std::string::npos || (separator != std::string::npos && dot < separator)) {
+    return path + suffix;
+  }
+  return path.substr(0, dot) + suffix + path.substr(dot);
+}
+
+// loadMeshFile() that also hands back the file's place in its chain
+static bool load_level(const std::string &path, Mesh &mesh, Bounds &bounds, MeshFileLod &lod) {
+  std::shared_ptr<MappedFile> file = MappedFile::open(path);
+  if (!file) {
+    SPDLOG_ERROR("Mesh file {}: can't open", path);
+    return false;
+  }
+  const unsigned char *data = file->data();
+  const size_t size = file->size();
+  if (!parseMeshFile(path, std::move(file), data, size, mesh, bounds)) {
+    return false;
+  }
+  MeshFileHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  lod = {header.lod_level, header.lod_count, header.lod_error};
+  return true;
+}
+
+bool loadMeshLodChain(const std::string &path, MeshLodChain &chain, Bounds &bounds) {
+  chain.levels.clear();
+  chain.errors.clear();
+
+  Mesh mesh;
+  MeshFileLod lod;
+  if (!load_level(path, mesh, bounds, lod)) {
+    return false;
+  }
+  if (lod.level != 0) {
+    SPDLOG_ERROR("Mesh file {}: level {} of a chain, expected level 0", path, lod.level);
+    return false;
+  }
+  const uint32_t count = lod.count;
+  chain.levels.push_back(std::move(mesh));
+  chain.errors.push_back(lod.error);
+
+  for (uint32_t level = 1; level < count; ++level) {
+    const std::string level_path = meshLodPath(path, level);
+    Bounds level_bounds;
+    if (!load_level(level_path, mesh, level_bounds, lod)) {
+      chain.levels.clear();
+      chain.errors.clear();
+      return false;
+    }
+    if (lod.level != level || lod.count != count) {
+      SPDLOG_ERROR("Mesh file {}: level {} of {}, expected level {} of {}", level_path, lod.level, lod.count, level,
+                   count);
+      chain.levels.clear();
+      chain.errors.clear();
+      return false;
+    }
+    chain.levels.push_back(std::move(mesh));
+    chain.errors.push_back(lod.error);
+  }
+  return true;
+}
+
+bool parseMeshFile(const std::string &path, std::shared_ptr<const void> owner, const unsigned char *data, size_t size,
+                   Mesh &mesh, Bounds &bounds) {
+  if (size < sizeof(MeshFileHeader)) {
+    SPDLOG_ERROR("Mesh file {}: truncated header", path);
+    return false;
+  }
+  MeshFileHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, mesh_file_magic, sizeof(header.magic)) != 0) {
+    SPDLOG_ERROR("Mesh file {}: not a mesh file", path);
+    return false;
+  }
+  if (header.version != mesh_file_version) {
+    SPDLOG_ERROR("Mesh file {}: version {} unsupported, expected {}", path, header.version, mesh_file_version);
+    return false;
+  }
+
+  const bool packed = (header.flags & MeshFilePacked) != 0;
+  const bool short_indices = (header.flags & MeshFileShortIndices) != 0;
+  const uint32_t expected_stride = packed ? sizeof(PackedVertex) : sizeof(Vertex);
+  if (header.vertex_stride != expected_stride) {
+    SPDLOG_ERROR("Mesh file {}: vertex stride {} doesn't match this build's {}", path, header.vertex_stride,
+                 expected_stride);
+    return false;
+  }
+  if (header.index_size != (short_indices ? sizeof(uint16_t) : sizeof(uint32_t)) ||
+      header.vertex_bytes != static_cast<uint64_t>(header.vertex_count) * header.vertex_stride ||
+      header.index_bytes != static_cast<uint64_t>(header.index_count) * header.index_size ||
+      header.vertex_offset % mesh_file_alignment != 0 || header.index_offset % mesh_file_alignment != 0 ||
+      header.vertex_offset < sizeof(MeshFileHeader) || (short_indices && header.vertex_count > 0x10000) ||
+      header.lod_level >= header.lod_count || !(header.lod_error >= 0.0f) ||
+      !fits_within(header.vertex_offset, header.vertex_bytes, size) ||
+      !fits_within(header.index_offset, header.index_bytes, size)) {
+    SPDLOG_ERROR("Mesh file {}: inconsistent header", path);
+    return false;
+  }
+
+  // The renderers use indices unchecked and the content hash comes from the same file, so one index past the vertices
+  // would have them read out of bounds
+  const unsigned char *indices = data + header.index_offset;
+  if (!(short_indices ? indices_in_range<uint16_t>(indices, header.index_count, header.vertex_count)
+                      : indices_in_range<uint32_t>(indices, header.index_count, header.vertex_count))) {
+    SPDLOG_ERROR("Mesh file {}: index out of range", path);
+    return false;
+  }
+
+  // The content hash is the blob's identity in MeshCache, a file whose blobs don't match it must not share buffers
+  // with the mesh that really has that hash
+  auto blob = std::make_shared<MeshBlob>();
+  blob->vertices = data + header.vertex_offset;
+  blob->vertex_bytes = header.vertex_bytes;
+  blob->indices = indices;
+  blob->index_bytes = header.index_bytes;
+  blob->vertex_count = header.vertex_count;
+  blob->index_count = header.index_count;
+  blob->packed = packed;
+  blob->short_indices = short_indices;
+  blob->content_hash = header.content_hash;
+  blob->owner = std::move(owner);
+  if (!verifyMeshBlob(*blob)) {
+    SPDLOG_ERROR("Mesh file {}: content hash mismatch", path);
+    return false;
+  }
+
+  mesh.clear();
+  mesh.blob = std::move(blob);
+  for (int i = 0; i < 3; ++i) {
+    bounds.center[i] = header.bounds_center[i];
+    bounds.extents[i] = header.bounds_extents[i];
+    mesh.quantization_offset[i] = header.quantization_offset[i];
+  }
+  mesh.quantization_scale = header.quantization_scale;
+  return true;
+}
+
+bool verifyMeshBlob(const MeshBlob &blob) {
+  const uint32_t flags =
+      (blob.packed ? uint32_t{MeshFilePacked} : 0u) | (blob.short_indices ? uint32_t{MeshFileShortIndices} : 0u);
+  return hash_blobs(flags, blob.vertex_count, blob.vertices, blob.vertex_bytes, blob.indices,
+                    blob.index_bytes) == blob.content_hash;
+}
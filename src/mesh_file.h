@@ -0,0 +1,107 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "components.h"
+
+// Binary mesh container, little endian, written offline by matfx_meshc and memory-mapped at load time:
+//
+//   MeshFileHeader          128 bytes
+//   vertex blob             at vertex_offset, Vertex or PackedVertex records exactly as uploaded, with the padding
+//                           GLM alignment adds to Vertex zeroed
+//   index blob              at index_offset, uint16 or uint32 exactly as uploaded
+//
+// A LOD chain is one file per level, the most detailed at the given path and level i at meshLodPath(path, i). Each
+// level's header carries its place in the chain and its error, so the chain loads without simplifying at runtime.
+//
+// Both blobs start on a mesh_file_alignment boundary so they can be handed to sg_make_buffer straight out of the
+// mapping. Float vertices are only readable by builds with the same sizeof(Vertex) (it depends on GLM alignment),
+// packed vertices by every build.
+constexpr uint32_t mesh_file_version = 3;
+constexpr size_t mesh_file_alignment = 64;
+
+enum MeshFileFlags : uint32_t {
+  MeshFilePacked = 1u << 0,
+  MeshFileShortIndices = 1u << 1,
+};
+
+struct MeshFileHeader {
+  char magic[8];  // "MFXMESH\0"
+  uint32_t version;
+  uint32_t flags;
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t vertex_stride;
+  uint32_t index_size;
+  uint64_t vertex_offset;
+  uint64_t vertex_bytes;
+  uint64_t index_offset;
+  uint64_t index_bytes;
+  uint64_t content_hash;  // of both blobs (vertex fields, not padding), becomes MeshBlob::content_hash
+  float bounds_center[3];
+  float bounds_extents[3];
+  float quantization_offset[3];
+  float quantization_scale;
+  uint32_t lod_level;
+  uint32_t lod_count;  // levels in the chain, 1 for a lone mesh
+  float lod_error;     // becomes MeshLodChain::errors[lod_level]
+  uint8_t reserved[4];
+};
+static_assert(sizeof(MeshFileHeader) == 128);
+
+// Read-only view of a whole file. Falls back to reading into memory where mapping isn't available.
+class MappedFile {
+ public:
+  static std::shared_ptr<MappedFile> open(const std::string &path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const unsigned char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile() = default;
+
+  const unsigned char *data_ = nullptr;
+  size_t size_ = 0;
+  void *mapping_ = nullptr;  // platform handle, null for a plain read
+  std::unique_ptr<unsigned char[]> buffer_;
+};
+
+// Where a file sits in a LOD chain, a lone mesh is level 0 of 1
+struct MeshFileLod {
+  uint32_t level = 0;
+  uint32_t count = 1;
+  float error = 0.0f;
+};
+
+// Hashes the fields of each vertex, never the padding GLM_FORCE_ALIGNED leaves in Vertex, so equal meshes hash equal
+uint64_t hashVertices(const Vertex *vertices, size_t count, uint64_t h);
+
+// Writes the mesh in the form the GPU would get it: packed_vertices when the mesh has them, vertices otherwise, and
+// indices narrowed when Mesh::usesShortIndices().
+bool writeMeshFile(const std::string &path, const Mesh &mesh, const Bounds &bounds, const MeshFileLod &lod = {});
+
+// "rock.mfx" for level 0, "rock.lod1.mfx" for level 1 and so on
+std::string meshLodPath(const std::string &path, uint32_t level);
+
+// Validates the header, the index range and the content hash, then points mesh.blob into the mapping; no geometry is
+// copied, but every byte is read once. The vectors of mesh are left empty; bounds are read from the header since there
+// are no CPU vertices to compute them from.
+bool loadMeshFile(const std::string &path, Mesh &mesh, Bounds &bounds);
+
+// Loads every level of a chain written by matfx_meshc --lods, or a lone mesh as a chain of one. Bounds come from
+// level 0. Fails if a level is missing or belongs to a chain of a different length.
+bool loadMeshLodChain(const std::string &path, MeshLodChain &chain, Bounds &bounds);
+
+// loadMeshFile() for a file that is already in memory; path only names it in errors. The blob points into data and
+// holds on to owner, which has to keep data alive.
+bool parseMeshFile(const std::string &path, std::shared_ptr<const void> owner, const unsigned char *data, size_t size,
+                   Mesh &mesh, Bounds &bounds);
+
+// Recomputes the content hash of the blob and compares it to the one the file was written with
+bool verifyMeshBlob(const MeshBlob &blob);
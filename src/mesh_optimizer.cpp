@@ -0,0 +1,327 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#include "hash.h"
+
+namespace {
+
+constexpr uint32_t invalid_index = ~0u;
+
+// Triangles adjacent to each vertex, stored as one array with per vertex offsets
+struct Adjacency {
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> triangles;
+
+  Adjacency(const std::vector<uint32_t> &indices, size_t vertex_count) : offsets(vertex_count + 1, 0) {
+    for (uint32_t index : indices) {
+      offsets[index + 1]++;
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    triangles.resize(indices.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  uint32_t count(uint32_t vertex) const { return offsets[vertex + 1] - offsets[vertex]; }
+  const uint32_t *begin(uint32_t vertex) const { return triangles.data() + offsets[vertex]; }
+  const uint32_t *end(uint32_t vertex) const { return triangles.data() + offsets[vertex + 1]; }
+};
+
+// FIFO cache by timestamp: a vertex is cached while fewer than cache_size misses happened since it was loaded
+class CacheSimulator {
+ public:
+  CacheSimulator(size_t vertex_count, uint32_t cache_size)
+      : loaded_(vertex_count, 0), cache_size_(cache_size), time_(cache_size + 1) {}
+
+  void reset() { time_ += cache_size_ + 1; }
+
+  // Returns true on a miss
+  bool access(uint32_t vertex) {
+    if (time_ - loaded_[vertex] > cache_size_) {
+      loaded_[vertex] = time_++;
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  std::vector<uint32_t> loaded_;
+  uint32_t cache_size_;
+  uint32_t time_;
+};
+
+struct VertexKey {
+  uint32_t bits[8];
+
+  bool operator==(const VertexKey &other) const { return std::memcmp(bits, other.bits, sizeof(bits)) == 0; }
+};
+
+struct VertexKeyHash {
+  size_t operator()(const VertexKey &key) const {
+    return static_cast<size_t>(hashBytes(key.bits, sizeof(key.bits), 0));
+  }
+};
+
+VertexKey make_key(const Vertex &vertex) {
+  const float values[8] = {vertex.position.x, vertex.position.y, vertex.position.z, vertex.normal.x,
+                           vertex.normal.y,   vertex.normal.z,   vertex.texcoord.x, vertex.texcoord.y};
+  VertexKey key;
+  for (int i = 0; i < 8; ++i) {
+    key.bits[i] = floatKeyBits(values[i]);
+  }
+  return key;
+}
+
+uint32_t skip_dead_end(const std::vector<uint32_t> &live, std::vector<uint32_t> &dead_end, uint32_t &cursor) {
+  while (!dead_end.empty()) {
+    const uint32_t vertex = dead_end.back();
+    dead_end.pop_back();
+    if (live[vertex] > 0) {
+      return vertex;
+    }
+  }
+  for (; cursor < live.size(); ++cursor) {
+    if (live[cursor] > 0) {
+      return cursor;
+    }
+  }
+  return invalid_index;
+}
+
+}  // namespace
+
+VertexCacheStats analyzeVertexCache(const Mesh &mesh, uint32_t cache_size) {
+  VertexCacheStats stats;
+  if (mesh.indices.empty()) {
+    return stats;
+  }
+
+  CacheSimulator cache(mesh.vertices.size(), cache_size);
+  std::vector<bool> referenced(mesh.vertices.size(), false);
+  size_t unique = 0;
+  for (uint32_t index : mesh.indices) {
+    stats.transformed += cache.access(index) ? 1 : 0;
+    if (!referenced[index]) {
+      referenced[index] = true;
+      unique++;
+    }
+  }
+
+  stats.acmr = static_cast<float>(stats.transformed) / static_cast<float>(mesh.indices.size() / 3);
+  stats.atvr = static_cast<float>(stats.transformed) / static_cast<float>(unique);
+  return stats;
+}
+
+size_t weldVertices(Mesh &mesh) {
+  std::vector<VertexKey> keys(mesh.vertices.size());
+  for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+    keys[i] = make_key(mesh.vertices[i]);
+  }
+
+  // Open addressing with linear probing over indices of the first vertex of each key, at most half full
+  size_t table_size = 16;
+  while (table_size < mesh.vertices.size() * 2) {
+    table_size *= 2;
+  }
+  std::vector<uint32_t> table(table_size, invalid_index);
+  const VertexKeyHash hasher;
+
+  std::vector<uint32_t> remap(mesh.vertices.size());
+  std::vector<Vertex> vertices;
+  vertices.reserve(mesh.vertices.size());
+  for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+    size_t slot = hasher(keys[i]) & (table_size - 1);
+    while (table[slot] != invalid_index && !(keys[table[slot]] == keys[i])) {
+      slot = (slot + 1) & (table_size - 1);
+    }
+    if (table[slot] == invalid_index) {
+      table[slot] = static_cast<uint32_t>(i);
+      remap[i] = static_cast<uint32_t>(vertices.size());
+      vertices.push_back(mesh.vertices[i]);
+    } else {
+      remap[i] = remap[table[slot]];
+    }
+  }
+
+  for (uint32_t &index : mesh.indices) {
+    index = remap[index];
+  }
+
+  const size_t removed = mesh.vertices.size() - vertices.size();
+  mesh.vertices = std::move(vertices);
+  return removed;
+}
+
+void optimizeVertexCache(Mesh &mesh, uint32_t cache_size) {
+  const size_t vertex_count = mesh.vertices.size();
+  const size_t triangle_count = mesh.indices.size() / 3;
+  if (triangle_count == 0) {
+    return;
+  }
+
+  const Adjacency adjacency(mesh.indices, vertex_count);
+  std::vector<uint32_t> live(vertex_count);
+  for (uint32_t vertex = 0; vertex < vertex_count; ++vertex) {
+    live[vertex] = adjacency.count(vertex);
+  }
+
+  std::vector<uint32_t> cache_time(vertex_count, 0);
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<uint32_t> dead_end;
+  std::vector<uint32_t> candidates;
+  dead_end.reserve(mesh.indices.size());
+
+  std::vector<uint32_t> output;
+  output.reserve(mesh.indices.size());
+
+  uint32_t time = cache_size + 1;
+  uint32_t cursor = 0;
+  uint32_t fanning = skip_dead_end(live, dead_end, cursor);
+  while (fanning != invalid_index) {
+    candidates.clear();
+    for (const uint32_t *t = adjacency.begin(fanning); t != adjacency.end(fanning); ++t) {
+      if (emitted[*t]) {
+        continue;
+      }
+      emitted[*t] = true;
+      for (int corner = 0; corner < 3; ++corner) {
+        const uint32_t vertex = mesh.indices[*t * 3 + corner];
+        output.push_back(vertex);
+        dead_end.push_back(vertex);
+        candidates.push_back(vertex);
+        live[vertex]--;
+        if (time - cache_time[vertex] > cache_size) {
+          cache_time[vertex] = time++;
+        }
+      }
+    }
+
+    // Prefer the candidate that has been cached longest but will still be cached once its remaining fan is emitted
+    uint32_t best = invalid_index;
+    int64_t best_priority = -1;
+    for (uint32_t vertex : candidates) {
+      if (live[vertex] == 0) {
+        continue;
+      }
+      int64_t priority = 0;
+      if (time - cache_time[vertex] + 2 * live[vertex] <= cache_size) {
+        priority = time - cache_time[vertex];
+      }
+      if (priority > best_priority) {
+        best_priority = priority;
+        best = vertex;
+      }
+    }
+    fanning = best != invalid_index ? best : skip_dead_end(live, dead_end, cursor);
+  }
+
+  mesh.indices = std::move(output);
+}
+
+void optimizeOverdraw(Mesh &mesh, float threshold, uint32_t cache_size) {
+  const size_t triangle_count = mesh.indices.size() / 3;
+  if (triangle_count < 2) {
+    return;
+  }
+
+  const float target_acmr = analyzeVertexCache(mesh, cache_size).acmr * threshold;
+
+  // Cluster starts: where all three vertices miss the cache carries over nothing, otherwise wherever the cluster so
+  // far is already as cache efficient as the mesh
+  std::vector<uint32_t> starts{0};
+  CacheSimulator cache(mesh.vertices.size(), cache_size);
+  uint32_t cluster_triangles = 0;
+  uint32_t cluster_misses = 0;
+  for (uint32_t t = 0; t < triangle_count; ++t) {
+    uint32_t misses = 0;
+    for (int corner = 0; corner < 3; ++corner) {
+      misses += cache.access(mesh.indices[t * 3 + corner]) ? 1 : 0;
+    }
+
+    if (misses == 3 && cluster_triangles > 0 && starts.back() != t) {
+      starts.push_back(t);
+      cluster_triangles = 0;
+      cluster_misses = 0;
+    }
+    cluster_triangles++;
+    cluster_misses += misses;
+
+    if (static_cast<float>(cluster_misses) <= target_acmr * static_cast<float>(cluster_triangles) &&
+        t + 1 < triangle_count) {
+      starts.push_back(t + 1);
+      cluster_triangles = 0;
+      cluster_misses = 0;
+      cache.reset();
+    }
+  }
+  starts.push_back(static_cast<uint32_t>(triangle_count));
+  const size_t cluster_count = starts.size() - 1;
+  if (cluster_count < 2) {
+    return;
+  }
+
+  glm::vec3 mesh_centroid(0.0f);
+  for (const Vertex &vertex : mesh.vertices) {
+    mesh_centroid += vertex.position;
+  }
+  mesh_centroid /= static_cast<float>(std::max<size_t>(mesh.vertices.size(), 1));
+
+  std::vector<float> sort_key(cluster_count);
+  for (size_t c = 0; c < cluster_count; ++c) {
+    glm::vec3 centroid(0.0f);
+    glm::vec3 normal(0.0f);
+    float area = 0.0f;
+    for (uint32_t t = starts[c]; t < starts[c + 1]; ++t) {
+      const glm::vec3 &a = mesh.vertices[mesh.indices[t * 3 + 0]].position;
+      const glm::vec3 &b = mesh.vertices[mesh.indices[t * 3 + 1]].position;
+      const glm::vec3 &d = mesh.vertices[mesh.indices[t * 3 + 2]].position;
+      const glm::vec3 cross = glm::cross(b - a, d - a);
+      const float weight = glm::length(cross);
+      centroid += (a + b + d) * (weight / 3.0f);
+      normal += cross;
+      area += weight;
+    }
+    centroid = area > 0.0f ? centroid / area : centroid;
+    const float normal_length = glm::length(normal);
+    sort_key[c] = normal_length > 0.0f ? glm::dot(centroid - mesh_centroid, normal / normal_length) : 0.0f;
+  }
+
+  std::vector<uint32_t> order(cluster_count);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sort_key[a] > sort_key[b]; });
+
+  std::vector<uint32_t> output;
+  output.reserve(mesh.indices.size());
+  for (uint32_t c : order) {
+    output.insert(output.end(), mesh.indices.begin() + starts[c] * 3, mesh.indices.begin() + starts[c + 1] * 3);
+  }
+  mesh.indices = std::move(output);
+}
+
+void optimizeVertexFetch(Mesh &mesh) {
+  std::vector<uint32_t> remap(mesh.vertices.size(), invalid_index);
+  std::vector<Vertex> vertices;
+  vertices.reserve(mesh.vertices.size());
+  for (uint32_t &index : mesh.indices) {
+    if (remap[index] == invalid_index) {
+      remap[index] = static_cast<uint32_t>(vertices.size());
+      vertices.push_back(mesh.vertices[index]);
+    }
+    index = remap[index];
+  }
+  mesh.vertices = std::move(vertices);
+}
+
+void optimizeMesh(Mesh &mesh) {
+  weldVertices(mesh);
+  optimizeVertexCache(mesh);
+  optimizeOverdraw(mesh);
+  optimizeVertexFetch(mesh);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "components.h"
+
+// Load-time processing of indexed triangle meshes, run before a mesh is first uploaded. Every pass keeps the set of
+// triangles and their winding, only the order of triangles or vertices changes. optimizeMesh() runs them in the
+// order they depend on each other: weld, vertex cache, overdraw, vertex fetch.
+
+// Post-transform cache model used to measure index order: a FIFO of cache_size vertices.
+// ACMR is transformed vertices per triangle (0.5 at best on a regular grid, 3 at worst), ATVR is transformed
+// vertices per unique vertex (1 at best).
+struct VertexCacheStats {
+  uint32_t transformed = 0;
+  float acmr = 0.0f;
+  float atvr = 0.0f;
+};
+
+constexpr uint32_t default_vertex_cache_size = 16;
+
+VertexCacheStats analyzeVertexCache(const Mesh &mesh, uint32_t cache_size = default_vertex_cache_size);
+
+// Merges vertices whose attributes are bitwise equal (+0 and -0 count as equal) and rewrites the indices. Returns the
+// number of vertices removed.
+size_t weldVertices(Mesh &mesh);
+
+// Reorders triangles for the post-transform cache with Tipsify (Sander, Nehab, Barczak 2007): triangles are emitted
+// in fans around the vertex most likely to still be cached, in linear time.
+void optimizeVertexCache(Mesh &mesh, uint32_t cache_size = default_vertex_cache_size);
+
+// Splits the cache-optimised order into clusters and sorts the clusters so outward facing ones come first, which lets
+// early depth reject more of the rest from most view directions. A cluster ends where the cache restarts anyway, or
+// where its own ACMR is within threshold of the whole mesh's, so cache efficiency drops by at most that factor.
+void optimizeOverdraw(Mesh &mesh, float threshold = 1.05f, uint32_t cache_size = default_vertex_cache_size);
+
+// Renumbers vertices in the order the indices first use them so vertex fetch walks memory forwards. Vertices no
+// triangle references are dropped.
+void optimizeVertexFetch(Mesh &mesh);
+
+void optimizeMesh(Mesh &mesh);
@@ -0,0 +1,423 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "culling.h"
+#include "hash.h"
+#include "mesh_optimizer.h"
+
+namespace {
+
+constexpr uint32_t invalid_index = ~0u;
+
+// Border planes count this much more than the area weighted triangle planes, outlines are what shows first
+constexpr double border_weight = 10.0;
+
+// A collapse may turn a triangle's normal by up to about 78 degrees
+constexpr float min_normal_cosine = 0.2f;
+
+// Symmetric 4x4 matrix A of the quadric x^T A x, x = (p, 1), plus the total weight of its planes so costs come out
+// as mean squared distances
+struct Quadric {
+  double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+  double a11 = 0, a12 = 0, a13 = 0;
+  double a22 = 0, a23 = 0;
+  double a33 = 0;
+  double weight = 0;
+
+  void addPlane(const glm::vec3 &normal, float distance, double w) {
+    const double a = normal.x, b = normal.y, c = normal.z, d = distance;
+    a00 += w * a * a, a01 += w * a * b, a02 += w * a * c, a03 += w * a * d;
+    a11 += w * b * b, a12 += w * b * c, a13 += w * b * d;
+    a22 += w * c * c, a23 += w * c * d;
+    a33 += w * d * d;
+    weight += w;
+  }
+
+  void add(const Quadric &q) {
+    a00 += q.a00, a01 += q.a01, a02 += q.a02, a03 += q.a03;
+    a11 += q.a11, a12 += q.a12, a13 += q.a13;
+    a22 += q.a22, a23 += q.a23;
+    a33 += q.a33;
+    weight += q.weight;
+  }
+
+  double evaluate(const glm::vec3 &p) const {
+    const double x = p.x, y = p.y, z = p.z;
+    const double r = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x + a11 * y * y + 2 * a12 * y * z +
+                     2 * a13 * y + a22 * z * z + 2 * a23 * z + a33;
+    return weight > 0 ? std::max(r, 0.0) / weight : 0.0;
+  }
+};
+
+struct Collapse {
+  double cost;
+  uint32_t from;
+  uint32_t to;
+  uint32_t from_version;
+  uint32_t to_version;
+
+  bool operator>(const Collapse &other) const { return cost > other.cost; }
+};
+
+uint64_t edge_key(uint32_t a, uint32_t b) {
+  return a < b ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a;
+}
+
+// How well vertex b can stand in for vertex a when a's position collapses onto b's
+float attribute_match(const Vertex &a, const Vertex &b) {
+  return glm::dot(a.normal, b.normal) - glm::length(a.texcoord - b.texcoord);
+}
+
+// Edge collapse state over positions: every vertex maps to the position it shares with others, triangles refer to
+// positions, and the vertices of a position are its wedges
+class Simplifier {
+ public:
+  explicit Simplifier(const Mesh &mesh) : mesh_(mesh) {
+    buildPositions();
+    buildTriangles();
+    buildQuadrics();
+  }
+
+  float run(size_t target_index_count, float target_error) {
+    std::vector<uint32_t> neighbours;
+    for (const auto &[key, count] : edge_count_) {
+      const uint32_t a = static_cast<uint32_t>(key >> 32);
+      const uint32_t b = static_cast<uint32_t>(key);
+      push(a, b);
+      push(b, a);
+    }
+
+    const double max_cost = static_cast<double>(target_error) * static_cast<double>(target_error);
+    double error = 0.0;
+    while (live_triangles_ * 3 > target_index_count && !heap_.empty()) {
+      const Collapse collapse = heap_.top();
+      heap_.pop();
+      if (collapsed_to_[collapse.from] != invalid_index || collapsed_to_[collapse.to] != invalid_index ||
+          version_[collapse.from] != collapse.from_version || version_[collapse.to] != collapse.to_version) {
+        continue;
+      }
+      if (collapse.cost > max_cost) {
+        break;
+      }
+      if (!isValid(collapse.from, collapse.to)) {
+        continue;
+      }
+
+      apply(collapse.from, collapse.to);
+      error = std::max(error, collapse.cost);
+
+      collectNeighbours(collapse.to, neighbours);
+      for (uint32_t neighbour : neighbours) {
+        push(collapse.to, neighbour);
+        push(neighbour, collapse.to);
+      }
+    }
+    return static_cast<float>(std::sqrt(error));
+  }
+
+  // Rewrites the mesh's indices: every corner whose position collapsed takes the wedge of its new position that
+  // matches its own attributes best
+  void write(Mesh &mesh) const {
+    std::vector<uint32_t> indices;
+    indices.reserve(live_triangles_ * 3);
+    for (size_t t = 0; t < triangle_alive_.size(); ++t) {
+      if (!triangle_alive_[t]) {
+        continue;
+      }
+      uint32_t corners[3];
+      for (int k = 0; k < 3; ++k) {
+        const uint32_t original = mesh_.indices[t * 3 + k];
+        const uint32_t position = triangles_[t * 3 + k];
+        corners[k] = position == position_of_[original] ? original : closestWedge(position, original);
+      }
+      if (corners[0] != corners[1] && corners[1] != corners[2] && corners[0] != corners[2]) {
+        indices.insert(indices.end(), corners, corners + 3);
+      }
+    }
+    mesh.indices = std::move(indices);
+  }
+
+ private:
+  const Mesh &mesh_;
+
+  std::vector<uint32_t> position_of_;     // per vertex
+  std::vector<glm::vec3> positions_;      // per position
+  std::vector<uint32_t> wedge_offsets_;   // per position, into wedges_
+  std::vector<uint32_t> wedges_;          // vertices grouped by position
+  std::vector<uint32_t> triangles_;       // three positions per triangle
+  std::vector<bool> triangle_alive_;
+  size_t live_triangles_ = 0;
+  std::vector<std::vector<uint32_t>> triangles_of_;  // per position, may hold dead triangles
+  std::unordered_map<uint64_t, uint32_t> edge_count_;
+
+  std::vector<Quadric> quadrics_;
+  std::vector<bool> border_;
+  std::vector<bool> seam_;
+  std::vector<bool> locked_;
+  std::vector<uint32_t> collapsed_to_;
+  std::vector<uint32_t> version_;
+  std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap_;
+
+  void buildPositions() {
+    // Float equality already treats -0 and +0 as one position, the hash has to as well
+    struct KeyHash {
+      size_t operator()(const glm::vec3 &p) const {
+        const uint32_t bits[3] = {floatKeyBits(p.x), floatKeyBits(p.y), floatKeyBits(p.z)};
+        return static_cast<size_t>(hashBytes(bits, sizeof(bits), 0));
+      }
+    };
+
+    std::unordered_map<glm::vec3, uint32_t, KeyHash> lookup;
+    lookup.reserve(mesh_.vertices.size());
+    position_of_.resize(mesh_.vertices.size());
+    for (size_t i = 0; i < mesh_.vertices.size(); ++i) {
+      const glm::vec3 &p = mesh_.vertices[i].position;
+      auto [it, inserted] = lookup.emplace(p, static_cast<uint32_t>(positions_.size()));
+      if (inserted) {
+        positions_.push_back(p);
+      }
+      position_of_[i] = it->second;
+    }
+
+    wedge_offsets_.assign(positions_.size() + 1, 0);
+    for (uint32_t position : position_of_) {
+      wedge_offsets_[position + 1]++;
+    }
+    for (size_t p = 0; p < positions_.size(); ++p) {
+      wedge_offsets_[p + 1] += wedge_offsets_[p];
+    }
+    wedges_.resize(mesh_.vertices.size());
+    std::vector<uint32_t> fill(wedge_offsets_.begin(), wedge_offsets_.end() - 1);
+    for (uint32_t v = 0; v < position_of_.size(); ++v) {
+      wedges_[fill[position_of_[v]]++] = v;
+    }
+
+    seam_.resize(positions_.size());
+    locked_.resize(positions_.size());
+    for (size_t p = 0; p < positions_.size(); ++p) {
+      const uint32_t wedges = wedge_offsets_[p + 1] - wedge_offsets_[p];
+      seam_[p] = wedges > 1;
+      // Where more than two wedges meet (a hard corner, a sphere's pole) no single neighbour can stand in for all of
+      // them
+      locked_[p] = wedges > 2;
+    }
+  }
+
+  void buildTriangles() {
+    const size_t triangle_count = mesh_.indices.size() / 3;
+    triangles_.resize(triangle_count * 3);
+    triangle_alive_.assign(triangle_count, false);
+    triangles_of_.resize(positions_.size());
+    for (size_t t = 0; t < triangle_count; ++t) {
+      const uint32_t a = position_of_[mesh_.indices[t * 3 + 0]];
+      const uint32_t b = position_of_[mesh_.indices[t * 3 + 1]];
+      const uint32_t c = position_of_[mesh_.indices[t * 3 + 2]];
+      triangles_[t * 3 + 0] = a;
+      triangles_[t * 3 + 1] = b;
+      triangles_[t * 3 + 2] = c;
+      // Triangles degenerate in position space (a sphere's poles) have no area to keep, they are dropped
+      if (a == b || b == c || a == c) {
+        continue;
+      }
+      triangle_alive_[t] = true;
+      live_triangles_++;
+      for (int k = 0; k < 3; ++k) {
+        triangles_of_[triangles_[t * 3 + k]].push_back(static_cast<uint32_t>(t));
+        edge_count_[edge_key(triangles_[t * 3 + k], triangles_[t * 3 + (k + 1) % 3])]++;
+      }
+    }
+  }
+
+  void buildQuadrics() {
+    quadrics_.resize(positions_.size());
+    border_.assign(positions_.size(), false);
+    collapsed_to_.assign(positions_.size(), invalid_index);
+    version_.assign(positions_.size(), 0);
+
+    for (size_t t = 0; t < triangle_alive_.size(); ++t) {
+      if (!triangle_alive_[t]) {
+        continue;
+      }
+      const glm::vec3 &p0 = positions_[triangles_[t * 3 + 0]];
+      const glm::vec3 &p1 = positions_[triangles_[t * 3 + 1]];
+      const glm::vec3 &p2 = positions_[triangles_[t * 3 + 2]];
+      const glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+      const float length = glm::length(cross);
+      if (length <= 0.0f) {
+        continue;
+      }
+      const glm::vec3 normal = cross / length;
+      const double area = 0.5 * length;
+      for (int k = 0; k < 3; ++k) {
+        quadrics_[triangles_[t * 3 + k]].addPlane(normal, -glm::dot(normal, p0), area);
+      }
+
+      // An edge only one triangle uses lies on a border; the plane through it, perpendicular to the triangle, keeps
+      // its endpoints from sliding off the outline
+      for (int k = 0; k < 3; ++k) {
+        const uint32_t a = triangles_[t * 3 + k];
+        const uint32_t b = triangles_[t * 3 + (k + 1) % 3];
+        if (edge_count_[edge_key(a, b)] != 1) {
+          continue;
+        }
+        const glm::vec3 edge = positions_[b] - positions_[a];
+        const glm::vec3 border_normal = glm::cross(edge, normal);
+        const float border_length = glm::length(border_normal);
+        if (border_length <= 0.0f) {
+          continue;
+        }
+        const glm::vec3 plane = border_normal / border_length;
+        const double weight = border_weight * glm::dot(edge, edge);
+        quadrics_[a].addPlane(plane, -glm::dot(plane, positions_[a]), weight);
+        quadrics_[b].addPlane(plane, -glm::dot(plane, positions_[a]), weight);
+        border_[a] = true;
+        border_[b] = true;
+      }
+    }
+  }
+
+  void push(uint32_t from, uint32_t to) {
+    // Borders and seams may only shrink along themselves
+    if (locked_[from] || (border_[from] && !border_[to]) || (seam_[from] && !seam_[to])) {
+      return;
+    }
+    Quadric combined = quadrics_[from];
+    combined.add(quadrics_[to]);
+    heap_.push({combined.evaluate(positions_[to]), from, to, version_[from], version_[to]});
+  }
+
+  // Moving from onto to must not fold any triangle around from that survives the collapse
+  bool isValid(uint32_t from, uint32_t to) const {
+    for (uint32_t t : triangles_of_[from]) {
+      if (!triangle_alive_[t]) {
+        continue;
+      }
+      const uint32_t *corners = &triangles_[t * 3];
+      if (corners[0] == to || corners[1] == to || corners[2] == to) {
+        continue;
+      }
+      glm::vec3 before[3];
+      glm::vec3 after[3];
+      for (int k = 0; k < 3; ++k) {
+        before[k] = positions_[corners[k]];
+        after[k] = corners[k] == from ? positions_[to] : before[k];
+      }
+      const glm::vec3 normal_before = glm::cross(before[1] - before[0], before[2] - before[0]);
+      const glm::vec3 normal_after = glm::cross(after[1] - after[0], after[2] - after[0]);
+      const float lengths = glm::length(normal_before) * glm::length(normal_after);
+      if (lengths <= 0.0f || glm::dot(normal_before, normal_after) < min_normal_cosine * lengths) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void apply(uint32_t from, uint32_t to) {
+    quadrics_[to].add(quadrics_[from]);
+    collapsed_to_[from] = to;
+    version_[to]++;
+
+    for (uint32_t t : triangles_of_[from]) {
+      if (!triangle_alive_[t]) {
+        continue;
+      }
+      uint32_t *corners = &triangles_[t * 3];
+      if (corners[0] == to || corners[1] == to || corners[2] == to) {
+        triangle_alive_[t] = false;
+        live_triangles_--;
+        continue;
+      }
+      for (int k = 0; k < 3; ++k) {
+        corners[k] = corners[k] == from ? to : corners[k];
+      }
+      triangles_of_[to].push_back(t);
+    }
+    triangles_of_[from].clear();
+    triangles_of_[from].shrink_to_fit();
+  }
+
+  // Positions sharing a live triangle with position, dead triangles are dropped from its list on the way
+  void collectNeighbours(uint32_t position, std::vector<uint32_t> &neighbours) {
+    neighbours.clear();
+    std::vector<uint32_t> &list = triangles_of_[position];
+    size_t kept = 0;
+    for (uint32_t t : list) {
+      if (!triangle_alive_[t]) {
+        continue;
+      }
+      list[kept++] = t;
+      for (int k = 0; k < 3; ++k) {
+        if (triangles_[t * 3 + k] != position) {
+          neighbours.push_back(triangles_[t * 3 + k]);
+        }
+      }
+    }
+    list.resize(kept);
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+  }
+
+  uint32_t closestWedge(uint32_t position, uint32_t original) const {
+    const Vertex &vertex = mesh_.vertices[original];
+    uint32_t best = wedges_[wedge_offsets_[position]];
+    float best_match = -FLT_MAX;
+    for (uint32_t i = wedge_offsets_[position]; i < wedge_offsets_[position + 1]; ++i) {
+      const float match = attribute_match(vertex, mesh_.vertices[wedges_[i]]);
+      if (match > best_match) {
+        best_match = match;
+        best = wedges_[i];
+      }
+    }
+    return best;
+  }
+};
+
+}  // namespace
+
+float simplifyMesh(Mesh &mesh, size_t target_index_count, float target_error) {
+  if (mesh.vertices.empty() || mesh.indices.size() <= target_index_count) {
+    return 0.0f;
+  }
+
+  Simplifier simplifier(mesh);
+  const float error = simplifier.run(target_index_count, target_error);
+  simplifier.write(mesh);
+  return error;
+}
+
+MeshLodChain buildLodChain(const Mesh &mesh, uint32_t max_levels, float reduction, float max_relative_error) {
+  MeshLodChain chain;
+  chain.levels.push_back(mesh);
+  chain.errors.push_back(0.0f);
+  if (mesh.vertices.empty()) {
+    return chain;
+  }
+
+  const Bounds bounds = computeBounds(mesh);
+  const float max_error = max_relative_error * glm::length(bounds.extents);
+
+  Mesh level = mesh;
+  weldVertices(level);
+  float error = 0.0f;
+  while (chain.levels.size() < max_levels && error < max_error) {
+    const size_t before = level.indices.size();
+    const size_t target = static_cast<size_t>(static_cast<float>(before / 3) * reduction) * 3;
+    // Simplifying the previous level is much cheaper than starting over from the full mesh, its error adds up
+    const float level_error = simplifyMesh(level, target, max_error - error);
+    if (level.indices.size() * 10 > before * 9) {
+      break;
+    }
+    error += level_error;
+
+    optimizeVertexCache(level);
+    optimizeVertexFetch(level);
+    chain.levels.push_back(level);
+    chain.errors.push_back(error);
+  }
+  return chain;
+}
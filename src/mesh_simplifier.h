@@ -0,0 +1,26 @@
+#pragma once
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+
+#include "components.h"
+
+// Quadric error simplification (Garland, Heckbert 1997) by edge collapse. Each position accumulates the planes of the
+// triangles around it; collapsing an edge moves one endpoint onto the other, so no new vertices are made and every
+// attribute stays exact. Open borders carry extra planes perpendicular to them so outlines hold their shape, and
+// positions on an attribute seam (two vertices with one position) only collapse onto other seam positions so
+// texcoords don't smear across the seam. Positions with more than two vertices never move. Collapses that would flip
+// a triangle are skipped.
+//
+// Works on the float vertices only, packed and blob meshes have to be simplified before packing. Vertices no longer
+// referenced stay in the vertex array, optimizeVertexFetch() drops them.
+
+// Collapses the cheapest edges until at most target_index_count indices are left or the next collapse would move the
+// surface by more than target_error mesh units. Returns the largest error of any collapse done.
+float simplifyMesh(Mesh &mesh, size_t target_index_count, float target_error = FLT_MAX);
+
+// Builds levels of detail from mesh by repeated simplification, each level aiming at reduction times the triangles of
+// the one before. Stops early when a level can't be reduced by at least a tenth or its error would exceed
+// max_relative_error times the mesh's bounding radius. Every level is cache and fetch optimised.
+MeshLodChain buildLodChain(const Mesh &mesh, uint32_t max_levels = 5, float reduction = 0.5f,
+                           float max_relative_error = 0.1f);
@@ -0,0 +1,379 @@
+#include "pipeline_cache.h"
+
+#ifndef SOKOL_DUMMY_BACKEND
+#include <glad/glad.h>
+#endif
+#include <sokol_time.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#include <vector>
+
+#include "frame_log.h"
+#include "hash.h"
+
+static uint64_t hash_string(const char *string, uint64_t h) {
+  return string ? hashBytes(string, std::strlen(string), h) : hashMix(h, 0);
+}
+
+static uint64_t hash_function(sg_shader_function &function, uint64_t h) {
+  h = hash_string(function.source, h);
+  h = function.bytecode.ptr ? hashBytes(function.bytecode.ptr, function.bytecode.size, h) : hashMix(h, 0);
+  h = hash_string(function.entry, h);
+  h = hash_string(function.d3d11_target, h);
+  function.source = nullptr;
+  function.bytecode.ptr = nullptr;
+  function.entry = nullptr;
+  function.d3d11_target = nullptr;
+  return h;
+}
+
+// Strings and bytecode are hashed by content and their pointers cleared, the rest is plain data hashed as bytes
+static uint64_t hash_shader_desc(const sg_shader_desc &input) {
+  sg_shader_desc desc;
+  std::memcpy(&desc, &input, sizeof(desc));
+  uint64_t h = hash_function(desc.vertex_func, 0);
+  h = hash_function(desc.fragment_func, h);
+  h = hash_function(desc.compute_func, h);
+  for (sg_shader_vertex_attr &attr : desc.attrs) {
+    h = hash_string(attr.hlsl_sem_name, hash_string(attr.glsl_name, h));
+    attr.glsl_name = nullptr;
+    attr.hlsl_sem_name = nullptr;
+  }
+  for (sg_shader_uniform_block &block : desc.uniform_blocks) {
+    for (sg_glsl_shader_uniform &uniform : block.glsl_uniforms) {
+      h = hash_string(uniform.glsl_name, h);
+      uniform.glsl_name = nullptr;
+    }
+  }
+  for (sg_shader_image_sampler_pair &pair : desc.image_sampler_pairs) {
+    h = hash_string(pair.glsl_name, h);
+    pair.glsl_name = nullptr;
+  }
+  desc.label = nullptr;
+  return hashBytes(&desc, sizeof(desc), h);
+}
+
+static uint64_t hash_pipeline_desc(const sg_pipeline_desc &input) {
+  sg_pipeline_desc desc;
+  std::memcpy(&desc, &input, sizeof(desc));
+  desc.label = nullptr;
+  return hashBytes(&desc, sizeof(desc), 0);
+}
+
+#ifndef SOKOL_DUMMY_BACKEND
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+namespace {
+using GetProgramBinaryProc = void(APIENTRYP)(GLuint program, GLsizei size, GLsizei *length, GLenum *format,
+                                             void *binary);
+using ProgramBinaryProc = void(APIENTRYP)(GLuint program, GLenum format, const void *binary, GLsizei length);
+using ProgramParameteriProc = void(APIENTRYP)(GLuint program, GLenum pname, GLint value);
+
+GetProgramBinaryProc gl_get_program_binary = nullptr;
+ProgramBinaryProc gl_program_binary = nullptr;
+ProgramParameteriProc gl_program_parameteri = nullptr;
+
+struct BinaryHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t driver_hash;
+  uint64_t program_key;
+  uint32_t format;
+  uint32_t size;
+};
+
+constexpr char binary_magic[4] = {'M', 'F', 'X', 'P'};
+constexpr uint32_t binary_version = 1;
+
+// What the redirected GL calls do while sokol creates one shader. The real entry points are kept to forward to.
+struct LinkOverride {
+  const void *binary = nullptr;  // link from this instead of compiling
+  GLsizei binary_size = 0;
+  GLenum binary_format = 0;
+  PFNGLCOMPILESHADERPROC compile_shader = nullptr;
+  PFNGLGETSHADERIVPROC get_shaderiv = nullptr;
+  PFNGLLINKPROGRAMPROC link_program = nullptr;
+};
+
+LinkOverride link_override;
+
+void APIENTRY skip_compile_shader(GLuint /* shader */) {}
+
+void APIENTRY report_compiled(GLuint shader, GLenum pname, GLint *params) {
+  if (pname == GL_COMPILE_STATUS) {
+    *params = GL_TRUE;
+  } else if (pname == GL_INFO_LOG_LENGTH) {
+    *params = 0;
+  } else {
+    link_override.get_shaderiv(shader, pname, params);
+  }
+}
+
+void APIENTRY link_program(GLuint program) {
+  if (link_override.binary) {
+    gl_program_binary(program, link_override.binary_format, link_override.binary, link_override.binary_size);
+  } else {
+    gl_program_parameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    link_override.link_program(program);
+  }
+}
+
+// Without a binary the shader is compiled as usual and only marked retrievable before linking; with one, compiling
+// is skipped and reported successful, and linking loads the binary
+class ScopedLinkOverride {
+ public:
+  ScopedLinkOverride(const std::vector<uint8_t> *binary, GLenum format) {
+    link_override.binary = binary ? binary->data() : nullptr;
+    link_override.binary_size = binary ? static_cast<GLsizei>(binary->size()) : 0;
+    link_override.binary_format = format;
+    link_override.link_program = glad_glLinkProgram;
+    glad_glLinkProgram = link_program;
+    if (binary) {
+      link_override.compile_shader = glad_glCompileShader;
+      link_override.get_shaderiv = glad_glGetShaderiv;
+      glad_glCompileShader = skip_compile_shader;
+      glad_glGetShaderiv = report_compiled;
+    }
+  }
+
+  ~ScopedLinkOverride() {
+    glad_glLinkProgram = link_override.link_program;
+    if (link_override.binary) {
+      glad_glCompileShader = link_override.compile_shader;
+      glad_glGetShaderiv = link_override.get_shaderiv;
+    }
+    link_override = {};
+  }
+
+  ScopedLinkOverride(const ScopedLinkOverride &) = delete;
+  ScopedLinkOverride &operator=(const ScopedLinkOverride &) = delete;
+};
+
+bool read_binary(const std::string &path, uint64_t driver_hash, uint64_t program_key, GLenum &format,
+                 std::vector<uint8_t> &binary) {
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  BinaryHeader header;
+  bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+            std::memcmp(header.magic, binary_magic, sizeof(binary_magic)) == 0 && header.version == binary_version &&
+            header.driver_hash == driver_hash && header.program_key == program_key && header.size > 0;
+  if (ok) {
+    binary.resize(header.size);
+    ok = std::fread(binary.data(), 1, binary.size(), file) == binary.size();
+    format = header.format;
+  }
+  std::fclose(file);
+  return ok;
+}
+}  // namespace
+#endif
+
+PipelineCache::PipelineCache() : driver_hash_(0), binaries_enabled_(false) {}
+
+PipelineCache::~PipelineCache() { clear(); }
+
+bool PipelineCache::enableProgramBinaries(const std::string &directory, ProcLoader get_proc_address) {
+#ifndef SOKOL_DUMMY_BACKEND
+  bool supported = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1);
+  GLint extension_count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+  for (GLint i = 0; i < extension_count && !supported; ++i) {
+    const char *name = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+    supported = name && std::strcmp(name, "GL_ARB_get_program_binary") == 0;
+  }
+  GLint format_count = 0;
+  if (supported) {
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+    gl_get_program_binary = reinterpret_cast<GetProgramBinaryProc>(get_proc_address("glGetProgramBinary"));
+    gl_program_binary = reinterpret_cast<ProgramBinaryProc>(get_proc_address("glProgramBinary"));
+    gl_program_parameteri = reinterpret_cast<ProgramParameteriProc>(get_proc_address("glProgramParameteri"));
+  }
+  if (!supported || format_count <= 0 || !gl_get_program_binary || !gl_program_binary || !gl_program_parameteri) {
+    SPDLOG_INFO("The driver can't save program binaries, shaders are compiled on every start");
+    return false;
+  }
+
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  if (error) {
+    SPDLOG_WARN("Can't create the shader cache directory {}: {}", directory, error.message());
+    return false;
+  }
+
+  // Binaries only load on the driver that saved them
+  uint64_t h = 0;
+  for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION}) {
+    h = hash_string(reinterpret_cast<const char *>(glGetString(name)), h);
+  }
+  driver_hash_ = h;
+  binary_directory_ = directory;
+  binaries_enabled_ = true;
+  SPDLOG_INFO("Program binaries cached in {}", directory);
+  return true;
+#else
+  (void)directory;
+  (void)get_proc_address;
+  return false;
+#endif
+}
+
+sg_shader PipelineCache::getShader(const sg_shader_desc &desc) {
+  const uint64_t key = hash_shader_desc(desc);
+  auto it = shaders_.find(key);
+  if (it != shaders_.end()) {
+    stats_.shader_hits++;
+    return it->second;
+  }
+
+  // Failed shaders aren't kept, sokol has logged why and asking again tries again
+  const sg_shader shader = makeShader(desc, key);
+  if (sg_query_shader_state(shader) == SG_RESOURCESTATE_VALID) {
+    shaders_.emplace(key, shader);
+    stats_.shaders++;
+  }
+  return shader;
+}
+
+sg_pipeline PipelineCache::getPipeline(const sg_pipeline_desc &desc) {
+  const uint64_t key = hash_pipeline_desc(desc);
+  auto it = pipelines_.find(key);
+  if (it != pipelines_.end()) {
+    stats_.pipeline_hits++;
+    return it->second;
+  }
+
+  const sg_pipeline pipeline = sg_make_pipeline(&desc);
+  if (sg_query_pipeline_state(pipeline) == SG_RESOURCESTATE_VALID) {
+    pipelines_.emplace(key, pipeline);
+    stats_.pipelines++;
+  }
+  return pipeline;
+}
+
+void PipelineCache::clear() {
+  if (sg_isvalid()) {
+    for (const auto &[key, pipeline] : pipelines_) {
+      sg_destroy_pipeline(pipeline);
+    }
+    for (const auto &[key, shader] : shaders_) {
+      sg_destroy_shader(shader);
+    }
+  }
+  pipelines_.clear();
+  shaders_.clear();
+}
+
+sg_shader PipelineCache::makeShader(const sg_shader_desc &desc, uint64_t key) {
+  const uint64_t start = stm_now();
+  sg_shader shader{};
+  bool made = false;
+
+#ifndef SOKOL_DUMMY_BACKEND
+  if (binaries_enabled_) {
+    const uint64_t program_key = hashMix(driver_hash_, key);
+    const std::string path = getBinaryPath(program_key);
+    std::vector<uint8_t> binary;
+    GLenum format = 0;
+    if (read_binary(path, driver_hash_, program_key, format, binary)) {
+      {
+        ScopedLinkOverride link(&binary, format);
+        shader = sg_make_shader(&desc);
+      }
+      if (sg_query_shader_state(shader) == SG_RESOURCESTATE_VALID) {
+        stats_.binaries_loaded++;
+        made = true;
+      } else {
+        SPDLOG_INFO("The driver rejected the cached program {}, compiling it again", path);
+        sg_destroy_shader(shader);
+        std::remove(path.c_str());
+        stats_.binaries_rejected++;
+      }
+    }
+
+    if (!made) {
+      {
+        ScopedLinkOverride link(nullptr, 0);
+        shader = sg_make_shader(&desc);
+      }
+      if (sg_query_shader_state(shader) == SG_RESOURCESTATE_VALID) {
+        saveBinary(program_key, shader);
+      }
+      made = true;
+    }
+  }
+#else
+  (void)key;
+#endif
+
+  if (!made) {
+    shader = sg_make_shader(&desc);
+  }
+  stats_.shader_ms += stm_ms(stm_since(start));
+  return shader;
+}
+
+std::string PipelineCache::getBinaryPath(uint64_t program_key) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(program_key));
+  return (std::filesystem::path(binary_directory_) / name).string();
+}
+
+void PipelineCache::saveBinary(uint64_t program_key, sg_shader shader) {
+#ifndef SOKOL_DUMMY_BACKEND
+  const GLuint program = sg_gl_query_shader_info(shader).prog;
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  std::vector<uint8_t> binary(static_cast<size_t>(length));
+  GLsizei written = 0;
+  GLenum format = 0;
+  gl_get_program_binary(program, length, &written, &format, binary.data());
+  if (written <= 0) {
+    return;
+  }
+
+  BinaryHeader header{};
+  std::memcpy(header.magic, binary_magic, sizeof(binary_magic));
+  header.version = binary_version;
+  header.driver_hash = driver_hash_;
+  header.program_key = program_key;
+  header.format = format;
+  header.size = static_cast<uint32_t>(written);
+
+  // Written under a temporary name and renamed, a start that crashes half way never leaves a truncated binary behind
+  const std::string path = getBinaryPath(program_key);
+  const std::string temporary = path + ".tmp";
+  std::FILE *file = std::fopen(temporary.c_str(), "wb");
+  if (!file) {
+    MATFX_LOG_WARN("Can't write the program binary {}", temporary);
+    return;
+  }
+  const bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  std::fwrite(binary.data(), 1, header.size, file) == header.size;
+  if (std::fclose(file) != 0 || !ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    MATFX_LOG_WARN("Can't write the program binary {}", path);
+    std::remove(temporary.c_str());
+    return;
+  }
+  stats_.binaries_saved++;
+#else
+  (void)program_key;
+  (void)shader;
+#endif
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <sokol_gfx.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+struct PipelineCacheStats {
+  uint32_t shaders = 0;    // distinct shaders created
+  uint32_t pipelines = 0;  // distinct pipelines created
+  uint32_t shader_hits = 0;
+  uint32_t pipeline_hits = 0;
+  uint32_t binaries_loaded = 0;    // programs linked from the disk cache without compiling
+  uint32_t binaries_saved = 0;     // programs compiled from source and written to the disk cache
+  uint32_t binaries_rejected = 0;  // cached programs the driver refused, compiled from source instead
+  double shader_ms = 0.0;          // time spent creating shaders
+};
+
+// Interns sokol shaders and pipelines by the hash of their descriptors, so asking twice for the same shader or
+// pipeline returns the handle made the first time. Descriptors are hashed as written, with strings and bytecode by
+// content and labels ignored; value-initialise them so padding compares equal.
+//
+// With program binaries enabled, a GL program is looked up on disk by the hash of the driver strings and the shader
+// descriptor before it is built. A hit links it with glProgramBinary() and skips compiling altogether; a miss builds
+// from source as usual and stores the linked binary for the next start. Sokol has no way to take an existing program,
+// so while it creates a shader glCompileShader and glLinkProgram are redirected through glad's function pointers.
+// Binaries are dropped and rebuilt whenever the driver rejects them, e.g. after a driver update.
+class PipelineCache {
+ public:
+  using ProcLoader = void *(*)(const char *name);
+
+  PipelineCache();
+  ~PipelineCache();
+
+  PipelineCache(const PipelineCache &) = delete;
+  PipelineCache &operator=(const PipelineCache &) = delete;
+  PipelineCache(PipelineCache &&) = delete;
+  PipelineCache &operator=(PipelineCache &&) = delete;
+
+  // Stores program binaries in directory. Needs a current GL context with glad loaded; get_proc_address loads the
+  // GL 4.1 / ARB_get_program_binary entry points glad was generated without. Returns false when the driver can't
+  // save programs, and does nothing on the dummy backend.
+  bool enableProgramBinaries(const std::string &directory, ProcLoader get_proc_address);
+
+  sg_shader getShader(const sg_shader_desc &desc);
+  sg_pipeline getPipeline(const sg_pipeline_desc &desc);
+
+  // Destroys every shader and pipeline made through the cache
+  void clear();
+
+  const PipelineCacheStats &getStats() const { return stats_; }
+
+ private:
+  std::unordered_map<uint64_t, sg_shader> shaders_;
+  std::unordered_map<uint64_t, sg_pipeline> pipelines_;
+  std::string binary_directory_;
+  uint64_t driver_hash_;
+  bool binaries_enabled_;
+  PipelineCacheStats stats_;
+
+  sg_shader makeShader(const sg_shader_desc &desc, uint64_t key);
+  std::string getBinaryPath(uint64_t program_key) const;
+  void saveBinary(uint64_t program_key, sg_shader shader);
+};
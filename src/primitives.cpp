@@ -0,0 +1,77 @@
+#include "primitives.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+Mesh createCubeMesh(float size) {
+  const float h = size * 0.5f;
+
+  struct Face {
+    glm::vec3 normal;
+    glm::vec3 u;
+    glm::vec3 v;
+  };
+
+  // u x v == normal so every face winds counter-clockwise when viewed from outside
+  const std::array<Face, 6> faces = {{
+      {{1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, 1.0f, 0.0f}},
+      {{-1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f}},
+      {{0.0f, 1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, -1.0f}},
+      {{0.0f, -1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+      {{0.0f, 0.0f, 1.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}},
+      {{0.0f, 0.0f, -1.0f}, {-1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}},
+  }};
+
+  Mesh mesh;
+  mesh.vertices.reserve(faces.size() * 4);
+  mesh.indices.reserve(faces.size() * 6);
+
+  for (const Face &face : faces) {
+    const uint32_t base = static_cast<uint32_t>(mesh.vertices.size());
+    const glm::vec3 center = face.normal * h;
+
+    mesh.vertices.push_back({center - face.u * h - face.v * h, face.normal, {0.0f, 0.0f}});
+    mesh.vertices.push_back({center + face.u * h - face.v * h, face.normal, {1.0f, 0.0f}});
+    mesh.vertices.push_back({center + face.u * h + face.v * h, face.normal, {1.0f, 1.0f}});
+    mesh.vertices.push_back({center - face.u * h + face.v * h, face.normal, {0.0f, 1.0f}});
+
+    mesh.indices.insert(mesh.indices.end(), {base, base + 1, base + 2, base, base + 2, base + 3});
+  }
+
+  return mesh;
+}
+
+Mesh createSphereMesh(float radius, uint32_t segments, uint32_t rings) {
+  segments = std::max(segments, 3u);
+  rings = std::max(rings, 2u);
+
+  Mesh mesh;
+  mesh.vertices.reserve((segments + 1) * (rings + 1));
+  mesh.indices.reserve(segments * rings * 6);
+
+  const float pi = 3.14159265358979f;
+  for (uint32_t ring = 0; ring <= rings; ++ring) {
+    const float v = static_cast<float>(ring) / static_cast<float>(rings);
+    const float theta = v * pi;
+    // sin(pi) isn't 0 in float, the bottom pole's vertices would all get slightly different positions
+    const float sin_theta = ring == rings ? 0.0f : std::sin(theta);
+    for (uint32_t segment = 0; segment <= segments; ++segment) {
+      const float u = static_cast<float>(segment) / static_cast<float>(segments);
+      const float phi = u * 2.0f * pi;
+      const glm::vec3 normal(sin_theta * std::cos(phi), std::cos(theta), -sin_theta * std::sin(phi));
+      mesh.vertices.push_back({normal * radius, normal, {u, 1.0f - v}});
+    }
+  }
+
+  const uint32_t stride = segments + 1;
+  for (uint32_t ring = 0; ring < rings; ++ring) {
+    for (uint32_t segment = 0; segment < segments; ++segment) {
+      const uint32_t a = ring * stride + segment;
+      const uint32_t b = a + stride;
+      mesh.indices.insert(mesh.indices.end(), {a, b, b + 1, a, b + 1, a + 1});
+    }
+  }
+
+  return mesh;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include "components.h"
+
+Mesh createCubeMesh(float size = 1.0f);
+// UV sphere; the seam column and the pole rows carry their own vertices so texcoords stay continuous
+Mesh createSphereMesh(float radius = 0.5f, uint32_t segments = 32, uint32_t rings = 16);
@@ -0,0 +1,262 @@
+#include "profiler.h"
+
+#include <sokol_time.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Fields are relaxed atomics so a capture can read a slot while its owner overwrites it; such slots are detected
+// from the write count and dropped
+struct Event {
+  std::atomic<const char *> name;
+  std::atomic<uint64_t> stamp;  // stm_now() << 1, low bit set for the end of a zone
+};
+
+struct ThreadRing {
+  uint32_t id = 0;
+  std::atomic<const char *> name{nullptr};
+  std::unique_ptr<Event[]> events{new Event[Profiler::ring_capacity]};
+  std::atomic<uint64_t> written{0};
+};
+
+struct CapturedEvent {
+  const char *name;
+  uint64_t stamp;
+};
+
+struct CapturedThread {
+  uint32_t id;
+  const char *name;
+  std::vector<CapturedEvent> events;
+};
+
+// Everything a trace is written from, copied out of the rings when the capture ends
+struct Capture {
+  std::string path;
+  size_t frame_count;
+  std::vector<uint64_t> frame_starts;
+  std::vector<CapturedThread> threads;
+};
+
+struct ProfilerState {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadRing>> rings;
+
+  std::atomic<bool> capturing{false};
+  bool active = false;
+  size_t frame_count = 0;
+  size_t frames_left = 0;
+  std::string path;
+  std::vector<uint64_t> frame_starts;
+  std::thread writer;  // writes the last finished capture
+};
+
+// Never destroyed: worker threads may still record while static destructors run
+ProfilerState &state() {
+  static ProfilerState *instance = new ProfilerState();
+  return *instance;
+}
+
+thread_local ThreadRing *t_ring = nullptr;
+
+ThreadRing &thread_ring() {
+  if (!t_ring) {
+    ProfilerState &s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.rings.push_back(std::make_unique<ThreadRing>());
+    t_ring = s.rings.back().get();
+    t_ring->id = static_cast<uint32_t>(s.rings.size());
+  }
+  return *t_ring;
+}
+
+void record(const char *name, uint64_t end) {
+  ThreadRing &ring = thread_ring();
+  const uint64_t index = ring.written.load(std::memory_order_relaxed);
+  Event &event = ring.events[index & (Profiler::ring_capacity - 1)];
+  event.name.store(name, std::memory_order_relaxed);
+  event.stamp.store(stm_now() << 1 | end, std::memory_order_relaxed);
+  ring.written.store(index + 1, std::memory_order_release);
+}
+
+// Copies the events still intact in a ring, oldest first
+void snapshot(const ThreadRing &ring, std::vector<CapturedEvent> &out) {
+  out.clear();
+  const uint64_t written = ring.written.load(std::memory_order_acquire);
+  const uint64_t first = written > Profiler::ring_capacity ? written - Profiler::ring_capacity : 0;
+  for (uint64_t i = first; i < written; ++i) {
+    const Event &event = ring.events[i & (Profiler::ring_capacity - 1)];
+    out.push_back({event.name.load(std::memory_order_relaxed), event.stamp.load(std::memory_order_relaxed)});
+  }
+
+  // Anything the owner may have started overwriting while we copied is unreliable
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t written_after = ring.written.load(std::memory_order_relaxed);
+  const uint64_t valid = written_after >= Profiler::ring_capacity ? written_after - Profiler::ring_capacity + 1 : 0;
+  if (valid > first) {
+    out.erase(out.begin(), out.begin() + static_cast<std::ptrdiff_t>(std::min(valid - first, out.size())));
+  }
+}
+
+void write_name(std::FILE *file, const char *name) {
+  std::fputc('"', file);
+  for (const char *c = name ? name : "?"; *c; ++c) {
+    if (*c == '"' || *c == '\\') {
+      std::fputc('\\', file);
+    }
+    std::fputc(*c, file);
+  }
+  std::fputc('"', file);
+}
+
+// Chrome trace event format, timestamps in microseconds from the first captured frame
+void write_trace(const Capture &capture) {
+  std::FILE *file = std::fopen(capture.path.c_str(), "w");
+  if (!file) {
+    SPDLOG_ERROR("Failed to open profile capture {}", capture.path);
+    return;
+  }
+
+  const uint64_t start = capture.frame_starts.front();
+  const uint64_t end = capture.frame_starts.back();
+  auto micros = [start](uint64_t time) { return stm_us(stm_diff(time, start)); };
+  const char *separator = "";
+  size_t event_count = 0;
+  std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  for (size_t i = 0; i + 1 < capture.frame_starts.size(); ++i) {
+    std::fprintf(file, "%s{\"name\":\"frame %zu\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":%.3f}",
+                 separator, i, micros(capture.frame_starts[i]));
+    separator = ",\n";
+  }
+
+  std::vector<bool> open;
+  for (const CapturedThread &thread : capture.threads) {
+    std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", separator,
+                 thread.id);
+    if (thread.name) {
+      write_name(file, thread.name);
+    } else {
+      std::fprintf(file, "\"thread %u\"", thread.id);
+    }
+    std::fprintf(file, "}}");
+
+    // Zones are only emitted when their begin falls inside the capture, zones still open at its end are closed there
+    open.clear();
+    for (const CapturedEvent &event : thread.events) {
+      const uint64_t time = event.stamp >> 1;
+      if (time > end) {
+        break;
+      }
+      if ((event.stamp & 1) == 0) {
+        const bool inside = time >= start;
+        open.push_back(inside);
+        if (inside) {
+          std::fprintf(file, ",\n{\"name\":");
+          write_name(file, event.name);
+          std::fprintf(file, ",\"ph\":\"B\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", thread.id, micros(time));
+          event_count++;
+        }
+      } else if (!open.empty()) {
+        if (open.back()) {
+          std::fprintf(file, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", thread.id, micros(time));
+        }
+        open.pop_back();
+      }
+    }
+    for (size_t i = open.size(); i-- > 0;) {
+      if (open[i]) {
+        std::fprintf(file, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", thread.id, micros(end));
+      }
+    }
+    separator = ",\n";
+  }
+
+  std::fprintf(file, "\n]}\n");
+  std::fclose(file);
+  SPDLOG_INFO("Profile capture of {} frames with {} zones written to {}", capture.frame_count, event_count,
+              capture.path);
+}
+
+}  // namespace
+
+void Profiler::setThreadName(const char *name) { thread_ring().name.store(name, std::memory_order_relaxed); }
+
+void Profiler::beginZone(const char *name) { record(name, 0); }
+
+void Profiler::endZone() { record(nullptr, 1); }
+
+void Profiler::markFrame() {
+  ProfilerState &s = state();
+  if (!s.capturing.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  const uint64_t now = stm_now();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  s.frame_starts.push_back(now);
+  if (!s.active) {
+    s.active = true;
+    return;
+  }
+
+  if (--s.frames_left == 0) {
+    // Only the copy happens on the frame thread, formatting and writing the file would hitch the frame
+    auto capture = std::make_unique<Capture>();
+    capture->path = s.path;
+    capture->frame_count = s.frame_count;
+    capture->frame_starts.swap(s.frame_starts);
+    capture->threads.resize(s.rings.size());
+    for (size_t i = 0; i < s.rings.size(); ++i) {
+      const ThreadRing &ring = *s.rings[i];
+      capture->threads[i].id = ring.id;
+      capture->threads[i].name = ring.name.load(std::memory_order_relaxed);
+      snapshot(ring, capture->threads[i].events);
+    }
+    s.active = false;
+    s.capturing.store(false, std::memory_order_release);
+
+    if (s.writer.joinable()) {
+      s.writer.join();
+    }
+    s.writer = std::thread([capture = std::move(capture)] { write_trace(*capture); });
+  }
+}
+
+void Profiler::flush() {
+  ProfilerState &s = state();
+  std::thread writer;
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    writer.swap(s.writer);
+  }
+  if (writer.joinable()) {
+    writer.join();
+  }
+}
+
+bool Profiler::requestCapture(size_t frame_count, std::string path) {
+  ProfilerState &s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if (frame_count == 0 || s.capturing.load(std::memory_order_relaxed)) {
+    return false;
+  }
+
+  s.frame_count = frame_count;
+  s.frames_left = frame_count;
+  s.path = std::move(path);
+  s.capturing.store(true, std::memory_order_release);
+  return true;
+}
+
+bool Profiler::isCapturing() { return state().capturing.load(std::memory_order_acquire); }
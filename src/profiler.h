@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Scoped CPU zones recorded into per-thread rings and exported as Chrome trace JSON (chrome://tracing, Perfetto).
+//
+// Each thread owns its ring and is the only writer, so each zone edge costs one stm_now() and a few uncontended
+// stores. Rings wrap, only the most recent events are kept. A capture covers a number of frames counted by
+// MATFX_PROFILE_FRAME(). Once those have passed, the thread that marks frames copies the events out of the rings and
+// a background thread writes the trace.
+//
+// Zone names must be string literals or otherwise outlive the capture. Without MATFX_PROFILING the macros expand
+// to nothing.
+class Profiler {
+ public:
+  static constexpr size_t ring_capacity = 1 << 16;
+
+  static void setThreadName(const char *name);
+
+  static void beginZone(const char *name);
+  static void endZone();
+
+  // Call once per frame from the thread driving the frame loop
+  static void markFrame();
+
+  // Records the next frame_count frames and writes them to path when done. Ignored while a capture is pending.
+  static bool requestCapture(size_t frame_count, std::string path);
+  static bool isCapturing();
+
+  // Waits until the last finished capture is on disk, call before exiting
+  static void flush();
+};
+
+class ProfileZone {
+ public:
+  explicit ProfileZone(const char *name) { Profiler::beginZone(name); }
+  ~ProfileZone() { Profiler::endZone(); }
+
+  ProfileZone(const ProfileZone &) = delete;
+  ProfileZone &operator=(const ProfileZone &) = delete;
+};
+
+#define MATFX_PROFILE_CONCAT_INNER(a, b) a##b
+#define MATFX_PROFILE_CONCAT(a, b) MATFX_PROFILE_CONCAT_INNER(a, b)
+
+#ifdef MATFX_PROFILING
+#define MATFX_PROFILE_ZONE(name) ProfileZone MATFX_PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define MATFX_PROFILE_FUNCTION() MATFX_PROFILE_ZONE(__func__)
+#define MATFX_PROFILE_FRAME() Profiler::markFrame()
+#define MATFX_PROFILE_THREAD(name) Profiler::setThreadName(name)
+#else
+#define MATFX_PROFILE_ZONE(name) ((void)0)
+#define MATFX_PROFILE_FUNCTION() ((void)0)
+#define MATFX_PROFILE_FRAME() ((void)0)
+#define MATFX_PROFILE_THREAD(name) ((void)0)
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <entt/entity/fwd.hpp>
+#include <vector>
+
+#include "components.h"
+
+struct RenderItem {
+  Mesh *mesh;    // points into the registry's Mesh pool or a MeshLod's chain, only the render thread touches it
+  MeshLod *lod;  // null for entities drawn with a plain Mesh
+  Material material;
+  Bounds bounds;
+  bool bounded;
+  bool interpolated;
+};
+
+// Everything the render thread needs from the registry, captured at the sync point between two simulation frames.
+// After capture() the simulation is free to run on the registry while this frame is culled and drawn; it must not
+// add or remove Mesh or MeshLod components until the next sync point. Entities with a MeshLod are captured at their
+// last selected level until a LodSelector picks this frame's.
+//
+// World matrices are double-buffered: entities with a PreviousWorldTransform are blended between the last two
+// simulation steps by interpolate(), all others are drawn at their current matrix.
+class RenderList {
+ public:
+  void capture(entt::registry &registry);
+  void interpolate(float alpha);
+
+  const Camera &getCamera() const { return camera_; }
+  size_t size() const { return items_.size(); }
+  const std::vector<RenderItem> &getItems() const { return items_; }
+  // For passes that refine items after capture, such as LOD selection
+  std::vector<RenderItem> &getItems() { return items_; }
+  const std::vector<glm::mat4> &getWorld() const { return world_; }
+
+ private:
+  Camera camera_;
+  std::vector<RenderItem> items_;
+  std::vector<glm::mat4> previous_;
+  std::vector<glm::mat4> current_;
+  std::vector<glm::mat4> world_;
+};
@@ -0,0 +1,133 @@
+#include "render_queue.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+static constexpr int pass_shift = 62;
+static constexpr uint64_t depth_bits = 24;
+static constexpr uint64_t depth_mask = (1ull << depth_bits) - 1;
+
+uint64_t RenderQueue::makeKey(RenderPass pass, uint32_t pipeline_index, uint32_t material_index, float depth) {
+  const uint64_t quantized = static_cast<uint64_t>(std::clamp(depth, 0.0f, 1.0f) * static_cast<float>(depth_mask));
+  const uint64_t pipeline = pipeline_index & (max_pipelines - 1);
+  const uint64_t material = material_index & (max_materials - 1);
+
+  if (pass == RenderPass::Opaque) {
+    return (uint64_t{0} << pass_shift) | (pipeline << 48) | (material << 24) | quantized;
+  }
+  return (uint64_t{1} << pass_shift) | ((depth_mask - quantized) << 38) | (pipeline << 24) | material;
+}
+
+void RenderQueue::clear() {
+  items_.clear();
+  commands_.clear();
+  pipelines_.clear();
+  materials_.clear();
+  material_lookup_.clear();
+  stats_ = {};
+}
+
+uint32_t RenderQueue::addPipeline(uint32_t pipeline_id) {
+  // Only a handful of pipelines are live per frame, a linear scan beats hashing here
+  auto it = std::find(pipelines_.begin(), pipelines_.end(), pipeline_id);
+  if (it != pipelines_.end()) {
+    return static_cast<uint32_t>(it - pipelines_.begin());
+  }
+  pipelines_.push_back(pipeline_id);
+  return static_cast<uint32_t>(pipelines_.size() - 1);
+}
+
+uint32_t RenderQueue::addMaterial(const MaterialUniforms &uniforms) {
+  uint64_t words[2];
+  static_assert(sizeof(words) == sizeof(MaterialUniforms));
+  std::memcpy(words, &uniforms, sizeof(words));
+  const uint64_t hash = (words[0] * 0x9e3779b97f4a7c15ull) ^ words[1];
+
+  // Colliding hashes fall back to a separate entry, that only costs an extra uniform upload
+  auto [it, inserted] = material_lookup_.try_emplace(hash, static_cast<uint32_t>(materials_.size()));
+  if (!inserted && std::memcmp(&materials_[it->second], &uniforms, sizeof(MaterialUniforms)) == 0) {
+    return it->second;
+  }
+  materials_.push_back(uniforms);
+  return static_cast<uint32_t>(materials_.size() - 1);
+}
+
+void RenderQueue::push(uint64_t key, const DrawCommand &command) {
+  items_.push_back({key, static_cast<uint32_t>(commands_.size())});
+  commands_.push_back(command);
+}
+
+void RenderQueue::sort() {
+  // LSD radix sort over 8-bit digits, digits that are equal across all keys are skipped
+  scratch_.resize(items_.size());
+  Item *src = items_.data();
+  Item *dst = scratch_.data();
+  const size_t count = items_.size();
+
+  for (int shift = 0; shift < 64; shift += 8) {
+    std::array<uint32_t, 256> histogram{};
+    for (size_t i = 0; i < count; ++i) {
+      histogram[(src[i].key >> shift) & 0xff]++;
+    }
+    if (count == 0 || histogram[(src[0].key >> shift) & 0xff] == count) {
+      continue;
+    }
+
+    uint32_t offset = 0;
+    for (uint32_t &bucket : histogram) {
+      const uint32_t bucket_count = bucket;
+      bucket = offset;
+      offset += bucket_count;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      dst[histogram[(src[i].key >> shift) & 0xff]++] = src[i];
+    }
+    std::swap(src, dst);
+  }
+
+  if (src != items_.data()) {
+    items_.swap(scratch_);
+  }
+}
+
+void RenderQueue::submit(const sg_range &frame_uniforms) {
+  uint32_t current_pipeline = SG_INVALID_ID;
+  uint32_t current_material = UINT32_MAX;
+
+  for (const Item &item : items_) {
+    const DrawCommand &command = commands_[item.command];
+
+    // Uniform data does not survive a pipeline change in sokol, so both blocks are applied again after one
+    bool pipeline_changed = false;
+    if (command.pipeline_id != current_pipeline) {
+      sg_apply_pipeline(sg_pipeline{command.pipeline_id});
+      sg_apply_uniforms(0, &frame_uniforms);
+      current_pipeline = command.pipeline_id;
+      pipeline_changed = true;
+      stats_.pipelines_applied++;
+    } else {
+      stats_.pipelines_elided++;
+    }
+
+    sg_bindings bindings{};
+    bindings.vertex_buffers[0] = sg_buffer{command.vertex_buffer_id};
+    bindings.vertex_buffers[1] = sg_buffer{command.instance_buffer_id};
+    bindings.vertex_buffer_offsets[1] = static_cast<int>(command.instance_offset);
+    bindings.index_buffer = sg_buffer{command.index_buffer_id};
+    sg_apply_bindings(&bindings);
+    stats_.bindings_applied++;
+
+    if (pipeline_changed || command.material_index != current_material) {
+      const sg_range material_range{&materials_[command.material_index], sizeof(MaterialUniforms)};
+      sg_apply_uniforms(1, &material_range);
+      current_material = command.material_index;
+      stats_.uniforms_applied++;
+    } else {
+      stats_.uniforms_elided++;
+    }
+
+    sg_draw(0, static_cast<int>(command.element_count), static_cast<int>(command.instance_count));
+    stats_.draws++;
+  }
+}
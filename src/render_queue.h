@@ -0,0 +1,76 @@
+#pragma once
+#include <sokol_gfx.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <glm.hpp>
+#include <unordered_map>
+#include <vector>
+
+enum class RenderPass : uint8_t { Opaque = 0, Transparent = 1 };
+
+struct DrawCommand {
+  uint32_t pipeline_id;
+  uint32_t vertex_buffer_id;
+  uint32_t index_buffer_id;
+  uint32_t instance_buffer_id;
+  uint32_t instance_offset;  // in bytes
+  uint32_t element_count;
+  uint32_t instance_count;
+  uint32_t material_index;
+};
+
+struct MaterialUniforms {
+  glm::vec4 color;
+};
+
+struct RenderQueueStats {
+  uint32_t draws = 0;
+  uint32_t pipelines_applied = 0;
+  uint32_t pipelines_elided = 0;
+  uint32_t bindings_applied = 0;
+  uint32_t uniforms_applied = 0;
+  uint32_t uniforms_elided = 0;
+};
+
+// Collects draws for a frame, orders them by a 64-bit sort key and submits them while skipping pipeline and uniform
+// applications that would not change any state. Bindings are applied for every draw: each one reads its own range
+// of the instance buffer, and without a base instance in sg_draw that range can only be set through the binding.
+//
+// Key layout, most significant bits first:
+//   opaque:      pass:2 | pipeline:14 | material:24 | depth:24   (front to back)
+//   transparent: pass:2 | ~depth:24   | pipeline:14 | material:24 (back to front)
+class RenderQueue {
+ public:
+  static constexpr uint32_t max_pipelines = 1u << 14;
+  static constexpr uint32_t max_materials = 1u << 24;
+
+  static uint64_t makeKey(RenderPass pass, uint32_t pipeline_index, uint32_t material_index, float depth);
+
+  void clear();
+
+  // Both return a compact index for use in makeKey(), identical inputs share an index
+  uint32_t addPipeline(uint32_t pipeline_id);
+  uint32_t addMaterial(const MaterialUniforms &uniforms);
+  void push(uint64_t key, const DrawCommand &command);
+
+  void sort();
+  void submit(const sg_range &frame_uniforms);
+
+  size_t size() const { return items_.size(); }
+  const RenderQueueStats &getStats() const { return stats_; }
+
+ private:
+  struct Item {
+    uint64_t key;
+    uint32_t command;
+  };
+
+  std::vector<Item> items_;
+  std::vector<Item> scratch_;
+  std::vector<DrawCommand> commands_;
+  std::vector<uint32_t> pipelines_;
+  std::vector<MaterialUniforms> materials_;
+  std::unordered_map<uint64_t, uint32_t> material_lookup_;
+  RenderQueueStats stats_;
+};
@@ -1,42 +1,67 @@
 #include "renderer.h"
 
+#ifndef SOKOL_DUMMY_BACKEND
 #include <glad/glad.h>
+#endif
 #include <sokol_log.h>
+#include <sokol_time.h>
 #include <spdlog/spdlog.h>
 
-#include <array>
+#include <algorithm>
+#include <gtc/type_ptr.hpp>
 
+#include "frame_log.h"
+#include "profiler.h"
+
+// Sokol reports validation errors on every offending call, so everything but panics goes through the rate limited
+// frame log. Panics abort right after this returns and are logged synchronously.
 static void custom_sokol_logger(const char* tag, uint32_t log_level, uint32_t /* log_item_id */, const char* message,
                                 uint32_t line_nr, const char* filename, void* /* user_data */) {
+  tag = tag ? tag : "";
+  message = message ? message : "";
+  filename = filename ? filename : "";
   switch (log_level) {
     case 0:  // panic
       SPDLOG_CRITICAL("[{}:{}] {}: {}", filename, line_nr, tag, message);
       break;
     case 1:  // error
-      SPDLOG_ERROR("[{}:{}] {}: {}", filename, line_nr, tag, message);
+      MATFX_LOG_ERROR("[{}:{}] {}: {}", filename, line_nr, tag, message);
       break;
     case 2:  // warn
-      SPDLOG_WARN("[{}:{}] {}: {}", filename, line_nr, tag, message);
+      MATFX_LOG_WARN("[{}:{}] {}: {}", filename, line_nr, tag, message);
       break;
     case 3:  // info
-      SPDLOG_INFO("[{}:{}] {}: {}", filename, line_nr, tag, message);
+      MATFX_LOG_INFO("[{}:{}] {}: {}", filename, line_nr, tag, message);
       break;
     default:
-      SPDLOG_DEBUG("[{}:{}] {}: {}", filename, line_nr, tag, message);
+      MATFX_LOG_DEBUG("[{}:{}] {}: {}", filename, line_nr, tag, message);
       break;
   }
 }
 
-Renderer::Renderer() : initialized_(false) {}
+Renderer::Renderer()
+    : get_proc_address_(nullptr),
+      pipelines_{},
+      stream_("frame-stream"),
+      width_(0),
+      height_(0),
+      initialized_(false) {}
 
 Renderer::~Renderer() { shutdown(); }
 
+void Renderer::setProgramBinaryCache(const std::string &directory, PipelineCache::ProcLoader get_proc_address) {
+  program_binary_directory_ = directory;
+  get_proc_address_ = get_proc_address;
+}
+
 bool Renderer::init() {
+#ifndef SOKOL_DUMMY_BACKEND
   int version = gladLoadGL();
   if (version == 0) {
     SPDLOG_ERROR("Failed to load OpenGL with GLAD");
     return false;
   }
+#endif
 
   sg_desc desc{};
   desc.logger.func = custom_sokol_logger;
@@ -47,7 +72,16 @@ bool Renderer::init() {
     return false;
   }
 
-  setupTriangle();
+  sg_enable_frame_stats();
+  gpu_timer_.init();
+
+  if (!program_binary_directory_.empty() && get_proc_address_) {
+    pipeline_cache_.enableProgramBinaries(program_binary_directory_, get_proc_address_);
+  }
+  setupPipelines();
+  if (!stream_.init(1024 * sizeof(glm::mat4))) {
+    return false;
+  }
   initialized_ = true;
   SPDLOG_INFO("Renderer initialized successfully");
   return true;
@@ -55,59 +89,165 @@ bool Renderer::init() {
 
 void Renderer::shutdown() {
   if (initialized_) {
+    gpu_timer_.shutdown();
+    mesh_cache_.clear();
+    stream_.shutdown();
+    pipeline_cache_.clear();
     sg_shutdown();
     initialized_ = false;
   }
 }
 
-void Renderer::setupTriangle() {
-  // Triangle vertices
-  std::array<float, 18> vertices = {{
-      0.0f, 0.5f, 0.0f, 1.0f, 0.0f, 0.0f,    // top (red)
-      -0.5f, -0.5f, 0.0f, 0.0f, 1.0f, 0.0f,  // bottom-left (green)
-      0.5f, -0.5f, 0.0f, 0.0f, 0.0f, 1.0f    // bottom-right (blue)
-  }};
-
-  // Create vertex buffer
-  sg_buffer_desc vbuf_desc{};
-  vbuf_desc.data.ptr = vertices.data();
-  vbuf_desc.data.size = vertices.size() * sizeof(float);
-  vbuf_desc.label = "triangle-vertices";
-  vertex_buffer_ = sg_make_buffer(&vbuf_desc);
-
-  // Create shader
+// Vertex stage bodies share everything but attribute decoding
+static const char *float_vertex_source =
+    "#version 330\n"
+    "uniform mat4 u_view_proj;\n"
+    "layout(location=0) in vec3 position;\n"
+    "layout(location=1) in vec3 normal;\n"
+    "layout(location=2) in vec2 texcoord;\n"
+    "layout(location=3) in vec4 model0;\n"
+    "layout(location=4) in vec4 model1;\n"
+    "layout(location=5) in vec4 model2;\n"
+    "layout(location=6) in vec4 model3;\n"
+    "out vec3 v_normal;\n"
+    "out vec2 v_texcoord;\n"
+    "void main() {\n"
+    "  mat4 model = mat4(model0, model1, model2, model3);\n"
+    "  gl_Position = u_view_proj * model * vec4(position, 1.0);\n"
+    "  v_normal = mat3(model) * normal;\n"
+    "  v_texcoord = texcoord;\n"
+    "}\n";
+
+// Packed positions arrive as unorm16 with w = 1, the mesh's quantization transform is already part of the model
+// matrix. Its scale is uniform, so the normal only needs the renormalisation the fragment stage does anyway.
+static const char *packed_vertex_source =
+    "#version 330\n"
+    "uniform mat4 u_view_proj;\n"
+    "layout(location=0) in vec4 position;\n"
+    "layout(location=1) in vec2 normal_oct;\n"
+    "layout(location=2) in vec2 texcoord;\n"
+    "layout(location=3) in vec4 model0;\n"
+    "layout(location=4) in vec4 model1;\n"
+    "layout(location=5) in vec4 model2;\n"
+    "layout(location=6) in vec4 model3;\n"
+    "out vec3 v_normal;\n"
+    "out vec2 v_texcoord;\n"
+    "vec3 decode_octahedral(vec2 e) {\n"
+    "  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+    "  float t = max(-n.z, 0.0);\n"
+    "  n.x += n.x >= 0.0 ? -t : t;\n"
+    "  n.y += n.y >= 0.0 ? -t : t;\n"
+    "  return n;\n"
+    "}\n"
+    "void main() {\n"
+    "  mat4 model = mat4(model0, model1, model2, model3);\n"
+    "  gl_Position = u_view_proj * model * position;\n"
+    "  v_normal = mat3(model) * decode_octahedral(normal_oct);\n"
+    "  v_texcoord = texcoord;\n"
+    "}\n";
+
+static const char *fragment_source =
+    "#version 330\n"
+    "in vec3 v_normal;\n"
+    "in vec2 v_texcoord;\n"
+    "uniform vec4 u_color;\n"
+    "out vec4 frag_color;\n"
+    "void main() {\n"
+    "  vec3 light_dir = normalize(vec3(0.4, 1.0, 0.6));\n"
+    "  float diffuse = max(dot(normalize(v_normal), light_dir), 0.0);\n"
+    "  vec3 base = vec3(0.6 + 0.4 * v_texcoord, 0.8);\n"
+    "  frag_color = vec4(base * (0.2 + 0.8 * diffuse), 1.0) * u_color;\n"
+    "}\n";
+
+static sg_shader_desc mesh_shader_desc(const char *vertex_source, const char *label) {
   sg_shader_desc shd_desc{};
-  shd_desc.vertex_func.source =
-      "#version 330\n"
-      "layout(location=0) in vec3 position;\n"
-      "layout(location=1) in vec3 color;\n"
-      "out vec3 v_color;\n"
-      "void main() {\n"
-      "  gl_Position = vec4(position, 1.0);\n"
-      "  v_color = color;\n"
-      "}\n";
-  shd_desc.fragment_func.source =
-      "#version 330\n"
-      "in vec3 v_color;\n"
-      "out vec4 frag_color;\n"
-      "void main() {\n"
-      "  frag_color = vec4(v_color, 1.0);\n"
-      "}\n";
-  shd_desc.label = "triangle-shader";
-  sg_shader shd = sg_make_shader(&shd_desc);
-
-  // Create pipeline
-  sg_pipeline_desc pip_desc{};
-  pip_desc.shader = shd;
-  pip_desc.layout.attrs[0].format = SG_VERTEXFORMAT_FLOAT3;  // position
-  pip_desc.layout.attrs[1].format = SG_VERTEXFORMAT_FLOAT3;  // color
-  pip_desc.depth.pixel_format = SG_PIXELFORMAT_DEPTH;
-  pip_desc.colors[0].pixel_format = SG_PIXELFORMAT_RGBA8;
-  pip_desc.label = "triangle-pipeline";
-  pipeline_ = sg_make_pipeline(&pip_desc);
+  shd_desc.vertex_func.source = vertex_source;
+  shd_desc.fragment_func.source = fragment_source;
+  shd_desc.uniform_blocks[0].stage = SG_SHADERSTAGE_VERTEX;
+  shd_desc.uniform_blocks[0].size = sizeof(glm::mat4);
+  shd_desc.uniform_blocks[0].glsl_uniforms[0].type = SG_UNIFORMTYPE_MAT4;
+  shd_desc.uniform_blocks[0].glsl_uniforms[0].glsl_name = "u_view_proj";
+  shd_desc.uniform_blocks[1].stage = SG_SHADERSTAGE_FRAGMENT;
+  shd_desc.uniform_blocks[1].size = sizeof(MaterialUniforms);
+  shd_desc.uniform_blocks[1].glsl_uniforms[0].type = SG_UNIFORMTYPE_FLOAT4;
+  shd_desc.uniform_blocks[1].glsl_uniforms[0].glsl_name = "u_color";
+  shd_desc.label = label;
+  return shd_desc;
+}
+
+// Every default permutation is built up front, so no shader is compiled the first time a mesh needs it
+void Renderer::setupPipelines() {
+  const uint64_t start = stm_now();
+  const sg_shader float_shader = pipeline_cache_.getShader(mesh_shader_desc(float_vertex_source, "mesh-shader"));
+  const sg_shader packed_shader =
+      pipeline_cache_.getShader(mesh_shader_desc(packed_vertex_source, "packed-mesh-shader"));
+
+  for (int packed = 0; packed < 2; ++packed) {
+    for (int short_indices = 0; short_indices < 2; ++short_indices) {
+      // Slot 0 is per-vertex mesh data and slot 1 the per-instance model matrices
+      sg_pipeline_desc pip_desc{};
+      if (packed) {
+        pip_desc.shader = packed_shader;
+        pip_desc.layout.buffers[0].stride = sizeof(PackedVertex);
+        pip_desc.layout.attrs[0].format = SG_VERTEXFORMAT_USHORT4N;  // position
+        pip_desc.layout.attrs[0].offset = offsetof(PackedVertex, position);
+        pip_desc.layout.attrs[1].format = SG_VERTEXFORMAT_SHORT2N;  // octahedral normal
+        pip_desc.layout.attrs[1].offset = offsetof(PackedVertex, normal);
+        pip_desc.layout.attrs[2].format = SG_VERTEXFORMAT_HALF2;  // texcoord
+        pip_desc.layout.attrs[2].offset = offsetof(PackedVertex, texcoord);
+      } else {
+        pip_desc.shader = float_shader;
+        pip_desc.layout.buffers[0].stride = sizeof(Vertex);
+        pip_desc.layout.attrs[0].format = SG_VERTEXFORMAT_FLOAT3;  // position
+        pip_desc.layout.attrs[0].offset = offsetof(Vertex, position);
+        pip_desc.layout.attrs[1].format = SG_VERTEXFORMAT_FLOAT3;  // normal
+        pip_desc.layout.attrs[1].offset = offsetof(Vertex, normal);
+        pip_desc.layout.attrs[2].format = SG_VERTEXFORMAT_FLOAT2;  // texcoord
+        pip_desc.layout.attrs[2].offset = offsetof(Vertex, texcoord);
+      }
+      pip_desc.layout.buffers[1].stride = sizeof(glm::mat4);
+      pip_desc.layout.buffers[1].step_func = SG_VERTEXSTEP_PER_INSTANCE;
+      for (int column = 0; column < 4; ++column) {
+        pip_desc.layout.attrs[3 + column].buffer_index = 1;
+        pip_desc.layout.attrs[3 + column].offset = column * static_cast<int>(sizeof(glm::vec4));
+        pip_desc.layout.attrs[3 + column].format = SG_VERTEXFORMAT_FLOAT4;
+      }
+      pip_desc.index_type = short_indices ? SG_INDEXTYPE_UINT16 : SG_INDEXTYPE_UINT32;
+      pip_desc.cull_mode = SG_CULLMODE_BACK;
+      pip_desc.face_winding = SG_FACEWINDING_CCW;
+      pip_desc.depth.compare = SG_COMPAREFUNC_LESS_EQUAL;
+      pip_desc.depth.write_enabled = true;
+      pip_desc.depth.pixel_format = SG_PIXELFORMAT_DEPTH;
+      pip_desc.colors[0].pixel_format = SG_PIXELFORMAT_RGBA8;
+      pip_desc.label = "mesh-opaque-pipeline";
+      pipelines_[packed][short_indices].opaque = pipeline_cache_.getPipeline(pip_desc);
+
+      // Transparent draws blend over the opaque scene and test against its depth without writing their own
+      pip_desc.depth.write_enabled = false;
+      pip_desc.colors[0].blend.enabled = true;
+      pip_desc.colors[0].blend.src_factor_rgb = SG_BLENDFACTOR_SRC_ALPHA;
+      pip_desc.colors[0].blend.dst_factor_rgb = SG_BLENDFACTOR_ONE_MINUS_SRC_ALPHA;
+      pip_desc.colors[0].blend.src_factor_alpha = SG_BLENDFACTOR_ONE;
+      pip_desc.colors[0].blend.dst_factor_alpha = SG_BLENDFACTOR_ONE_MINUS_SRC_ALPHA;
+      pip_desc.label = "mesh-transparent-pipeline";
+      pipelines_[packed][short_indices].transparent = pipeline_cache_.getPipeline(pip_desc);
+    }
+  }
+
+  const PipelineCacheStats &stats = pipeline_cache_.getStats();
+  SPDLOG_INFO("{} shaders ({} from program binaries) and {} pipelines ready in {:.1f} ms", stats.shaders,
+              stats.binaries_loaded, stats.pipelines, stm_ms(stm_since(start)));
 }
 
 void Renderer::beginFrame(int width, int height) {
+  MATFX_PROFILE_ZONE("Renderer::beginFrame");
+  width_ = width;
+  height_ = height;
+  gpu_timer_.beginFrame();
+  collectFrameStats();
+  mesh_cache_.beginFrame();
+  stream_.beginFrame();
+
   sg_pass pass{};
   pass.action.colors[0].load_action = SG_LOADACTION_CLEAR;
   pass.action.colors[0].clear_value = {0.0f, 0.0f, 0.0f, 1.0f};
@@ -117,20 +257,155 @@ void Renderer::beginFrame(int width, int height) {
   pass.swapchain.color_format = SG_PIXELFORMAT_RGBA8;
   pass.swapchain.depth_format = SG_PIXELFORMAT_DEPTH;
 
+  gpu_timer_.beginPass("main");
   sg_begin_pass(&pass);
 }
 
-void Renderer::render() {
-  sg_apply_pipeline(pipeline_);
+void Renderer::collectFrameStats() {
+  const sg_frame_stats stats = sg_query_frame_stats();
+  frame_stats_.frame_index = stats.frame_index;
+  frame_stats_.draw_calls = stats.num_draw;
+  frame_stats_.pipeline_switches = stats.num_apply_pipeline;
+  frame_stats_.binding_switches = stats.num_apply_bindings;
+  frame_stats_.uniform_updates = stats.num_apply_uniforms;
+  frame_stats_.buffer_upload_bytes = stats.size_update_buffer + stats.size_append_buffer;
+  frame_stats_.uniform_upload_bytes = stats.size_apply_uniforms;
+  frame_stats_.mesh_upload_bytes = mesh_cache_.getStats().frame_upload_bytes;
+  frame_stats_.gl_bind_buffer = stats.gl.num_bind_buffer;
+  frame_stats_.gl_use_program = stats.gl.num_use_program;
+  frame_stats_.gl_render_state = stats.gl.num_render_state;
+  frame_stats_.gpu = gpu_timer_.getLatest();
+}
+
+void Renderer::buildBatches(const RenderList &list, const std::vector<uint32_t> &visible) {
+  draw_keys_.clear();
+  batches_.clear();
+  queue_.clear();
+
+  const Camera &camera = list.getCamera();
+  const float inv_far = camera.far_plane > 0.0f ? 1.0f / camera.far_plane : 0.0f;
+
+  const std::vector<RenderItem> &items = list.getItems();
+  const std::vector<glm::mat4> &world = list.getWorld();
+  for (uint32_t index : visible) {
+    const RenderItem &item = items[index];
+    Mesh &mesh = *item.mesh;
+    if (!mesh_cache_.acquire(mesh)) {
+      continue;
+    }
+
+    const Material &material = item.material;
+    uint32_t pipeline_id = material.pipeline_id;
+    if (pipeline_id == SG_INVALID_ID) {
+      const PipelineVariant &variant = pipelines_[mesh.isPacked() ? 1 : 0][mesh.usesShortIndices() ? 1 : 0];
+      pipeline_id = material.transparent ? variant.transparent.id : variant.opaque.id;
+    }
+
+    const glm::vec3 position = glm::vec3(world[index][3]);
+    const float depth = glm::length(position - camera.position) * inv_far;
+
+    draw_keys_.push_back({pipeline_id, mesh.vertex_buffer_id, mesh.index_buffer_id,
+                          static_cast<uint32_t>(mesh.getIndexCount()), queue_.addMaterial({material.color}),
+                          material.transparent, depth, index});
+  }
+
+  // Sorting brings every opaque entity sharing pipeline, mesh and material next to each other, so each run becomes
+  // one instanced draw. Transparent entities are drawn one by one so they can be ordered back to front.
+  std::sort(draw_keys_.begin(), draw_keys_.end(), [](const DrawKey &a, const DrawKey &b) {
+    if (a.transparent != b.transparent) return a.transparent < b.transparent;
+    if (a.pipeline_id != b.pipeline_id) return a.pipeline_id < b.pipeline_id;
+    if (a.vertex_buffer_id != b.vertex_buffer_id) return a.vertex_buffer_id < b.vertex_buffer_id;
+    if (a.index_buffer_id != b.index_buffer_id) return a.index_buffer_id < b.index_buffer_id;
+    return a.material_index < b.material_index;
+  });
+
+  if (draw_keys_.empty()) {
+    return;
+  }
+
+  // Every visible entity is one instance, written straight into the frame's stream buffer in batch order
+  uint32_t instances_offset = 0;
+  glm::mat4 *instances = stream_.allocate<glm::mat4>(draw_keys_.size(), instances_offset);
+  if (!instances) {
+    return;
+  }
+
+  uint32_t instance_count = 0;
+  for (const DrawKey &key : draw_keys_) {
+    if (batches_.empty() || key.transparent || batches_.back().pipeline_id != key.pipeline_id ||
+        batches_.back().vertex_buffer_id != key.vertex_buffer_id ||
+        batches_.back().index_buffer_id != key.index_buffer_id ||
+        batches_.back().material_index != key.material_index) {
+      batches_.push_back({key.pipeline_id, key.vertex_buffer_id, key.index_buffer_id, key.index_count,
+                          key.material_index, key.transparent, key.depth,
+                          instances_offset + instance_count * static_cast<uint32_t>(sizeof(glm::mat4)), 0});
+    }
+
+    InstanceBatch &batch = batches_.back();
+    batch.depth = std::min(batch.depth, key.depth);
+    batch.instance_count++;
+    const Mesh &mesh = *items[key.item].mesh;
+    if (mesh.isPacked()) {
+      // model * translate(offset) * scale(quantization_scale), so the shader can feed the unorm position straight in
+      const glm::mat4 &model = world[key.item];
+      glm::mat4 &instance = instances[instance_count++];
+      instance[0] = model[0] * mesh.quantization_scale;
+      instance[1] = model[1] * mesh.quantization_scale;
+      instance[2] = model[2] * mesh.quantization_scale;
+      instance[3] = model * glm::vec4(mesh.quantization_offset, 1.0f);
+    } else {
+      instances[instance_count++] = world[key.item];
+    }
+  }
+}
+
+void Renderer::buildQueue() {
+  for (const InstanceBatch &batch : batches_) {
+    const RenderPass pass = batch.transparent ? RenderPass::Transparent : RenderPass::Opaque;
+    const uint64_t key = RenderQueue::makeKey(pass, queue_.addPipeline(batch.pipeline_id), batch.material_index,
+                                              batch.depth);
 
-  sg_bindings bindings{};
-  bindings.vertex_buffers[0] = vertex_buffer_;
-  sg_apply_bindings(&bindings);
+    DrawCommand command{};
+    command.pipeline_id = batch.pipeline_id;
+    command.vertex_buffer_id = batch.vertex_buffer_id;
+    command.index_buffer_id = batch.index_buffer_id;
+    command.instance_buffer_id = stream_.getBuffer().id;
+    command.instance_offset = batch.instance_offset;
+    command.element_count = batch.index_count;
+    command.instance_count = batch.instance_count;
+    command.material_index = batch.material_index;
+    queue_.push(key, command);
+  }
 
-  sg_draw(0, 3, 1);
+  queue_.sort();
+}
+
+void Renderer::render(const RenderList &list, const std::vector<uint32_t> &visible) {
+  MATFX_PROFILE_ZONE("Renderer::render");
+  buildBatches(list, visible);
+  if (batches_.empty()) {
+    return;
+  }
+
+  stream_.flush();
+  buildQueue();
+
+  const float aspect_ratio = height_ > 0 ? static_cast<float>(width_) / static_cast<float>(height_) : 1.0f;
+  const glm::mat4 view_proj = list.getCamera().getViewProjectionMatrix(aspect_ratio);
+  const sg_range view_proj_range{glm::value_ptr(view_proj), sizeof(view_proj)};
+  queue_.submit(view_proj_range);
 }
 
 void Renderer::endFrame() {
+  MATFX_PROFILE_ZONE("Renderer::endFrame");
   sg_end_pass();
+  gpu_timer_.endPass();
   sg_commit();
-}
\ No newline at end of file
+}
+
+void Renderer::waitIdle() {
+  MATFX_PROFILE_ZONE("Renderer::waitIdle");
+#ifndef SOKOL_DUMMY_BACKEND
+  glFinish();
+#endif
+}
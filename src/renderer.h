@@ -1,6 +1,37 @@
 #pragma once
 #include <sokol_gfx.h>
 
+#include <cstdint>
+#include <glm.hpp>
+#include <string>
+#include <vector>
+
+#include "components.h"
+#include "frame_allocator.h"
+#include "gpu_timer.h"
+#include "mesh_cache.h"
+#include "pipeline_cache.h"
+#include "render_list.h"
+#include "render_queue.h"
+
+// Counters of the last completed frame, collected at the start of the next one. GPU timings arrive asynchronously
+// and may be a few frames older than the counters, gpu.frame says which frame they belong to.
+struct FrameStats {
+  uint32_t frame_index = 0;  // sokol frame the counters belong to
+  uint32_t draw_calls = 0;
+  uint32_t pipeline_switches = 0;
+  uint32_t binding_switches = 0;
+  uint32_t uniform_updates = 0;
+  uint64_t buffer_upload_bytes = 0;  // sg_update_buffer / sg_append_buffer
+  uint64_t uniform_upload_bytes = 0;
+  uint64_t mesh_upload_bytes = 0;  // new vertex and index buffers created by the mesh cache
+  uint32_t gl_bind_buffer = 0;
+  uint32_t gl_use_program = 0;
+  uint32_t gl_render_state = 0;
+  GpuFrameTiming gpu;
+  double input_to_present_ms = 0.0;  // reported by the frame loop, see FramePacer
+};
+
 class Renderer {
  public:
   Renderer();
@@ -11,17 +42,77 @@ class Renderer {
   Renderer(Renderer &&) = delete;
   Renderer &operator=(Renderer &&) = delete;
 
+  // Before init(): keeps linked GL programs in directory so later starts skip shader compilation, see PipelineCache
+  void setProgramBinaryCache(const std::string &directory, PipelineCache::ProcLoader get_proc_address);
   bool init();
   void shutdown();
 
   void beginFrame(int width, int height);
-  void render();
+  void render(const RenderList &list, const std::vector<uint32_t> &visible);
   void endFrame();
+  // Blocks until the GPU has executed everything submitted, including the last swap. Keeps the driver from queueing
+  // frames ahead in low latency mode.
+  void waitIdle();
+  void setInputLatency(double input_to_present_ms) { frame_stats_.input_to_present_ms = input_to_present_ms; }
+
+  size_t getDrawCallCount() const { return queue_.getStats().draws; }
+  const FrameStats &getFrameStats() const { return frame_stats_; }
+  const RenderQueueStats &getQueueStats() const { return queue_.getStats(); }
+  const FrameAllocatorStats &getStreamStats() const { return stream_.getStats(); }
+  MeshCache &getMeshCache() { return mesh_cache_; }
+  // Materials' own pipelines should come from here so identical ones are shared
+  PipelineCache &getPipelineCache() { return pipeline_cache_; }
 
  private:
-  sg_pipeline pipeline_;
-  sg_buffer vertex_buffer_;
+  struct DrawKey {
+    uint32_t pipeline_id;
+    uint32_t vertex_buffer_id;
+    uint32_t index_buffer_id;
+    uint32_t index_count;
+    uint32_t material_index;
+    bool transparent;
+    float depth;
+    uint32_t item;
+  };
+
+  struct PipelineVariant {
+    sg_pipeline opaque;
+    sg_pipeline transparent;
+  };
+
+  struct InstanceBatch {
+    uint32_t pipeline_id;
+    uint32_t vertex_buffer_id;
+    uint32_t index_buffer_id;
+    uint32_t index_count;
+    uint32_t material_index;
+    bool transparent;
+    float depth;
+    uint32_t instance_offset;  // bytes into stream_
+    uint32_t instance_count;
+  };
+
+  MeshCache mesh_cache_;
+  PipelineCache pipeline_cache_;
+  std::string program_binary_directory_;
+  PipelineCache::ProcLoader get_proc_address_;
+  RenderQueue queue_;
+  GpuTimer gpu_timer_;
+  FrameStats frame_stats_;
+  // Default pipelines indexed by [Mesh::isPacked()][Mesh::usesShortIndices()]. A material's own pipeline has to
+  // match the vertex format and index width of the meshes it is used with.
+  PipelineVariant pipelines_[2][2];
+  // Per-frame data: the instance transforms
+  FrameAllocator stream_;
+  int width_;
+  int height_;
   bool initialized_;
 
-  void setupTriangle();
-};
\ No newline at end of file
+  std::vector<DrawKey> draw_keys_;
+  std::vector<InstanceBatch> batches_;
+
+  void setupPipelines();
+  void buildBatches(const RenderList &list, const std::vector<uint32_t> &visible);
+  void buildQueue();
+  void collectFrameStats();
+};
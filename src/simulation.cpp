@@ -0,0 +1,122 @@
+#include "simulation.h"
+
+#include <sokol_time.h>
+
+#include <cmath>
+#include <entt/entity/registry.hpp>
+#include <utility>
+
+#include "job_system.h"
+#include "profiler.h"
+#include "transform_system.h"
+
+SimulationClock::SimulationClock(double step_seconds, uint32_t max_steps)
+    : step_seconds_(step_seconds), max_steps_(max_steps), last_time_(0), accumulator_(0.0), dropped_seconds_(0.0) {
+  reset();
+}
+
+void SimulationClock::reset() {
+  last_time_ = stm_now();
+  accumulator_ = 0.0;
+}
+
+uint32_t SimulationClock::advance() {
+  accumulator_ += stm_sec(stm_laptime(&last_time_));
+
+  const double max_seconds = step_seconds_ * max_steps_;
+  if (accumulator_ >= max_seconds + step_seconds_) {
+    // Keep the fractional part so alpha stays continuous, only whole steps are given up
+    const double excess = accumulator_ - max_seconds;
+    const double dropped = excess - std::fmod(excess, step_seconds_);
+    dropped_seconds_ += dropped;
+    accumulator_ -= dropped;
+  }
+
+  uint32_t steps = 0;
+  while (accumulator_ >= step_seconds_) {
+    accumulator_ -= step_seconds_;
+    steps++;
+  }
+  return steps;
+}
+
+Simulation::Simulation(entt::registry &registry, JobSystem &jobs, TransformSystem &transforms,
+                       std::vector<entt::organizer::vertex> systems, double step_seconds)
+    : registry_(registry),
+      jobs_(jobs),
+      transforms_(transforms),
+      systems_(std::move(systems)),
+      clock_(step_seconds),
+      tick_(0),
+      steps_last_frame_(0),
+      alpha_(0.0f),
+      kicked_(false),
+      busy_(false),
+      stop_(false) {
+  // Settle the initial state so the first frame has world matrices to draw
+  runStep();
+  clock_.reset();
+  thread_ = std::thread(&Simulation::threadLoop, this);
+}
+
+Simulation::~Simulation() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void Simulation::kick() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    kicked_ = true;
+    busy_ = true;
+  }
+  cv_.notify_all();
+}
+
+void Simulation::wait() {
+  MATFX_PROFILE_ZONE("Simulation::wait");
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return !busy_; });
+}
+
+void Simulation::threadLoop() {
+  MATFX_PROFILE_THREAD("simulation");
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this] { return kicked_ || stop_; });
+    if (stop_) {
+      return;
+    }
+    kicked_ = false;
+
+    lock.unlock();
+    runFrame();
+    lock.lock();
+
+    busy_ = false;
+    cv_.notify_all();
+  }
+}
+
+void Simulation::runFrame() {
+  MATFX_PROFILE_ZONE("Simulation::runFrame");
+  const uint32_t steps = clock_.advance();
+  for (uint32_t i = 0; i < steps; ++i) {
+    runStep();
+  }
+
+  steps_last_frame_ = steps;
+  alpha_ = clock_.getAlpha();
+}
+
+void Simulation::runStep() {
+  MATFX_PROFILE_ZONE("Simulation::runStep");
+  registry_.ctx().insert_or_assign(SimTime{clock_.getStepSeconds(), tick_});
+  transforms_.storePrevious();
+  jobs_.run(systems_, registry_);
+  tick_++;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <entt/entity/organizer.hpp>
+#include <entt/entity/registry.hpp>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+class TransformSystem;
+
+// Registry context variable describing the step being simulated; systems read it to integrate
+struct SimTime {
+  double step_seconds = 0.0;
+  uint64_t tick = 0;
+};
+
+// Fixed timestep accumulator driven by sokol_time. Each frame the elapsed wall time is added and whole steps are
+// consumed; whatever is left over becomes the interpolation factor between the last two steps. When a frame would
+// need more than max_steps steps (a hitch, or a simulation slower than real time) the excess is dropped instead of
+// being carried over, so one slow frame can't make every following frame slower.
+class SimulationClock {
+ public:
+  explicit SimulationClock(double step_seconds = 1.0 / 60.0, uint32_t max_steps = 8);
+
+  void reset();
+
+  // Returns the number of steps to simulate for the wall time elapsed since the last call
+  uint32_t advance();
+
+  double getStepSeconds() const { return step_seconds_; }
+  float getAlpha() const { return static_cast<float>(accumulator_ / step_seconds_); }
+  double getDroppedSeconds() const { return dropped_seconds_; }
+
+ private:
+  double step_seconds_;
+  uint32_t max_steps_;
+  uint64_t last_time_;
+  double accumulator_;
+  double dropped_seconds_;
+};
+
+// Runs the simulation systems at a fixed rate on a dedicated thread, one frame ahead of rendering. The render thread
+// calls wait(), copies what it needs out of the registry, then kick()s the next frame and draws its copy while the
+// simulation moves on. The registry belongs to the simulation thread between kick() and wait().
+class Simulation {
+ public:
+  Simulation(entt::registry &registry, JobSystem &jobs, TransformSystem &transforms,
+             std::vector<entt::organizer::vertex> systems, double step_seconds = 1.0 / 60.0);
+  ~Simulation();
+
+  Simulation(const Simulation &) = delete;
+  Simulation &operator=(const Simulation &) = delete;
+  Simulation(Simulation &&) = delete;
+  Simulation &operator=(Simulation &&) = delete;
+
+  void kick();
+  void wait();
+
+  // Only read these between wait() and the next kick(). Alpha is how far rendering is between the previous and the
+  // current step.
+  float getAlpha() const { return alpha_; }
+  uint64_t getTick() const { return tick_; }
+  uint32_t getStepsLastFrame() const { return steps_last_frame_; }
+  const SimulationClock &getClock() const { return clock_; }
+
+ private:
+  entt::registry &registry_;
+  JobSystem &jobs_;
+  TransformSystem &transforms_;
+  std::vector<entt::organizer::vertex> systems_;
+  SimulationClock clock_;
+
+  uint64_t tick_;
+  uint32_t steps_last_frame_;
+  float alpha_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool kicked_;
+  bool busy_;
+  bool stop_;
+  std::thread thread_;
+
+  void threadLoop();
+  void runFrame();
+  void runStep();
+};
@@ -0,0 +1,562 @@
+#include "software_renderer.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <sokol_time.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "hash.h"
+#include "job_system.h"
+#include "profiler.h"
+#include "vertex_packing.h"
+
+// Screen coordinates stay within this many pixels outside the viewport. Together with max_size and the largest tile
+// it keeps edge function values inside a tile within 32 bits.
+static constexpr float guard_band = 4096.0f;
+static constexpr int subpixel_bits = 4;
+static constexpr int subpixels = 1 << subpixel_bits;
+static constexpr uint32_t max_tile_size = 128;
+// Draws are split into batches of at least this many, and at most max_batches batches
+static constexpr size_t min_batch_draws = 16;
+static constexpr size_t max_batches = 64;
+static constexpr uint32_t clear_color = 0xff000000u;
+
+// Frustum planes in bits 0-5 for trivial rejection, needs_clip when a vertex is behind the near plane or outside the
+// guard band
+static constexpr uint32_t needs_clip = 1u << 6;
+
+static uint32_t clip_code(const glm::vec4 &p, float guard_x, float guard_y) {
+  uint32_t code = 0;
+  code |= p.x < -p.w ? 1u : 0u;
+  code |= p.x > p.w ? 2u : 0u;
+  code |= p.y < -p.w ? 4u : 0u;
+  code |= p.y > p.w ? 8u : 0u;
+  code |= p.z < -p.w ? 16u | needs_clip : 0u;
+  code |= p.z > p.w ? 32u : 0u;
+  if (std::abs(p.x) > guard_x * p.w || std::abs(p.y) > guard_y * p.w) {
+    code |= needs_clip;
+  }
+  return code;
+}
+
+// The default fragment shader's lighting, done once per vertex
+static glm::vec4 shade_vertex(const glm::vec3 &normal, const glm::vec2 &texcoord, const glm::vec4 &color) {
+  const glm::vec3 light_dir(0.3244428f, 0.8111071f, 0.4866643f);  // normalize(0.4, 1.0, 0.6)
+  const float length = glm::length(normal);
+  const float diffuse = length > 0.0f ? std::max(glm::dot(normal, light_dir) / length, 0.0f) : 0.0f;
+  const glm::vec3 base(0.6f + 0.4f * texcoord.x, 0.6f + 0.4f * texcoord.y, 0.8f);
+  return glm::vec4(base * (0.2f + 0.8f * diffuse), 1.0f) * color;
+}
+
+SoftwareRenderer::SoftwareRenderer(JobSystem &jobs, uint32_t tile_size)
+    : jobs_(jobs),
+      tile_size_(std::clamp((tile_size + 7) & ~7u, 8u, max_tile_size)),
+      width_(0),
+      height_(0),
+      stride_(0),
+      tiles_x_(0),
+      tiles_y_(0),
+      guard_x_(1.0f),
+      guard_y_(1.0f),
+      batch_count_(0) {}
+
+void SoftwareRenderer::beginFrame(int width, int height) {
+  width_ = std::clamp(width, 0, max_size);
+  height_ = std::clamp(height, 0, max_size);
+  tiles_x_ = (static_cast<uint32_t>(width_) + tile_size_ - 1) / tile_size_;
+  tiles_y_ = (static_cast<uint32_t>(height_) + tile_size_ - 1) / tile_size_;
+  // Rows are padded to whole tiles so eight pixel spans never need a tail
+  stride_ = static_cast<size_t>(tiles_x_) * tile_size_;
+  color_.resize(stride_ * height_);
+  depth_.resize(stride_ * height_);
+  guard_x_ = width_ > 0 ? 1.0f + 2.0f * guard_band / static_cast<float>(width_) : 1.0f;
+  guard_y_ = height_ > 0 ? 1.0f + 2.0f * guard_band / static_cast<float>(height_) : 1.0f;
+}
+
+void SoftwareRenderer::render(const RenderList &list, const std::vector<uint32_t> &visible) {
+  MATFX_PROFILE_ZONE("SoftwareRenderer::render");
+  stats_ = {};
+  if (width_ == 0 || height_ == 0) {
+    return;
+  }
+  uint64_t lap = stm_now();
+
+  // Opaque items in the order given, then transparent ones back to front
+  const Camera &camera = list.getCamera();
+  const std::vector<RenderItem> &items = list.getItems();
+  const std::vector<glm::mat4> &world = list.getWorld();
+  draws_.clear();
+  for (uint32_t index : visible) {
+    const RenderItem &item = items[index];
+    if (item.mesh->getIndexCount() < 3) {
+      continue;
+    }
+    const float distance = glm::length(glm::vec3(world[index][3]) - camera.position);
+    draws_.push_back({index, item.material.transparent, distance});
+    stats_.triangles += item.mesh->getIndexCount() / 3;
+  }
+  const auto transparent = std::stable_partition(draws_.begin(), draws_.end(), [](const Draw &d) {
+    return !d.transparent;
+  });
+  std::stable_sort(transparent, draws_.end(), [](const Draw &a, const Draw &b) { return a.distance > b.distance; });
+  stats_.draws = static_cast<uint32_t>(draws_.size());
+
+  const size_t tile_count = static_cast<size_t>(tiles_x_) * tiles_y_;
+  const size_t batch_draws = std::max(min_batch_draws, (draws_.size() + max_batches - 1) / max_batches);
+  batch_count_ = (draws_.size() + batch_draws - 1) / batch_draws;
+  if (batches_.size() < batch_count_) {
+    batches_.resize(batch_count_);
+  }
+  for (size_t b = 0; b < batch_count_; ++b) {
+    batches_[b].first_draw = b * batch_draws;
+    batches_[b].draw_count = std::min(batch_draws, draws_.size() - b * batch_draws);
+    batches_[b].bins.resize(tile_count);
+  }
+
+  const float aspect_ratio = static_cast<float>(width_) / static_cast<float>(height_);
+  const glm::mat4 view_proj = camera.getViewProjectionMatrix(aspect_ratio);
+  jobs_.parallelFor(batch_count_, 1, [&](size_t begin, size_t end) {
+    for (size_t b = begin; b < end; ++b) {
+      processBatch(batches_[b], list, view_proj);
+    }
+  });
+  for (size_t b = 0; b < batch_count_; ++b) {
+    const Batch &batch = batches_[b];
+    stats_.triangles_culled += batch.triangles_culled;
+    stats_.triangles_clipped += batch.triangles_clipped;
+    stats_.triangles_rasterized += batch.triangles.size();
+    stats_.tile_triangles += batch.tile_triangles;
+  }
+  stats_.geometry_ms = stm_ms(stm_laptime(&lap));
+
+  jobs_.parallelFor(tile_count, 1, [&](size_t begin, size_t end) {
+    for (size_t tile = begin; tile < end; ++tile) {
+      rasterizeTile(static_cast<uint32_t>(tile));
+    }
+  });
+  stats_.raster_ms = stm_ms(stm_laptime(&lap));
+}
+
+uint64_t SoftwareRenderer::hashImage() const {
+  uint64_t h = 0;
+  for (int y = 0; y < height_; ++y) {
+    h = hashBytes(color_.data() + y * stride_, static_cast<size_t>(width_) * sizeof(uint32_t), h);
+  }
+  return h;
+}
+
+void SoftwareRenderer::processBatch(Batch &batch, const RenderList &list, const glm::mat4 &view_proj) {
+  batch.triangles.clear();
+  for (std::vector<uint32_t> &bin : batch.bins) {
+    bin.clear();
+  }
+  batch.triangles_culled = 0;
+  batch.triangles_clipped = 0;
+  batch.tile_triangles = 0;
+
+  const std::vector<RenderItem> &items = list.getItems();
+  const std::vector<glm::mat4> &world = list.getWorld();
+  for (size_t d = batch.first_draw; d < batch.first_draw + batch.draw_count; ++d) {
+    const Draw &draw = draws_[d];
+    const RenderItem &item = items[draw.item];
+    const Mesh &mesh = *item.mesh;
+    const size_t vertex_count = mesh.getVertexCount();
+
+    const Vertex *vertices = mesh.vertices.data();
+    if (mesh.isPacked()) {
+      const PackedVertex *packed =
+          mesh.blob ? static_cast<const PackedVertex *>(mesh.blob->vertices) : mesh.packed_vertices.data();
+      batch.vertices.resize(vertex_count);
+      for (size_t i = 0; i < vertex_count; ++i) {
+        batch.vertices[i] = unpackVertex(mesh, packed[i]);
+      }
+      vertices = batch.vertices.data();
+    } else if (mesh.blob) {
+      vertices = static_cast<const Vertex *>(mesh.blob->vertices);
+    }
+
+    const glm::mat4 &model = world[draw.item];
+    const glm::mat4 model_view_proj = view_proj * model;
+    const glm::mat3 normal_matrix(model);
+    batch.clip.resize(vertex_count);
+    batch.screen.resize(vertex_count);
+    batch.codes.resize(vertex_count);
+    for (size_t i = 0; i < vertex_count; ++i) {
+      const Vertex &vertex = vertices[i];
+      ClipVertex &clip = batch.clip[i];
+      clip.position = model_view_proj * glm::vec4(vertex.position, 1.0f);
+      clip.color = shade_vertex(normal_matrix * vertex.normal, vertex.texcoord, item.material.color);
+      batch.codes[i] = clip_code(clip.position, guard_x_, guard_y_);
+      if (!(batch.codes[i] & needs_clip)) {
+        batch.screen[i] = project(clip.position);
+      }
+    }
+
+    if (!mesh.blob) {
+      assemble(batch, mesh.indices.data(), mesh.indices.size(), draw.transparent);
+    } else if (mesh.blob->short_indices) {
+      assemble(batch, static_cast<const uint16_t *>(mesh.blob->indices), mesh.blob->index_count, draw.transparent);
+    } else {
+      assemble(batch, static_cast<const uint32_t *>(mesh.blob->indices), mesh.blob->index_count, draw.transparent);
+    }
+  }
+}
+
+template <typename Index>
+void SoftwareRenderer::assemble(Batch &batch, const Index *indices, size_t index_count, bool transparent) {
+  for (size_t i = 0; i + 2 < index_count; i += 3) {
+    const uint32_t i0 = indices[i], i1 = indices[i + 1], i2 = indices[i + 2];
+    const uint32_t c0 = batch.codes[i0], c1 = batch.codes[i1], c2 = batch.codes[i2];
+    if (c0 & c1 & c2 & ~needs_clip) {
+      batch.triangles_culled++;
+    } else if ((c0 | c1 | c2) & needs_clip) {
+      const ClipVertex triangle[3] = {batch.clip[i0], batch.clip[i1], batch.clip[i2]};
+      clipTriangle(batch, triangle, transparent);
+    } else {
+      const ScreenVertex screen[3] = {batch.screen[i0], batch.screen[i1], batch.screen[i2]};
+      const glm::vec4 *colors[3] = {&batch.clip[i0].color, &batch.clip[i1].color, &batch.clip[i2].color};
+      setupTriangle(batch, screen, colors, transparent);
+    }
+  }
+}
+
+// Sutherland-Hodgman against the near plane and the guard band in clip space, the polygon left over is drawn as a fan
+void SoftwareRenderer::clipTriangle(Batch &batch, const ClipVertex (&triangle)[3], bool transparent) {
+  batch.triangles_clipped++;
+  const glm::vec4 planes[5] = {{0.0f, 0.0f, 1.0f, 1.0f},
+                               {1.0f, 0.0f, 0.0f, guard_x_},
+                               {-1.0f, 0.0f, 0.0f, guard_x_},
+                               {0.0f, 1.0f, 0.0f, guard_y_},
+                               {0.0f, -1.0f, 0.0f, guard_y_}};
+
+  // Every plane adds at most one vertex
+  ClipVertex buffers[2][8];
+  ClipVertex *polygon = buffers[0];
+  ClipVertex *next = buffers[1];
+  size_t count = 3;
+  std::copy(std::begin(triangle), std::end(triangle), polygon);
+
+  for (const glm::vec4 &plane : planes) {
+    size_t next_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+      const ClipVertex &a = polygon[i];
+      const ClipVertex &b = polygon[(i + 1) % count];
+      const float da = glm::dot(plane, a.position);
+      const float db = glm::dot(plane, b.position);
+      if (da >= 0.0f) {
+        next[next_count++] = a;
+      }
+      if ((da >= 0.0f) != (db >= 0.0f)) {
+        const float t = da / (da - db);
+        next[next_count++] = {glm::mix(a.position, b.position, t), glm::mix(a.color, b.color, t)};
+      }
+    }
+    std::swap(polygon, next);
+    count = next_count;
+    if (count < 3) {
+      batch.triangles_culled++;
+      return;
+    }
+  }
+
+  for (size_t i = 1; i + 1 < count; ++i) {
+    const ScreenVertex screen[3] = {project(polygon[0].position), project(polygon[i].position),
+                                    project(polygon[i + 1].position)};
+    const glm::vec4 *colors[3] = {&polygon[0].color, &polygon[i].color, &polygon[i + 1].color};
+    setupTriangle(batch, screen, colors, transparent);
+  }
+}
+
+SoftwareRenderer::ScreenVertex SoftwareRenderer::project(const glm::vec4 &position) const {
+  const float inv_w = 1.0f / position.w;
+  const float half_width = 0.5f * subpixels * static_cast<float>(width_);
+  const float half_height = 0.5f * subpixels * static_cast<float>(height_);
+  return {static_cast<int32_t>(std::lrint((position.x * inv_w + 1.0f) * half_width)),
+          static_cast<int32_t>(std::lrint((1.0f - position.y * inv_w) * half_height)),
+          position.z * inv_w * 0.5f + 0.5f};
+}
+
+void SoftwareRenderer::setupTriangle(Batch &batch, const ScreenVertex (&screen)[3], const glm::vec4 *(&colors)[3],
+                                     bool transparent) {
+  int64_t x[3] = {screen[0].x, screen[1].x, screen[2].x};
+  int64_t y[3] = {screen[0].y, screen[1].y, screen[2].y};
+  float z[3] = {screen[0].z, screen[1].z, screen[2].z};
+
+  // Counter-clockwise in GL's y-up clip space is clockwise on the y-down screen, which has a negative area here.
+  // Swapping two corners turns front faces positive so every edge function is positive inside.
+  const int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+  if (area >= 0) {
+    batch.triangles_culled++;
+    return;
+  }
+  std::swap(x[1], x[2]);
+  std::swap(y[1], y[2]);
+  std::swap(z[1], z[2]);
+  std::swap(colors[1], colors[2]);
+
+  // Pixels whose centre lies within the bounding box
+  const int64_t half_pixel = subpixels / 2;
+  Triangle triangle;
+  triangle.min_x = static_cast<int32_t>((std::min({x[0], x[1], x[2]}) - half_pixel + subpixels - 1) >> subpixel_bits);
+  triangle.min_y = static_cast<int32_t>((std::min({y[0], y[1], y[2]}) - half_pixel + subpixels - 1) >> subpixel_bits);
+  triangle.max_x = static_cast<int32_t>((std::max({x[0], x[1], x[2]}) - half_pixel) >> subpixel_bits);
+  triangle.max_y = static_cast<int32_t>((std::max({y[0], y[1], y[2]}) - half_pixel) >> subpixel_bits);
+  triangle.min_x = std::max(triangle.min_x, 0);
+  triangle.min_y = std::max(triangle.min_y, 0);
+  triangle.max_x = std::min(triangle.max_x, width_ - 1);
+  triangle.max_y = std::min(triangle.max_y, height_ - 1);
+  if (triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y) {
+    batch.triangles_culled++;
+    return;
+  }
+
+  // Edge i runs between the two other corners, its function is the doubled area of the triangle it forms with the
+  // sample point, so divided by the area it is the barycentric weight of corner i
+  const float inv_area = 1.0f / static_cast<float>(-area);
+  const int64_t origin_x = triangle.min_x * subpixels + half_pixel;
+  const int64_t origin_y = triangle.min_y * subpixels + half_pixel;
+  float weight[3], weight_dx[3], weight_dy[3];
+  for (int i = 0; i < 3; ++i) {
+    const int j = (i + 1) % 3;
+    const int k = (i + 2) % 3;
+    const int64_t a = y[j] - y[k];
+    const int64_t b = x[k] - x[j];
+    const int64_t c = -(a * x[j] + b * y[j]);
+    // Samples exactly on an edge belong to the triangle if the edge is a top or a left one
+    const bool top_left = a > 0 || (a == 0 && b > 0);
+    triangle.edge_a[i] = static_cast<int32_t>(a);
+    triangle.edge_b[i] = static_cast<int32_t>(b);
+    triangle.edge_c[i] = c - (top_left ? 0 : 1);
+
+    weight[i] = static_cast<float>(a * origin_x + b * origin_y + c) * inv_area;
+    weight_dx[i] = static_cast<float>(a * subpixels) * inv_area;
+    weight_dy[i] = static_cast<float>(b * subpixels) * inv_area;
+  }
+
+  auto plane = [&](float (&out)[3], float a0, float a1, float a2) {
+    out[0] = weight[0] * a0 + weight[1] * a1 + weight[2] * a2;
+    out[1] = weight_dx[0] * a0 + weight_dx[1] * a1 + weight_dx[2] * a2;
+    out[2] = weight_dy[0] * a0 + weight_dy[1] * a1 + weight_dy[2] * a2;
+  };
+  plane(triangle.depth, z[0], z[1], z[2]);
+  plane(triangle.red, colors[0]->r, colors[1]->r, colors[2]->r);
+  plane(triangle.green, colors[0]->g, colors[1]->g, colors[2]->g);
+  plane(triangle.blue, colors[0]->b, colors[1]->b, colors[2]->b);
+  triangle.alpha = std::clamp(colors[0]->a, 0.0f, 1.0f);
+  triangle.blend = transparent;
+
+  const uint32_t index = static_cast<uint32_t>(batch.triangles.size());
+  batch.triangles.push_back(triangle);
+  const uint32_t tile_x0 = static_cast<uint32_t>(triangle.min_x) / tile_size_;
+  const uint32_t tile_x1 = static_cast<uint32_t>(triangle.max_x) / tile_size_;
+  const uint32_t tile_y0 = static_cast<uint32_t>(triangle.min_y) / tile_size_;
+  const uint32_t tile_y1 = static_cast<uint32_t>(triangle.max_y) / tile_size_;
+  for (uint32_t ty = tile_y0; ty <= tile_y1; ++ty) {
+    for (uint32_t tx = tile_x0; tx <= tile_x1; ++tx) {
+      batch.bins[ty * tiles_x_ + tx].push_back(index);
+    }
+  }
+  batch.tile_triangles += (tile_x1 - tile_x0 + 1) * (tile_y1 - tile_y0 + 1);
+}
+
+void SoftwareRenderer::rasterizeTile(uint32_t tile) {
+  const int x0 = static_cast<int>((tile % tiles_x_) * tile_size_);
+  const int y0 = static_cast<int>((tile / tiles_x_) * tile_size_);
+  const int x1 = std::min(x0 + static_cast<int>(tile_size_), width_);
+  const int y1 = std::min(y0 + static_cast<int>(tile_size_), height_);
+
+  for (int y = y0; y < y1; ++y) {
+    std::fill_n(color_.data() + y * stride_ + x0, tile_size_, clear_color);
+    std::fill_n(depth_.data() + y * stride_ + x0, tile_size_, 1.0f);
+  }
+  for (size_t b = 0; b < batch_count_; ++b) {
+    const Batch &batch = batches_[b];
+    for (uint32_t index : batch.bins[tile]) {
+      rasterizeTriangle(batch.triangles[index], x0, y0, x1, y1);
+    }
+  }
+}
+
+void SoftwareRenderer::rasterizeTriangle(const Triangle &triangle, int tile_x0, int tile_y0, int tile_x1,
+                                         int tile_y1) {
+  const int min_x = std::max(triangle.min_x, tile_x0);
+  const int min_y = std::max(triangle.min_y, tile_y0);
+  const int max_x = std::min(triangle.max_x, tile_x1 - 1);
+  const int max_y = std::min(triangle.max_y, tile_y1 - 1);
+  if (min_x > max_x || min_y > max_y) {
+    return;
+  }
+
+  // Spans of eight pixels start on multiples of eight; tiles are too, so a span never reaches into another tile
+  const int start_x = min_x & ~7;
+  const int spans = (max_x - start_x) / 8 + 1;
+  const int rows = max_y - min_y + 1;
+
+  // Edges that pass the whole rectangle drop out of the test. The others cross it, which bounds their values inside
+  // it to what 32 bits hold.
+  int32_t step_x[3], step_y[3], row_value[3];
+  for (int i = 0; i < 3; ++i) {
+    const int64_t dx = static_cast<int64_t>(triangle.edge_a[i]) * subpixels;
+    const int64_t dy = static_cast<int64_t>(triangle.edge_b[i]) * subpixels;
+    const int64_t value = dx * start_x + dy * min_y + triangle.edge_c[i] +
+                          (static_cast<int64_t>(triangle.edge_a[i]) + triangle.edge_b[i]) * (subpixels / 2);
+    const int64_t lowest = value + std::min<int64_t>(0, dx * (spans * 8 - 1)) + std::min<int64_t>(0, dy * (rows - 1));
+    const int64_t highest = value + std::max<int64_t>(0, dx * (spans * 8 - 1)) + std::max<int64_t>(0, dy * (rows - 1));
+    if (highest < 0) {
+      return;
+    }
+    if (lowest >= 0) {
+      step_x[i] = step_y[i] = row_value[i] = 0;
+    } else {
+      step_x[i] = static_cast<int32_t>(dx);
+      step_y[i] = static_cast<int32_t>(dy);
+      row_value[i] = static_cast<int32_t>(value);
+    }
+  }
+
+  const float offset_x = static_cast<float>(start_x - triangle.min_x);
+  const float offset_y = static_cast<float>(min_y - triangle.min_y);
+  float row_depth = triangle.depth[0] + triangle.depth[1] * offset_x + triangle.depth[2] * offset_y;
+  float row_red = triangle.red[0] + triangle.red[1] * offset_x + triangle.red[2] * offset_y;
+  float row_green = triangle.green[0] + triangle.green[1] * offset_x + triangle.green[2] * offset_y;
+  float row_blue = triangle.blue[0] + triangle.blue[1] * offset_x + triangle.blue[2] * offset_y;
+
+#ifdef __AVX2__
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256 lanes_f = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+  const __m256i minus_one = _mm256_set1_epi32(-1);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 to_byte = _mm256_set1_ps(255.0f);
+  const __m256 from_byte = _mm256_set1_ps(1.0f / 255.0f);
+  const __m256i byte_mask = _mm256_set1_epi32(0xff);
+  const __m256 alpha = _mm256_set1_ps(triangle.alpha);
+  const __m256 inv_alpha = _mm256_set1_ps(1.0f - triangle.alpha);
+  const __m256i alpha_bits = _mm256_set1_epi32(static_cast<int32_t>(std::lrint(triangle.alpha * 255.0f)) << 24);
+
+  __m256i lane_edge[3], span_edge[3];
+  for (int i = 0; i < 3; ++i) {
+    lane_edge[i] = _mm256_mullo_epi32(_mm256_set1_epi32(step_x[i]), lanes);
+    span_edge[i] = _mm256_set1_epi32(step_x[i] * 8);
+  }
+  auto lane_plane = [&](float start, float dx) {
+    return _mm256_add_ps(_mm256_set1_ps(start), _mm256_mul_ps(_mm256_set1_ps(dx), lanes_f));
+  };
+  auto quantize = [&](__m256 value) {
+    return _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(value, zero), one), to_byte));
+  };
+  auto channel = [&](__m256i pixels, int shift) {
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, shift), byte_mask)),
+                         from_byte);
+  };
+  const __m256 span_depth = _mm256_set1_ps(triangle.depth[1] * 8.0f);
+  const __m256 span_red = _mm256_set1_ps(triangle.red[1] * 8.0f);
+  const __m256 span_green = _mm256_set1_ps(triangle.green[1] * 8.0f);
+  const __m256 span_blue = _mm256_set1_ps(triangle.blue[1] * 8.0f);
+
+  for (int y = min_y; y <= max_y; ++y) {
+    uint32_t *color_row = color_.data() + y * stride_;
+    float *depth_row = depth_.data() + y * stride_;
+    __m256i e0 = _mm256_add_epi32(_mm256_set1_epi32(row_value[0]), lane_edge[0]);
+    __m256i e1 = _mm256_add_epi32(_mm256_set1_epi32(row_value[1]), lane_edge[1]);
+    __m256i e2 = _mm256_add_epi32(_mm256_set1_epi32(row_value[2]), lane_edge[2]);
+    __m256 depth = lane_plane(row_depth, triangle.depth[1]);
+    __m256 red = lane_plane(row_red, triangle.red[1]);
+    __m256 green = lane_plane(row_green, triangle.green[1]);
+    __m256 blue = lane_plane(row_blue, triangle.blue[1]);
+
+    for (int x = start_x; x < start_x + spans * 8; x += 8) {
+      // Inside where no edge function is negative
+      const __m256i covered = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(e0, e1), e2), minus_one);
+      if (!_mm256_testz_si256(covered, covered)) {
+        const __m256 stored = _mm256_loadu_ps(depth_row + x);
+        const __m256 pass = _mm256_and_ps(_mm256_castsi256_ps(covered), _mm256_cmp_ps(depth, stored, _CMP_LE_OQ));
+        if (_mm256_movemask_ps(pass)) {
+          const __m256i mask = _mm256_castps_si256(pass);
+          auto *pixels = reinterpret_cast<int *>(color_row + x);
+          __m256i rgba;
+          if (triangle.blend) {
+            const __m256i dst = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixels));
+            const __m256 r = _mm256_add_ps(_mm256_mul_ps(red, alpha), _mm256_mul_ps(channel(dst, 0), inv_alpha));
+            const __m256 g = _mm256_add_ps(_mm256_mul_ps(green, alpha), _mm256_mul_ps(channel(dst, 8), inv_alpha));
+            const __m256 b = _mm256_add_ps(_mm256_mul_ps(blue, alpha), _mm256_mul_ps(channel(dst, 16), inv_alpha));
+            const __m256 a = _mm256_add_ps(alpha, _mm256_mul_ps(channel(dst, 24), inv_alpha));
+            rgba = _mm256_or_si256(_mm256_or_si256(quantize(r), _mm256_slli_epi32(quantize(g), 8)),
+                                   _mm256_or_si256(_mm256_slli_epi32(quantize(b), 16),
+                                                   _mm256_slli_epi32(quantize(a), 24)));
+          } else {
+            rgba = _mm256_or_si256(_mm256_or_si256(quantize(red), _mm256_slli_epi32(quantize(green), 8)),
+                                   _mm256_or_si256(_mm256_slli_epi32(quantize(blue), 16), alpha_bits));
+            _mm256_maskstore_ps(depth_row + x, mask, depth);
+          }
+          _mm256_maskstore_epi32(pixels, mask, rgba);
+        }
+      }
+      e0 = _mm256_add_epi32(e0, span_edge[0]);
+      e1 = _mm256_add_epi32(e1, span_edge[1]);
+      e2 = _mm256_add_epi32(e2, span_edge[2]);
+      depth = _mm256_add_ps(depth, span_depth);
+      red = _mm256_add_ps(red, span_red);
+      green = _mm256_add_ps(green, span_green);
+      blue = _mm256_add_ps(blue, span_blue);
+    }
+
+    for (int i = 0; i < 3; ++i) {
+      row_value[i] += step_y[i];
+    }
+    row_depth += triangle.depth[2];
+    row_red += triangle.red[2];
+    row_green += triangle.green[2];
+    row_blue += triangle.blue[2];
+  }
+#else
+  auto quantize = [](float value) {
+    return static_cast<uint32_t>(std::lrint(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+  };
+  auto channel = [](uint32_t pixel, int shift) { return static_cast<float>((pixel >> shift) & 0xff) / 255.0f; };
+  const uint32_t alpha_bits = quantize(triangle.alpha) << 24;
+
+  for (int y = min_y; y <= max_y; ++y) {
+    uint32_t *color_row = color_.data() + y * stride_;
+    float *depth_row = depth_.data() + y * stride_;
+    for (int x = start_x; x < start_x + spans * 8; ++x) {
+      const int lane = x - start_x;
+      const float dx = static_cast<float>(lane);
+      if ((row_value[0] + step_x[0] * lane) < 0 || (row_value[1] + step_x[1] * lane) < 0 ||
+          (row_value[2] + step_x[2] * lane) < 0) {
+        continue;
+      }
+      const float depth = row_depth + triangle.depth[1] * dx;
+      if (!(depth <= depth_row[x])) {
+        continue;
+      }
+      const float red = row_red + triangle.red[1] * dx;
+      const float green = row_green + triangle.green[1] * dx;
+      const float blue = row_blue + triangle.blue[1] * dx;
+      if (triangle.blend) {
+        const uint32_t dst = color_row[x];
+        const float inv_alpha = 1.0f - triangle.alpha;
+        color_row[x] = quantize(red * triangle.alpha + channel(dst, 0) * inv_alpha) |
+                       quantize(green * triangle.alpha + channel(dst, 8) * inv_alpha) << 8 |
+                       quantize(blue * triangle.alpha + channel(dst, 16) * inv_alpha) << 16 |
+                       quantize(triangle.alpha + channel(dst, 24) * inv_alpha) << 24;
+      } else {
+        color_row[x] = quantize(red) | quantize(green) << 8 | quantize(blue) << 16 | alpha_bits;
+        depth_row[x] = depth;
+      }
+    }
+
+    for (int i = 0; i < 3; ++i) {
+      row_value[i] += step_y[i];
+    }
+    row_depth += triangle.depth[2];
+    row_red += triangle.red[2];
+    row_green += triangle.green[2];
+    row_blue += triangle.blue[2];
+  }
+#endif
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <glm.hpp>
+#include <vector>
+
+#include "components.h"
+#include "render_list.h"
+
+class JobSystem;
+
+// Counters of the last render() call
+struct SoftwareRenderStats {
+  uint32_t draws = 0;
+  uint64_t triangles = 0;             // triangles of the meshes drawn
+  uint64_t triangles_culled = 0;      // back facing, outside the frustum or between pixel centres
+  uint64_t triangles_clipped = 0;     // crossed the near plane or the guard band and were clipped
+  uint64_t triangles_rasterized = 0;  // set up and binned, clipping may have split one into several
+  uint64_t tile_triangles = 0;        // bin entries, a triangle counts once for every tile it overlaps
+  double geometry_ms = 0.0;
+  double raster_ms = 0.0;
+};
+
+// CPU rendering backend for hosts without a GPU. Draws the same render list and visible indices as Renderer into an
+// in-memory RGBA8 colour and float depth buffer, with the default pipelines' state: back faces culled, depth tested
+// less-or-equal, transparent materials blended back to front over the opaque scene without writing depth.
+//
+//   geometry   visible items in fixed batches on the job system: vertices transformed and lit, triangles clipped,
+//              set up in 28.4 fixed point and binned into screen tiles
+//   raster     one job per tile: cleared, then every triangle binned to it in draw order, eight pixels at a time
+//
+// Batches depend only on the number of draws and every tile sees its triangles in draw order, so the image is the
+// same whatever the number of workers. Lighting is the default fragment shader's evaluated per vertex, the colour is
+// interpolated linearly in screen space; edges and depth follow GL's rules (top-left fill, pixel centre sampling).
+// Triangles are clipped against the near plane and a guard band, everything else is scissored per tile.
+class SoftwareRenderer {
+ public:
+  explicit SoftwareRenderer(JobSystem &jobs, uint32_t tile_size = 64);
+
+  SoftwareRenderer(const SoftwareRenderer &) = delete;
+  SoftwareRenderer &operator=(const SoftwareRenderer &) = delete;
+  SoftwareRenderer(SoftwareRenderer &&) = delete;
+  SoftwareRenderer &operator=(SoftwareRenderer &&) = delete;
+
+  // Sizes the framebuffer, at most max_size pixels on a side
+  void beginFrame(int width, int height);
+  // Clears and draws the frame, once per beginFrame()
+  void render(const RenderList &list, const std::vector<uint32_t> &visible);
+
+  int getWidth() const { return width_; }
+  int getHeight() const { return height_; }
+  // RGBA8 pixels row after row, getStride() pixels apart, top row first
+  const uint32_t *getPixels() const { return color_.data(); }
+  const float *getDepth() const { return depth_.data(); }
+  size_t getStride() const { return stride_; }
+  // Hash of the visible pixels, for comparing against golden images
+  uint64_t hashImage() const;
+
+  const SoftwareRenderStats &getStats() const { return stats_; }
+
+  static constexpr int max_size = 8192;
+
+ private:
+  // A triangle after setup. Edge functions are in 28.4 fixed point with the fill rule folded into c; attributes are
+  // planes over whole pixels relative to the bounding box's top left corner.
+  struct Triangle {
+    int32_t edge_a[3];
+    int32_t edge_b[3];
+    int64_t edge_c[3];
+    int32_t min_x, min_y, max_x, max_y;
+    float depth[3];  // value at the corner, per pixel in x, per pixel in y
+    float red[3];
+    float green[3];
+    float blue[3];
+    float alpha;
+    bool blend;
+  };
+
+  struct Draw {
+    uint32_t item;
+    bool transparent;
+    float distance;
+  };
+
+  struct ClipVertex {
+    glm::vec4 position;
+    glm::vec4 color;
+  };
+
+  // 28.4 fixed point pixel position and depth after the perspective divide
+  struct ScreenVertex {
+    int32_t x, y;
+    float z;
+  };
+
+  // A fixed range of draws with its own triangles and bins
+  struct Batch {
+    size_t first_draw;
+    size_t draw_count;
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<uint32_t>> bins;  // triangle indices per tile
+    std::vector<Vertex> vertices;             // decoded vertices of packed meshes
+    std::vector<ClipVertex> clip;             // clip space positions and lit colours of the current mesh
+    std::vector<ScreenVertex> screen;         // their screen positions, valid where the clip code needs no clipping
+    std::vector<uint32_t> codes;
+    uint64_t triangles_culled;
+    uint64_t triangles_clipped;
+    uint64_t tile_triangles;
+  };
+
+  JobSystem &jobs_;
+  uint32_t tile_size_;
+  int width_;
+  int height_;
+  size_t stride_;
+  uint32_t tiles_x_;
+  uint32_t tiles_y_;
+  float guard_x_;  // guard band planes in clip space, |x| <= guard_x_ * w
+  float guard_y_;
+  std::vector<uint32_t> color_;
+  std::vector<float> depth_;
+
+  std::vector<Draw> draws_;
+  std::vector<Batch> batches_;  // only the first batch_count_ are in use, the rest keep their memory
+  size_t batch_count_;
+  SoftwareRenderStats stats_;
+
+  void processBatch(Batch &batch, const RenderList &list, const glm::mat4 &view_proj);
+  template <typename Index>
+  void assemble(Batch &batch, const Index *indices, size_t index_count, bool transparent);
+  void clipTriangle(Batch &batch, const ClipVertex (&triangle)[3], bool transparent);
+  ScreenVertex project(const glm::vec4 &position) const;
+  void setupTriangle(Batch &batch, const ScreenVertex (&screen)[3], const glm::vec4 *(&colors)[3], bool transparent);
+  void rasterizeTile(uint32_t tile);
+  void rasterizeTriangle(const Triangle &triangle, int tile_x0, int tile_y0, int tile_x1, int tile_y1);
+};
@@ -0,0 +1,1103 @@
+#include "spatial_index.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <sokol_time.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <entt/entity/registry.hpp>
+#include <limits>
+
+#include "frame_log.h"
+#include "job_system.h"
+#include "profiler.h"
+
+static constexpr float infinity = std::numeric_limits<float>::infinity();
+
+// LSD radix sort over 8-bit digits like RenderQueue::sort(), digits equal across all entities (usually the version)
+// are skipped
+static void sort_entities(std::vector<entt::entity> &entities, std::vector<entt::entity> &scratch) {
+  scratch.resize(entities.size());
+  entt::entity *src = entities.data();
+  entt::entity *dst = scratch.data();
+  const size_t count = entities.size();
+
+  for (int shift = 0; shift < 32; shift += 8) {
+    std::array<uint32_t, 256> histogram{};
+    for (size_t i = 0; i < count; ++i) {
+      histogram[(entt::to_integral(src[i]) >> shift) & 0xff]++;
+    }
+    if (count == 0 || histogram[(entt::to_integral(src[0]) >> shift) & 0xff] == count) {
+      continue;
+    }
+
+    uint32_t offset = 0;
+    for (uint32_t &bucket : histogram) {
+      const uint32_t bucket_count = bucket;
+      bucket = offset;
+      offset += bucket_count;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      dst[histogram[(entt::to_integral(src[i]) >> shift) & 0xff]++] = src[i];
+    }
+    std::swap(src, dst);
+  }
+
+  if (src != entities.data()) {
+    entities.swap(scratch);
+  }
+}
+
+// Explicit traversal stack; deep trees, which only incremental updates produce, spill to the heap
+template <typename T>
+class TraversalStack {
+ public:
+  bool empty() const { return size_ == 0; }
+  void push(const T &value) {
+    if (size_ < local_capacity) {
+      local_[size_++] = value;
+    } else {
+      spill_.push_back(value);
+      size_++;
+    }
+  }
+  T pop() {
+    size_--;
+    if (size_ < local_capacity) {
+      return local_[size_];
+    }
+    const T value = spill_.back();
+    spill_.pop_back();
+    return value;
+  }
+
+ private:
+  static constexpr size_t local_capacity = 128;
+  T local_[local_capacity];
+  std::vector<T> spill_;
+  size_t size_ = 0;
+};
+
+static inline float half_area(const glm::vec3 &min, const glm::vec3 &max) {
+  const glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+  return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+static inline bool box_contains(const glm::vec3 &outer_min, const glm::vec3 &outer_max, const glm::vec3 &min,
+                                const glm::vec3 &max) {
+  return glm::all(glm::lessThanEqual(outer_min, min)) && glm::all(glm::lessThanEqual(max, outer_max));
+}
+
+static inline bool box_overlaps(const glm::vec3 &a_min, const glm::vec3 &a_max, const glm::vec3 &b_min,
+                                const glm::vec3 &b_max) {
+  return glm::all(glm::lessThanEqual(a_min, b_max)) && glm::all(glm::lessThanEqual(b_min, a_max));
+}
+
+static inline bool box_in_frustum(const Frustum &frustum, const glm::vec3 &min, const glm::vec3 &max) {
+  const glm::vec3 center = (min + max) * 0.5f;
+  const glm::vec3 extents = (max - min) * 0.5f;
+  for (const glm::vec4 &p : frustum.planes) {
+    const float radius = std::abs(p.x) * extents.x + std::abs(p.y) * extents.y + std::abs(p.z) * extents.z;
+    if (p.x * center.x + p.y * center.y + p.z * center.z + p.w + radius < 0.0f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static inline float box_distance_squared(const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &point) {
+  const glm::vec3 d = glm::max(glm::max(min - point, point - max), glm::vec3(0.0f));
+  return glm::dot(d, d);
+}
+
+// Entry distance of the ray into the box, or infinity when it misses it before max_t
+static inline float ray_box(const glm::vec3 &origin, const glm::vec3 &inv_direction, float max_t,
+                            const glm::vec3 &min, const glm::vec3 &max) {
+  const glm::vec3 t1 = (min - origin) * inv_direction;
+  const glm::vec3 t2 = (max - origin) * inv_direction;
+  const glm::vec3 near = glm::min(t1, t2);
+  const glm::vec3 far = glm::max(t1, t2);
+  const float t_near = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+  const float t_far = std::min(std::min(far.x, far.y), std::min(far.z, max_t));
+  return t_near <= t_far ? t_near : infinity;
+}
+
+SpatialIndex::SpatialIndex(entt::registry &registry, JobSystem *jobs)
+    : registry_(registry),
+      jobs_(jobs),
+      root_(invalid_index),
+      free_node_(invalid_index),
+      node_count_(0),
+      free_item_(invalid_index),
+      item_count_(0),
+      churn_(0) {
+  registry_.on_construct<Bounds>().connect<&SpatialIndex::onBoundsChanged>(*this);
+  registry_.on_update<Bounds>().connect<&SpatialIndex::onBoundsChanged>(*this);
+  registry_.on_destroy<Bounds>().connect<&SpatialIndex::onBoundsChanged>(*this);
+  registry_.on_construct<WorldTransform>().connect<&SpatialIndex::onChanged>(*this);
+  registry_.on_update<WorldTransform>().connect<&SpatialIndex::onChanged>(*this);
+  registry_.on_destroy<WorldTransform>().connect<&SpatialIndex::onChanged>(*this);
+
+  for (entt::entity entity : registry_.view<Bounds, WorldTransform>()) {
+    changed_.push_back(entity);
+  }
+}
+
+SpatialIndex::~SpatialIndex() {
+  registry_.on_construct<Bounds>().disconnect(this);
+  registry_.on_update<Bounds>().disconnect(this);
+  registry_.on_destroy<Bounds>().disconnect(this);
+  registry_.on_construct<WorldTransform>().disconnect(this);
+  registry_.on_update<WorldTransform>().disconnect(this);
+  registry_.on_destroy<WorldTransform>().disconnect(this);
+}
+
+// Systems writing WorldTransform or Bounds may run side by side, so their signals can arrive from several threads
+void SpatialIndex::onChanged(entt::registry & /* registry */, entt::entity entity) {
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  changed_.push_back(entity);
+}
+
+void SpatialIndex::onBoundsChanged(entt::registry & /* registry */, entt::entity entity) {
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  bounds_changed_.push_back(entity);
+}
+
+SpatialIndex::Box SpatialIndex::computeBox(const Bounds &bounds, const WorldTransform &world) {
+  const glm::mat4 &m = world.matrix;
+  const glm::vec3 center = glm::vec3(m * glm::vec4(bounds.center, 1.0f));
+  const glm::vec3 extents = glm::abs(glm::vec3(m[0])) * bounds.extents.x +
+                            glm::abs(glm::vec3(m[1])) * bounds.extents.y +
+                            glm::abs(glm::vec3(m[2])) * bounds.extents.z;
+  return {center - extents, center + extents};
+}
+
+SpatialIndex::Box SpatialIndex::fatten(const Box &box) const {
+  const glm::vec3 margin = glm::max((box.max - box.min) * margin_, glm::vec3(min_margin_));
+  return {box.min - margin, box.max + margin};
+}
+
+uint32_t SpatialIndex::allocateItem(entt::entity entity, const Bounds &bounds, const Box &box) {
+  uint32_t item = free_item_;
+  if (item != invalid_index) {
+    free_item_ = items_[item].node;
+  } else {
+    item = static_cast<uint32_t>(items_.size());
+    items_.emplace_back();
+  }
+  items_[item] = {entity, invalid_index, 0, bounds, box, fatten(box)};
+  item_count_++;
+
+  const size_t slot = entt::to_entity(entity);
+  if (slot >= item_of_.size()) {
+    item_of_.resize(std::max(slot + 1, item_of_.size() * 2), invalid_index);
+  }
+  item_of_[slot] = item;
+  return item;
+}
+
+void SpatialIndex::freeItem(uint32_t item) {
+  Item &it = items_[item];
+  const size_t slot = entt::to_entity(it.entity);
+  if (item_of_[slot] == item) {
+    item_of_[slot] = invalid_index;
+  }
+  it.entity = entt::null;
+  it.node = free_item_;
+  free_item_ = item;
+  item_count_--;
+}
+
+void SpatialIndex::initNode(Node &node, uint32_t parent, uint32_t parent_slot) {
+  for (uint32_t slot = 0; slot < node_width; ++slot) {
+    clearSlot(node, slot);
+  }
+  node.parent = parent;
+  node.parent_slot = parent_slot;
+  node.count = 0;
+  node.padding = 0;
+}
+
+uint32_t SpatialIndex::allocateNode(uint32_t parent, uint32_t parent_slot) {
+  uint32_t node = free_node_;
+  if (node != invalid_index) {
+    free_node_ = nodes_[node].child[0];
+  } else {
+    node = static_cast<uint32_t>(nodes_.size());
+    nodes_.emplace_back();
+  }
+  initNode(nodes_[node], parent, parent_slot);
+  node_count_++;
+  return node;
+}
+
+void SpatialIndex::freeNode(uint32_t node) {
+  initNode(nodes_[node], invalid_index, 0);
+  nodes_[node].child[0] = free_node_;
+  free_node_ = node;
+  node_count_--;
+}
+
+void SpatialIndex::setSlot(Node &node, uint32_t slot, uint32_t child, const Box &box) {
+  node.min_x[slot] = box.min.x;
+  node.min_y[slot] = box.min.y;
+  node.min_z[slot] = box.min.z;
+  node.max_x[slot] = box.max.x;
+  node.max_y[slot] = box.max.y;
+  node.max_z[slot] = box.max.z;
+  node.child[slot] = child;
+}
+
+void SpatialIndex::clearSlot(Node &node, uint32_t slot) {
+  setSlot(node, slot, invalid_index, {glm::vec3(infinity), glm::vec3(-infinity)});
+}
+
+SpatialIndex::Box SpatialIndex::getSlotBox(const Node &node, uint32_t slot) {
+  return {{node.min_x[slot], node.min_y[slot], node.min_z[slot]},
+          {node.max_x[slot], node.max_y[slot], node.max_z[slot]}};
+}
+
+SpatialIndex::Box SpatialIndex::getNodeBox(const Node &node) {
+  // Empty slots hold an inverted box and drop out of the min / max
+  Box box = getSlotBox(node, 0);
+  for (uint32_t slot = 1; slot < node_width; ++slot) {
+    const Box other = getSlotBox(node, slot);
+    box.min = glm::min(box.min, other.min);
+    box.max = glm::max(box.max, other.max);
+  }
+  return box;
+}
+
+// Points the child in the slot back at it
+void SpatialIndex::linkSlot(uint32_t node, uint32_t slot) {
+  const uint32_t child = nodes_[node].child[slot];
+  if (child & leaf_bit) {
+    Item &item = items_[child & ~leaf_bit];
+    item.node = node;
+    item.slot = slot;
+  } else {
+    nodes_[child].parent = node;
+    nodes_[child].parent_slot = slot;
+  }
+}
+
+void SpatialIndex::refitUp(uint32_t node) {
+  while (nodes_[node].parent != invalid_index) {
+    const uint32_t parent = nodes_[node].parent;
+    const uint32_t slot = nodes_[node].parent_slot;
+    const Box box = getNodeBox(nodes_[node]);
+    const Box current = getSlotBox(nodes_[parent], slot);
+    if (current.min == box.min && current.max == box.max) {
+      return;
+    }
+    setSlot(nodes_[parent], slot, node, box);
+    node = parent;
+  }
+}
+
+// Slot of a full node whose box grows least to take in box, preferring the smaller one on ties
+uint32_t SpatialIndex::chooseSlot(const Node &node, const Box &box) {
+  uint32_t best = 0;
+  float best_growth = infinity;
+  float best_area = infinity;
+  for (uint32_t slot = 0; slot < node_width; ++slot) {
+    const Box current = getSlotBox(node, slot);
+    const float area = half_area(glm::min(current.min, box.min), glm::max(current.max, box.max));
+    const float growth = area - half_area(current.min, current.max);
+    if (growth < best_growth || (growth == best_growth && area < best_area)) {
+      best = slot;
+      best_growth = growth;
+      best_area = area;
+    }
+  }
+  return best;
+}
+
+void SpatialIndex::insertItem(uint32_t item, const Box &fat, uint32_t node) {
+  items_[item].fat = fat;
+  if (root_ == invalid_index) {
+    root_ = allocateNode(invalid_index, 0);
+    node = root_;
+  }
+
+  for (;;) {
+    if (nodes_[node].count < node_width) {
+      const uint32_t slot = nodes_[node].count++;
+      setSlot(nodes_[node], slot, item | leaf_bit, fat);
+      linkSlot(node, slot);
+      refitUp(node);
+      return;
+    }
+
+    const uint32_t best = chooseSlot(nodes_[node], fat);
+    const uint32_t child = nodes_[node].child[best];
+    if (!(child & leaf_bit)) {
+      node = child;
+      continue;
+    }
+
+    // The slot holds an entity: replace it with a node holding that entity and the new one
+    const Box sibling = getSlotBox(nodes_[node], best);
+    const uint32_t split = allocateNode(node, best);
+    setSlot(nodes_[split], 0, child, sibling);
+    setSlot(nodes_[split], 1, item | leaf_bit, fat);
+    nodes_[split].count = 2;
+    linkSlot(split, 0);
+    linkSlot(split, 1);
+    setSlot(nodes_[node], best, split, {glm::min(sibling.min, fat.min), glm::max(sibling.max, fat.max)});
+    refitUp(node);
+    return;
+  }
+}
+
+// Descents only read the tree, so they all advance a level at a time and the node fetches of one level overlap
+// instead of each insert waiting out its own path. The inserts then run one by one from where their descent stopped;
+// nodes are only added meanwhile, so those stay valid.
+void SpatialIndex::insertPending() {
+  pending_nodes_.assign(pending_inserts_.size(), root_);
+  bool descending = root_ != invalid_index;
+  while (descending) {
+    descending = false;
+    for (size_t i = 0; i < pending_inserts_.size(); ++i) {
+      const Node &node = nodes_[pending_nodes_[i]];
+      if (node.count < node_width) {
+        continue;
+      }
+      const uint32_t child = node.child[chooseSlot(node, items_[pending_inserts_[i]].fat)];
+      if (child & leaf_bit) {
+        continue;
+      }
+      pending_nodes_[i] = child;
+      __builtin_prefetch(&nodes_[child]);
+      __builtin_prefetch(reinterpret_cast<const char *>(&nodes_[child]) + 64);
+      descending = true;
+    }
+  }
+
+  // An empty tree gets its root from the first insert
+  for (size_t i = 0; i < pending_inserts_.size(); ++i) {
+    const uint32_t node = pending_nodes_[i] != invalid_index ? pending_nodes_[i] : root_;
+    insertItem(pending_inserts_[i], items_[pending_inserts_[i]].fat, node);
+  }
+}
+
+void SpatialIndex::removeItem(uint32_t item) {
+  Item &it = items_[item];
+  if (it.node == invalid_index) {
+    return;
+  }
+  const uint32_t node = it.node;
+  const uint32_t slot = it.slot;
+  it.node = invalid_index;
+  removeSlot(node, slot);
+}
+
+void SpatialIndex::removeSlot(uint32_t node, uint32_t slot) {
+  Node &n = nodes_[node];
+  const uint32_t last = n.count - 1;
+  if (slot != last) {
+    setSlot(n, slot, n.child[last], getSlotBox(n, last));
+    linkSlot(node, slot);
+  }
+  clearSlot(n, last);
+  n.count--;
+
+  if (node == root_) {
+    if (n.count == 0) {
+      freeNode(node);
+      root_ = invalid_index;
+    } else if (n.count == 1 && !(n.child[0] & leaf_bit)) {
+      // A root with a single node below is just overhead
+      const uint32_t child = n.child[0];
+      freeNode(node);
+      root_ = child;
+      nodes_[child].parent = invalid_index;
+      nodes_[child].parent_slot = 0;
+    }
+    return;
+  }
+
+  if (n.count == 1) {
+    // The remaining child takes this node's place in the parent
+    const uint32_t parent = n.parent;
+    const uint32_t parent_slot = n.parent_slot;
+    const uint32_t child = n.child[0];
+    const Box box = getSlotBox(n, 0);
+    freeNode(node);
+    setSlot(nodes_[parent], parent_slot, child, box);
+    linkSlot(parent, parent_slot);
+    refitUp(parent);
+    return;
+  }
+
+  refitUp(node);
+}
+
+void SpatialIndex::update() {
+  MATFX_PROFILE_ZONE("SpatialIndex::update");
+  const uint64_t start = stm_now();
+
+  stats_.inserted = 0;
+  stats_.removed = 0;
+  stats_.reinserted = 0;
+  stats_.refitted = 0;
+
+  // Looked up once, not per entity through the registry's pool map
+  const auto &bounds = registry_.storage<Bounds>();
+  const auto &worlds = registry_.storage<WorldTransform>();
+
+  // Items keep a copy of their Bounds, refreshed here, so movers below only look up their WorldTransform. Items
+  // whose Bounds are gone are dropped.
+  for (entt::entity entity : bounds_changed_) {
+    const size_t slot = entt::to_entity(entity);
+    const uint32_t item = slot < item_of_.size() ? item_of_[slot] : invalid_index;
+    if (item != invalid_index && items_[item].entity == entity) {
+      if (bounds.contains(entity)) {
+        items_[item].bounds = bounds.get(entity);
+      } else {
+        removeItem(item);
+        freeItem(item);
+        stats_.removed++;
+      }
+    }
+    changed_.push_back(entity);
+  }
+  bounds_changed_.clear();
+
+  // Movers are signalled once per component. Sorted, duplicates end up adjacent and the lookups below walk
+  // item_of_ and the component storages front to back.
+  sort_entities(changed_, changed_scratch_);
+  changed_.erase(std::unique(changed_.begin(), changed_.end()), changed_.end());
+  stats_.changed = static_cast<uint32_t>(changed_.size());
+
+  // A few thousand movers among a million entities hit memory at random. Each batch resolves its transforms and
+  // prefetches its items before any tree work, so the misses overlap instead of queueing behind one another.
+  constexpr size_t batch_size = 64;
+  const WorldTransform *batch_worlds[batch_size];
+  uint32_t moved[batch_size];
+
+  pending_inserts_.clear();
+  for (size_t base = 0; base < changed_.size(); base += batch_size) {
+    const size_t count = std::min(batch_size, changed_.size() - base);
+    size_t moved_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+      const entt::entity entity = changed_[base + i];
+      // contains() compares versions too, so destroyed entities and stale handles fail it without asking the registry
+      batch_worlds[i] = worlds.contains(entity) ? &worlds.get(entity) : nullptr;
+      const size_t slot = entt::to_entity(entity);
+      const uint32_t item = slot < item_of_.size() ? item_of_[slot] : invalid_index;
+      if (item < items_.size()) {
+        __builtin_prefetch(&items_[item]);
+        __builtin_prefetch(reinterpret_cast<const char *>(&items_[item]) + sizeof(Item) - 1);
+      }
+      if (batch_worlds[i]) {
+        __builtin_prefetch(batch_worlds[i]);
+      }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      const entt::entity entity = changed_[base + i];
+      const WorldTransform *world = batch_worlds[i];
+      const size_t slot = entt::to_entity(entity);
+      uint32_t item = slot < item_of_.size() ? item_of_[slot] : invalid_index;
+      if (item != invalid_index && items_[item].entity != entity) {
+        // Another version of the entity owns the slot. If that one is still alive, this one is stale.
+        if (registry_.valid(items_[item].entity)) {
+          continue;
+        }
+        removeItem(item);
+        freeItem(item);
+        stats_.removed++;
+        item = invalid_index;
+      }
+
+      if (item == invalid_index) {
+        if (world && bounds.contains(entity)) {
+          const Bounds &local = bounds.get(entity);
+          pending_inserts_.push_back(allocateItem(entity, local, computeBox(local, *world)));
+          stats_.inserted++;
+        }
+        continue;
+      }
+      if (!world) {
+        removeItem(item);
+        freeItem(item);
+        stats_.removed++;
+        continue;
+      }
+
+      Item &it = items_[item];
+      const Box box = computeBox(it.bounds, *world);
+      it.box = box;
+      // Items queued for insertion have no slot to compare against yet
+      if (it.node == invalid_index) {
+        continue;
+      }
+      if (box_contains(it.fat.min, it.fat.max, box.min, box.max)) {
+        continue;
+      }
+
+      // Tree work waits for the rest of the batch, which gives the nodes it climbs through time to arrive
+      it.fat = fatten(box);
+      moved[moved_count++] = item;
+      __builtin_prefetch(&nodes_[it.node]);
+      __builtin_prefetch(reinterpret_cast<const char *>(&nodes_[it.node]) + 64);
+    }
+
+    for (size_t i = 0; i < moved_count; ++i) {
+      const Node &node = nodes_[items_[moved[i]].node];
+      if (node.parent != invalid_index) {
+        __builtin_prefetch(&nodes_[node.parent]);
+        __builtin_prefetch(reinterpret_cast<const char *>(&nodes_[node.parent]) + 64);
+      }
+    }
+    for (size_t i = 0; i < moved_count; ++i) {
+      moveItem(moved[i]);
+    }
+  }
+  changed_.clear();
+
+  churn_ += stats_.inserted;
+  if (churn_ > rebuild_fraction_ * static_cast<float>(item_count_)) {
+    rebuild();
+  } else {
+    insertPending();
+  }
+
+  stats_.entities = item_count_;
+  stats_.nodes = node_count_;
+  stats_.update_ms = stm_ms(stm_since(start));
+}
+
+// The item left its fat box, it.fat already holds the new one
+void SpatialIndex::moveItem(uint32_t item) {
+  Item &it = items_[item];
+  const Box &fat = it.fat;
+
+  // A new fat box that stays within what the node's slots already cover leaves every ancestor box valid, so only the
+  // slot changes. The root has no ancestors to keep valid.
+  const Box node_box = getNodeBox(nodes_[it.node]);
+  if (it.node == root_ || box_contains(node_box.min, node_box.max, fat.min, fat.max)) {
+    setSlot(nodes_[it.node], it.slot, item | leaf_bit, fat);
+    stats_.refitted++;
+    return;
+  }
+
+  // Up to grow_levels above the node, an ancestor still covering the new fat box lets the boxes below it grow to take
+  // the entity in where it is. Otherwise it is removed and queued with the new entities; removal may free the node,
+  // so nothing is kept from where it was.
+  churn_++;
+  uint32_t ancestor = it.node;
+  bool covered = false;
+  for (uint32_t level = 0; level < grow_levels && !covered && ancestor != root_; ++level) {
+    ancestor = nodes_[ancestor].parent;
+    const Box ancestor_box = getNodeBox(nodes_[ancestor]);
+    covered = box_contains(ancestor_box.min, ancestor_box.max, fat.min, fat.max);
+  }
+  if (covered) {
+    setSlot(nodes_[it.node], it.slot, item | leaf_bit, fat);
+    refitUp(it.node);
+    stats_.refitted++;
+    return;
+  }
+
+  removeItem(item);
+  pending_inserts_.push_back(item);
+  stats_.reinserted++;
+}
+
+void SpatialIndex::rebuild() {
+  MATFX_PROFILE_ZONE("SpatialIndex::rebuild");
+  const uint64_t start = stm_now();
+
+  build_entries_.clear();
+  for (uint32_t item = 0; item < items_.size(); ++item) {
+    if (items_[item].entity == entt::null) {
+      continue;
+    }
+    const Box fat = fatten(items_[item].box);
+    items_[item].fat = fat;
+    build_entries_.push_back({fat.min, item, fat.max, 0});
+  }
+
+  nodes_.clear();
+  free_node_ = invalid_index;
+  root_ = invalid_index;
+  const uint32_t count = static_cast<uint32_t>(build_entries_.size());
+  if (count > 0) {
+    // Below the top levels, ranges are handed out as tasks, a few per thread
+    const size_t threads = jobs_ ? jobs_->getWorkerCount() + 1 : 1;
+    const uint32_t task_size =
+        threads > 1 ? std::max<uint32_t>(count / static_cast<uint32_t>(8 * threads), 4096) : 0;
+
+    build_tasks_.clear();
+    if (count == 1) {
+      nodes_.emplace_back();
+      initNode(nodes_[0], invalid_index, 0);
+      setSlot(nodes_[0], 0, build_entries_[0].item | leaf_bit, {build_entries_[0].min, build_entries_[0].max});
+      nodes_[0].count = 1;
+      root_ = 0;
+    } else {
+      root_ = buildNode(nodes_, 0, count, invalid_index, 0, task_size);
+    }
+
+    if (!build_tasks_.empty()) {
+      jobs_->parallelFor(build_tasks_.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          BuildTask &task = build_tasks_[i];
+          task.nodes.clear();
+          buildNode(task.nodes, task.begin, task.end, invalid_index, 0, 0);
+        }
+      });
+
+      // Append every subtree, moving its node indices past the ones already there
+      for (BuildTask &task : build_tasks_) {
+        const uint32_t offset = static_cast<uint32_t>(nodes_.size());
+        for (Node &node : task.nodes) {
+          for (uint32_t slot = 0; slot < node.count; ++slot) {
+            if (!(node.child[slot] & leaf_bit)) {
+              node.child[slot] += offset;
+            }
+          }
+          if (node.parent == invalid_index) {
+            node.parent = task.parent;
+            node.parent_slot = task.parent_slot;
+          } else {
+            node.parent += offset;
+          }
+        }
+        nodes_.insert(nodes_.end(), task.nodes.begin(), task.nodes.end());
+        nodes_[task.parent].child[task.parent_slot] = offset;
+      }
+    }
+
+    for (uint32_t node = 0; node < nodes_.size(); ++node) {
+      for (uint32_t slot = 0; slot < nodes_[node].count; ++slot) {
+        if (nodes_[node].child[slot] & leaf_bit) {
+          linkSlot(node, slot);
+        }
+      }
+    }
+  }
+
+  node_count_ = static_cast<uint32_t>(nodes_.size());
+  churn_ = 0;
+  stats_.entities = item_count_;
+  stats_.nodes = node_count_;
+  stats_.rebuilds++;
+  stats_.rebuild_ms = stm_ms(stm_since(start));
+  MATFX_LOG_DEBUG("Spatial index rebuilt with {} entities in {} nodes, {:.2f} ms", item_count_, node_count_,
+                  stats_.rebuild_ms);
+}
+
+// Builds the node over build_entries_[begin, end), which holds at least two items. Ranges of at most task_size items
+// are left for build tasks, their slot only gets its box.
+uint32_t SpatialIndex::buildNode(std::vector<Node> &nodes, uint32_t begin, uint32_t end, uint32_t parent,
+                                 uint32_t parent_slot, uint32_t task_size) {
+  // Split into up to four ranges, always splitting the largest
+  uint32_t ranges[node_width][2] = {{begin, end}};
+  uint32_t range_count = 1;
+  while (range_count < node_width) {
+    uint32_t largest = 0;
+    for (uint32_t i = 1; i < range_count; ++i) {
+      if (ranges[i][1] - ranges[i][0] > ranges[largest][1] - ranges[largest][0]) {
+        largest = i;
+      }
+    }
+    if (ranges[largest][1] - ranges[largest][0] < 2) {
+      break;
+    }
+    const uint32_t mid = splitRange(ranges[largest][0], ranges[largest][1]);
+    ranges[range_count][0] = mid;
+    ranges[range_count][1] = ranges[largest][1];
+    ranges[largest][1] = mid;
+    range_count++;
+  }
+
+  const uint32_t node = static_cast<uint32_t>(nodes.size());
+  nodes.emplace_back();
+  initNode(nodes[node], parent, parent_slot);
+  nodes[node].count = range_count;
+
+  for (uint32_t slot = 0; slot < range_count; ++slot) {
+    const uint32_t first = ranges[slot][0];
+    const uint32_t last = ranges[slot][1];
+    if (last - first == 1) {
+      const BuildEntry &entry = build_entries_[first];
+      setSlot(nodes[node], slot, entry.item | leaf_bit, {entry.min, entry.max});
+    } else if (last - first <= task_size) {
+      Box box = {build_entries_[first].min, build_entries_[first].max};
+      for (uint32_t i = first + 1; i < last; ++i) {
+        box.min = glm::min(box.min, build_entries_[i].min);
+        box.max = glm::max(box.max, build_entries_[i].max);
+      }
+      setSlot(nodes[node], slot, invalid_index, box);
+      build_tasks_.push_back({first, last, node, slot, {}});
+    } else {
+      const uint32_t child = buildNode(nodes, first, last, node, slot, task_size);
+      setSlot(nodes[node], slot, child, getNodeBox(nodes[child]));
+    }
+  }
+  return node;
+}
+
+// Partitions build_entries_[begin, end) in two with a binned surface area heuristic over the box centers, trying
+// every axis, and returns where the second half starts. Centers are kept doubled, min + max, which bins the same.
+uint32_t SpatialIndex::splitRange(uint32_t begin, uint32_t end) {
+  constexpr int bin_count = 16;
+
+  glm::vec3 center_min(infinity);
+  glm::vec3 center_max(-infinity);
+  for (uint32_t i = begin; i < end; ++i) {
+    const glm::vec3 center = build_entries_[i].min + build_entries_[i].max;
+    center_min = glm::min(center_min, center);
+    center_max = glm::max(center_max, center);
+  }
+  const glm::vec3 center_extent = center_max - center_min;
+  glm::vec3 scale;
+  for (int axis = 0; axis < 3; ++axis) {
+    scale[axis] = center_extent[axis] > 0.0f ? static_cast<float>(bin_count) / center_extent[axis] : 0.0f;
+  }
+
+  struct Bin {
+    glm::vec3 min{infinity};
+    glm::vec3 max{-infinity};
+    uint32_t count = 0;
+  };
+
+  // One pass bins all three axes
+  Bin bins[3][bin_count];
+  for (uint32_t i = begin; i < end; ++i) {
+    const BuildEntry &entry = build_entries_[i];
+    const glm::ivec3 b = glm::min(glm::ivec3((entry.min + entry.max - center_min) * scale), glm::ivec3(bin_count - 1));
+    for (int axis = 0; axis < 3; ++axis) {
+      Bin &bin = bins[axis][b[axis]];
+      bin.min = glm::min(bin.min, entry.min);
+      bin.max = glm::max(bin.max, entry.max);
+      bin.count++;
+    }
+  }
+
+  float best_cost = infinity;
+  int best_axis = -1;
+  int best_bin = 0;
+  for (int axis = 0; axis < 3; ++axis) {
+    if (!(center_extent[axis] > 0.0f)) {
+      continue;
+    }
+
+    // right_cost[b] covers bins b and up
+    float right_cost[bin_count];
+    Bin right;
+    for (int b = bin_count - 1; b > 0; --b) {
+      right.min = glm::min(right.min, bins[axis][b].min);
+      right.max = glm::max(right.max, bins[axis][b].max);
+      right.count += bins[axis][b].count;
+      right_cost[b] = static_cast<float>(right.count) * half_area(right.min, right.max);
+    }
+
+    Bin left;
+    for (int b = 0; b < bin_count - 1; ++b) {
+      left.min = glm::min(left.min, bins[axis][b].min);
+      left.max = glm::max(left.max, bins[axis][b].max);
+      left.count += bins[axis][b].count;
+      const float cost = static_cast<float>(left.count) * half_area(left.min, left.max) + right_cost[b + 1];
+      if (left.count > 0 && left.count < end - begin && cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_bin = b;
+      }
+    }
+  }
+
+  if (best_axis < 0) {
+    // Every center coincides, any split is as good as another
+    return begin + (end - begin) / 2;
+  }
+
+  const auto first = build_entries_.begin();
+  const auto middle = std::partition(first + begin, first + end, [&](const BuildEntry &entry) {
+    const float center = entry.min[best_axis] + entry.max[best_axis];
+    return std::min(static_cast<int>((center - center_min[best_axis]) * scale[best_axis]), bin_count - 1) <= best_bin;
+  });
+  const uint32_t split = static_cast<uint32_t>(middle - first);
+  return split > begin && split < end ? split : begin + (end - begin) / 2;
+}
+
+template <typename SlotTest, typename ItemTest>
+void SpatialIndex::collect(SlotTest &&test, ItemTest &&exact, std::vector<entt::entity> &out) const {
+  if (root_ == invalid_index) {
+    return;
+  }
+
+  TraversalStack<uint32_t> stack;
+  stack.push(root_);
+  while (!stack.empty()) {
+    const Node &node = nodes_[stack.pop()];
+    const uint32_t mask = test(node) & ((1u << node.count) * 0x11u - 0x11u);
+    for (uint32_t slot = 0; slot < node.count; ++slot) {
+      const uint32_t child = node.child[slot];
+      if (mask & (0x10u << slot)) {
+        collectSubtree(child, out);
+      } else if (mask & (1u << slot)) {
+        if (!(child & leaf_bit)) {
+          stack.push(child);
+        } else if (exact(items_[child & ~leaf_bit])) {
+          out.push_back(items_[child & ~leaf_bit].entity);
+        }
+      }
+    }
+  }
+}
+
+void SpatialIndex::collectSubtree(uint32_t child, std::vector<entt::entity> &out) const {
+  TraversalStack<uint32_t> stack;
+  stack.push(child);
+  while (!stack.empty()) {
+    const uint32_t current = stack.pop();
+    if (current & leaf_bit) {
+      out.push_back(items_[current & ~leaf_bit].entity);
+      continue;
+    }
+    const Node &node = nodes_[current];
+    for (uint32_t slot = 0; slot < node.count; ++slot) {
+      stack.push(node.child[slot]);
+    }
+  }
+}
+
+void SpatialIndex::queryFrustum(const Frustum &frustum, std::vector<entt::entity> &out) const {
+  MATFX_PROFILE_ZONE("SpatialIndex::queryFrustum");
+#ifdef __AVX2__
+  struct PlaneLanes {
+    __m128 x, y, z, w, abs_x, abs_y, abs_z;
+  } planes[6];
+  for (size_t i = 0; i < 6; ++i) {
+    const glm::vec4 &p = frustum.planes[i];
+    planes[i] = {_mm_set1_ps(p.x),
+                 _mm_set1_ps(p.y),
+                 _mm_set1_ps(p.z),
+                 _mm_set1_ps(p.w),
+                 _mm_set1_ps(std::abs(p.x)),
+                 _mm_set1_ps(std::abs(p.y)),
+                 _mm_set1_ps(std::abs(p.z))};
+  }
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 zero = _mm_setzero_ps();
+
+  auto test = [&](const Node &node) -> uint32_t {
+    const __m128 min_x = _mm_load_ps(node.min_x), max_x = _mm_load_ps(node.max_x);
+    const __m128 min_y = _mm_load_ps(node.min_y), max_y = _mm_load_ps(node.max_y);
+    const __m128 min_z = _mm_load_ps(node.min_z), max_z = _mm_load_ps(node.max_z);
+    const __m128 cx = _mm_mul_ps(_mm_add_ps(min_x, max_x), half), ex = _mm_mul_ps(_mm_sub_ps(max_x, min_x), half);
+    const __m128 cy = _mm_mul_ps(_mm_add_ps(min_y, max_y), half), ey = _mm_mul_ps(_mm_sub_ps(max_y, min_y), half);
+    const __m128 cz = _mm_mul_ps(_mm_add_ps(min_z, max_z), half), ez = _mm_mul_ps(_mm_sub_ps(max_z, min_z), half);
+
+    __m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    __m128 inside = visible;
+    for (const PlaneLanes &p : planes) {
+      const __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(p.x, cx), _mm_mul_ps(p.y, cy)), _mm_add_ps(_mm_mul_ps(p.z, cz), p.w));
+      const __m128 radius =
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(p.abs_x, ex), _mm_mul_ps(p.abs_y, ey)), _mm_mul_ps(p.abs_z, ez));
+      visible = _mm_and_ps(visible, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_sub_ps(distance, radius), zero));
+    }
+    return static_cast<uint32_t>(_mm_movemask_ps(visible)) | (static_cast<uint32_t>(_mm_movemask_ps(inside)) << 4);
+  };
+#else
+  auto test = [&](const Node &node) -> uint32_t {
+    uint32_t mask = 0;
+    for (uint32_t slot = 0; slot < node.count; ++slot) {
+      const Box box = getSlotBox(node, slot);
+      const glm::vec3 center = (box.min + box.max) * 0.5f;
+      const glm::vec3 extents = (box.max - box.min) * 0.5f;
+      bool visible = true;
+      bool inside = true;
+      for (const glm::vec4 &p : frustum.planes) {
+        const float distance = p.x * center.x + p.y * center.y + p.z * center.z + p.w;
+        const float radius = std::abs(p.x) * extents.x + std::abs(p.y) * extents.y + std::abs(p.z) * extents.z;
+        visible = visible && distance + radius >= 0.0f;
+        inside = inside && distance - radius >= 0.0f;
+      }
+      mask |= (visible ? 1u : 0u) << slot;
+      mask |= (inside ? 0x10u : 0u) << slot;
+    }
+    return mask;
+  };
+#endif
+
+  collect(test, [&](const Item &item) { return box_in_frustum(frustum, item.box.min, item.box.max); }, out);
+}
+
+void SpatialIndex::queryBox(const glm::vec3 &min, const glm::vec3 &max, std::vector<entt::entity> &out) const {
+  MATFX_PROFILE_ZONE("SpatialIndex::queryBox");
+#ifdef __AVX2__
+  const __m128 query_min_x = _mm_set1_ps(min.x), query_max_x = _mm_set1_ps(max.x);
+  const __m128 query_min_y = _mm_set1_ps(min.y), query_max_y = _mm_set1_ps(max.y);
+  const __m128 query_min_z = _mm_set1_ps(min.z), query_max_z = _mm_set1_ps(max.z);
+
+  auto test = [&](const Node &node) -> uint32_t {
+    const __m128 min_x = _mm_load_ps(node.min_x), max_x = _mm_load_ps(node.max_x);
+    const __m128 min_y = _mm_load_ps(node.min_y), max_y = _mm_load_ps(node.max_y);
+    const __m128 min_z = _mm_load_ps(node.min_z), max_z = _mm_load_ps(node.max_z);
+    const __m128 overlap = _mm_and_ps(
+        _mm_and_ps(_mm_and_ps(_mm_cmple_ps(min_x, query_max_x), _mm_cmple_ps(query_min_x, max_x)),
+                   _mm_and_ps(_mm_cmple_ps(min_y, query_max_y), _mm_cmple_ps(query_min_y, max_y))),
+        _mm_and_ps(_mm_cmple_ps(min_z, query_max_z), _mm_cmple_ps(query_min_z, max_z)));
+    const __m128 inside = _mm_and_ps(
+        _mm_and_ps(_mm_and_ps(_mm_cmple_ps(query_min_x, min_x), _mm_cmple_ps(max_x, query_max_x)),
+                   _mm_and_ps(_mm_cmple_ps(query_min_y, min_y), _mm_cmple_ps(max_y, query_max_y))),
+        _mm_and_ps(_mm_cmple_ps(query_min_z, min_z), _mm_cmple_ps(max_z, query_max_z)));
+    return static_cast<uint32_t>(_mm_movemask_ps(overlap)) | (static_cast<uint32_t>(_mm_movemask_ps(inside)) << 4);
+  };
+#else
+  auto test = [&](const Node &node) -> uint32_t {
+    uint32_t mask = 0;
+    for (uint32_t slot = 0; slot < node.count; ++slot) {
+      const Box box = getSlotBox(node, slot);
+      mask |= (box_overlaps(box.min, box.max, min, max) ? 1u : 0u) << slot;
+      mask |= (box_contains(min, max, box.min, box.max) ? 0x10u : 0u) << slot;
+    }
+    return mask;
+  };
+#endif
+
+  collect(test, [&](const Item &item) { return box_overlaps(item.box.min, item.box.max, min, max); }, out);
+}
+
+void SpatialIndex::querySphere(const glm::vec3 &center, float radius, std::vector<entt::entity> &out) const {
+  MATFX_PROFILE_ZONE("SpatialIndex::querySphere");
+  const float radius_squared = radius * radius;
+#ifdef __AVX2__
+  const __m128 center_x = _mm_set1_ps(center.x);
+  const __m128 center_y = _mm_set1_ps(center.y);
+  const __m128 center_z = _mm_set1_ps(center.z);
+  const __m128 limit = _mm_set1_ps(radius_squared);
+  const __m128 zero = _mm_setzero_ps();
+
+  // Distance from the center to the nearest point of each box, and to the farthest for boxes inside the sphere
+  auto test = [&](const Node &node) -> uint32_t {
+    auto axis = [&](const float *mins, const float *maxs, __m128 c, __m128 &near, __m128 &far) {
+      const __m128 lo = _mm_sub_ps(_mm_load_ps(mins), c);
+      const __m128 hi = _mm_sub_ps(c, _mm_load_ps(maxs));
+      const __m128 d = _mm_max_ps(_mm_max_ps(lo, hi), zero);
+      const __m128 f = _mm_max_ps(_mm_sub_ps(zero, lo), _mm_sub_ps(zero, hi));
+      near = _mm_add_ps(near, _mm_mul_ps(d, d));
+      far = _mm_add_ps(far, _mm_mul_ps(f, f));
+    };
+    __m128 near = zero;
+    __m128 far = zero;
+    axis(node.min_x, node.max_x, center_x, near, far);
+    axis(node.min_y, node.max_y, center_y, near, far);
+    axis(node.min_z, node.max_z, center_z, near, far);
+    return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(near, limit))) |
+           (static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(far, limit))) << 4);
+  };
+#else
+  auto test = [&](const Node &node) -> uint32_t {
+    uint32_t mask = 0;
+    for (uint32_t slot = 0; slot < node.count; ++slot) {
+      const Box box = getSlotBox(node, slot);
+      const glm::vec3 far = glm::max(center - box.min, box.max - center);
+      mask |= (box_distance_squared(box.min, box.max, center) <= radius_squared ? 1u : 0u) << slot;
+      mask |= (glm::dot(far, far) <= radius_squared ? 0x10u : 0u) << slot;
+    }
+    return mask;
+  };
+#endif
+
+  collect(
+      test,
+      [&](const Item &item) { return box_distance_squared(item.box.min, item.box.max, center) <= radius_squared; },
+      out);
+}
+
+bool SpatialIndex::raycast(const glm::vec3 &origin, const glm::vec3 &direction, float max_distance,
+                           RayHit &hit) const {
+  MATFX_PROFILE_ZONE("SpatialIndex::raycast");
+  if (root_ == invalid_index) {
+    return false;
+  }
+
+  // Axis-parallel rays get a huge but finite reciprocal, so 0 * inf can't produce NaN
+  glm::vec3 inv_direction;
+  for (int axis = 0; axis < 3; ++axis) {
+    const float d = direction[axis];
+    inv_direction[axis] = 1.0f / (std::abs(d) > 1e-30f ? d : std::copysign(1e-30f, d));
+  }
+
+  struct Entry {
+    uint32_t node;
+    float distance;
+  };
+
+  float best = max_distance;
+  bool found = false;
+  TraversalStack<Entry> stack;
+  stack.push({root_, 0.0f});
+  while (!stack.empty()) {
+    const Entry entry = stack.pop();
+    if (entry.distance > best) {
+      continue;
+    }
+    const Node &node = nodes_[entry.node];
+
+    float distances[node_width];
+#ifdef __AVX2__
+    auto slab = [&](const float *mins, const float *maxs, float o, float inv, __m128 &near, __m128 &far) {
+      const __m128 origin_lanes = _mm_set1_ps(o);
+      const __m128 inv_lanes = _mm_set1_ps(inv);
+      const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(mins), origin_lanes), inv_lanes);
+      const __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxs), origin_lanes), inv_lanes);
+      near = _mm_max_ps(near, _mm_min_ps(t1, t2));
+      far = _mm_min_ps(far, _mm_max_ps(t1, t2));
+    };
+    __m128 near = _mm_setzero_ps();
+    __m128 far = _mm_set1_ps(best);
+    slab(node.min_x, node.max_x, origin.x, inv_direction.x, near, far);
+    slab(node.min_y, node.max_y, origin.y, inv_direction.y, near, far);
+    slab(node.min_z, node.max_z, origin.z, inv_direction.z, near, far);
+    const __m128 missed = _mm_cmpgt_ps(near, far);
+    _mm_storeu_ps(distances, _mm_blendv_ps(near, _mm_set1_ps(infinity), missed));
+#else
+    for (uint32_t slot = 0; slot < node_width; ++slot) {
+      const Box box = getSlotBox(node, slot);
+      distances[slot] = ray_box(origin, inv_direction, best, box.min, box.max);
+    }
+#endif
+
+    // Push the nearer children last so they are visited first
+    uint32_t order[node_width];
+    uint32_t hits = 0;
+    for (uint32_t slot = 0; slot < node.count; ++slot) {
+      if (distances[slot] <= best) {
+        uint32_t i = hits++;
+        for (; i > 0 && distances[order[i - 1]] < distances[slot]; --i) {
+          order[i] = order[i - 1];
+        }
+        order[i] = slot;
+      }
+    }
+    for (uint32_t i = 0; i < hits; ++i) {
+      const uint32_t slot = order[i];
+      const uint32_t child = node.child[slot];
+      if (!(child & leaf_bit)) {
+        stack.push({child, distances[slot]});
+        continue;
+      }
+      const Item &item = items_[child & ~leaf_bit];
+      const float distance = ray_box(origin, inv_direction, best, item.box.min, item.box.max);
+      if (distance <= best) {
+        best = distance;
+        hit = {item.entity, distance};
+        found = true;
+      }
+    }
+  }
+  return found;
+}
@@ -0,0 +1,202 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <entt/entity/fwd.hpp>
+#include <glm.hpp>
+#include <mutex>
+#include <vector>
+
+#include "culling.h"
+
+class JobSystem;
+
+struct SpatialIndexStats {
+  uint32_t entities = 0;    // entities in the tree
+  uint32_t nodes = 0;       // nodes in use
+  uint32_t changed = 0;     // signalled entities the last update() looked at
+  uint32_t inserted = 0;    // entities the last update() added
+  uint32_t removed = 0;     // entities the last update() dropped
+  uint32_t refitted = 0;    // entities the last update() moved outside their fat box, but kept in their node
+  uint32_t reinserted = 0;  // entities the last update() moved too far to keep in their node, and reinserted
+  uint32_t rebuilds = 0;    // full rebuilds so far
+  double update_ms = 0.0;   // last update(), rebuild included
+  double rebuild_ms = 0.0;  // last full rebuild
+};
+
+struct RayHit {
+  entt::entity entity = entt::null;
+  float distance = 0.0f;  // in units of the ray direction's length
+};
+
+// Bounding volume hierarchy over the world-space boxes of every entity with Bounds and a WorldTransform, for "what
+// is in this frustum / box / sphere / along this ray" queries without walking the registry.
+//
+// The tree is 4-wide: a node stores the boxes of up to four children in structure-of-arrays form, and every child is
+// either another node or one entity. Traversal is iterative, with an explicit stack, and tests a node's four
+// children at once with SSE when the build enables AVX2.
+//
+// Full builds split the entities with a binned surface area heuristic. On a job system, once the top of the tree is
+// split, its subtrees are built in parallel. Between builds the tree is updated incrementally. Entities are stored
+// with a box fattened by a margin, so small moves need no tree work at all. An entity that leaves its fat box but
+// whose new fat box still fits in its node's box only has its slot rewritten. One that fits in the box of an ancestor
+// at most grow_levels up stays in its node, and the boxes below that ancestor grow. Anything further is removed, and
+// reinserted with the new entities once all movers are handled, along the path of least surface area growth; those
+// descents run side by side so their cache misses overlap. When more than a fraction of the entities were added,
+// grown into place or reinserted since the last build, the whole tree is rebuilt, since incremental updates degrade
+// it.
+//
+// Changes arrive through entt signals: construction, update and destruction of Bounds and WorldTransform.
+// TransformSystem patches WorldTransform, so everything it moves is picked up. Signals only queue the entity, under a
+// lock, so any number of systems may write Bounds and WorldTransform at once. Items keep a copy of their Bounds, so a
+// mover costs a WorldTransform lookup but no Bounds one. update() applies the queue and must run once world matrices
+// are final, never while systems writing Bounds or WorldTransform are running. Queries may run concurrently with each
+// other but not with update().
+class SpatialIndex {
+ public:
+  // jobs, when given, builds the tree in parallel
+  explicit SpatialIndex(entt::registry &registry, JobSystem *jobs = nullptr);
+  ~SpatialIndex();
+
+  SpatialIndex(const SpatialIndex &) = delete;
+  SpatialIndex &operator=(const SpatialIndex &) = delete;
+  SpatialIndex(SpatialIndex &&) = delete;
+  SpatialIndex &operator=(SpatialIndex &&) = delete;
+
+  // Fat boxes grow by fraction of the box's size on every side, and by at least minimum world units
+  void setMargin(float fraction, float minimum) {
+    margin_ = fraction;
+    min_margin_ = minimum;
+  }
+  // Rebuild once entities added, grown into place and reinserted since the last build exceed this fraction of the tree
+  void setRebuildFraction(float fraction) { rebuild_fraction_ = fraction; }
+
+  void update();
+  // Rebuilds the whole tree from the current boxes
+  void rebuild();
+
+  // Matching entities are appended to out, in no particular order. Boxes are tested exactly, at their current world
+  // size; the fat boxes only steer traversal.
+  void queryFrustum(const Frustum &frustum, std::vector<entt::entity> &out) const;
+  void queryBox(const glm::vec3 &min, const glm::vec3 &max, std::vector<entt::entity> &out) const;
+  void querySphere(const glm::vec3 &center, float radius, std::vector<entt::entity> &out) const;
+  // Nearest entity whose box the ray origin + t * direction enters for t in [0, max_distance]. Rays starting inside
+  // a box hit it at 0.
+  bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, float max_distance, RayHit &hit) const;
+
+  const SpatialIndexStats &getStats() const { return stats_; }
+
+ private:
+  static constexpr uint32_t invalid_index = UINT32_MAX;
+  static constexpr uint32_t leaf_bit = 0x80000000u;  // set on a child that refers to an entity, not a node
+  static constexpr uint32_t node_width = 4;
+  static constexpr uint32_t grow_levels = 2;  // how far up update() grows boxes instead of reinserting
+
+  // 128 bytes. Unused slots hold an inverted empty box.
+  struct alignas(64) Node {
+    float min_x[node_width], min_y[node_width], min_z[node_width];
+    float max_x[node_width], max_y[node_width], max_z[node_width];
+    uint32_t child[node_width];
+    uint32_t parent;       // invalid for the root and for free nodes, which chain through child[0] instead
+    uint32_t parent_slot;  // slot of this node in its parent
+    uint32_t count;        // slots in use, always the first ones
+    uint32_t padding;
+  };
+
+  struct Box {
+    glm::vec3 min;
+    glm::vec3 max;
+  };
+
+  // One entity in the tree, 96 bytes. The fat box duplicates the one in its node slot, so update() can tell whether
+  // the entity left it without touching the tree.
+  struct alignas(32) Item {
+    entt::entity entity;
+    uint32_t node;
+    uint32_t slot;
+    Bounds bounds;  // local box, refreshed from Bounds signals
+    Box box;        // exact world box
+    Box fat;
+  };
+
+  // 32 bytes, partitioned in place so the build streams through memory
+  struct BuildEntry {
+    glm::vec3 min;
+    uint32_t item;
+    glm::vec3 max;
+    uint32_t padding;
+  };
+
+  struct BuildTask {
+    uint32_t begin, end;  // range of build_entries_
+    uint32_t parent, parent_slot;
+    std::vector<Node> nodes;
+  };
+
+  entt::registry &registry_;
+  JobSystem *jobs_;
+
+  std::vector<Node> nodes_;
+  uint32_t root_;
+  uint32_t free_node_;
+  uint32_t node_count_;
+
+  std::vector<Item> items_;
+  uint32_t free_item_;
+  uint32_t item_count_;
+  std::vector<uint32_t> item_of_;  // indexed by entity slot
+
+  std::mutex queue_mutex_;  // held by the signal handlers, update() runs when none can fire
+  std::vector<entt::entity> changed_;
+  std::vector<entt::entity> bounds_changed_;
+  std::vector<entt::entity> changed_scratch_;
+  std::vector<uint32_t> pending_inserts_;  // items to insert with their fat box set
+  std::vector<uint32_t> pending_nodes_;    // where each pending insert's descent got to
+  uint32_t churn_;  // items added, grown into place or reinserted since the last build
+
+  // Build scratch
+  std::vector<BuildEntry> build_entries_;  // live items with their fat boxes
+  std::vector<BuildTask> build_tasks_;
+
+  float margin_ = 0.1f;
+  float min_margin_ = 0.05f;
+  float rebuild_fraction_ = 0.25f;
+  SpatialIndexStats stats_;
+
+  void onChanged(entt::registry &registry, entt::entity entity);
+  void onBoundsChanged(entt::registry &registry, entt::entity entity);
+
+  static Box computeBox(const Bounds &bounds, const WorldTransform &world);
+  Box fatten(const Box &box) const;
+
+  uint32_t allocateItem(entt::entity entity, const Bounds &bounds, const Box &box);
+  void freeItem(uint32_t item);
+  uint32_t allocateNode(uint32_t parent, uint32_t parent_slot);
+  void freeNode(uint32_t node);
+
+  // Descends from node, the root or one on the path a descent from the root would take
+  void insertItem(uint32_t item, const Box &fat, uint32_t node);
+  void insertPending();
+  void moveItem(uint32_t item);
+  void removeItem(uint32_t item);
+  void removeSlot(uint32_t node, uint32_t slot);
+  void linkSlot(uint32_t node, uint32_t slot);
+  void refitUp(uint32_t node);
+
+  static void initNode(Node &node, uint32_t parent, uint32_t parent_slot);
+  static void setSlot(Node &node, uint32_t slot, uint32_t child, const Box &box);
+  static void clearSlot(Node &node, uint32_t slot);
+  static Box getSlotBox(const Node &node, uint32_t slot);
+  static Box getNodeBox(const Node &node);
+  static uint32_t chooseSlot(const Node &node, const Box &box);
+
+  uint32_t buildNode(std::vector<Node> &nodes, uint32_t begin, uint32_t end, uint32_t parent, uint32_t parent_slot,
+                     uint32_t task_size);
+  uint32_t splitRange(uint32_t begin, uint32_t end);
+
+  // Walks every node slot accepted by test, which returns one bit per slot that may hold matches and, four bits up,
+  // one per slot lying entirely inside the query. Entities in accepted slots are kept when exact(item) agrees,
+  // everything under an inside slot is kept untested.
+  template <typename SlotTest, typename ItemTest>
+  void collect(SlotTest &&test, ItemTest &&exact, std::vector<entt::entity> &out) const;
+  void collectSubtree(uint32_t child, std::vector<entt::entity> &out) const;
+};
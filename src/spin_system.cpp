@@ -0,0 +1,16 @@
+#include "spin_system.h"
+
+#include "transform_system.h"
+
+void SpinSystem::update(entt::view<entt::get_t<Transform, const Spin>> view, const SimTime &time) {
+  const float dt = static_cast<float>(time.step_seconds);
+  for (auto [entity, transform, spin] : view.each()) {
+    const float speed = glm::length(spin.angular_velocity);
+    if (speed <= 0.0f) {
+      continue;
+    }
+    const glm::quat delta = glm::angleAxis(speed * dt, spin.angular_velocity / speed);
+    transform.rotation = glm::normalize(delta * glm::quat(transform.rotation));
+    transforms.markDirty(entity);
+  }
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <entt/entity/view.hpp>
+
+#include "components.h"
+#include "simulation.h"
+
+class TransformSystem;
+
+// Rotates every Spin entity by one simulation step
+struct SpinSystem {
+  TransformSystem &transforms;
+
+  void update(entt::view<entt::get_t<Transform, const Spin>> view, const SimTime &time);
+};
@@ -0,0 +1,182 @@
+#include "transform_batch.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Both paths evaluate the same expressions in the same order, this file is built with -ffp-contract=off so the
+// compiler cannot fuse them differently.
+static inline void compose_one(glm::vec3 position, float x, float y, float z, float w, glm::vec3 scale,
+                               glm::mat4 &m) {
+  const float xx = x * x, yy = y * y, zz = z * z;
+  const float xy = x * y, xz = x * z, yz = y * z;
+  const float wx = w * x, wy = w * y, wz = w * z;
+
+  m[0][0] = (1.0f - 2.0f * (yy + zz)) * scale.x;
+  m[0][1] = (2.0f * (xy + wz)) * scale.x;
+  m[0][2] = (2.0f * (xz - wy)) * scale.x;
+  m[0][3] = 0.0f;
+
+  m[1][0] = (2.0f * (xy - wz)) * scale.y;
+  m[1][1] = (1.0f - 2.0f * (xx + zz)) * scale.y;
+  m[1][2] = (2.0f * (yz + wx)) * scale.y;
+  m[1][3] = 0.0f;
+
+  m[2][0] = (2.0f * (xz + wy)) * scale.z;
+  m[2][1] = (2.0f * (yz - wx)) * scale.z;
+  m[2][2] = (1.0f - 2.0f * (xx + yy)) * scale.z;
+  m[2][3] = 0.0f;
+
+  m[3][0] = position.x;
+  m[3][1] = position.y;
+  m[3][2] = position.z;
+  m[3][3] = 1.0f;
+}
+
+void composeTransformsScalar(const Transform *transforms, glm::mat4 *matrices, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    const Transform &t = transforms[i];
+    compose_one(t.position, t.rotation.x, t.rotation.y, t.rotation.z, t.rotation.w, t.scale, matrices[i]);
+  }
+}
+
+void composeTransformsScalar(const TransformLanes &lanes, size_t first, glm::mat4 *matrices, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    const size_t k = first + i;
+    const glm::vec3 position(lanes.position[0][k], lanes.position[1][k], lanes.position[2][k]);
+    const glm::vec3 scale(lanes.scale[0][k], lanes.scale[1][k], lanes.scale[2][k]);
+    compose_one(position, lanes.rotation[0][k], lanes.rotation[1][k], lanes.rotation[2][k], lanes.rotation[3][k],
+                scale, matrices[i]);
+  }
+}
+
+#ifdef __AVX2__
+
+// Transposes the 4x4 blocks held in the low and high halves of four registers
+static inline void transpose4x4x2(__m256 r0, __m256 r1, __m256 r2, __m256 r3, __m256 &c0, __m256 &c1, __m256 &c2,
+                                  __m256 &c3) {
+  const __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+  const __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+  const __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+  const __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+
+  c0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+  c1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+  c2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  c3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+// Writes one matrix column for 8 consecutive matrices from four registers holding rows 0..3 of that column
+static inline void store_column8(glm::mat4 *matrices, int column, __m256 r0, __m256 r1, __m256 r2, __m256 r3) {
+  __m256 c0, c1, c2, c3;
+  transpose4x4x2(r0, r1, r2, r3, c0, c1, c2, c3);
+
+  _mm_storeu_ps(&matrices[0][column][0], _mm256_castps256_ps128(c0));
+  _mm_storeu_ps(&matrices[1][column][0], _mm256_castps256_ps128(c1));
+  _mm_storeu_ps(&matrices[2][column][0], _mm256_castps256_ps128(c2));
+  _mm_storeu_ps(&matrices[3][column][0], _mm256_castps256_ps128(c3));
+  _mm_storeu_ps(&matrices[4][column][0], _mm256_extractf128_ps(c0, 1));
+  _mm_storeu_ps(&matrices[5][column][0], _mm256_extractf128_ps(c1, 1));
+  _mm_storeu_ps(&matrices[6][column][0], _mm256_extractf128_ps(c2, 1));
+  _mm_storeu_ps(&matrices[7][column][0], _mm256_extractf128_ps(c3, 1));
+}
+
+// Loads four consecutive floats at the same offset of 8 transforms spaced 12 floats apart and transposes them into
+// one register per component
+static inline void load_field8(const float *base, __m256 &a, __m256 &b, __m256 &c, __m256 &d) {
+  auto load_pair = [&](int i) {
+    const __m128 lo = _mm_loadu_ps(base + i * 12);
+    const __m128 hi = _mm_loadu_ps(base + (i + 4) * 12);
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+  };
+  transpose4x4x2(load_pair(0), load_pair(1), load_pair(2), load_pair(3), a, b, c, d);
+}
+
+// Composes 8 consecutive matrices from one register per component
+static inline void compose8(__m256 px, __m256 py, __m256 pz, __m256 x, __m256 y, __m256 z, __m256 w, __m256 sx,
+                            __m256 sy, __m256 sz, glm::mat4 *matrices) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+
+  const __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+  const __m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+  const __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+
+  const __m256 m00 = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz))), sx);
+  const __m256 m01 = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx);
+  const __m256 m02 = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx);
+
+  const __m256 m10 = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy);
+  const __m256 m11 = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz))), sy);
+  const __m256 m12 = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy);
+
+  const __m256 m20 = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz);
+  const __m256 m21 = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz);
+  const __m256 m22 = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy))), sz);
+
+  store_column8(matrices, 0, m00, m01, m02, zero);
+  store_column8(matrices, 1, m10, m11, m12, zero);
+  store_column8(matrices, 2, m20, m21, m22, zero);
+  store_column8(matrices, 3, px, py, pz, one);
+}
+
+void composeTransforms(const Transform *transforms, glm::mat4 *matrices, size_t count) {
+  static_assert(sizeof(Transform) % sizeof(float) == 0);
+  constexpr int stride = sizeof(Transform) / sizeof(float);
+  constexpr int position = offsetof(Transform, position) / sizeof(float);
+  constexpr int rotation = offsetof(Transform, rotation) / sizeof(float);
+  constexpr int scale = offsetof(Transform, scale) / sizeof(float);
+  constexpr bool padded_layout = stride == 12 && position == 0 && rotation == 4 && scale == 8;
+
+  const __m256i lanes = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 px, py, pz, x, y, z, w, sx, sy, sz;
+    if constexpr (padded_layout) {
+      // Every field spans four floats, so two 4x4 transposes per field replace ten gathers
+      const float *base = reinterpret_cast<const float *>(transforms + i);
+      __m256 unused;
+      load_field8(base + position, px, py, pz, unused);
+      load_field8(base + rotation, x, y, z, w);
+      load_field8(base + scale, sx, sy, sz, unused);
+    } else {
+      const float *base = reinterpret_cast<const float *>(transforms + i);
+      auto gather = [&](int offset) { return _mm256_i32gather_ps(base + offset, lanes, sizeof(float)); };
+      px = gather(position + 0), py = gather(position + 1), pz = gather(position + 2);
+      x = gather(rotation + 0), y = gather(rotation + 1), z = gather(rotation + 2), w = gather(rotation + 3);
+      sx = gather(scale + 0), sy = gather(scale + 1), sz = gather(scale + 2);
+    }
+
+    compose8(px, py, pz, x, y, z, w, sx, sy, sz, matrices + i);
+  }
+
+  composeTransformsScalar(transforms + i, matrices + i, count - i);
+}
+
+void composeTransforms(const TransformLanes &lanes, size_t first, glm::mat4 *matrices, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const size_t k = first + i;
+    compose8(_mm256_loadu_ps(lanes.position[0] + k), _mm256_loadu_ps(lanes.position[1] + k),
+             _mm256_loadu_ps(lanes.position[2] + k), _mm256_loadu_ps(lanes.rotation[0] + k),
+             _mm256_loadu_ps(lanes.rotation[1] + k), _mm256_loadu_ps(lanes.rotation[2] + k),
+             _mm256_loadu_ps(lanes.rotation[3] + k), _mm256_loadu_ps(lanes.scale[0] + k),
+             _mm256_loadu_ps(lanes.scale[1] + k), _mm256_loadu_ps(lanes.scale[2] + k), matrices + i);
+  }
+
+  composeTransformsScalar(lanes, first + i, matrices + i, count - i);
+}
+
+#else
+
+void composeTransforms(const Transform *transforms, glm::mat4 *matrices, size_t count) {
+  composeTransformsScalar(transforms, matrices, count);
+}
+
+void composeTransforms(const TransformLanes &lanes, size_t first, glm::mat4 *matrices, size_t count) {
+  composeTransformsScalar(lanes, first, matrices, count);
+}
+
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+
+#include "components.h"
+
+// Converts transforms straight into affine translate * rotate * scale matrices without building intermediate
+// matrices. composeTransforms uses AVX2 when the build enables it and produces results bit-identical to
+// composeTransformsScalar.
+void composeTransforms(const Transform *transforms, glm::mat4 *matrices, size_t count);
+void composeTransformsScalar(const Transform *transforms, glm::mat4 *matrices, size_t count);
+
+// Same for count entities of a TransformStorage starting at storage index first, read straight from its lanes. Each
+// component is a plain load, no transposes or gathers; results match the Transform overloads bit for bit.
+void composeTransforms(const TransformLanes &lanes, size_t first, glm::mat4 *matrices, size_t count);
+void composeTransformsScalar(const TransformLanes &lanes, size_t first, glm::mat4 *matrices, size_t count);
@@ -0,0 +1,361 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <entt/core/iterator.hpp>
+#include <entt/core/type_info.hpp>
+#include <entt/entity/fwd.hpp>
+#include <entt/entity/mixin.hpp>
+#include <entt/entity/sparse_set.hpp>
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+#include <gtc/quaternion.hpp>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+struct Transform {
+  glm::vec3 position{0.0f};
+  glm::quat rotation{1.0f, 0.0f, 0.0f, 0.0f};
+  glm::vec3 scale{1.0f};
+
+  glm::mat4 getMatrix() const {
+    glm::mat4 t = glm::translate(glm::mat4(1.0f), position);
+    glm::mat4 r = glm::mat4_cast(rotation);
+    glm::mat4 s = glm::scale(glm::mat4(1.0f), scale);
+    return t * r * s;
+  }
+};
+
+// One array per float of Transform, indexed by position in a TransformStorage. Every array starts 32-byte aligned.
+struct TransformLanes {
+  const float *position[3];
+  const float *rotation[4];  // x, y, z, w
+  const float *scale[3];
+};
+
+// A vec3 whose components live stride floats apart. Assigning writes through, reading converts to a plain vec3;
+// glm's operators are templates and won't convert on their own, so wrap the proxy in glm::vec3() to do math on it.
+class Vec3Ref {
+ public:
+  Vec3Ref(float *x, size_t stride) : x_(x), stride_(stride) {}
+  Vec3Ref(const Vec3Ref &) = default;
+
+  Vec3Ref &operator=(const Vec3Ref &other) { return *this = other.get(); }
+  Vec3Ref &operator=(const glm::vec3 &value) {
+    x_[0] = value.x;
+    x_[stride_] = value.y;
+    x_[2 * stride_] = value.z;
+    return *this;
+  }
+
+  glm::vec3 get() const { return {x_[0], x_[stride_], x_[2 * stride_]}; }
+  operator glm::vec3() const { return get(); }
+
+ private:
+  float *x_;
+  size_t stride_;
+};
+
+// Same for a quaternion, lanes in x, y, z, w order
+class QuatRef {
+ public:
+  QuatRef(float *x, size_t stride) : x_(x), stride_(stride) {}
+  QuatRef(const QuatRef &) = default;
+
+  QuatRef &operator=(const QuatRef &other) { return *this = other.get(); }
+  QuatRef &operator=(const glm::quat &value) {
+    x_[0] = value.x;
+    x_[stride_] = value.y;
+    x_[2 * stride_] = value.z;
+    x_[3 * stride_] = value.w;
+    return *this;
+  }
+
+  glm::quat get() const {
+    glm::quat value;
+    value.x = x_[0];
+    value.y = x_[stride_];
+    value.z = x_[2 * stride_];
+    value.w = x_[3 * stride_];
+    return value;
+  }
+  operator glm::quat() const { return get(); }
+
+ private:
+  float *x_;
+  size_t stride_;
+};
+
+// What registry.get<Transform>(), views and emplace() hand out instead of Transform &. Reads and writes touch only
+// the lanes of the fields used. Like a reference into any entt storage, it is invalidated when Transforms are added,
+// removed or sorted.
+struct TransformRef {
+  Vec3Ref position;
+  QuatRef rotation;
+  Vec3Ref scale;
+
+  TransformRef(float *first, size_t stride)
+      : position(first, stride), rotation(first + 3 * stride, stride), scale(first + 7 * stride, stride) {}
+  TransformRef(const TransformRef &) = default;
+
+  TransformRef &operator=(const TransformRef &other) { return *this = other.get(); }
+  TransformRef &operator=(const Transform &value) {
+    position = value.position;
+    rotation = value.rotation;
+    scale = value.scale;
+    return *this;
+  }
+
+  Transform get() const { return {position.get(), rotation.get(), scale.get()}; }
+  operator Transform() const { return get(); }
+  glm::mat4 getMatrix() const { return get().getMatrix(); }
+};
+
+// entt storage for Transform laid out as structure of arrays: position x/y/z, rotation x/y/z/w and scale x/y/z each
+// in their own aligned array, so batch code can stream exactly the components it needs (see getLanes()). Everything
+// going through the registry, views and signals works as with the default storage, except that elements are
+// returned as TransformRef proxies, or Transform copies from a const storage, rather than references. Elements have
+// no address of their own, so the type-erased value() of the base set returns nullptr.
+class TransformStorage : public entt::basic_sparse_set<entt::entity> {
+ public:
+  using allocator_type = std::allocator<Transform>;
+  using base_type = entt::basic_sparse_set<entt::entity>;
+  using element_type = Transform;
+  using value_type = Transform;
+  using entity_type = entt::entity;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  static constexpr entt::deletion_policy storage_policy = entt::deletion_policy::swap_and_pop;
+
+  static constexpr size_t lane_count = 10;
+  static constexpr size_t lane_alignment = 32;
+
+ private:
+  // Walks the storage in the same order as the entities of the base set
+  template <bool Const>
+  class ElementIterator {
+   public:
+    using value_type = std::conditional_t<Const, Transform, TransformRef>;
+    using pointer = entt::input_iterator_pointer<value_type>;
+    using reference = value_type;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::input_iterator_tag;
+    using iterator_concept = std::forward_iterator_tag;
+
+    ElementIterator() : it_(), lanes_(nullptr), stride_(0) {}
+    ElementIterator(base_type::iterator it, float *lanes, size_t stride) : it_(it), lanes_(lanes), stride_(stride) {}
+
+    ElementIterator &operator++() { return ++it_, *this; }
+    ElementIterator operator++(int) {
+      const ElementIterator orig = *this;
+      return ++it_, orig;
+    }
+    ElementIterator operator+(difference_type n) const { return {it_ + n, lanes_, stride_}; }
+    ElementIterator operator-(difference_type n) const { return {it_ - n, lanes_, stride_}; }
+
+    reference operator*() const { return TransformRef(lanes_ + it_.index(), stride_); }
+    pointer operator->() const { return operator*(); }
+
+    bool operator==(const ElementIterator &other) const { return it_ == other.it_; }
+    bool operator!=(const ElementIterator &other) const { return it_ != other.it_; }
+
+   private:
+    base_type::iterator it_;
+    float *lanes_;
+    size_t stride_;
+  };
+
+  // Entity and element pairs for each()
+  template <bool Const>
+  class EachIterator {
+   public:
+    using value_type = std::tuple<entt::entity, std::conditional_t<Const, Transform, TransformRef>>;
+    using pointer = entt::input_iterator_pointer<value_type>;
+    using reference = value_type;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::input_iterator_tag;
+    using iterator_concept = std::forward_iterator_tag;
+
+    EachIterator() : it_(), lanes_(nullptr), stride_(0) {}
+    EachIterator(base_type::iterator it, float *lanes, size_t stride) : it_(it), lanes_(lanes), stride_(stride) {}
+
+    EachIterator &operator++() { return ++it_, *this; }
+    EachIterator operator++(int) {
+      const EachIterator orig = *this;
+      return ++it_, orig;
+    }
+
+    reference operator*() const { return {*it_, TransformRef(lanes_ + it_.index(), stride_)}; }
+    pointer operator->() const { return operator*(); }
+
+    bool operator==(const EachIterator &other) const { return it_ == other.it_; }
+    bool operator!=(const EachIterator &other) const { return it_ != other.it_; }
+
+   private:
+    base_type::iterator it_;
+    float *lanes_;
+    size_t stride_;
+  };
+
+ public:
+  using iterator = ElementIterator<false>;
+  using const_iterator = ElementIterator<true>;
+  using iterable = entt::iterable_adaptor<EachIterator<false>>;
+  using const_iterable = entt::iterable_adaptor<EachIterator<true>>;
+
+  TransformStorage() : TransformStorage(allocator_type{}) {}
+  explicit TransformStorage(const allocator_type &allocator)
+      : base_type(entt::type_id<Transform>(), storage_policy, base_type::allocator_type(allocator)), capacity_(0) {}
+  TransformStorage(TransformStorage &&other) noexcept
+      : base_type(std::move(other)), lanes_(std::move(other.lanes_)), capacity_(std::exchange(other.capacity_, 0)) {}
+  ~TransformStorage() override = default;
+
+  TransformStorage(const TransformStorage &) = delete;
+  TransformStorage &operator=(const TransformStorage &) = delete;
+  TransformStorage &operator=(TransformStorage &&other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  void swap(TransformStorage &other) noexcept {
+    base_type::swap(other);
+    std::swap(lanes_, other.lanes_);
+    std::swap(capacity_, other.capacity_);
+  }
+
+  allocator_type get_allocator() const noexcept { return allocator_type(base_type::get_allocator()); }
+
+  void reserve(const size_type cap) override {
+    base_type::reserve(cap);
+    reserveLanes(cap);
+  }
+  size_type capacity() const noexcept override { return capacity_; }
+  void shrink_to_fit() override {
+    base_type::shrink_to_fit();
+    reallocateLanes(round_up_lanes(base_type::size()));
+  }
+
+  TransformRef get(const entity_type entt) { return at(base_type::index(entt)); }
+  Transform get(const entity_type entt) const { return at(base_type::index(entt)); }
+  std::tuple<TransformRef> get_as_tuple(const entity_type entt) { return std::make_tuple(get(entt)); }
+  std::tuple<Transform> get_as_tuple(const entity_type entt) const { return std::make_tuple(get(entt)); }
+
+  template <typename... Args>
+  TransformRef emplace(const entity_type entt, Args &&...args) {
+    const auto it = emplaceValue(entt, false, Transform{std::forward<Args>(args)...});
+    return at(static_cast<size_t>(it.index()));
+  }
+
+  template <typename... Func>
+  TransformRef patch(const entity_type entt, Func &&...func) {
+    TransformRef ref = get(entt);
+    (std::forward<Func>(func)(ref), ...);
+    return ref;
+  }
+
+  template <typename It>
+  void insert(It first, It last, const Transform &value = {}) {
+    for (; first != last; ++first) {
+      emplaceValue(*first, true, value);
+    }
+  }
+
+  iterator begin() noexcept { return {base_type::begin(), lanes_.get(), capacity_}; }
+  iterator end() noexcept { return {base_type::end(), lanes_.get(), capacity_}; }
+  const_iterator begin() const noexcept { return {base_type::begin(), lanes_.get(), capacity_}; }
+  const_iterator end() const noexcept { return {base_type::end(), lanes_.get(), capacity_}; }
+  const_iterator cbegin() const noexcept { return begin(); }
+  const_iterator cend() const noexcept { return end(); }
+
+  iterable each() noexcept {
+    return {{base_type::begin(), lanes_.get(), capacity_}, {base_type::end(), lanes_.get(), capacity_}};
+  }
+  const_iterable each() const noexcept {
+    return {{base_type::begin(), lanes_.get(), capacity_}, {base_type::end(), lanes_.get(), capacity_}};
+  }
+
+  // Valid until Transforms are added, removed or sorted
+  TransformLanes getLanes() const {
+    const float *lanes = lanes_.get();
+    const size_t stride = capacity_;
+    return {{lanes, lanes + stride, lanes + 2 * stride},
+            {lanes + 3 * stride, lanes + 4 * stride, lanes + 5 * stride, lanes + 6 * stride},
+            {lanes + 7 * stride, lanes + 8 * stride, lanes + 9 * stride}};
+  }
+
+ protected:
+  void pop(basic_iterator first, basic_iterator last) override {
+    for (; first != last; ++first) {
+      // The last element moves into the hole, as base_type::swap_and_pop() does with the entity
+      const size_t pos = base_type::index(*first);
+      const size_t back = base_type::size() - 1;
+      for (size_t lane = 0; lane < lane_count; ++lane) {
+        lanes_[lane * capacity_ + pos] = lanes_[lane * capacity_ + back];
+      }
+      base_type::swap_and_pop(first);
+    }
+  }
+
+  basic_iterator try_emplace(const entity_type entt, const bool force_back, const void *value) override {
+    return emplaceValue(entt, force_back, value ? *static_cast<const Transform *>(value) : Transform{});
+  }
+
+ private:
+  struct AlignedDelete {
+    void operator()(float *lanes) const { ::operator delete[](lanes, std::align_val_t{lane_alignment}); }
+  };
+
+  std::unique_ptr<float[], AlignedDelete> lanes_;
+  size_t capacity_;  // floats per lane, a multiple of 8 so every lane stays aligned
+
+  static size_t round_up_lanes(size_t count) { return (count + 7) & ~size_t{7}; }
+
+  TransformRef at(size_t pos) const { return TransformRef(lanes_.get() + pos, capacity_); }
+
+  basic_iterator emplaceValue(const entity_type entt, const bool force_back, const Transform &value) {
+    reserveLanes(base_type::size() + 1);
+    const auto it = base_type::try_emplace(entt, force_back);
+    at(static_cast<size_t>(it.index())) = value;
+    return it;
+  }
+
+  void reserveLanes(size_t count) {
+    if (count > capacity_) {
+      reallocateLanes(std::max(round_up_lanes(count), 2 * capacity_));
+    }
+  }
+
+  void reallocateLanes(size_t capacity) {
+    if (capacity == capacity_) {
+      return;
+    }
+    std::unique_ptr<float[], AlignedDelete> lanes;
+    if (capacity > 0) {
+      lanes.reset(static_cast<float *>(
+          ::operator new[](lane_count * capacity * sizeof(float), std::align_val_t{lane_alignment})));
+      const size_t size = base_type::size();
+      for (size_t lane = 0; size > 0 && lane < lane_count; ++lane) {
+        std::memcpy(lanes.get() + lane * capacity, lanes_.get() + lane * capacity_, size * sizeof(float));
+      }
+    }
+    lanes_ = std::move(lanes);
+    capacity_ = capacity;
+  }
+
+  void swap_or_move(const std::size_t from, const std::size_t to) override {
+    for (size_t lane = 0; lane < lane_count; ++lane) {
+      std::swap(lanes_[lane * capacity_ + from], lanes_[lane * capacity_ + to]);
+    }
+  }
+};
+
+// Makes the registry keep Transform in a TransformStorage. Visible wherever Transform is, through components.h, so
+// every translation unit agrees on the storage type.
+template <>
+struct entt::storage_type<Transform, entt::entity, std::allocator<Transform>> {
+  using type = ENTT_STORAGE(sigh_mixin, TransformStorage);
+};
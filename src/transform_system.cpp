@@ -0,0 +1,211 @@
+#include "transform_system.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <entt/entity/registry.hpp>
+
+#include "frame_log.h"
+#include "transform_batch.h"
+
+TransformSystem::TransformSystem(entt::registry &registry)
+    : registry_(registry), dirty_count_(0), updated_count_(0), hierarchy_changed_(true) {
+  // Create the pool here so update() never adds one while other systems may be reading the registry
+  registry_.storage<WorldTransform>();
+  registry_.on_construct<Transform>().connect<&TransformSystem::onHierarchyChanged>(*this);
+  registry_.on_destroy<Transform>().connect<&TransformSystem::onHierarchyChanged>(*this);
+  registry_.on_update<Transform>().connect<&TransformSystem::onTransformUpdated>(*this);
+  registry_.on_construct<Parent>().connect<&TransformSystem::onHierarchyChanged>(*this);
+  registry_.on_update<Parent>().connect<&TransformSystem::onHierarchyChanged>(*this);
+  registry_.on_destroy<Parent>().connect<&TransformSystem::onHierarchyChanged>(*this);
+}
+
+TransformSystem::~TransformSystem() {
+  registry_.on_construct<Transform>().disconnect(this);
+  registry_.on_destroy<Transform>().disconnect(this);
+  registry_.on_update<Transform>().disconnect(this);
+  registry_.on_construct<Parent>().disconnect(this);
+  registry_.on_update<Parent>().disconnect(this);
+  registry_.on_destroy<Parent>().disconnect(this);
+}
+
+void TransformSystem::onHierarchyChanged(entt::registry & /* registry */, entt::entity /* entity */) {
+  hierarchy_changed_ = true;
+}
+
+void TransformSystem::onTransformUpdated(entt::registry & /* registry */, entt::entity entity) { markDirty(entity); }
+
+void TransformSystem::markDirty(entt::entity entity) {
+  // A pending rebuild recomputes every node anyway
+  if (hierarchy_changed_) {
+    return;
+  }
+
+  const auto slot = static_cast<size_t>(entt::to_entity(entity));
+  if (slot >= node_index_.size() || node_index_[slot] == invalid_index) {
+    return;
+  }
+
+  const uint32_t index = node_index_[slot];
+  if (!dirty_[index]) {
+    dirty_[index] = 1;
+    dirty_count_++;
+  }
+}
+
+void TransformSystem::rebuild() {
+  auto transforms = registry_.view<Transform>();
+  const size_t count = transforms.size();
+
+  size_t slot_count = 0;
+  for (entt::entity entity : transforms) {
+    slot_count = std::max(slot_count, static_cast<size_t>(entt::to_entity(entity)) + 1);
+  }
+
+  auto parent_of = [&](entt::entity entity) -> entt::entity {
+    const Parent *parent = registry_.try_get<Parent>(entity);
+    if (!parent || parent->entity == entity || !registry_.valid(parent->entity) ||
+        !registry_.all_of<Transform>(parent->entity)) {
+      return entt::null;
+    }
+    return parent->entity;
+  };
+
+  // Resolve each entity's depth by walking up until a root or an already resolved ancestor
+  std::vector<int32_t> depths(slot_count, -1);
+  std::vector<entt::entity> chain;
+  bool cycle_found = false;
+  for (entt::entity entity : transforms) {
+    chain.clear();
+    int32_t depth = -1;
+    entt::entity current = entity;
+    while (current != entt::null) {
+      const int32_t known = depths[entt::to_entity(current)];
+      if (known >= 0) {
+        depth = known;
+        break;
+      }
+      if (chain.size() > count) {
+        cycle_found = true;
+        break;
+      }
+      chain.push_back(current);
+      current = parent_of(current);
+    }
+
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+      depths[entt::to_entity(*it)] = ++depth;
+    }
+  }
+
+  if (cycle_found) {
+    MATFX_LOG_WARN("Transform hierarchy contains a cycle, affected nodes are treated as roots");
+  }
+
+  nodes_.clear();
+  nodes_.reserve(count);
+  for (entt::entity entity : transforms) {
+    nodes_.push_back({entity, invalid_index});
+  }
+  std::stable_sort(nodes_.begin(), nodes_.end(), [&](const Node &a, const Node &b) {
+    return depths[entt::to_entity(a.entity)] < depths[entt::to_entity(b.entity)];
+  });
+
+  node_index_.assign(slot_count, invalid_index);
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    node_index_[entt::to_entity(nodes_[i].entity)] = static_cast<uint32_t>(i);
+  }
+
+  // Node i's local transform goes to storage index i. entt sorts its packed array back to front, hence the reversed
+  // comparison.
+  registry_.storage<Transform>().sort([&](entt::entity a, entt::entity b) {
+    return node_index_[entt::to_entity(a)] > node_index_[entt::to_entity(b)];
+  });
+
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    Node &node = nodes_[i];
+    const entt::entity parent = parent_of(node.entity);
+    if (parent != entt::null) {
+      const uint32_t parent_index = node_index_[entt::to_entity(parent)];
+      // Links that close a cycle point at a later node, those are cut here
+      node.parent = parent_index < i ? parent_index : invalid_index;
+    }
+    if (!registry_.all_of<WorldTransform>(node.entity)) {
+      registry_.emplace<WorldTransform>(node.entity);
+      spawned_.push_back(node.entity);
+    }
+  }
+
+  auto stale = registry_.view<WorldTransform>(entt::exclude<Transform>);
+  std::vector<entt::entity> stale_entities(stale.begin(), stale.end());
+  registry_.remove<WorldTransform>(stale_entities.begin(), stale_entities.end());
+
+  world_.resize(nodes_.size());
+  dirty_.assign(nodes_.size(), 1);
+  dirty_count_ = nodes_.size();
+  hierarchy_changed_ = false;
+
+  MATFX_LOG_DEBUG("Transform hierarchy rebuilt with {} nodes", nodes_.size());
+}
+
+void TransformSystem::storePrevious() {
+  for (auto [entity, world, previous] : registry_.view<const WorldTransform, PreviousWorldTransform>().each()) {
+    previous.matrix = world.matrix;
+  }
+}
+
+void TransformSystem::update() {
+  if (hierarchy_changed_) {
+    rebuild();
+  }
+
+  updated_count_ = 0;
+  if (dirty_count_ == 0) {
+    return;
+  }
+
+  // Parents precede children, so a dirty parent has already been flagged by the time its children are visited
+  update_indices_.clear();
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    const Node &node = nodes_[i];
+    if (!dirty_[i] && node.parent != invalid_index && dirty_[node.parent]) {
+      dirty_[i] = 1;
+    }
+    if (dirty_[i]) {
+      update_indices_.push_back(static_cast<uint32_t>(i));
+    }
+  }
+
+  // Storage and node order match since rebuild(), so consecutive dirty nodes are one batch over the lanes
+  const TransformLanes lanes = registry_.storage<Transform>().getLanes();
+  update_matrices_.resize(update_indices_.size());
+  for (size_t k = 0; k < update_indices_.size();) {
+    size_t run = 1;
+    while (k + run < update_indices_.size() && update_indices_[k + run] == update_indices_[k] + run) {
+      run++;
+    }
+    composeTransforms(lanes, update_indices_[k], update_matrices_.data() + k, run);
+    k += run;
+  }
+
+  // Patched rather than assigned so on_update listeners, such as SpatialIndex, see every move
+  auto &world_transforms = registry_.storage<WorldTransform>();
+  for (size_t k = 0; k < update_indices_.size(); ++k) {
+    const uint32_t i = update_indices_[k];
+    const Node &node = nodes_[i];
+    world_[i] = node.parent == invalid_index ? update_matrices_[k] : world_[node.parent] * update_matrices_[k];
+    world_transforms.patch(node.entity, [&](WorldTransform &world) { world.matrix = world_[i]; });
+    dirty_[i] = 0;
+  }
+
+  // Nodes that only just got a world matrix have no previous step to interpolate from
+  for (entt::entity entity : spawned_) {
+    if (PreviousWorldTransform *previous = registry_.try_get<PreviousWorldTransform>(entity)) {
+      previous->matrix = world_transforms.get(entity).matrix;
+    }
+  }
+  spawned_.clear();
+
+  updated_count_ = update_indices_.size();
+  dirty_count_ = 0;
+}
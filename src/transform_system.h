@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <entt/entity/fwd.hpp>
+#include <vector>
+
+#include "components.h"
+
+// Keeps WorldTransform up to date for every entity with a Transform, following Parent links. The hierarchy is kept
+// flattened in depth order so parents always precede their children and propagation is one linear pass over the
+// dirty nodes.
+//
+// Changes are picked up through registry.patch<Transform>() / replace<Transform>(); code writing to a Transform
+// directly has to call markDirty() afterwards.
+//
+// Rebuilding sorts the Transform storage into node order, so update() composes each run of dirty nodes straight from
+// the storage's lanes. Systems scheduled alongside update() must treat Transform as written, not read.
+class TransformSystem {
+ public:
+  explicit TransformSystem(entt::registry &registry);
+  ~TransformSystem();
+
+  TransformSystem(const TransformSystem &) = delete;
+  TransformSystem &operator=(const TransformSystem &) = delete;
+  TransformSystem(TransformSystem &&) = delete;
+  TransformSystem &operator=(TransformSystem &&) = delete;
+
+  void markDirty(entt::entity entity);
+  void update();
+
+  // Copies WorldTransform into PreviousWorldTransform; called at the start of each simulation step, before anything
+  // moves, so the renderer can interpolate between the last two steps.
+  void storePrevious();
+
+  size_t getNodeCount() const { return nodes_.size(); }
+  size_t getUpdatedCount() const { return updated_count_; }
+
+ private:
+  static constexpr uint32_t invalid_index = UINT32_MAX;
+
+  struct Node {
+    entt::entity entity;
+    uint32_t parent;
+  };
+
+  entt::registry &registry_;
+
+  std::vector<Node> nodes_;
+  std::vector<glm::mat4> world_;
+  std::vector<uint8_t> dirty_;
+  std::vector<uint32_t> node_index_;
+
+  std::vector<uint32_t> update_indices_;
+  std::vector<glm::mat4> update_matrices_;
+  std::vector<entt::entity> spawned_;
+
+  size_t dirty_count_;
+  size_t updated_count_;
+  bool hierarchy_changed_;
+
+  void rebuild();
+
+  void onHierarchyChanged(entt::registry &registry, entt::entity entity);
+  void onTransformUpdated(entt::registry &registry, entt::entity entity);
+};
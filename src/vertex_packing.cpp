@@ -0,0 +1,82 @@
+#include "vertex_packing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <gtc/packing.hpp>
+
+static int16_t to_snorm16(float value) {
+  return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+static uint16_t to_unorm16(float value) {
+  return static_cast<uint16_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+}
+
+static glm::vec2 sign_not_zero(const glm::vec2 &v) { return {v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f}; }
+
+void encodeOctahedral(const glm::vec3 &normal, int16_t out[2]) {
+  const float l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+  glm::vec2 e = l1 > 0.0f ? glm::vec2(normal.x, normal.y) / l1 : glm::vec2(0.0f);
+  if (normal.z < 0.0f) {
+    e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * sign_not_zero(e);
+  }
+  out[0] = to_snorm16(e.x);
+  out[1] = to_snorm16(e.y);
+}
+
+glm::vec3 decodeOctahedral(const int16_t in[2]) {
+  const glm::vec2 e(std::max(in[0] / 32767.0f, -1.0f), std::max(in[1] / 32767.0f, -1.0f));
+  glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+  const float t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return glm::normalize(n);
+}
+
+void packMesh(Mesh &mesh) {
+  mesh.packed_vertices.clear();
+  if (mesh.vertices.empty()) {
+    return;
+  }
+
+  glm::vec3 min_position = mesh.vertices[0].position;
+  glm::vec3 max_position = mesh.vertices[0].position;
+  for (const Vertex &vertex : mesh.vertices) {
+    min_position = glm::min(min_position, vertex.position);
+    max_position = glm::max(max_position, vertex.position);
+  }
+
+  const glm::vec3 size = max_position - min_position;
+  const float scale = std::max({size.x, size.y, size.z});
+  const float inv_scale = scale > 0.0f ? 1.0f / scale : 0.0f;
+  mesh.quantization_offset = min_position;
+  mesh.quantization_scale = scale > 0.0f ? scale : 1.0f;
+
+  mesh.packed_vertices.resize(mesh.vertices.size());
+  for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+    const Vertex &vertex = mesh.vertices[i];
+    PackedVertex &packed = mesh.packed_vertices[i];
+    const glm::vec3 position = (vertex.position - min_position) * inv_scale;
+    packed.position[0] = to_unorm16(position.x);
+    packed.position[1] = to_unorm16(position.y);
+    packed.position[2] = to_unorm16(position.z);
+    packed.position[3] = 65535;
+    encodeOctahedral(vertex.normal, packed.normal);
+    packed.texcoord[0] = glm::packHalf1x16(vertex.texcoord.x);
+    packed.texcoord[1] = glm::packHalf1x16(vertex.texcoord.y);
+  }
+
+  // The GPU copy changes, so does the cache key
+  mesh.vertex_buffer_id = 0;
+  mesh.index_buffer_id = 0;
+  mesh.uploaded = false;
+}
+
+Vertex unpackVertex(const Mesh &mesh, const PackedVertex &packed) {
+  Vertex vertex;
+  const glm::vec3 position(packed.position[0], packed.position[1], packed.position[2]);
+  vertex.position = mesh.quantization_offset + position / 65535.0f * mesh.quantization_scale;
+  vertex.normal = decodeOctahedral(packed.normal);
+  vertex.texcoord = {glm::unpackHalf1x16(packed.texcoord[0]), glm::unpackHalf1x16(packed.texcoord[1])};
+  return vertex;
+}
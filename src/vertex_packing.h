@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdint>
+#include <glm.hpp>
+
+#include "components.h"
+
+// Fills mesh.packed_vertices and the quantization transform from mesh.vertices. The float vertices are left alone,
+// CPU-side users (bounds, culling, optimisation) keep working on them; clear them afterwards if they aren't needed.
+void packMesh(Mesh &mesh);
+
+// Octahedral normal encoding: the unit sphere is projected onto an octahedron and unfolded into a square, which
+// spreads snorm16 precision evenly over all directions.
+void encodeOctahedral(const glm::vec3 &normal, int16_t out[2]);
+glm::vec3 decodeOctahedral(const int16_t in[2]);
+
+// Decodes the way the packed shader does, for checking precision
+Vertex unpackVertex(const Mesh &mesh, const PackedVertex &packed);
@@ -1,7 +1,10 @@
 #include "window.h"
 
+#include <sokol_time.h>
 #include <spdlog/spdlog.h>
 
+#include "profiler.h"
+
 Window::Window(int width, int height, const char *title)
     : window_(nullptr),
       width_(width),
@@ -13,7 +16,8 @@ Window::Window(int width, int height, const char *title)
       mouse_dy_(0.0),
       last_mouse_x_(0.0),
       last_mouse_y_(0.0),
-      first_mouse_(true) {}
+      first_mouse_(true),
+      mouse_captured_(false) {}
 
 Window::~Window() { shutdown(); }
 
@@ -54,41 +58,78 @@ void Window::shutdown() {
 
 bool Window::shouldClose() const { return glfwWindowShouldClose(window_); }
 
-void Window::swapBuffers() { glfwSwapBuffers(window_); }
+void Window::swapBuffers() {
+  MATFX_PROFILE_ZONE("Window::swapBuffers");
+  glfwSwapBuffers(window_);
+}
 
 void Window::pollEvents() {
+  MATFX_PROFILE_ZONE("Window::pollEvents");
   updateInputStates();
   glfwPollEvents();
 }
 
 void Window::getFramebufferSize(int &width, int &height) const { glfwGetFramebufferSize(window_, &width, &height); }
 
-void Window::keyCallback(GLFWwindow *window, int key, int /* scancode */, int action, int /* mods */) {
+void Window::setSwapInterval(int interval) { glfwSwapInterval(interval); }
+
+int Window::getRefreshRate() const {
+  GLFWmonitor *monitor = glfwGetPrimaryMonitor();
+  const GLFWvidmode *mode = monitor ? glfwGetVideoMode(monitor) : nullptr;
+  return mode ? mode->refreshRate : 0;
+}
+
+void *Window::getProcAddress(const char *name) { return reinterpret_cast<void *>(glfwGetProcAddress(name)); }
+
+void Window::setMouseCaptured(bool captured, bool raw_motion) {
+  glfwSetInputMode(window_, GLFW_CURSOR, captured ? GLFW_CURSOR_DISABLED : GLFW_CURSOR_NORMAL);
+  if (glfwRawMouseMotionSupported()) {
+    glfwSetInputMode(window_, GLFW_RAW_MOUSE_MOTION, captured && raw_motion ? GLFW_TRUE : GLFW_FALSE);
+  } else if (captured && raw_motion) {
+    SPDLOG_WARN("Raw mouse motion is not supported, using cursor motion");
+  }
+
+  // The cursor jumps when the mode changes, don't report that as motion
+  mouse_captured_ = captured;
+  first_mouse_ = true;
+}
+
+void Window::keyCallback(GLFWwindow *window, int key, int /* scancode */, int action, int mods) {
   Window *win = static_cast<Window *>(glfwGetWindowUserPointer(window));
 
   if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
     glfwSetWindowShouldClose(window, GLFW_TRUE);
   }
 
+  if (key < 0 || key > GLFW_KEY_LAST) {
+    return;
+  }
+
   if (action == GLFW_PRESS) {
-    win->keys_pressed_.insert(key);
-    win->keys_just_pressed_.insert(key);
+    win->keys_pressed_.set(key);
+    win->keys_just_pressed_.set(key);
   } else if (action == GLFW_RELEASE) {
-    win->keys_pressed_.erase(key);
-    win->keys_just_released_.insert(key);
+    win->keys_pressed_.reset(key);
+    win->keys_just_released_.set(key);
   }
+  win->pushEvent(InputEventType::Key, key, action, mods);
 }
 
-void Window::mouseButtonCallback(GLFWwindow *window, int button, int action, int /* mods */) {
+void Window::mouseButtonCallback(GLFWwindow *window, int button, int action, int mods) {
   Window *win = static_cast<Window *>(glfwGetWindowUserPointer(window));
 
+  if (button < 0 || button > GLFW_MOUSE_BUTTON_LAST) {
+    return;
+  }
+
   if (action == GLFW_PRESS) {
-    win->mouse_buttons_pressed_.insert(button);
-    win->mouse_buttons_just_pressed_.insert(button);
+    win->mouse_buttons_pressed_.set(button);
+    win->mouse_buttons_just_pressed_.set(button);
   } else if (action == GLFW_RELEASE) {
-    win->mouse_buttons_pressed_.erase(button);
-    win->mouse_buttons_just_released_.insert(button);
+    win->mouse_buttons_pressed_.reset(button);
+    win->mouse_buttons_just_released_.set(button);
   }
+  win->pushEvent(InputEventType::MouseButton, button, action, mods);
 }
 
 void Window::cursorPosCallback(GLFWwindow *window, double xpos, double ypos) {
@@ -100,40 +141,50 @@ void Window::cursorPosCallback(GLFWwindow *window, double xpos, double ypos) {
     win->first_mouse_ = false;
   }
 
-  win->mouse_dx_ = xpos - win->last_mouse_x_;
-  win->mouse_dy_ = ypos - win->last_mouse_y_;
+  // Several motion events can arrive in one poll
+  win->mouse_dx_ += xpos - win->last_mouse_x_;
+  win->mouse_dy_ += ypos - win->last_mouse_y_;
   win->last_mouse_x_ = xpos;
   win->last_mouse_y_ = ypos;
 
   win->mouse_x_ = xpos;
   win->mouse_y_ = ypos;
+  win->pushEvent(InputEventType::MouseMove, 0, 0, 0);
+}
+
+void Window::pushEvent(InputEventType type, int code, int action, int mods) {
+  events_.push(InputEvent{type, code, action, mods, mouse_x_, mouse_y_, stm_now()});
 }
 
 void Window::updateInputStates() {
-  keys_just_pressed_.clear();
-  keys_just_released_.clear();
-  mouse_buttons_just_pressed_.clear();
-  mouse_buttons_just_released_.clear();
+  keys_just_pressed_.reset();
+  keys_just_released_.reset();
+  mouse_buttons_just_pressed_.reset();
+  mouse_buttons_just_released_.reset();
   mouse_dx_ = 0.0;
   mouse_dy_ = 0.0;
 }
 
-bool Window::isKeyPressed(int key) const { return keys_pressed_.find(key) != keys_pressed_.end(); }
+bool Window::isKeyPressed(int key) const { return key >= 0 && key <= GLFW_KEY_LAST && keys_pressed_.test(key); }
 
-bool Window::isKeyJustPressed(int key) const { return keys_just_pressed_.find(key) != keys_just_pressed_.end(); }
+bool Window::isKeyJustPressed(int key) const {
+  return key >= 0 && key <= GLFW_KEY_LAST && keys_just_pressed_.test(key);
+}
 
-bool Window::isKeyJustReleased(int key) const { return keys_just_released_.find(key) != keys_just_released_.end(); }
+bool Window::isKeyJustReleased(int key) const {
+  return key >= 0 && key <= GLFW_KEY_LAST && keys_just_released_.test(key);
+}
 
 bool Window::isMouseButtonPressed(int button) const {
-  return mouse_buttons_pressed_.find(button) != mouse_buttons_pressed_.end();
+  return button >= 0 && button <= GLFW_MOUSE_BUTTON_LAST && mouse_buttons_pressed_.test(button);
 }
 
 bool Window::isMouseButtonJustPressed(int button) const {
-  return mouse_buttons_just_pressed_.find(button) != mouse_buttons_just_pressed_.end();
+  return button >= 0 && button <= GLFW_MOUSE_BUTTON_LAST && mouse_buttons_just_pressed_.test(button);
 }
 
 bool Window::isMouseButtonJustReleased(int button) const {
-  return mouse_buttons_just_released_.find(button) != mouse_buttons_just_released_.end();
+  return button >= 0 && button <= GLFW_MOUSE_BUTTON_LAST && mouse_buttons_just_released_.test(button);
 }
 
 void Window::getMousePosition(double &x, double &y) const {
@@ -1,7 +1,10 @@
 #pragma once
 #include <GLFW/glfw3.h>
 
-#include <unordered_set>
+#include <bitset>
+#include <cstdint>
+
+#include "input.h"
 
 class Window {
  public:
@@ -21,6 +24,13 @@ class Window {
   void pollEvents();
   void getFramebufferSize(int &width, int &height) const;
 
+  // 0 presents immediately, 1 waits for every vblank, n for every nth
+  void setSwapInterval(int interval);
+  // Refresh rate of the primary monitor in Hz, 0 when unknown
+  int getRefreshRate() const;
+  // GL entry points of the current context, for extensions glad wasn't generated with
+  static void *getProcAddress(const char *name);
+
   bool isKeyPressed(int key) const;
   bool isKeyJustPressed(int key) const;
   bool isKeyJustReleased(int key) const;
@@ -30,14 +40,23 @@ class Window {
   bool isMouseButtonJustReleased(int button) const;
 
   void getMousePosition(double &x, double &y) const;
+  // Motion accumulated over every cursor event of the last pollEvents()
   void getMouseDelta(double &dx, double &dy) const;
 
+  // Hides and locks the cursor for mouse look; raw (unaccelerated) motion is used when asked for and supported
+  void setMouseCaptured(bool captured, bool raw_motion = true);
+  bool isMouseCaptured() const { return mouse_captured_; }
+
+  // Events in arrival order, stamped with stm_now(). Read on the thread calling pollEvents().
+  const InputEventRing &getInputEvents() const { return events_; }
+
  private:
   static void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods);
   static void mouseButtonCallback(GLFWwindow *window, int button, int action, int mods);
   static void cursorPosCallback(GLFWwindow *window, double xpos, double ypos);
 
   void updateInputStates();
+  void pushEvent(InputEventType type, int code, int action, int mods);
   GLFWwindow *getGLFWWindow() const { return window_; }
 
   GLFWwindow *window_;
@@ -45,16 +64,20 @@ class Window {
   int height_;
   const char *title_;
 
-  std::unordered_set<int> keys_pressed_;
-  std::unordered_set<int> keys_just_pressed_;
-  std::unordered_set<int> keys_just_released_;
+  // Indexed by GLFW code; GLFW_KEY_UNKNOWN and other out of range codes are ignored
+  std::bitset<GLFW_KEY_LAST + 1> keys_pressed_;
+  std::bitset<GLFW_KEY_LAST + 1> keys_just_pressed_;
+  std::bitset<GLFW_KEY_LAST + 1> keys_just_released_;
+
+  std::bitset<GLFW_MOUSE_BUTTON_LAST + 1> mouse_buttons_pressed_;
+  std::bitset<GLFW_MOUSE_BUTTON_LAST + 1> mouse_buttons_just_pressed_;
+  std::bitset<GLFW_MOUSE_BUTTON_LAST + 1> mouse_buttons_just_released_;
 
-  std::unordered_set<int> mouse_buttons_pressed_;
-  std::unordered_set<int> mouse_buttons_just_pressed_;
-  std::unordered_set<int> mouse_buttons_just_released_;
+  InputEventRing events_;
 
   double mouse_x_, mouse_y_;
   double mouse_dx_, mouse_dy_;
   double last_mouse_x_, last_mouse_y_;
   bool first_mouse_;
+  bool mouse_captured_;
 };
\ No newline at end of file
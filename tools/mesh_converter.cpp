@@ -0,0 +1,282 @@
+// Offline mesh converter: reads a Wavefront OBJ (or generates a primitive), optionally simplifies, optimises and packs
+// it, and writes the memory-mappable mesh file loadMeshFile() reads, or with --lods the chain loadMeshLodChain() reads.
+//
+// usage: matfx_meshc INPUT OUTPUT [--optimize=0|1] [--packed=0|1] [--simplify=RATIO] [--lods=LEVELS]
+//   INPUT is an .obj path, "cube" or "sphere:SEGMENTS"
+//   RATIO is the fraction of triangles to keep, 1 keeps all
+//   LEVELS is the most levels of detail to write, level i > 0 goes to meshLodPath(OUTPUT, i)
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "culling.h"
+#include "mesh_file.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "primitives.h"
+#include "vertex_packing.h"
+
+struct ConverterConfig {
+  std::string input;
+  std::string output;
+  bool optimize = true;
+  bool packed = true;
+  float simplify = 1.0f;
+  uint32_t lods = 1;
+};
+
+static bool parse_args(int argc, char **argv, ConverterConfig &config) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = std::strchr(arg, '=');
+    if (std::strncmp(arg, "--", 2) != 0) {
+      if (config.input.empty()) {
+        config.input = arg;
+      } else if (config.output.empty()) {
+        config.output = arg;
+      } else {
+        return false;
+      }
+      continue;
+    }
+    if (!value) {
+      return false;
+    }
+    const std::string key(arg, value - arg);
+    value++;
+
+    if (key == "--optimize") {
+      config.optimize = std::atoi(value) != 0;
+    } else if (key == "--packed") {
+      config.packed = std::atoi(value) != 0;
+    } else if (key == "--simplify") {
+      config.simplify = std::strtof(value, nullptr);
+      if (!(config.simplify > 0.0f && config.simplify <= 1.0f)) {
+        return false;
+      }
+    } else if (key == "--lods") {
+      config.lods = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+      if (config.lods == 0) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return !config.input.empty() && !config.output.empty();
+}
+
+static bool read_file(const std::string &path, std::string &contents) {
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  std::fseek(file, 0, SEEK_END);
+  const long size = std::ftell(file);
+  std::fseek(file, 0, SEEK_SET);
+  contents.resize(size > 0 ? static_cast<size_t>(size) : 0);
+  const size_t read = std::fread(contents.data(), 1, contents.size(), file);
+  std::fclose(file);
+  return read == contents.size();
+}
+
+// OBJ index: 1-based, negative counts back from the end, 0 means absent
+static int resolve_index(long index, size_t count) {
+  if (index > 0) {
+    return static_cast<int>(index - 1);
+  }
+  if (index < 0) {
+    return static_cast<int>(static_cast<long>(count) + index);
+  }
+  return -1;
+}
+
+// Positions, texcoords and normals of the v/vt/vn/f subset; polygons become triangle fans. Every corner is its own
+// vertex here, welding merges them afterwards. Faces without normals get their flat normal.
+static bool load_obj(const std::string &path, Mesh &mesh) {
+  std::string text;
+  if (!read_file(path, text)) {
+    SPDLOG_ERROR("Can't read {}", path);
+    return false;
+  }
+
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec2> texcoords;
+  std::vector<glm::vec3> normals;
+  struct Corner {
+    int position;
+    int texcoord;
+    int normal;
+  };
+  std::vector<Corner> face;
+
+  const char *cursor = text.c_str();
+  size_t line_number = 0;
+  while (*cursor) {
+    line_number++;
+    const char *line_end = std::strchr(cursor, '\n');
+    if (!line_end) {
+      line_end = cursor + std::strlen(cursor);
+    }
+    const std::string line(cursor, line_end);
+    cursor = *line_end ? line_end + 1 : line_end;
+
+    const char *p = line.c_str();
+    char *next = nullptr;
+    if (std::strncmp(p, "v ", 2) == 0) {
+      glm::vec3 v;
+      v.x = std::strtof(p + 2, &next);
+      v.y = std::strtof(next, &next);
+      v.z = std::strtof(next, &next);
+      positions.push_back(v);
+    } else if (std::strncmp(p, "vt ", 3) == 0) {
+      glm::vec2 t;
+      t.x = std::strtof(p + 3, &next);
+      t.y = std::strtof(next, &next);
+      texcoords.push_back(t);
+    } else if (std::strncmp(p, "vn ", 3) == 0) {
+      glm::vec3 n;
+      n.x = std::strtof(p + 3, &next);
+      n.y = std::strtof(next, &next);
+      n.z = std::strtof(next, &next);
+      normals.push_back(n);
+    } else if (std::strncmp(p, "f ", 2) == 0) {
+      face.clear();
+      p += 2;
+      while (true) {
+        while (*p == ' ' || *p == '\t' || *p == '\r') {
+          p++;
+        }
+        if (!*p) {
+          break;
+        }
+        Corner corner{-1, -1, -1};
+        corner.position = resolve_index(std::strtol(p, &next, 10), positions.size());
+        p = next;
+        if (*p == '/') {
+          p++;
+          if (*p != '/') {
+            corner.texcoord = resolve_index(std::strtol(p, &next, 10), texcoords.size());
+            p = next;
+          }
+          if (*p == '/') {
+            p++;
+            corner.normal = resolve_index(std::strtol(p, &next, 10), normals.size());
+            p = next;
+          }
+        }
+        if (corner.position < 0 || corner.position >= static_cast<int>(positions.size()) ||
+            corner.texcoord >= static_cast<int>(texcoords.size()) ||
+            corner.normal >= static_cast<int>(normals.size())) {
+          SPDLOG_ERROR("{}:{}: index out of range", path, line_number);
+          return false;
+        }
+        face.push_back(corner);
+        while (*p && *p != ' ' && *p != '\t' && *p != '\r') {
+          p++;
+        }
+      }
+
+      for (size_t i = 2; i < face.size(); ++i) {
+        const Corner corners[3] = {face[0], face[i - 1], face[i]};
+        const glm::vec3 flat = glm::cross(positions[corners[1].position] - positions[corners[0].position],
+                                          positions[corners[2].position] - positions[corners[0].position]);
+        const float flat_length = glm::length(flat);
+        for (const Corner &corner : corners) {
+          Vertex vertex;
+          vertex.position = positions[corner.position];
+          vertex.texcoord = corner.texcoord >= 0 ? texcoords[corner.texcoord] : glm::vec2(0.0f);
+          if (corner.normal >= 0) {
+            vertex.normal = normals[corner.normal];
+          } else {
+            vertex.normal = flat_length > 0.0f ? flat / flat_length : glm::vec3(0.0f, 1.0f, 0.0f);
+          }
+          mesh.indices.push_back(static_cast<uint32_t>(mesh.vertices.size()));
+          mesh.vertices.push_back(vertex);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  ConverterConfig config;
+  if (!parse_args(argc, argv, config)) {
+    std::fprintf(stderr, "usage: %s INPUT OUTPUT [--optimize=0|1] [--packed=0|1] [--simplify=RATIO] [--lods=LEVELS]\n",
+                 argv[0]);
+    std::fprintf(stderr, "  INPUT is an .obj path, \"cube\" or \"sphere:SEGMENTS\"\n");
+    std::fprintf(stderr, "  RATIO is the fraction of triangles to keep, 1 keeps all\n");
+    std::fprintf(stderr, "  LEVELS is the most levels of detail to write, level i > 0 goes next to OUTPUT\n");
+    return 1;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  Mesh mesh;
+  if (config.input == "cube") {
+    mesh = createCubeMesh();
+  } else if (config.input.rfind("sphere:", 0) == 0) {
+    const uint32_t segments = static_cast<uint32_t>(std::strtoul(config.input.c_str() + 7, nullptr, 10));
+    mesh = createSphereMesh(0.5f, segments, segments / 2);
+  } else if (!load_obj(config.input, mesh)) {
+    return 1;
+  }
+  if (mesh.indices.empty()) {
+    SPDLOG_ERROR("{} has no triangles", config.input);
+    return 1;
+  }
+
+  const size_t input_vertices = mesh.vertices.size();
+  const size_t input_triangles = mesh.indices.size() / 3;
+  if (config.simplify < 1.0f) {
+    // Unwelded corners would all look like seams to the simplifier and never move
+    weldVertices(mesh);
+    const size_t target = static_cast<size_t>(static_cast<double>(input_triangles) * config.simplify) * 3;
+    const float error = simplifyMesh(mesh, target);
+    std::printf("simplified %zu -> %zu triangles, error %.5f (%.3f%% of radius)\n", input_triangles,
+                mesh.indices.size() / 3, error, 100.0f * error / glm::length(computeBounds(mesh).extents));
+  }
+  if (config.optimize) {
+    optimizeMesh(mesh);
+  }
+  const Bounds bounds = computeBounds(mesh);
+  const VertexCacheStats cache = analyzeVertexCache(mesh);
+
+  // Level 0 is the mesh as converted so far. Every level is written with level 0's bounds, the ones entities get.
+  MeshLodChain chain;
+  if (config.lods > 1) {
+    chain = buildLodChain(mesh, config.lods);
+  } else {
+    chain.levels.push_back(std::move(mesh));
+    chain.errors.push_back(0.0f);
+  }
+  const uint32_t level_count = static_cast<uint32_t>(chain.levels.size());
+  for (uint32_t level = 0; level < level_count; ++level) {
+    Mesh &level_mesh = chain.levels[level];
+    if (config.packed) {
+      packMesh(level_mesh);
+    }
+    const std::string path = meshLodPath(config.output, level);
+    if (!writeMeshFile(path, level_mesh, bounds, {level, level_count, chain.errors[level]})) {
+      return 1;
+    }
+    if (level > 0) {
+      std::printf("level %u -> %s: %zu vertices, %zu triangles, error %.5f (%.3f%% of radius)\n", level, path.c_str(),
+                  level_mesh.getVertexCount(), level_mesh.getIndexCount() / 3, chain.errors[level],
+                  100.0f * chain.errors[level] / glm::length(bounds.extents));
+    }
+  }
+
+  const Mesh &written = chain.levels[0];
+  const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  std::printf("%s -> %s: %zu -> %zu vertices, %zu triangles, ACMR %.3f, %s vertices, %s indices, %u levels, %.1f ms\n",
+              config.input.c_str(), config.output.c_str(), input_vertices, written.getVertexCount(),
+              written.getIndexCount() / 3, cache.acmr, written.isPacked() ? "packed" : "float",
+              written.usesShortIndices() ? "16-bit" : "32-bit", level_count, ms);
+  return 0;
+}